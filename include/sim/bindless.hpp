@@ -0,0 +1,162 @@
+//
+// Created by maros on 14.12.2023.
+//
+
+#ifndef SIM_BINDLESS_HPP
+#define SIM_BINDLESS_HPP
+
+#define VULKAN_HPP_NO_CONSTRUCTORS
+#include <vulkan/vulkan_raii.hpp>
+
+#include <cstdint>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+namespace vulkan
+{
+
+namespace vkr = vk::raii;
+
+//! Descriptor set of large buffer and image arrays, indexed from shaders.
+//!
+//! Resources are registered once and referenced by their index, passed with the draws as
+//! push constants, so that the set is bound once per command buffer however many meshes,
+//! materials or instance buffers there are. Descriptors are written with update after bind,
+//! so that resources can be registered or replaced while frames in flight use the set,
+//! as long as those frames don't access the replaced descriptors. Thread safe.
+class BindlessDescriptors
+{
+public:
+  //! Binding of the storage buffer array.
+  static constexpr uint32_t BufferBinding = 0;
+  //! Binding of the combined image sampler array.
+  static constexpr uint32_t ImageBinding = 1;
+  //! Largest number of buffers, lowered to the device limits.
+  static constexpr uint32_t MaxBuffers = 65536;
+  //! Largest number of images, lowered to the device limits.
+  static constexpr uint32_t MaxImages = 16384;
+
+  //! @param physicalDevice Physical device.
+  //! @returns Whether the device supports the descriptor indexing features the set needs.
+  [[nodiscard]] static bool supported(const vkr::PhysicalDevice& physicalDevice);
+
+  //! @returns Descriptor indexing features to enable at device creation.
+  [[nodiscard]] static vk::PhysicalDeviceDescriptorIndexingFeaturesEXT requiredFeatures() noexcept;
+
+  //! @param physicalDevice Physical device.
+  //! @param device Logical device, created with the required features.
+  BindlessDescriptors(const vkr::PhysicalDevice& physicalDevice, const vkr::Device& device);
+
+  //! Registers storage buffer.
+  //! @param buffer Buffer.
+  //! @param offset Offset of the range [bytes].
+  //! @param range Size of the range [bytes].
+  //! @returns Index of the buffer in the array.
+  //! @throws std::runtime_error If the array is full.
+  [[nodiscard]] uint32_t addBuffer(
+    vk::Buffer buffer,
+    vk::DeviceSize offset = 0,
+    vk::DeviceSize range = VK_WHOLE_SIZE);
+
+  //! Replaces registered storage buffer. Frames in flight must not access the index.
+  //! @param index Index of the buffer.
+  //! @param buffer Buffer.
+  //! @param offset Offset of the range [bytes].
+  //! @param range Size of the range [bytes].
+  void updateBuffer(
+    uint32_t index,
+    vk::Buffer buffer,
+    vk::DeviceSize offset = 0,
+    vk::DeviceSize range = VK_WHOLE_SIZE);
+
+  //! Releases index of a buffer, reused by a later registration.
+  //! Frames in flight must not access the index.
+  void releaseBuffer(uint32_t index);
+
+  //! Registers sampled image.
+  //! @param imageView View of the image.
+  //! @param sampler Sampler of the image.
+  //! @param layout Layout the image is in when accessed.
+  //! @returns Index of the image in the array.
+  //! @throws std::runtime_error If the array is full.
+  [[nodiscard]] uint32_t addImage(
+    vk::ImageView imageView,
+    vk::Sampler sampler,
+    vk::ImageLayout layout = vk::ImageLayout::eShaderReadOnlyOptimal);
+
+  //! Replaces registered sampled image. Frames in flight must not access the index.
+  //! @param index Index of the image.
+  //! @param imageView View of the image.
+  //! @param sampler Sampler of the image.
+  //! @param layout Layout the image is in when accessed.
+  void updateImage(
+    uint32_t index,
+    vk::ImageView imageView,
+    vk::Sampler sampler,
+    vk::ImageLayout layout = vk::ImageLayout::eShaderReadOnlyOptimal);
+
+  //! Releases index of an image, reused by a later registration.
+  //! Frames in flight must not access the index.
+  void releaseImage(uint32_t index);
+
+  //! @returns Layout of the set.
+  [[nodiscard]] vk::DescriptorSetLayout layout() const noexcept
+  {
+    return *_layout;
+  }
+
+  //! @returns The set.
+  [[nodiscard]] vk::DescriptorSet set() const noexcept
+  {
+    return *_sets.front();
+  }
+
+  //! @returns Capacity of the buffer array.
+  [[nodiscard]] uint32_t bufferCapacity() const noexcept
+  {
+    return _buffers.capacity;
+  }
+
+  //! @returns Capacity of the image array.
+  [[nodiscard]] uint32_t imageCapacity() const noexcept
+  {
+    return _images.capacity;
+  }
+
+private:
+  //! Indices of an array, released ones reused first.
+  struct Slots
+  {
+    uint32_t capacity = 0;
+    //! Number of indices ever handed out.
+    uint32_t used = 0;
+    std::vector<uint32_t> released;
+
+    //! @param kind Kind of the array, for errors.
+    //! @returns Free index.
+    //! @throws std::runtime_error If the array is full.
+    uint32_t acquire(std::string_view kind);
+  };
+
+  //! Writes buffer descriptor. Expects the mutex held.
+  void writeBuffer(uint32_t index, vk::Buffer buffer, vk::DeviceSize offset, vk::DeviceSize range);
+
+  //! Writes image descriptor. Expects the mutex held.
+  void writeImage(uint32_t index, vk::ImageView imageView, vk::Sampler sampler, vk::ImageLayout layout);
+
+private:
+  const vkr::Device& _device;
+
+  vkr::DescriptorSetLayout _layout { nullptr };
+  vkr::DescriptorPool _pool { nullptr };
+  vkr::DescriptorSets _sets { nullptr };
+
+  std::mutex _mutex;
+  Slots _buffers;
+  Slots _images;
+};
+
+}// namespace vulkan
+
+#endif//SIM_BINDLESS_HPP
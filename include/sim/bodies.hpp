@@ -0,0 +1,146 @@
+//
+// Created by maros on 12.12.2023.
+//
+
+#ifndef SIM_BODIES_HPP
+#define SIM_BODIES_HPP
+
+#define VULKAN_HPP_NO_CONSTRUCTORS
+#include <vulkan/vulkan_raii.hpp>
+#include "sim/memory.hpp"
+#include "sim/sim.hpp"
+#include <glm/glm.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <optional>
+
+namespace vulkan
+{
+
+namespace vkr = vk::raii;
+
+class Renderer;
+
+//! Simulates bodies on the device, keeping their state resident in device local storage buffers.
+//!
+//! Dynamics and kinematics of a tick run in a single compute dispatch, which also writes the
+//! instance transforms of the bodies. Ticks are recorded into the frame's command buffer ahead of
+//! culling, which reads the transforms in place, so nothing is uploaded per frame. Ticks run at
+//! a fixed rate, as many per frame as are due.
+class BodySimulation
+{
+public:
+  //! Maximum number of impulse forces of a body.
+  static constexpr size_t MaxImpulses = 4;
+  //! Maximum number of ticks recorded into a frame, the rest of a backlog is dropped.
+  static constexpr uint32_t MaxTicksPerFrame = 8;
+
+  //! Uploads the bodies of the environment.
+  //! @param renderer Renderer with a logical device and a pipeline cache.
+  //! @param environment Environment to simulate. Its gravity and wind are captured.
+  //! @param ticksPerSecond Fixed tick rate.
+  //! @throws std::runtime_error If a body has more impulse forces than supported.
+  BodySimulation(
+    const Renderer& renderer,
+    const sim::Environment& environment,
+    uint32_t ticksPerSecond = 128);
+
+  //! Records ticks due since the previous call.
+  //! Transforms written by the ticks are visible to compute shaders recorded after.
+  //! @param commandBuffer Command buffer of the frame, outside of a render pass.
+  //! @param now Current time.
+  //! @returns Number of ticks recorded.
+  uint32_t record(
+    const vkr::CommandBuffer& commandBuffer,
+    std::chrono::steady_clock::time_point now);
+
+  //! Runs ticks right away and waits for them. Meant for parity checks.
+  //! @param ticks Number of ticks.
+  void run(uint32_t ticks);
+
+  //! Reads the body state back. Waits for the device.
+  //! @param environment Environment the simulation was created from, receiving the state.
+  void download(sim::Environment& environment) const;
+
+  //! Reloads the shader binary and recreates the pipeline.
+  //! @returns Replaced pipeline, which frames in flight may still use.
+  //! @throws std::runtime_error If the binary can't be read, keeping the previous pipeline.
+  [[nodiscard]] vkr::Pipeline reloadShader();
+
+  //! @returns Buffer of instance transforms, one per body.
+  [[nodiscard]] vk::Buffer transforms() const noexcept
+  {
+    return *_transformBuffer;
+  }
+
+  //! @returns Number of simulated bodies.
+  [[nodiscard]] uint32_t bodyCount() const noexcept
+  {
+    return _bodyCount;
+  }
+
+  //! @returns Duration of a tick [s].
+  [[nodiscard]] float step() const noexcept
+  {
+    return _step;
+  }
+
+private:
+  //! Records dispatches of ticks.
+  void recordTicks(const vkr::CommandBuffer& commandBuffer, uint32_t ticks) const;
+
+  //! Records commands into a one time command buffer, submits it and waits for it.
+  template<typename Record>
+  void submitAndWait(Record&& record) const;
+
+private:
+  const Renderer& _renderer;
+  uint32_t _bodyCount = 0;
+  float _step = 0.0f;
+  std::chrono::steady_clock::duration _tickDuration {};
+  //! Time of the last recorded tick, empty until the first frame.
+  std::optional<std::chrono::steady_clock::time_point> _lastTick;
+
+  glm::vec4 _gravity {};
+  glm::vec4 _wind {};
+
+  Allocation _bodyAllocation;
+  vkr::Buffer _bodyBuffer { nullptr };
+  Allocation _transformAllocation;
+  vkr::Buffer _transformBuffer { nullptr };
+
+  vkr::DescriptorSetLayout _descriptorLayout { nullptr };
+  vkr::DescriptorPool _descriptorPool { nullptr };
+  vkr::DescriptorSets _descriptorSets { nullptr };
+  vkr::PipelineLayout _pipelineLayout { nullptr };
+  vkr::ShaderModule _shader { nullptr };
+  vkr::Pipeline _pipeline { nullptr };
+
+  vkr::CommandPool _commandPool { nullptr };
+};
+
+//! Largest difference between bodies simulated on the device and on the host.
+struct ParityReport
+{
+  //! Number of compared bodies.
+  size_t bodies = 0;
+  //! Largest position difference, relative to the position magnitude when above one.
+  double position = 0.0;
+  //! Largest velocity difference, relative to the velocity magnitude when above one.
+  double velocity = 0.0;
+};
+
+//! Simulates the environment on the device and with the host simulators, and compares the results.
+//! @param renderer Renderer with a logical device and a pipeline cache.
+//! @param environment Environment to simulate, left untouched.
+//! @param ticks Number of ticks.
+//! @returns Largest differences.
+ParityReport checkParity(
+  const Renderer& renderer,
+  const sim::Environment& environment,
+  uint32_t ticks);
+
+}// namespace vulkan
+
+#endif//SIM_BODIES_HPP
@@ -0,0 +1,149 @@
+//
+// Created by maros on 09.12.2023.
+//
+
+#ifndef SIM_CAPTURE_HPP
+#define SIM_CAPTURE_HPP
+
+#define VULKAN_HPP_NO_CONSTRUCTORS
+#include <vulkan/vulkan_raii.hpp>
+#include "sim/memory.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace vulkan
+{
+
+namespace vkr = vk::raii;
+
+class Renderer;
+
+//! Format of captured frames.
+enum class CaptureFormat
+{
+  //! Sequence of PNG images in a directory.
+  Png,
+  //! Tightly packed RGBA frames appended to a single file.
+  Raw,
+  //! YUV4MPEG2 video, readable by most encoders.
+  Y4m
+};
+
+//! Options of frame capture.
+struct CaptureOptions
+{
+  //! Directory of the image sequence, or the file of a raw or Y4M capture.
+  std::filesystem::path path;
+  CaptureFormat format = CaptureFormat::Png;
+  //! Frame rate written to the Y4M header.
+  uint32_t frameRate = 60;
+};
+
+//! Captures rendered frames without stalling the render loop.
+//!
+//! Images are copied into a ring of host visible readback buffers by the frame's own command
+//! buffer. Buffers of completed frames are handed to an encoder thread, which writes them out and
+//! returns them to the ring. When the encoder falls behind and the ring is full, frames are skipped
+//! rather than waited for.
+class FrameCapture
+{
+public:
+  //! @param renderer Renderer with color images set up.
+  //! @param options Capture options.
+  //! @throws std::runtime_error If the color images can't be copied from.
+  FrameCapture(const Renderer& renderer, CaptureOptions options);
+  ~FrameCapture();
+
+  FrameCapture(const FrameCapture&) = delete;
+  FrameCapture& operator=(const FrameCapture&) = delete;
+
+  //! Records copy of a rendered image into a free readback buffer.
+  //! @param commandBuffer Command buffer of the frame, outside of a render pass.
+  //! @param image Rendered color image.
+  //! @param layout Layout of the image, which is restored after the copy.
+  //! @param frame Serial of the frame.
+  //! @returns Whether the frame is captured, false if it was skipped
+  //!          because the ring is full or the image was resized.
+  bool record(
+    const vkr::CommandBuffer& commandBuffer,
+    vk::Image image,
+    vk::ImageLayout layout,
+    uint64_t frame);
+
+  //! Hands readback buffers of completed frames to the encoder.
+  //! @param completedFrame Serial of the last completed frame.
+  void poll(uint64_t completedFrame);
+
+  //! @returns Number of frames handed to the encoder.
+  [[nodiscard]] uint64_t capturedFrames() const noexcept
+  {
+    return _capturedFrames;
+  }
+
+  //! @returns Number of frames skipped because the encoder fell behind.
+  [[nodiscard]] uint64_t skippedFrames() const noexcept
+  {
+    return _skippedFrames;
+  }
+
+private:
+  //! Readback buffer of the ring.
+  struct Slot
+  {
+    enum class State
+    {
+      Free,
+      //! Copy recorded, frame not yet completed.
+      Recorded,
+      //! Owned by the encoder.
+      Encoding
+    };
+
+    Allocation allocation;
+    vkr::Buffer buffer { nullptr };
+    State state = State::Free;
+    uint64_t frame = 0;
+  };
+
+  //! Encodes frames until stopped and the queue is drained.
+  void encode(std::stop_token stop);
+
+  //! Writes frame in the capture format.
+  void write(const Slot& slot);
+
+private:
+  const Renderer& _renderer;
+  CaptureOptions _options;
+  vk::Extent2D _extent {};
+  //! Whether pixels are stored as BGRA.
+  bool _bgra = false;
+
+  //! Ring of readback buffers. State of the slots is guarded by the mutex.
+  std::vector<Slot> _slots;
+  //! Slots queued for the encoder, in frame order.
+  std::deque<Slot*> _queue;
+  std::mutex _mutex;
+  std::condition_variable_any _queueCondition;
+
+  std::atomic<uint64_t> _capturedFrames = 0;
+  std::atomic<uint64_t> _skippedFrames = 0;
+
+  //! Output of raw and Y4M captures, used by the encoder thread only.
+  std::ofstream _output;
+  //! Conversion buffer used by the encoder thread only.
+  std::vector<uint8_t> _scratch;
+
+  std::jthread _encoder;
+};
+
+}// namespace vulkan
+
+#endif//SIM_CAPTURE_HPP
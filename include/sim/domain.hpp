@@ -0,0 +1,178 @@
+//
+// Created by maros on 21.12.2023.
+//
+
+#ifndef SIM_DOMAIN_HPP
+#define SIM_DOMAIN_HPP
+
+#include "sim.hpp"
+#include "snapshot.hpp"
+#include "spatial.hpp"
+#include "transport.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace sim
+{
+
+//! Decomposition of space into a grid of regions, one per worker.
+//!
+//! Regions on the edges of the grid extend to infinity, so that every position
+//! belongs to exactly one region.
+struct RegionGrid
+{
+  //! Corner of the grid.
+  math::vec3d _min{0.0};
+  //! Opposite corner of the grid.
+  math::vec3d _max{0.0};
+  //! Number of regions along every axis.
+  std::array<uint32_t, 3> _divisions{1, 1, 1};
+
+  //! @returns Number of regions.
+  [[nodiscard]] uint32_t Count() const noexcept
+  {
+    return _divisions[0] * _divisions[1] * _divisions[2];
+  }
+
+  //! @returns Region owning the position.
+  [[nodiscard]] uint32_t RegionOf(const math::vec3d& position) const noexcept;
+
+  //! @returns Bounds of the region, infinite towards the outside of the grid.
+  [[nodiscard]] Box BoundsOf(uint32_t region) const noexcept;
+
+  //! @returns Regions sharing a face, an edge or a corner with the region.
+  [[nodiscard]] std::vector<uint32_t> NeighborsOf(uint32_t region) const;
+};
+
+//! Region of a decomposed simulation owned by a worker.
+//!
+//! Every tick the worker simulates the bodies of its region, then exchanges with the other
+//! workers the bodies that crossed into their regions, and ghosts: read only copies of
+//! the bodies within the halo distance of their regions. Ghosts make the neighbourhood
+//! of bodies near the region boundary visible, such as to spatial queries.
+class Domain
+{
+public:
+  //! Default halo distance [m].
+  static constexpr double DefaultHalo = 2.0;
+
+  //! @param environment Conditions of the simulation, its bodies aren't simulated.
+  //! @param grid Decomposition of space, with a region per rank of the transport.
+  //! @param transport Transport to the workers of the other regions.
+  //! @param halo Distance from a region within which bodies are its ghosts [m].
+  //! @throws std::runtime_error If the grid doesn't have a region per worker.
+  Domain(
+    Environment& environment,
+    RegionGrid grid,
+    Transport& transport,
+    double halo = DefaultHalo);
+
+  //! Adds body, if the region owns its position.
+  //! Meant for seeding all workers with the same bodies.
+  //! @returns Whether the body was added.
+  bool Add(Body body);
+
+  //! Simulates the bodies of the region, then migrates bodies and exchanges ghosts.
+  //! Collective, all workers tick together.
+  //! @param time Tick duration [s].
+  //! @param stop Whether this worker stops after the tick.
+  //! @returns Whether all workers keep running, false once any stops.
+  //! @throws std::runtime_error If a worker is gone.
+  bool Tick(float time, bool stop = false);
+
+  //! Captures the bodies of the region, followed by the ghosts, and indexes them.
+  //! @param snapshot Snapshot, its bodies from Owned() on are ghosts.
+  //! @param time Simulation time [s].
+  void Capture(Snapshot& snapshot, double time) const;
+
+  //! @returns Region of this worker.
+  [[nodiscard]] uint32_t Region() const noexcept
+  {
+    return _region;
+  }
+
+  //! @returns Bodies owned by the region.
+  [[nodiscard]] std::span<const Body> Bodies() const noexcept
+  {
+    return _bodies;
+  }
+
+  //! @returns Identifiers of the owned bodies, unique across workers and kept by migration.
+  [[nodiscard]] std::span<const uint64_t> Identifiers() const noexcept
+  {
+    return _identifiers;
+  }
+
+  //! @returns Ghosts received by the last tick.
+  [[nodiscard]] std::span<const BodyState> Ghosts() const noexcept
+  {
+    return _ghosts;
+  }
+
+  //! @returns Identifiers of the ghosts.
+  [[nodiscard]] std::span<const uint64_t> GhostIdentifiers() const noexcept
+  {
+    return _ghostIdentifiers;
+  }
+
+  //! @returns Number of owned bodies.
+  [[nodiscard]] size_t Owned() const noexcept
+  {
+    return _bodies.size();
+  }
+
+  //! @returns Number of bodies that left the region by the last tick.
+  [[nodiscard]] size_t Emigrated() const noexcept
+  {
+    return _emigrated;
+  }
+
+  //! @returns Number of bodies that entered the region by the last tick.
+  [[nodiscard]] size_t Immigrated() const noexcept
+  {
+    return _immigrated;
+  }
+
+private:
+  //! Writes bodies leaving the region and ghosts into the messages of their regions.
+  void Emigrate();
+
+  //! Reads bodies entering the region and ghosts from the messages of the other regions.
+  //! @returns Whether all workers keep running.
+  bool Immigrate();
+
+private:
+  RegionGrid _grid;
+  Transport& _transport;
+  double _halo;
+  uint32_t _region;
+  //! Regions close enough to receive ghosts.
+  std::vector<uint32_t> _neighbors;
+  //! Bounds of the neighbouring regions.
+  std::vector<Box> _neighborBounds;
+
+  BodyDynamicsSimulator _dynamics;
+  BodyKinematicsSimulator _kinematics;
+
+  std::vector<Body> _bodies;
+  std::vector<uint64_t> _identifiers;
+  std::vector<BodyState> _ghosts;
+  std::vector<uint64_t> _ghostIdentifiers;
+  //! Identifier of the next body added by this worker.
+  uint64_t _nextIdentifier = 0;
+
+  //! Message of every region of the current tick.
+  std::vector<Message> _outgoing;
+  std::vector<Message> _incoming;
+  bool _stop = false;
+  size_t _emigrated = 0;
+  size_t _immigrated = 0;
+};
+
+}// namespace sim
+
+#endif//SIM_DOMAIN_HPP
@@ -14,6 +14,8 @@
 namespace sdk
 {
 
+  //! Actor placed in the scene. Its creation and destruction are reported
+  //! by the world in batches, see World::onCreate() and World::onDestroy().
   class Actor {
   public:
     glm::vec3 _position { 0.0f };
@@ -21,16 +23,6 @@ namespace sdk
     glm::vec3 _rotation { 0.0f };
     glm::vec3 _scale { 0.0f };
 
-  public:
-    virtual ~Actor() = default;
-
-  public:
-    //! Called when actor is created in a world.
-    virtual void OnCreate() = 0;
-
-    //! Called when actor is destroyed in a world.
-    virtual void OnDestroy() = 0;
-
   public:
     //! Translates actor model matrix.
     //! @param translationVector Translation vector.
@@ -73,13 +65,6 @@ namespace sdk
     Camera()
       : _viewport(45.0f, 1.0f, 0.1f, 100.0f)
     {}
-
-    void OnCreate() override
-    {
-    }
-    void OnDestroy() override
-    {
-    }
   };
 
   class State
@@ -0,0 +1,146 @@
+//
+// Created by maros on 22.12.2023.
+//
+
+#ifndef SIM_EVENTS_HPP
+#define SIM_EVENTS_HPP
+
+#include "math.hpp"
+#include "spatial.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+namespace sim
+{
+
+struct Body;
+
+//! Kind of a simulation event.
+enum class EventType : uint8_t
+{
+  //! Body entered a region.
+  RegionEnter,
+  //! Body left a region.
+  RegionExit,
+  //! Speed of a body rose to a threshold.
+  SpeedAbove,
+  //! Speed of a body fell below a threshold.
+  SpeedBelow,
+  //! Height of a body rose to a threshold.
+  HeightAbove,
+  //! Height of a body fell below a threshold.
+  HeightBelow,
+  //! Body touched the ground.
+  GroundContact,
+  //! Body left the ground.
+  GroundRelease,
+};
+
+//! @returns Name of the event type.
+[[nodiscard]] const char* ToString(EventType type) noexcept;
+
+//! Event produced by a simulation pass.
+struct Event
+{
+  EventType _type = EventType::RegionEnter;
+  //! Region or threshold of the event, 0 for ground contact.
+  uint32_t _trigger = 0;
+  //! Index of the body in the ticked bodies, in the order they are captured into snapshots.
+  uint64_t _body = 0;
+  //! Position of the body at the end of the pass.
+  math::vec3d _position{0.0};
+};
+
+//! Events of bodies crossing regions and thresholds, detected by the simulation passes.
+//!
+//! Simulators report the state of every body they step, so that events cost a few
+//! comparisons per body instead of a scan of all bodies after a tick. Events are
+//! collected into a buffer per thread, so that threads ticking bodies concurrently
+//! never synchronize, and merged into a single list in body order once per tick.
+//! Triggers must not be added while a tick is running.
+class EventStream
+{
+public:
+  EventStream();
+
+  EventStream(const EventStream&) = delete;
+  EventStream& operator=(const EventStream&) = delete;
+
+  //! Adds region, whose entering and leaving bodies are reported.
+  //! @returns Index of the region.
+  uint32_t AddRegion(const Box& region);
+
+  //! Adds speed threshold, whose crossing bodies are reported.
+  //! @param speed Speed [m * s(-1)].
+  //! @returns Index of the threshold.
+  uint32_t AddSpeedThreshold(double speed);
+
+  //! Adds height threshold, whose crossing bodies are reported.
+  //! @param height Height [m].
+  //! @returns Index of the threshold.
+  uint32_t AddHeightThreshold(double height);
+
+  //! Reports motion of a body by the kinematics pass.
+  //! @param body Index of the body.
+  //! @param position Position before the pass.
+  //! @param velocity Velocity before the pass.
+  //! @param moved Body after the pass.
+  void Moved(
+    uint64_t body,
+    const math::vec3d& position,
+    const math::vec3d& velocity,
+    const Body& moved);
+
+  //! Reports ground contact of a body by the dynamics pass, and remembers it for the next tick.
+  //! Contact is whatever Body::_onGround holds, the simulators don't detect it themselves.
+  //! @param index Index of the body.
+  //! @param body Body.
+  void Grounded(uint64_t index, Body& body);
+
+  //! Merges the events collected by all threads since the previous merge.
+  //! Must be called between ticks.
+  void Merge();
+
+  //! @returns Events merged by the last Merge(), ordered by body.
+  [[nodiscard]] std::span<const Event> Events() const noexcept
+  {
+    return _events;
+  }
+
+private:
+  //! Events collected by a thread.
+  struct Buffer
+  {
+    std::thread::id _thread;
+    std::vector<Event> _events;
+  };
+
+  //! @returns Buffer of the calling thread, registered on its first event.
+  Buffer& Local();
+
+  void Emit(EventType type, uint32_t trigger, uint64_t body, const math::vec3d& position);
+
+private:
+  //! Identifies the stream in the buffer cache of the threads, never reused.
+  uint64_t _identifier;
+
+  std::vector<Box> _regions;
+  //! Squared speeds.
+  std::vector<double> _speeds;
+  std::vector<double> _heights;
+
+  //! Guards lookup and registration of the buffers, not the events.
+  std::mutex _mutex;
+  std::vector<std::unique_ptr<Buffer>> _buffers;
+  std::vector<Event> _events;
+};
+
+}// namespace sim
+
+#endif//SIM_EVENTS_HPP
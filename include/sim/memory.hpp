@@ -0,0 +1,196 @@
+//
+// Created by maros on 07.12.2023.
+//
+
+#ifndef SIM_MEMORY_HPP
+#define SIM_MEMORY_HPP
+
+#define VULKAN_HPP_NO_CONSTRUCTORS
+#include <vulkan/vulkan_raii.hpp>
+
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace vulkan
+{
+
+namespace vkr = vk::raii;
+
+class Allocator;
+
+//! Kind of resource placed in memory.
+//! Linear and optimal resources are kept in separate blocks when
+//! the device's buffer-image granularity would otherwise be violated.
+enum class ResourceKind
+{
+  //! Buffers and linear images.
+  Linear,
+  //! Optimal tiling images.
+  Optimal
+};
+
+//! Device memory block sub-allocated with a buddy allocator.
+struct MemoryBlock
+{
+  vkr::DeviceMemory memory { nullptr };
+  //! Persistent mapping of the whole block, if host visible.
+  std::byte* mapped = nullptr;
+  vk::DeviceSize size = 0;
+  //! Bytes handed out to allocations, including buddy rounding.
+  vk::DeviceSize used = 0;
+  uint32_t allocations = 0;
+  //! Whether the block is dedicated to a single allocation.
+  bool dedicated = false;
+  //! Offsets of free nodes, indexed by node order.
+  std::vector<std::set<vk::DeviceSize>> freeNodes;
+};
+
+//! Sub-allocation of a memory block. Returned to its block on destruction.
+class Allocation
+{
+public:
+  Allocation() = default;
+  Allocation(Allocation&& rhs) noexcept;
+  Allocation& operator=(Allocation&& rhs) noexcept;
+  ~Allocation();
+
+  Allocation(const Allocation&) = delete;
+  Allocation& operator=(const Allocation&) = delete;
+
+  //! @returns Device memory of the allocation.
+  [[nodiscard]] vk::DeviceMemory memory() const noexcept
+  {
+    return *_block->memory;
+  }
+
+  //! @returns Offset of the allocation in its device memory.
+  [[nodiscard]] vk::DeviceSize offset() const noexcept
+  {
+    return _offset;
+  }
+
+  //! @returns Mapped pointer to the allocation, null if not host visible.
+  [[nodiscard]] std::byte* mapped() const noexcept
+  {
+    return _block->mapped ? _block->mapped + _offset : nullptr;
+  }
+
+  explicit operator bool() const noexcept
+  {
+    return _block != nullptr;
+  }
+
+private:
+  friend class Allocator;
+
+  Allocator* _allocator = nullptr;
+  MemoryBlock* _block = nullptr;
+  uint32_t _memoryType = 0;
+  ResourceKind _kind = ResourceKind::Linear;
+  vk::DeviceSize _offset = 0;
+  uint32_t _order = 0;
+};
+
+//! Memory statistics.
+struct MemoryStatistics
+{
+  uint32_t blocks = 0;
+  uint32_t dedicatedBlocks = 0;
+  uint32_t allocations = 0;
+  //! Bytes allocated from the device.
+  vk::DeviceSize reserved = 0;
+  //! Bytes handed out to allocations.
+  vk::DeviceSize used = 0;
+};
+
+//! Device memory allocator.
+//!
+//! Keeps a pool of blocks per memory type and resource kind, each block sub-allocated with
+//! a buddy allocator, so that the device sees a handful of allocations instead of one per
+//! resource. Allocations too big for a block get a dedicated one. Host visible blocks are
+//! persistently mapped. Thread safe.
+class Allocator
+{
+public:
+  //! @param physicalDevice Physical device.
+  //! @param device Logical device.
+  //! @param blockSize Preferred size of a block [bytes], a power of two.
+  Allocator(
+    const vkr::PhysicalDevice& physicalDevice,
+    const vkr::Device& device,
+    vk::DeviceSize blockSize = 64 * 1024 * 1024);
+
+  //! Allocates memory.
+  //! @param requirements Memory requirements of the resource.
+  //! @param properties Required memory properties.
+  //! @param kind Kind of the resource.
+  //! @throws std::runtime_error If no memory type satisfies the requirements.
+  Allocation allocate(
+    const vk::MemoryRequirements& requirements,
+    vk::MemoryPropertyFlags properties,
+    ResourceKind kind);
+
+  //! Allocates memory for buffer and binds it.
+  Allocation bind(
+    const vkr::Buffer& buffer,
+    vk::MemoryPropertyFlags properties);
+
+  //! Allocates memory for image and binds it.
+  Allocation bind(
+    const vkr::Image& image,
+    vk::MemoryPropertyFlags properties,
+    vk::ImageTiling tiling);
+
+  //! Finds memory type satisfying the requirements.
+  //! @param memoryTypeBits Memory types supported by the resource.
+  //! @param properties Required memory properties.
+  //! @returns Memory type index.
+  [[nodiscard]] uint32_t memoryType(
+    uint32_t memoryTypeBits, vk::MemoryPropertyFlags properties) const;
+
+  //! @returns Statistics of a memory type.
+  [[nodiscard]] MemoryStatistics statistics(uint32_t memoryType) const;
+
+  //! @returns Statistics of all memory types.
+  [[nodiscard]] MemoryStatistics statistics() const;
+
+  //! @returns Human readable report of the memory types in use.
+  [[nodiscard]] std::string report() const;
+
+private:
+  friend class Allocation;
+
+  //! Returns allocation to its block.
+  void free(Allocation& allocation) noexcept;
+
+  //! Creates block of memory type and adds it to the pool.
+  MemoryBlock& createBlock(
+    uint32_t memoryType, ResourceKind kind, vk::DeviceSize size, bool dedicated);
+
+  //! @returns Pool of blocks for the memory type and resource kind.
+  std::vector<std::unique_ptr<MemoryBlock>>& pool(uint32_t memoryType, ResourceKind kind);
+
+private:
+  //! Smallest node handed out by the buddy allocator.
+  static constexpr vk::DeviceSize MinNodeSize = 256;
+
+  const vkr::Device& _device;
+  vk::PhysicalDeviceMemoryProperties _memoryProperties {};
+  vk::DeviceSize _bufferImageGranularity = 1;
+
+  //! Block size per memory type, limited by the size of its heap.
+  std::array<vk::DeviceSize, VK_MAX_MEMORY_TYPES> _blockSizes {};
+  //! Pools of blocks per memory type, for linear and optimal resources.
+  std::array<std::array<std::vector<std::unique_ptr<MemoryBlock>>, 2>, VK_MAX_MEMORY_TYPES> _pools;
+
+  mutable std::mutex _mutex;
+};
+
+}// namespace vulkan
+
+#endif//SIM_MEMORY_HPP
@@ -0,0 +1,90 @@
+//
+// Created by maros on 03.12.2023.
+//
+
+#ifndef SIM_MESH_HPP
+#define SIM_MESH_HPP
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+namespace mesh
+{
+
+//! Mesh vertex.
+struct Vertex
+{
+  glm::vec3 pos;
+};
+
+//! Width of the indices in an index buffer.
+enum class IndexWidth
+{
+  U16,
+  U32
+};
+
+//! Sphere enclosing a mesh.
+struct Sphere
+{
+  glm::vec3 center;
+  float radius;
+};
+
+//! Indexed triangle list.
+struct Mesh
+{
+  std::vector<Vertex> vertices;
+  std::vector<uint32_t> indices;
+
+  //! @returns Narrowest index width able to address all vertices.
+  [[nodiscard]] IndexWidth indexWidth() const noexcept
+  {
+    return vertices.size() <= UINT16_MAX ? IndexWidth::U16 : IndexWidth::U32;
+  }
+
+  //! @returns Indices packed into the narrowest index width.
+  [[nodiscard]] std::vector<std::byte> packedIndices() const;
+
+  //! @returns Sphere enclosing all vertices, centered on their bounding box.
+  [[nodiscard]] Sphere boundingSphere() const;
+};
+
+//! Reorders triangles to maximise post-transform vertex cache hits.
+//! Uses Tom Forsyth's linear-speed vertex cache optimisation.
+//! @param mesh Mesh to optimise.
+void optimizeVertexCache(Mesh& mesh);
+
+//! Reorders vertices in order of their first use by the indices,
+//! so that vertex fetches are as sequential as possible.
+//! @param mesh Mesh to optimise.
+void optimizeVertexFetch(Mesh& mesh);
+
+//! Runs all load time optimisations.
+//! @param mesh Mesh to optimise.
+void optimize(Mesh& mesh);
+
+//! Simplifies mesh by clustering vertices on a uniform grid.
+//! Vertices sharing a cell are merged into their average, triangles collapsed by the merge are
+//! dropped. Works on any input, but doesn't preserve silhouettes as well as edge collapses.
+//! @param mesh Mesh to simplify.
+//! @param resolution Number of grid cells along the longest side of the bounding box.
+//! @returns Optimised simplified mesh.
+Mesh simplify(const Mesh& mesh, uint32_t resolution);
+
+//! @returns Optimised cube mesh, spanning from -1 to 1 on every axis.
+Mesh cube();
+
+//! Loads a Wavefront OBJ mesh. Polygons are triangulated as fans.
+//! @param path Path to the OBJ file.
+//! @returns Optimised mesh.
+//! @throws std::runtime_error If the file can't be read or is malformed.
+Mesh load(const std::filesystem::path& path);
+
+}// namespace mesh
+
+#endif//SIM_MESH_HPP
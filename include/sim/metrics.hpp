@@ -0,0 +1,229 @@
+//
+// Created by maros on 18.12.2023.
+//
+
+#ifndef SIM_METRICS_HPP
+#define SIM_METRICS_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace sim
+{
+
+//! Monotonic counter.
+//!
+//! Sharded by thread, so that threads counting concurrently don't contend for a cache line.
+class Counter
+{
+public:
+  //! Number of shards.
+  static constexpr size_t Shards = 16;
+
+  //! Adds to the counter.
+  void Add(uint64_t value = 1) noexcept
+  {
+    _shards[ShardIndex()].value.fetch_add(value, std::memory_order_relaxed);
+  }
+
+  //! @returns Sum of the shards.
+  [[nodiscard]] uint64_t Value() const noexcept;
+
+private:
+  struct alignas(64) Shard
+  {
+    std::atomic<uint64_t> value = 0;
+  };
+
+  //! @returns Shard of the calling thread.
+  static size_t ShardIndex() noexcept;
+
+private:
+  std::array<Shard, Shards> _shards;
+};
+
+//! Value that goes up and down.
+class Gauge
+{
+public:
+  void Set(int64_t value) noexcept
+  {
+    _value.store(value, std::memory_order_relaxed);
+  }
+
+  void Add(int64_t value) noexcept
+  {
+    _value.fetch_add(value, std::memory_order_relaxed);
+  }
+
+  [[nodiscard]] int64_t Value() const noexcept
+  {
+    return _value.load(std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<int64_t> _value = 0;
+};
+
+//! Histogram of non-negative integer values with high dynamic range buckets.
+//!
+//! Every power of two is split into SubBuckets linear buckets, so that any recorded value
+//! is known within 1/SubBuckets of itself, from 1 up to the full 64 bit range,
+//! in a fixed array of counts. Recording is a few relaxed atomic additions.
+class Histogram
+{
+public:
+  //! Bits of a value kept below its leading bit.
+  static constexpr uint32_t SubBucketBits = 4;
+  //! Buckets per power of two.
+  static constexpr uint32_t SubBuckets = 1u << SubBucketBits;
+  //! Number of buckets.
+  static constexpr uint32_t Buckets = (64 - SubBucketBits + 1) * SubBuckets;
+
+  //! @param unit Exported unit of a recorded value, such as 1e-9 for nanoseconds exported in seconds.
+  explicit Histogram(double unit = 1.0) noexcept
+    : _unit(unit)
+  {}
+
+  //! Records value.
+  void Record(uint64_t value) noexcept
+  {
+    _buckets[BucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+    _count.fetch_add(1, std::memory_order_relaxed);
+    _sum.fetch_add(value, std::memory_order_relaxed);
+
+    auto maximum = _maximum.load(std::memory_order_relaxed);
+    while (value > maximum
+           && !_maximum.compare_exchange_weak(maximum, value, std::memory_order_relaxed))
+    {
+    }
+  }
+
+  //! Records duration in nanoseconds.
+  void Record(std::chrono::steady_clock::duration duration) noexcept
+  {
+    const auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+    Record(static_cast<uint64_t>(std::max<int64_t>(nanoseconds, 0)));
+  }
+
+  //! @returns Value below which the fraction of the recorded values falls, within the bucket precision.
+  [[nodiscard]] uint64_t Quantile(double fraction) const noexcept;
+
+  [[nodiscard]] uint64_t Count() const noexcept
+  {
+    return _count.load(std::memory_order_relaxed);
+  }
+
+  [[nodiscard]] uint64_t Sum() const noexcept
+  {
+    return _sum.load(std::memory_order_relaxed);
+  }
+
+  [[nodiscard]] double Unit() const noexcept
+  {
+    return _unit;
+  }
+
+  //! @returns Bucket of a value.
+  [[nodiscard]] static uint32_t BucketOf(uint64_t value) noexcept;
+
+  //! @returns Largest value of a bucket.
+  [[nodiscard]] static uint64_t UpperBound(uint32_t bucket) noexcept;
+
+private:
+  double _unit;
+  std::array<std::atomic<uint64_t>, Buckets> _buckets {};
+  std::atomic<uint64_t> _count = 0;
+  std::atomic<uint64_t> _sum = 0;
+  std::atomic<uint64_t> _maximum = 0;
+};
+
+//! Registry of the process metrics, exported in the Prometheus text format.
+//!
+//! Metrics are registered once, typically into a function local static reference,
+//! and live as long as the process, so that recording never touches the registry.
+class Metrics
+{
+public:
+  //! @returns Registry of the process.
+  static Metrics& Instance();
+
+  //! Registers counter, or finds the one registered with the name.
+  //! @param name Name, such as sim_bodies_total.
+  //! @param help Description.
+  Counter& RegisterCounter(std::string_view name, std::string_view help);
+
+  //! Registers gauge, or finds the one registered with the name.
+  Gauge& RegisterGauge(std::string_view name, std::string_view help);
+
+  //! Registers histogram, or finds the one registered with the name.
+  //! @param unit Exported unit of a recorded value.
+  Histogram& RegisterHistogram(std::string_view name, std::string_view help, double unit = 1.0);
+
+  //! @returns Metrics in the Prometheus text exposition format.
+  [[nodiscard]] std::string Exposition() const;
+
+  //! Writes the exposition to a file, replacing it atomically, so that readers such as
+  //! the node exporter textfile collector never see a partial file.
+  //! @throws std::runtime_error If the file can't be written.
+  void Write(const std::filesystem::path& path) const;
+
+private:
+  Metrics() = default;
+
+  //! Registered metric, one of the kinds.
+  struct Entry
+  {
+    std::string name;
+    std::string help;
+    std::unique_ptr<Counter> counter;
+    std::unique_ptr<Gauge> gauge;
+    std::unique_ptr<Histogram> histogram;
+  };
+
+  //! @returns Entry of the name, added if not registered.
+  Entry& Find(std::string_view name, std::string_view help);
+
+private:
+  mutable std::mutex _mutex;
+  std::vector<std::unique_ptr<Entry>> _entries;
+};
+
+//! Writes the metrics to a file periodically on its own thread, and once more when destroyed.
+class MetricsDump
+{
+public:
+  //! @param path Path of the file.
+  //! @param interval Interval between writes.
+  explicit MetricsDump(
+    std::filesystem::path path,
+    std::chrono::steady_clock::duration interval = std::chrono::seconds(1));
+  ~MetricsDump();
+
+  MetricsDump(const MetricsDump&) = delete;
+  MetricsDump& operator=(const MetricsDump&) = delete;
+
+private:
+  std::filesystem::path _path;
+  std::chrono::steady_clock::duration _interval;
+
+  std::mutex _mutex;
+  std::condition_variable_any _wakeup;
+  std::jthread _writer;
+};
+
+}// namespace sim
+
+#endif//SIM_METRICS_HPP
@@ -0,0 +1,83 @@
+//
+// Created by maros on 08.12.2023.
+//
+
+#ifndef SIM_PIPELINES_HPP
+#define SIM_PIPELINES_HPP
+
+#define VULKAN_HPP_NO_CONSTRUCTORS
+#include <vulkan/vulkan_raii.hpp>
+
+#include <filesystem>
+#include <span>
+#include <vector>
+
+namespace vulkan
+{
+
+namespace vkr = vk::raii;
+
+//! Pipeline cache persisted on disk between launches.
+//!
+//! Cache file is keyed by the device UUID and the driver version, so that another GPU or
+//! an updated driver starts cold instead of being handed data it can't use. Pipelines are
+//! created on worker threads, all sharing the cache.
+class PipelineCache
+{
+public:
+  //! Loads the cache of the device, if a previous launch saved one.
+  //! @param physicalDevice Physical device.
+  //! @param device Logical device.
+  //! @param directory Directory of cache files. Platform cache directory if empty.
+  PipelineCache(
+    const vkr::PhysicalDevice& physicalDevice,
+    const vkr::Device& device,
+    std::filesystem::path directory = {});
+
+  //! Writes the cache to disk.
+  //! Failures are reported, not thrown, as the cache is only an optimisation.
+  void save() const;
+
+  //! Creates graphics pipelines in parallel.
+  //! @param createInfos Create infos. State they point to must outlive the call.
+  //! @returns Pipelines in the order of the create infos.
+  [[nodiscard]] std::vector<vkr::Pipeline> createGraphicsPipelines(
+    std::span<const vk::GraphicsPipelineCreateInfo> createInfos) const;
+
+  //! Creates compute pipeline.
+  //! @param createInfo Create info.
+  //! @returns Pipeline.
+  [[nodiscard]] vkr::Pipeline createComputePipeline(
+    const vk::ComputePipelineCreateInfo& createInfo) const;
+
+  //! @returns Whether the cache was loaded from a previous launch.
+  [[nodiscard]] bool warm() const noexcept
+  {
+    return _warm;
+  }
+
+  //! @returns Path of the cache file.
+  [[nodiscard]] const std::filesystem::path& path() const noexcept
+  {
+    return _path;
+  }
+
+private:
+  //! @returns Per-user cache directory of the platform.
+  static std::filesystem::path defaultDirectory();
+
+  //! @returns Whether the data has a header matching the device.
+  [[nodiscard]] bool compatible(std::span<const std::byte> data) const;
+
+private:
+  const vkr::Device& _device;
+  vk::PhysicalDeviceProperties _properties {};
+  std::filesystem::path _path;
+
+  vkr::PipelineCache _cache { nullptr };
+  bool _warm = false;
+};
+
+}// namespace vulkan
+
+#endif//SIM_PIPELINES_HPP
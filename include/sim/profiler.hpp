@@ -0,0 +1,260 @@
+//
+// Created by maros on 13.12.2023.
+//
+
+#ifndef SIM_PROFILER_HPP
+#define SIM_PROFILER_HPP
+
+#define VULKAN_HPP_NO_CONSTRUCTORS
+#include <vulkan/vulkan_raii.hpp>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace vulkan
+{
+
+namespace vkr = vk::raii;
+
+class Renderer;
+
+//! Timed span of work, on the host or on the device.
+struct ProfileEvent
+{
+  //! Name of the scope, a string literal.
+  const char* name = nullptr;
+  //! Start since the profiler epoch [ns].
+  int64_t start = 0;
+  //! Duration [ns].
+  int64_t duration = 0;
+  //! Thread the work ran on, Profiler::DeviceThread for device work.
+  uint32_t thread = 0;
+};
+
+//! Collects timed scopes of all threads into a trace.
+//!
+//! Every thread records into its own ring, which is lock free and never blocks the thread.
+//! Events are moved from the rings into the trace by collect(), dropped if a ring fills up
+//! in between. The trace keeps the most recent events only, so that a long running process
+//! can be profiled until a spike shows up.
+class Profiler
+{
+public:
+  using Clock = std::chrono::steady_clock;
+
+  //! Thread of device events.
+  static constexpr uint32_t DeviceThread = 0;
+  //! Capacity of a thread ring [events].
+  static constexpr size_t RingCapacity = 4096;
+  //! Capacity of the trace [events].
+  static constexpr size_t TraceCapacity = 1 << 20;
+
+  //! @returns Profiler of the process.
+  static Profiler& instance();
+
+  //! Enables or disables recording. Disabled scopes cost a load.
+  void enable(bool enabled) noexcept
+  {
+    _enabled.store(enabled, std::memory_order_relaxed);
+  }
+
+  //! @returns Whether scopes are recorded.
+  [[nodiscard]] bool enabled() const noexcept
+  {
+    return _enabled.load(std::memory_order_relaxed);
+  }
+
+  //! @returns Time since the profiler epoch [ns].
+  [[nodiscard]] int64_t since(Clock::time_point time) const noexcept
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time - _epoch).count();
+  }
+
+  //! Records scope of the calling thread.
+  //! @param name Name of the scope, a string literal.
+  //! @param start Start of the scope.
+  //! @param end End of the scope.
+  void record(const char* name, Clock::time_point start, Clock::time_point end);
+
+  //! Records scope of device work.
+  //! @param name Name of the scope, a string literal.
+  //! @param start Start since the profiler epoch [ns].
+  //! @param duration Duration [ns].
+  void recordDevice(const char* name, int64_t start, int64_t duration) noexcept;
+
+  //! Moves events from the thread rings into the trace.
+  void collect();
+
+  //! Summarises scopes collected since the previous summary.
+  //! @returns Average and maximum duration of every scope.
+  [[nodiscard]] std::string summary();
+
+  //! Writes the trace in the Chrome trace event format, readable by chrome://tracing and Perfetto.
+  //! @param path Path of the JSON file.
+  //! @throws std::runtime_error If the file can't be written.
+  void writeTrace(const std::filesystem::path& path);
+
+private:
+  //! Single producer, single consumer ring of a thread.
+  struct Ring
+  {
+    std::array<ProfileEvent, RingCapacity> events;
+    //! Written by the thread.
+    std::atomic<uint64_t> head = 0;
+    //! Written by the collector.
+    std::atomic<uint64_t> tail = 0;
+    std::atomic<uint64_t> dropped = 0;
+    uint32_t thread = 0;
+  };
+
+  //! Statistics of a scope.
+  struct Statistics
+  {
+    int64_t total = 0;
+    int64_t maximum = 0;
+    uint64_t count = 0;
+  };
+
+  Profiler() = default;
+
+  //! @returns Ring of the calling thread, registered on first use.
+  Ring& threadRing();
+
+  //! Appends event to the trace. Expects the trace mutex held.
+  void append(const ProfileEvent& event);
+
+private:
+  std::atomic<bool> _enabled = false;
+  const Clock::time_point _epoch = Clock::now();
+
+  std::mutex _ringsMutex;
+  std::vector<std::unique_ptr<Ring>> _rings;
+  //! Device events, recorded on the render thread only, but collected with the rest.
+  std::unique_ptr<Ring> _deviceRing = std::make_unique<Ring>();
+
+  std::mutex _traceMutex;
+  std::deque<ProfileEvent> _trace;
+  //! Scopes collected since the previous summary, by name.
+  std::map<std::string_view, Statistics> _window;
+  uint64_t _dropped = 0;
+};
+
+//! Records the enclosing scope of the calling thread.
+class ProfileScope
+{
+public:
+  //! @param name Name of the scope, a string literal.
+  explicit ProfileScope(const char* name) noexcept
+    : _name(name)
+  {
+    if (Profiler::instance().enabled())
+      _start = Profiler::Clock::now();
+  }
+
+  ~ProfileScope()
+  {
+    end();
+  }
+
+  //! Ends the scope before the end of the enclosing one.
+  void end()
+  {
+    if (_start == Profiler::Clock::time_point {})
+      return;
+    Profiler::instance().record(_name, _start, Profiler::Clock::now());
+    _start = {};
+  }
+
+  ProfileScope(const ProfileScope&) = delete;
+  ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+  const char* _name;
+  Profiler::Clock::time_point _start {};
+};
+
+//! Measures device time of passes with timestamp queries.
+//!
+//! Every frame in flight owns a range of queries, read once its fence signals. Device clock
+//! isn't related to the host one, so timestamps of a frame are placed relative to the time
+//! it was submitted, which the work can't start before. Durations are exact.
+class DeviceProfiler
+{
+public:
+  //! Maximum number of timed passes of a frame.
+  static constexpr uint32_t MaxScopesPerFrame = 16;
+
+  //! @param renderer Renderer with a logical device.
+  //! @param framesInFlight Number of frames in flight.
+  DeviceProfiler(const Renderer& renderer, uint32_t framesInFlight);
+
+  //! @returns Whether the graphics queue supports timestamps.
+  [[nodiscard]] bool supported() const noexcept
+  {
+    return _mask != 0;
+  }
+
+  //! Records the timestamps of the previous frame of the slot, if not recorded yet.
+  //! Must be called once the frame fence is signaled.
+  //! @param frameIndex Index of the frame in flight.
+  void collect(uint32_t frameIndex);
+
+  //! Collects the previous frame of the slot and resets its queries.
+  //! Must be called once the frame fence is signaled.
+  //! @param commandBuffer Command buffer of the frame, outside of a render pass.
+  //! @param frameIndex Index of the frame in flight.
+  void beginFrame(const vkr::CommandBuffer& commandBuffer, uint32_t frameIndex);
+
+  //! Writes timestamp at the start of a pass.
+  //! @param commandBuffer Command buffer of the frame.
+  //! @param name Name of the pass, a string literal.
+  //! @returns Scope to end, or none if the frame ran out of queries.
+  uint32_t begin(const vkr::CommandBuffer& commandBuffer, const char* name);
+
+  //! Writes timestamp at the end of a pass.
+  //! @param commandBuffer Command buffer of the frame.
+  //! @param scope Scope returned by begin().
+  void end(const vkr::CommandBuffer& commandBuffer, uint32_t scope);
+
+  //! Marks the frame as submitted, anchoring its timestamps.
+  //! @param time Time of the submission.
+  void submitted(Profiler::Clock::time_point time);
+
+private:
+  //! Queries of a frame in flight.
+  struct FrameQueries
+  {
+    std::vector<const char*> names;
+    //! Submission time since the profiler epoch [ns], 0 if nothing is pending.
+    int64_t submitted = 0;
+  };
+
+  //! Scope value of a frame out of queries.
+  static constexpr uint32_t NoScope = UINT32_MAX;
+  //! Queries of a frame in flight, a pair per scope.
+  static constexpr uint32_t QueriesPerFrame = 2 * MaxScopesPerFrame;
+
+  vkr::QueryPool _queryPool { nullptr };
+  //! Length of a timestamp tick [ns].
+  double _period = 1.0;
+  //! Mask of the valid timestamp bits.
+  uint64_t _mask = 0;
+
+  std::vector<FrameQueries> _frames;
+  //! Frame in flight being recorded.
+  uint32_t _frameIndex = 0;
+};
+
+}// namespace vulkan
+
+#endif//SIM_PROFILER_HPP
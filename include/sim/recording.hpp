@@ -0,0 +1,115 @@
+//
+// Created by maros on 11.12.2023.
+//
+
+#ifndef SIM_RECORDING_HPP
+#define SIM_RECORDING_HPP
+
+#define VULKAN_HPP_NO_CONSTRUCTORS
+#include <vulkan/vulkan_raii.hpp>
+
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace vulkan
+{
+
+namespace vkr = vk::raii;
+
+class Renderer;
+
+//! Records secondary command buffers of a render pass on worker threads.
+//!
+//! Every thread owns a command pool per frame in flight, as pools may only be used by one thread
+//! at a time and may only be reset once the frame using them completes. Work is split into
+//! contiguous ranges, one per thread, so the secondary command buffers execute in the order
+//! of the work. The calling thread records the first range itself.
+class ParallelRecorder
+{
+public:
+  //! Records a range of the work into a secondary command buffer.
+  using RecordFunction = std::function<void(
+    const vkr::CommandBuffer& commandBuffer, size_t begin, size_t end)>;
+
+  //! @param renderer Renderer with a logical device.
+  //! @param framesInFlight Number of frames in flight.
+  //! @param threadCount Number of recording threads, including the calling one.
+  //!                    Hardware concurrency if 0.
+  ParallelRecorder(const Renderer& renderer, uint32_t framesInFlight, uint32_t threadCount = 0);
+  ~ParallelRecorder();
+
+  ParallelRecorder(const ParallelRecorder&) = delete;
+  ParallelRecorder& operator=(const ParallelRecorder&) = delete;
+
+  //! @param count Number of work items.
+  //! @param minimumPerThread Smallest number of items worth a thread,
+  //!                         0 to split any work across all threads, some possibly recording nothing.
+  //! @returns Number of threads the work would be split across.
+  [[nodiscard]] uint32_t threadsFor(size_t count, size_t minimumPerThread) const noexcept;
+
+  //! Records the work in parallel and blocks until all threads are done.
+  //! Must only be called once the frame fence is signaled, as it resets the frame's pools.
+  //! @param frameIndex Index of the frame in flight.
+  //! @param inheritance Render pass state the command buffers execute in.
+  //! @param count Number of work items.
+  //! @param minimumPerThread Smallest number of items worth a thread.
+  //! @param function Records a range of the work. Called concurrently.
+  //! @returns Secondary command buffers in the order of the work.
+  //! @throws Exception thrown by the function on any thread.
+  std::vector<vk::CommandBuffer> record(
+    uint32_t frameIndex,
+    const vk::CommandBufferInheritanceInfo& inheritance,
+    size_t count,
+    size_t minimumPerThread,
+    const RecordFunction& function);
+
+  //! @returns Number of recording threads, including the calling one.
+  [[nodiscard]] uint32_t threadCount() const noexcept
+  {
+    return _threadCount;
+  }
+
+private:
+  //! Command pool of a thread and a frame in flight.
+  struct ThreadPool
+  {
+    vkr::CommandPool pool { nullptr };
+    vkr::CommandBuffer commandBuffer { nullptr };
+  };
+
+  //! Records ranges dispatched to the thread until stopped.
+  void work(std::stop_token stop, uint32_t thread);
+
+  //! Records the thread's range of the current dispatch.
+  void recordRange(uint32_t thread) noexcept;
+
+private:
+  uint32_t _threadCount = 1;
+  //! Pools indexed by frame in flight, then by thread.
+  std::vector<std::vector<ThreadPool>> _pools;
+
+  //! Dispatch state, published to the workers under the mutex.
+  std::mutex _mutex;
+  std::condition_variable_any _dispatchCondition;
+  std::condition_variable_any _doneCondition;
+  uint64_t _dispatch = 0;
+  uint32_t _pendingThreads = 0;
+  uint32_t _activeThreads = 0;
+  uint32_t _frameIndex = 0;
+  size_t _count = 0;
+  const vk::CommandBufferInheritanceInfo* _inheritance = nullptr;
+  const RecordFunction* _function = nullptr;
+  std::vector<std::exception_ptr> _errors;
+
+  //! Declared last, so that the workers stop before the pools are destroyed.
+  std::vector<std::jthread> _workers;
+};
+
+}// namespace vulkan
+
+#endif//SIM_RECORDING_HPP
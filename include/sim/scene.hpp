@@ -0,0 +1,173 @@
+//
+// Created by maros on 16.12.2023.
+//
+
+#ifndef SIM_SCENE_HPP
+#define SIM_SCENE_HPP
+
+#include "sim/engine.hpp"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace sdk
+{
+
+//! Handle of a transform node, stale once the node is destroyed.
+struct TransformNode
+{
+  uint32_t index = 0;
+  uint32_t generation = 0;
+
+  bool operator==(const TransformNode&) const = default;
+};
+
+//! Hierarchy of transforms, caching the world matrix of every node.
+//!
+//! Nodes are stored as arrays of their components, ordered breadth first, so that
+//! a level of the hierarchy is a contiguous range whose parents are all in the previous
+//! levels. Changing a node flags it dirty, and update() recomputes world matrices
+//! of the dirty nodes and their descendants only, level by level, starting at
+//! the shallowest dirty level. Levels large enough are split across threads.
+//!
+//! Structural changes, creating, destroying and reparenting nodes, reorder
+//! the arrays on the next update.
+class SceneGraph
+{
+public:
+  //! Smallest number of nodes of a level updated in parallel.
+  static constexpr size_t ParallelThreshold = 4096;
+
+  //! @param threadCount Number of threads updating a level, including the calling one.
+  //!                    Hardware concurrency if 0.
+  explicit SceneGraph(uint32_t threadCount = 0);
+
+  //! Creates node with an identity transform.
+  //! @param parent Parent of the node, a root if empty.
+  //! @returns Node.
+  //! @throws std::runtime_error If the parent doesn't exist.
+  TransformNode create(std::optional<TransformNode> parent = {});
+
+  //! Creates node placed at the actor's position and rotation.
+  //! @param actor Actor.
+  //! @param parent Parent of the node, a root if empty.
+  //! @returns Node.
+  //! @throws std::runtime_error If the parent doesn't exist.
+  TransformNode create(const Actor& actor, std::optional<TransformNode> parent = {});
+
+  //! Destroys node. Its descendants are destroyed by the next update.
+  //! @param node Node, ignored if already destroyed.
+  void destroy(TransformNode node);
+
+  //! Moves node under another parent, keeping its local transform.
+  //! @param node Node.
+  //! @param parent New parent, a root if empty.
+  //! @throws std::runtime_error If either node doesn't exist, or the parent is a descendant of the node.
+  void setParent(TransformNode node, std::optional<TransformNode> parent);
+
+  //! @returns Whether the node exists.
+  [[nodiscard]] bool alive(TransformNode node) const noexcept;
+
+  //! Sets position of the node relative to its parent.
+  void setPosition(TransformNode node, const glm::vec3& position);
+
+  //! Sets rotation of the node relative to its parent.
+  void setRotation(TransformNode node, const glm::quat& rotation);
+
+  //! Sets scale of the node.
+  void setScale(TransformNode node, const glm::vec3& scale);
+
+  //! Translates node in its parent's space.
+  //! @param translationVector Translation vector.
+  void translate(TransformNode node, const glm::vec3& translationVector);
+
+  //! Rotates node around an axis of its own space.
+  //! @param angle Angle [rad].
+  //! @param axis Normalized vector representing axis to rotate on.
+  void rotate(TransformNode node, float angle, const glm::vec3& axis);
+
+  //! @returns World matrix of the node as of the last update.
+  //! @throws std::runtime_error If the node doesn't exist.
+  [[nodiscard]] const glm::mat4x4& world(TransformNode node) const;
+
+  //! Reorders the arrays after structural changes and recomputes world matrices
+  //! of the changed subtrees.
+  //! @returns Number of recomputed world matrices.
+  size_t update();
+
+  //! @returns Number of nodes, including destroyed ones until the next update.
+  [[nodiscard]] size_t size() const noexcept
+  {
+    return _nodes.size();
+  }
+
+  //! @returns Number of levels of the hierarchy, as of the last update.
+  [[nodiscard]] size_t depth() const noexcept
+  {
+    return _levels.empty() ? 0 : _levels.size() - 1;
+  }
+
+private:
+  //! Slot of a node without a parent.
+  static constexpr uint32_t NoParent = UINT32_MAX;
+
+  //! Slot and generation of a handle index.
+  struct Handle
+  {
+    uint32_t generation = 0;
+    //! Slot of the node in the arrays, NoParent if the index is free.
+    uint32_t slot = NoParent;
+  };
+
+  //! @returns Slot of the node.
+  //! @throws std::runtime_error If the node doesn't exist.
+  [[nodiscard]] uint32_t slotOf(TransformNode node) const;
+
+  //! @returns Level of a slot, as of the last reorder.
+  [[nodiscard]] uint32_t levelOf(uint32_t slot) const noexcept;
+
+  //! Flags slot for recomputation.
+  void markDirty(uint32_t slot);
+
+  //! Orders the arrays breadth first and drops destroyed subtrees.
+  void reorder();
+
+  //! Recomputes world matrices of a range of a level.
+  //! @param first Whether the range is in the shallowest updated level.
+  //! @returns Number of recomputed world matrices.
+  size_t updateRange(size_t begin, size_t end, bool first) noexcept;
+
+private:
+  uint32_t _threadCount = 1;
+
+  std::vector<Handle> _handles;
+  std::vector<uint32_t> _freeHandles;
+
+  //! Arrays indexed by slot.
+  std::vector<uint32_t> _nodes;
+  std::vector<uint32_t> _parents;
+  std::vector<glm::vec3> _positions;
+  std::vector<glm::quat> _rotations;
+  std::vector<glm::vec3> _scales;
+  std::vector<glm::mat4x4> _worlds;
+  std::vector<uint8_t> _dirty;
+  std::vector<uint8_t> _changed;
+  std::vector<uint8_t> _destroyed;
+
+  //! First slot of every level, followed by the number of slots.
+  std::vector<uint32_t> _levels;
+  //! Whether the arrays need reordering.
+  bool _reorder = false;
+  size_t _dirtyCount = 0;
+  //! Shallowest level with a dirty node.
+  uint32_t _firstDirtyLevel = 0;
+};
+
+}// namespace sdk
+
+#endif//SIM_SCENE_HPP
@@ -0,0 +1,81 @@
+//
+// Created by maros on 19.12.2023.
+//
+
+#ifndef SIM_SHADERS_HPP
+#define SIM_SHADERS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <thread>
+
+namespace vulkan
+{
+
+//! Recompiles GLSL shaders edited in a directory on a background thread.
+//!
+//! Sources are polled for modification, so that any editor and file system work.
+//! An edited source `name.stage` is compiled into `name-stage.spv` in the working directory,
+//! where the renderer loads binaries from, through a temporary file, so that a failed
+//! compilation keeps the previous binary. The render loop polls rebuilt() between frames
+//! and reloads the pipelines.
+class ShaderWatcher
+{
+public:
+  //! Interval between polls of the sources.
+  static constexpr auto PollInterval = std::chrono::milliseconds(250);
+
+  //! @param sources Directory of the GLSL sources.
+  //! @param compiler GLSL compiler with a glslc command line.
+  explicit ShaderWatcher(
+    std::filesystem::path sources,
+    std::filesystem::path compiler = defaultCompiler());
+  ~ShaderWatcher();
+
+  ShaderWatcher(const ShaderWatcher&) = delete;
+  ShaderWatcher& operator=(const ShaderWatcher&) = delete;
+
+  //! @returns Whether shaders were rebuilt since the last call.
+  [[nodiscard]] bool rebuilt() noexcept
+  {
+    return _rebuilt.exchange(false, std::memory_order_acquire);
+  }
+
+  //! @returns Compiler found by the build, or glslc from the path.
+  [[nodiscard]] static std::filesystem::path defaultCompiler();
+
+  //! @returns Source directory known to the build, or resources/shaders of the working directory.
+  [[nodiscard]] static std::filesystem::path defaultSources();
+
+  //! @returns Binary the renderer loads for a source.
+  [[nodiscard]] static std::filesystem::path binaryOf(const std::filesystem::path& source);
+
+private:
+  //! Compiles sources modified since the last poll.
+  //! @returns Whether any source compiled.
+  bool poll();
+
+  //! Compiles source into its binary.
+  //! @returns Whether it compiled.
+  bool compile(const std::filesystem::path& source) const;
+
+private:
+  std::filesystem::path _sources;
+  std::filesystem::path _compiler;
+  //! Modification times of the sources seen so far.
+  std::map<std::filesystem::path, std::filesystem::file_time_type> _modified;
+
+  std::atomic<bool> _rebuilt = false;
+
+  std::mutex _mutex;
+  std::condition_variable_any _wakeup;
+  std::jthread _watcher;
+};
+
+}// namespace vulkan
+
+#endif//SIM_SHADERS_HPP
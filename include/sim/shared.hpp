@@ -0,0 +1,166 @@
+//
+// Created by maros on 20.12.2023.
+//
+
+#ifndef SIM_SHARED_HPP
+#define SIM_SHARED_HPP
+
+#include "snapshot.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+
+namespace sim
+{
+
+//! Layout of the shared memory ring of snapshots.
+//!
+//! A header is followed by a fixed number of slots, each holding up to a fixed number of
+//! body states. Every slot is guarded by a seqlock: its version is odd while the producer
+//! writes into it, and even once written. Readers copy a slot out and retry if the version
+//! changed meanwhile, so the producer never waits for them and doesn't know they exist.
+struct SharedSnapshotRing
+{
+  //! Identifies the layout, "sim-ring".
+  static constexpr uint64_t Magic = 0x73696D2D72696E67;
+  //! Default number of slots.
+  static constexpr uint32_t DefaultSlots = 4;
+
+  struct Header
+  {
+    //! Written last, once the header is complete.
+    std::atomic<uint64_t> _magic = 0;
+    uint32_t _slotCount = 0;
+    //! Maximum number of bodies of a slot.
+    uint32_t _capacity = 0;
+    //! Size of a slot [bytes].
+    uint64_t _slotSize = 0;
+    //! Size of a body, so that a viewer of another build doesn't misread the bodies [bytes].
+    uint64_t _bodySize = 0;
+    //! Sequence number of the newest written snapshot, 0 if none.
+    std::atomic<uint64_t> _latest = 0;
+    //! Set once the producer is gone, so that viewers attach to its successor.
+    std::atomic<uint32_t> _closed = 0;
+  };
+
+  struct Slot
+  {
+    //! Seqlock version, odd while written.
+    std::atomic<uint64_t> _version = 0;
+    //! Sequence number of the snapshot.
+    uint64_t _sequence = 0;
+    //! Simulation time of the snapshot [s].
+    double _time = 0.0;
+    //! Steady clock time at which the snapshot was published, shared by the processes of a machine.
+    int64_t _published = 0;
+    //! Number of bodies following the slot.
+    uint32_t _bodyCount = 0;
+  };
+
+  //! Body state as laid out in a slot.
+  struct Body
+  {
+    double _position[3];
+    double _velocity[3];
+  };
+
+  static_assert(std::atomic<uint64_t>::is_always_lock_free);
+  static_assert(std::atomic<uint32_t>::is_always_lock_free);
+  static_assert(std::is_trivially_copyable_v<Body>);
+
+  //! @returns Size of a slot holding the bodies [bytes].
+  [[nodiscard]] static constexpr size_t SlotSize(uint32_t capacity) noexcept
+  {
+    const auto size = sizeof(Slot) + size_t(capacity) * sizeof(Body);
+    // Slots start on their own cache lines.
+    return (size + 63) / 64 * 64;
+  }
+
+  //! @returns Size of the ring [bytes].
+  [[nodiscard]] static constexpr size_t Size(uint32_t slotCount, uint32_t capacity) noexcept
+  {
+    return SlotOffset + size_t(slotCount) * SlotSize(capacity);
+  }
+
+  //! Offset of the first slot [bytes].
+  static constexpr size_t SlotOffset = (sizeof(Header) + 63) / 64 * 64;
+};
+
+//! Publishes snapshots of a headless simulation into a POSIX shared memory ring.
+//!
+//! Publishing copies the snapshot into the oldest slot and never blocks, whether
+//! any viewer is attached or not. The shared memory object is removed on destruction.
+class SharedSnapshotPublisher
+{
+public:
+  //! Creates the shared memory object, replacing any left by a previous producer.
+  //! @param name Name of the shared memory object, such as /sim.
+  //! @param capacity Maximum number of bodies of a snapshot.
+  //! @param slotCount Number of slots of the ring.
+  //! @throws std::runtime_error If the object can't be created.
+  SharedSnapshotPublisher(
+    std::string name,
+    uint32_t capacity,
+    uint32_t slotCount = SharedSnapshotRing::DefaultSlots);
+  ~SharedSnapshotPublisher();
+
+  SharedSnapshotPublisher(const SharedSnapshotPublisher&) = delete;
+  SharedSnapshotPublisher& operator=(const SharedSnapshotPublisher&) = delete;
+
+  //! Publishes the snapshot. Bodies beyond the capacity aren't published.
+  //! @param snapshot Snapshot to publish.
+  void Publish(const Snapshot& snapshot) noexcept;
+
+private:
+  std::string _name;
+  std::byte* _memory = nullptr;
+  size_t _size = 0;
+  uint64_t _sequence = 0;
+  //! Whether bodies were dropped for the capacity, reported once.
+  bool _truncated = false;
+};
+
+//! Reads snapshots published by a simulation in another process, read only.
+//!
+//! Attaches lazily, so that a viewer may start before the simulation, and attaches again
+//! when the simulation restarts.
+class SharedSnapshotReader
+{
+public:
+  //! @param name Name of the shared memory object.
+  explicit SharedSnapshotReader(std::string name);
+  ~SharedSnapshotReader();
+
+  SharedSnapshotReader(const SharedSnapshotReader&) = delete;
+  SharedSnapshotReader& operator=(const SharedSnapshotReader&) = delete;
+
+  //! Reads the newest snapshot, if newer than the last one read.
+  //! @param snapshot Snapshot receiving the body states, sequence and times.
+  //! @returns Whether a newer snapshot was read.
+  bool Read(Snapshot& snapshot);
+
+  //! @returns Whether attached to a simulation.
+  [[nodiscard]] bool Attached() const noexcept
+  {
+    return _memory != nullptr;
+  }
+
+private:
+  //! Maps the shared memory object, if it exists and is complete.
+  void Attach();
+  void Detach() noexcept;
+
+private:
+  std::string _name;
+  const std::byte* _memory = nullptr;
+  size_t _size = 0;
+  //! Sequence number of the last snapshot read.
+  uint64_t _sequence = 0;
+};
+
+}// namespace sim
+
+#endif//SIM_SHARED_HPP
@@ -8,17 +8,24 @@
 #include "math.hpp"
 
 #include <array>
+#include <cstddef>
 #include <list>
 #include <numeric>
+#include <span>
+#include <tuple>
 #include <vector>
 
 namespace sim
 {
 
+class EventStream;
+
 struct Body
 {
   float _weight = 0.0f;
   bool _onGround = false;
+  //! Ground contact seen by the previous dynamics pass reporting events.
+  bool _wasOnGround = false;
 
   //! Position
   math::vec3d _position{0.0f};
@@ -61,10 +68,20 @@ class Simulator
 protected:
   Environment& _environment;
 
+  //! Events reported by the ticks, if any.
+  EventStream* _events = nullptr;
+
 public:
   explicit Simulator(Environment& environment) noexcept;
 
   virtual void Tick(float time) noexcept = 0;
+
+  //! Reports events of the stepped bodies to the stream, during the ticks.
+  //! @param events Event stream, null to stop reporting.
+  void SetEvents(EventStream* events) noexcept
+  {
+    _events = events;
+  }
 };
 
 //! Body dynamics simulator.
@@ -76,6 +93,15 @@ public:
 
 public:
   void Tick(float time) noexcept override;
+
+  //! Ticks bodies stored outside of the environment, in the environment's conditions.
+  //! @param bodies Contiguous bodies.
+  //! @param time Tick duration [s].
+  //! @param firstBody Index of the first body, such as the offset of a chunk, reported by events.
+  void Tick(std::span<Body> bodies, float time, size_t firstBody = 0) const noexcept;
+
+private:
+  void Step(Body& body, float time) const noexcept;
 };
 
 
@@ -88,6 +114,16 @@ public:
 
 public:
   void Tick(float time) noexcept override;
+
+  //! Ticks bodies stored outside of the environment.
+  //! @param bodies Contiguous bodies.
+  //! @param time Tick duration [s].
+  //! @param firstBody Index of the first body, such as the offset of a chunk, reported by events.
+  void Tick(std::span<Body> bodies, float time, size_t firstBody = 0) const noexcept;
+
+private:
+  void Step(Body& body, float time, size_t index) const noexcept;
+  static void Move(Body& body, float time) noexcept;
 };
 
 }// namespace sim
@@ -0,0 +1,137 @@
+//
+// Created by maros on 02.12.2023.
+//
+
+#ifndef SIM_SNAPSHOT_HPP
+#define SIM_SNAPSHOT_HPP
+
+#include "sim.hpp"
+#include "spatial.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace sim
+{
+
+//! State of a single body captured in a snapshot.
+struct BodyState
+{
+  //! Position
+  math::vec3d _position{0.0};
+  //! Velocity [m * s].
+  math::vec3d _velocity{0.0};
+};
+
+//! Immutable copy of the environment bodies at a point in simulation time.
+struct Snapshot
+{
+  using Clock = std::chrono::steady_clock;
+
+  //! Monotonic snapshot sequence number.
+  uint64_t _sequence = 0;
+  //! Simulation time of the snapshot [s].
+  double _time = 0.0;
+  //! Wall clock time at which the snapshot was published.
+  Clock::time_point _published{};
+
+  //! Body states in environment iteration order.
+  std::vector<BodyState> _bodies;
+  //! Spatial index of the body states, queried by their index.
+  SpatialIndex _index;
+
+  //! Captures and indexes the body states of the environment.
+  //! @param environment Environment to capture.
+  //! @param time Simulation time [s].
+  void Capture(const Environment& environment, double time);
+
+  //! Starts capturing body states appended by Append().
+  //! @param time Simulation time [s].
+  void Begin(double time);
+
+  //! Captures states of contiguous bodies, such as a chunk of a world.
+  //! @param bodies Bodies to capture.
+  void Append(std::span<const Body> bodies);
+
+  //! Updates the spatial index to the appended body states.
+  void Index();
+};
+
+//! Lock-free exchange of snapshots between the simulation thread (producer)
+//! and the render thread (consumer).
+//!
+//! Snapshots are triple-buffered: the producer owns a back slot, the consumer
+//! owns a front slot, and the most recently published slot sits in between and
+//! is swapped with an atomic pointer exchange. The consumer keeps one extra slot
+//! so that the two newest snapshots stay readable for interpolation.
+//! Neither side ever waits for the other.
+class SnapshotExchange
+{
+public:
+  SnapshotExchange() noexcept;
+
+  //! Producer side.
+  //! @returns Snapshot owned by the producer, safe to write into.
+  [[nodiscard]] Snapshot& Back() noexcept
+  {
+    return *_back;
+  }
+
+  //! Producer side. Stamps the back snapshot with the next sequence number and
+  //! the current time, before it's published.
+  void Stamp() noexcept;
+
+  //! Producer side. Publishes the back snapshot, as stamped, and takes over a free slot.
+  void Publish() noexcept;
+
+  //! Consumer side. Picks up the most recently published snapshot, if any.
+  //! @returns True if a newer snapshot was acquired.
+  bool Acquire() noexcept;
+
+  //! Consumer side.
+  //! @returns Newest acquired snapshot.
+  [[nodiscard]] const Snapshot& Latest() const noexcept
+  {
+    return *_latest;
+  }
+
+  //! Consumer side.
+  //! @returns Snapshot acquired before the newest one.
+  [[nodiscard]] const Snapshot& Previous() const noexcept
+  {
+    return *_previous;
+  }
+
+  //! Consumer side. Interpolates body positions between the two newest snapshots.
+  //! Rendering lags one tick behind the simulation, so that it always has a pair
+  //! of snapshots to interpolate between.
+  //! @param now Render time.
+  //! @param positions Interpolated positions, resized to the body count.
+  void Interpolate(
+    Snapshot::Clock::time_point now,
+    std::vector<math::vec3d>& positions) const;
+
+private:
+  //! Marks the shared slot as published and not yet acquired.
+  static constexpr std::uintptr_t FreshBit = 1;
+
+  std::array<Snapshot, 4> _slots;
+
+  //! Slot owned by the producer.
+  Snapshot* _back;
+  //! Sequence number of the last published snapshot.
+  uint64_t _sequence = 0;
+  //! Slot in between, tagged with FreshBit.
+  std::atomic<std::uintptr_t> _shared;
+  //! Slots owned by the consumer.
+  Snapshot* _latest;
+  Snapshot* _previous;
+};
+
+}// namespace sim
+
+#endif//SIM_SNAPSHOT_HPP
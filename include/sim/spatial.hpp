@@ -0,0 +1,211 @@
+//
+// Created by maros on 17.12.2023.
+//
+
+#ifndef SIM_SPATIAL_HPP
+#define SIM_SPATIAL_HPP
+
+#include "math.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+namespace sim
+{
+
+struct BodyState;
+
+//! Sphere query.
+struct Sphere
+{
+  math::vec3d _center{0.0};
+  //! Radius [m].
+  double _radius = 0.0;
+};
+
+//! Axis aligned box query.
+struct Box
+{
+  math::vec3d _min{0.0};
+  math::vec3d _max{0.0};
+};
+
+//! K nearest bodies query.
+struct Nearest
+{
+  math::vec3d _point{0.0};
+  //! Number of bodies to find.
+  uint32_t _count = 1;
+};
+
+//! Ray query. Bodies are hit as spheres.
+struct Ray
+{
+  math::vec3d _origin{0.0};
+  //! Normalized direction.
+  math::vec3d _direction{0.0, 0.0, 1.0};
+  //! Length of the ray [m].
+  double _length = 1000.0;
+  //! Radius the bodies are hit within [m].
+  double _radius = 0.5;
+};
+
+//! Body hit by a ray.
+struct RayHit
+{
+  //! Index of the body in the snapshot.
+  uint32_t _body = 0;
+  //! Distance along the ray [m].
+  double _distance = 0.0;
+};
+
+//! Bodies found by a batch of queries.
+struct SpatialResults
+{
+  //! Bodies of a query start at its offset and end at the next one.
+  std::vector<uint32_t> _offsets;
+  //! Indices of the bodies of all queries, in query order.
+  std::vector<uint32_t> _bodies;
+
+  //! @returns Bodies found by the query.
+  [[nodiscard]] std::span<const uint32_t> operator[](size_t query) const noexcept
+  {
+    return std::span(_bodies).subspan(
+      _offsets[query],
+      _offsets[query + 1] - _offsets[query]);
+  }
+
+  //! @returns Number of queries.
+  [[nodiscard]] size_t Size() const noexcept
+  {
+    return _offsets.empty() ? 0 : _offsets.size() - 1;
+  }
+};
+
+//! Uniform grid of body positions, answering proximity queries.
+//!
+//! Bodies are hashed into cubic cells. Updates only relink the bodies that crossed
+//! into another cell since the previous update, which for a snapshot slot reused every
+//! few ticks is a small part of the bodies. Queries only read the index, so any
+//! number of threads may query it while it isn't updated, and the batch overloads
+//! split their queries across threads.
+class SpatialIndex
+{
+public:
+  //! Default edge length of a cell [m].
+  static constexpr double DefaultCellSize = 4.0;
+  //! Smallest number of queries of a batch worth a thread.
+  static constexpr size_t MinQueriesPerThread = 256;
+
+  //! @param cellSize Edge length of a cell [m], best about the typical query radius.
+  explicit SpatialIndex(double cellSize = DefaultCellSize);
+
+  //! Updates index to the body positions.
+  //! @param bodies Bodies, indexed by their position in the span.
+  void Update(std::span<const BodyState> bodies);
+
+  //! Finds bodies within a sphere.
+  //! @param sphere Sphere.
+  //! @param results Indices of the bodies, appended.
+  void Query(const Sphere& sphere, std::vector<uint32_t>& results) const;
+
+  //! Finds bodies within a box.
+  //! @param box Box.
+  //! @param results Indices of the bodies, appended.
+  void Query(const Box& box, std::vector<uint32_t>& results) const;
+
+  //! Finds nearest bodies.
+  //! @param nearest Point and number of bodies.
+  //! @param results Indices of the bodies, appended nearest first.
+  void Query(const Nearest& nearest, std::vector<uint32_t>& results) const;
+
+  //! Finds the first body hit by a ray.
+  //! @param ray Ray.
+  //! @returns Hit, if any.
+  [[nodiscard]] std::optional<RayHit> Query(const Ray& ray) const;
+
+  //! Runs a batch of sphere queries across threads.
+  //! @param queries Queries.
+  //! @param results Bodies of every query, replaced.
+  void Query(std::span<const Sphere> queries, SpatialResults& results) const;
+
+  //! Runs a batch of box queries across threads.
+  //! @param queries Queries.
+  //! @param results Bodies of every query, replaced.
+  void Query(std::span<const Box> queries, SpatialResults& results) const;
+
+  //! Runs a batch of nearest bodies queries across threads.
+  //! @param queries Queries.
+  //! @param results Bodies of every query nearest first, replaced.
+  void Query(std::span<const Nearest> queries, SpatialResults& results) const;
+
+  //! Runs a batch of ray queries across threads.
+  //! @param queries Queries.
+  //! @param results Hit of every query, replaced.
+  void Query(std::span<const Ray> queries, std::vector<std::optional<RayHit>>& results) const;
+
+  //! @returns Number of indexed bodies.
+  [[nodiscard]] size_t Size() const noexcept
+  {
+    return _keys.size();
+  }
+
+  //! @returns Number of bodies relinked by the last update.
+  [[nodiscard]] size_t Relinked() const noexcept
+  {
+    return _relinked;
+  }
+
+private:
+  //! Coordinates of a cell.
+  struct Cell
+  {
+    int64_t _x = 0;
+    int64_t _y = 0;
+    int64_t _z = 0;
+  };
+
+  //! Bias of the cell coordinates packed into keys, which limits the extent of the grid.
+  static constexpr int64_t CellBias = int64_t(1) << 20;
+
+  [[nodiscard]] Cell CellOf(const math::vec3d& position) const noexcept;
+  [[nodiscard]] static uint64_t KeyOf(const Cell& cell) noexcept;
+  [[nodiscard]] static Cell CellOf(uint64_t key) noexcept;
+
+  //! Links body into the cell of the key.
+  void Insert(uint32_t body, uint64_t key);
+  //! Unlinks body from its cell.
+  void Remove(uint32_t body);
+
+  //! Calls function with the bodies of every non-empty cell within the inclusive range.
+  template<typename Function>
+  void ForEachCell(const Cell& min, const Cell& max, Function&& function) const;
+
+  //! Runs queries across threads, collecting their bodies.
+  template<typename QueryType>
+  void Batch(std::span<const QueryType> queries, SpatialResults& results) const;
+
+private:
+  double _cellSize;
+
+  //! Bodies of every non-empty cell.
+  std::unordered_map<uint64_t, std::vector<uint32_t>> _cells;
+  //! Positions of the bodies.
+  std::vector<math::vec3d> _positions;
+  //! Cell key of every body.
+  std::vector<uint64_t> _keys;
+  //! Row of every body in its cell.
+  std::vector<uint32_t> _rows;
+  //! Range of the non-empty cells.
+  Cell _min;
+  Cell _max;
+  size_t _relinked = 0;
+};
+
+}// namespace sim
+
+#endif//SIM_SPATIAL_HPP
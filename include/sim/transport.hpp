@@ -0,0 +1,136 @@
+//
+// Created by maros on 21.12.2023.
+//
+
+#ifndef SIM_TRANSPORT_HPP
+#define SIM_TRANSPORT_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <vector>
+
+namespace sim
+{
+
+//! Message between workers.
+using Message = std::vector<std::byte>;
+
+//! Exchanges messages between the workers of a decomposed simulation.
+//!
+//! Workers are numbered by rank. Every exchange is collective: all workers call it,
+//! each sending a message to every other worker and receiving one from each, which
+//! also keeps them in lockstep.
+class Transport
+{
+public:
+  virtual ~Transport() = default;
+
+  //! @returns Rank of this worker.
+  [[nodiscard]] virtual uint32_t Rank() const noexcept = 0;
+
+  //! @returns Number of workers.
+  [[nodiscard]] virtual uint32_t Ranks() const noexcept = 0;
+
+  //! Sends a message to every other worker and receives one from each.
+  //! @param outgoing Message of every rank, the one of this rank is ignored.
+  //! @param incoming Message from every rank, the one of this rank is left empty.
+  //! @throws std::runtime_error If a worker is gone.
+  virtual void Exchange(std::span<const Message> outgoing, std::vector<Message>& incoming) = 0;
+};
+
+//! Transport between workers running as threads of a process.
+class LocalTransport
+    : public Transport
+{
+public:
+  //! Creates connected transports of all ranks.
+  //! @param ranks Number of workers.
+  static std::vector<std::unique_ptr<LocalTransport>> Create(uint32_t ranks);
+
+  [[nodiscard]] uint32_t Rank() const noexcept override
+  {
+    return _rank;
+  }
+
+  [[nodiscard]] uint32_t Ranks() const noexcept override
+  {
+    return static_cast<uint32_t>(_hub->_mailboxes.size());
+  }
+
+  void Exchange(std::span<const Message> outgoing, std::vector<Message>& incoming) override;
+
+private:
+  //! Mailboxes shared by the transports, by sender and receiver.
+  struct Hub
+  {
+    std::mutex _mutex;
+    std::condition_variable _delivered;
+    std::vector<std::vector<std::deque<Message>>> _mailboxes;
+  };
+
+  LocalTransport(std::shared_ptr<Hub> hub, uint32_t rank) noexcept;
+
+private:
+  std::shared_ptr<Hub> _hub;
+  uint32_t _rank;
+};
+
+//! Transport between worker processes of a machine over Unix domain sockets.
+//!
+//! Every worker listens on a socket named by its rank in a shared directory, and connects
+//! to the workers of lower ranks, so that they may start in any order.
+//! Exchanges send and receive on all sockets at once, so that large messages
+//! never fill the socket buffers of two workers sending to each other.
+class SocketTransport
+    : public Transport
+{
+public:
+  //! How long to wait for the other workers to start.
+  static constexpr auto ConnectTimeout = std::chrono::seconds(10);
+
+  //! Connects to all other workers, waiting for them to start.
+  //! @param directory Directory of the sockets, shared by the workers.
+  //! @param rank Rank of this worker.
+  //! @param ranks Number of workers.
+  //! @throws std::runtime_error If the workers can't be connected.
+  SocketTransport(std::filesystem::path directory, uint32_t rank, uint32_t ranks);
+  ~SocketTransport() override;
+
+  SocketTransport(const SocketTransport&) = delete;
+  SocketTransport& operator=(const SocketTransport&) = delete;
+
+  [[nodiscard]] uint32_t Rank() const noexcept override
+  {
+    return _rank;
+  }
+
+  [[nodiscard]] uint32_t Ranks() const noexcept override
+  {
+    return static_cast<uint32_t>(_sockets.size());
+  }
+
+  void Exchange(std::span<const Message> outgoing, std::vector<Message>& incoming) override;
+
+  //! @returns Path of the socket of a rank.
+  [[nodiscard]] static std::filesystem::path SocketPath(
+    const std::filesystem::path& directory,
+    uint32_t rank);
+
+private:
+  std::filesystem::path _path;
+  uint32_t _rank;
+  int _listener = -1;
+  //! Socket connected to every other rank, -1 for this one.
+  std::vector<int> _sockets;
+};
+
+}// namespace sim
+
+#endif//SIM_TRANSPORT_HPP
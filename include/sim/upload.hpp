@@ -0,0 +1,157 @@
+//
+// Created by maros on 05.12.2023.
+//
+
+#ifndef SIM_UPLOAD_HPP
+#define SIM_UPLOAD_HPP
+
+#define VULKAN_HPP_NO_CONSTRUCTORS
+#include <vulkan/vulkan_raii.hpp>
+#include "sim/memory.hpp"
+
+#include <cstddef>
+#include <deque>
+#include <span>
+#include <vector>
+
+namespace vulkan
+{
+
+namespace vkr = vk::raii;
+
+class Renderer;
+
+//! Uploads data into device local buffers through a persistently mapped staging ring.
+//!
+//! Bulk uploads are copied on the transfer queue, which is a dedicated one when the device
+//! has it. Per-frame data is streamed through the same ring, with copies recorded into
+//! the frame's command buffer. Staged data is retired once the work reading it completes,
+//! which is polled, never waited for. When the ring runs out of space, it waits for the oldest
+//! transfer if that frees it, and otherwise grows, so that frames in flight are never stalled.
+class Uploader
+{
+public:
+  //! @param renderer Renderer with a logical device.
+  //! @param capacity Initial capacity of the staging ring [bytes].
+  Uploader(const Renderer& renderer, vk::DeviceSize capacity);
+
+  //! Stages data and queues its copy on the transfer queue.
+  //! Queued copies are submitted by submit().
+  //! @param destination Destination buffer.
+  //! @param offset Offset in the destination buffer.
+  //! @param data Data to upload.
+  void upload(
+    vk::Buffer destination,
+    vk::DeviceSize offset,
+    std::span<const std::byte> data);
+
+  //! Stages data and records its copy into the command buffer of a frame.
+  //! The caller is responsible for the barrier between the copy and the consumer.
+  //! @param commandBuffer Command buffer of the frame, outside of a render pass.
+  //! @param destination Destination buffer.
+  //! @param offset Offset in the destination buffer.
+  //! @param data Data to upload.
+  //! @param frame Serial of the frame.
+  void stream(
+    const vkr::CommandBuffer& commandBuffer,
+    vk::Buffer destination,
+    vk::DeviceSize offset,
+    std::span<const std::byte> data,
+    uint64_t frame);
+
+  //! Submits the queued copies to the transfer queue.
+  void submit();
+
+  //! Hands out semaphores of submitted transfers, which the frame must wait for.
+  //! @param frame Serial of the frame that will wait.
+  //! @returns Semaphores to wait for.
+  std::vector<vk::Semaphore> acquireWaitSemaphores(uint64_t frame);
+
+  //! Closes the staged data of a frame.
+  //! @param frame Serial of the submitted frame.
+  void endFrame(uint64_t frame);
+
+  //! Marks frames as completed, so that their staged data may be reused.
+  //! @param frame Serial of the last completed frame.
+  void retire(uint64_t frame);
+
+  //! Blocks until all submitted transfers complete. Meant for setup only.
+  void finish();
+
+private:
+  //! Staged data, retired all at once.
+  struct Batch
+  {
+    //! End of the batch in the ring.
+    vk::DeviceSize end = 0;
+    //! Frame which must complete before retiring, 0 if none.
+    uint64_t frame = 0;
+    //! Transfer of the batch, if any.
+    vkr::CommandBuffer commandBuffer { nullptr };
+    vkr::Fence fence { nullptr };
+    vkr::Semaphore semaphore { nullptr };
+    //! Whether a frame waits for the semaphore.
+    bool semaphoreAcquired = false;
+  };
+
+  //! Ring replaced by a bigger one, kept until the work reading its batches completes.
+  struct RetiredRing
+  {
+    Allocation allocation;
+    vkr::Buffer buffer { nullptr };
+    std::deque<Batch> batches;
+  };
+
+  //! Creates the staging ring.
+  //! @param capacity Capacity [bytes].
+  void ring(vk::DeviceSize capacity);
+
+  //! Allocates range in the ring, reclaiming retired batches, or growing the ring, as needed.
+  //! @returns Offset in the ring.
+  vk::DeviceSize allocate(vk::DeviceSize size);
+
+  //! Replaces the ring by one at least twice as big, retiring the current one.
+  //! @param size Size of the allocation that didn't fit [bytes].
+  void grow(vk::DeviceSize size);
+
+  //! @returns Whether the work reading the batch completed.
+  [[nodiscard]] bool completed(const Batch& batch) const;
+
+  //! Retires completed batches from the front of the ring.
+  void reclaim();
+
+  //! Closes the open batch.
+  Batch& close();
+
+private:
+  const Renderer& _renderer;
+
+  Allocation _stagingAllocation;
+  vkr::Buffer _stagingBuffer { nullptr };
+  std::byte* _staging = nullptr;
+
+  vk::DeviceSize _capacity = 0;
+  vk::DeviceSize _alignment = 16;
+  //! Next allocation offset.
+  vk::DeviceSize _head = 0;
+  //! Start of the oldest live batch.
+  vk::DeviceSize _tail = 0;
+
+  //! Allocations made since the last batch was closed.
+  size_t _openAllocations = 0;
+  //! Frame of the open batch, 0 if none.
+  uint64_t _openFrame = 0;
+  //! Last completed frame.
+  uint64_t _completedFrame = 0;
+
+  vkr::CommandPool _commandPool { nullptr };
+  //! Copies queued for the transfer queue.
+  std::vector<std::pair<vk::Buffer, vk::BufferCopy>> _queuedCopies;
+
+  std::deque<Batch> _batches;
+  std::deque<RetiredRing> _retiredRings;
+};
+
+}// namespace vulkan
+
+#endif//SIM_UPLOAD_HPP
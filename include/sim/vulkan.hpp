@@ -8,15 +8,35 @@
 #define VULKAN_HPP_NO_CONSTRUCTORS
 #include <vulkan/vulkan_raii.hpp>
 #include <GLFW/glfw3.h>
+#include <glm/gtc/quaternion.hpp>
+#include "sim/bindless.hpp"
+#include "sim/bodies.hpp"
+#include "sim/capture.hpp"
 #include "sim/engine.hpp"
-
-
+#include "sim/memory.hpp"
+#include "sim/metrics.hpp"
+#include "sim/mesh.hpp"
+#include "sim/pipelines.hpp"
+#include "sim/profiler.hpp"
+#include "sim/recording.hpp"
+#include "sim/scene.hpp"
+#include "sim/shaders.hpp"
+#include "sim/snapshot.hpp"
+#include "sim/upload.hpp"
+#include "sim/world.hpp"
+
+
+#include <chrono>
 #include <string_view>
 #include <filesystem>
+#include <span>
 #include <array>
+#include <deque>
 #include <memory>
+#include <optional>
 #include <fstream>
 #include <format>
+#include <functional>
 #include <vector>
 
 namespace vulkan
@@ -24,6 +44,20 @@ namespace vulkan
 
 namespace vkr = vk::raii;
 
+//! Frame pacing options, trading latency for throughput.
+struct PresentationOptions
+{
+  //! Frames recorded while the device works on earlier ones.
+  //! More keep the device busy, fewer keep the latency low.
+  uint32_t framesInFlight = 2;
+  //! Preferred present mode. Unsupported modes fall back to mailbox, immediate and finally FIFO,
+  //! which is always supported.
+  vk::PresentModeKHR presentMode = vk::PresentModeKHR::eFifo;
+  //! Threads recording the draws, hardware concurrency if 0. When set, draws are always
+  //! recorded on all of them, however few the batches, so that the parallel path is exercised.
+  uint32_t recordThreads = 0;
+};
+
 //! Renderer.
 class Renderer
 {
@@ -39,8 +73,45 @@ public:
   //! Setup device and queues.
   void logicalDevice();
 
+  //! Setup device memory allocator.
+  void allocator();
+
+  //! Setup staging ring and transfer queue uploads.
+  void uploads();
+
+  //! Setup pipeline cache persisted between launches.
+  void pipelineCache();
+
+  //! Setup bindless descriptors of meshes, materials and instance data.
+  void bindless();
+
   //! Setup swap chain.
-  void swapChain();
+  //! @param oldSwapChain Swap chain being replaced, if any.
+  void swapChain(vk::SwapchainKHR oldSwapChain = nullptr);
+
+  //! Resources of a replaced swap chain, kept until no frame in flight uses them.
+  struct RetiredSwapChain
+  {
+    vkr::SwapchainKHR swapChain { nullptr };
+    std::vector<vkr::ImageView> colorImageViews;
+    Allocation depthAllocation;
+    vkr::Image depthImage { nullptr };
+    vkr::ImageView depthImageView { nullptr };
+    std::vector<vkr::Framebuffer> framebuffers;
+  };
+
+  //! Recreates the swap chain and the resources sized by it, recycling the old swap chain.
+  //! Doesn't wait for the device, old resources are handed to the caller instead.
+  //! @returns Resources of the old swap chain.
+  [[nodiscard]] RetiredSwapChain recreateSwapChain();
+
+  //! @returns Whether the surface has no area, such as of a minimized window,
+  //! so that no swap chain can be created for it.
+  [[nodiscard]] bool surfaceEmpty() const;
+
+  //! Setup device images rendered to instead of a swap chain.
+  //! @param extent Size of the images.
+  void offscreenTargets(vk::Extent2D extent);
 
   //! Setup frame buffers.
   void framebuffers();
@@ -48,35 +119,108 @@ public:
   //! Setup depth buffer.
   void depthBuffer();
 
-  //! Setup uniform buffer.
+  //! Setup uniform buffer, with a range per frame in flight.
   void uniformBuffer();
 
-  //! Setup vertex buffer.
+  //! Setup vertex and index buffers of built-in meshes.
   void vertexBuffer();
 
-  //! Setup pipeline.
+  //! Uploads mesh to the device.
+  //! @param mesh Mesh to upload.
+  //! @param topology Primitive topology of the indices.
+  //! @returns Handle of the uploaded mesh.
+  uint32_t uploadMesh(
+    const mesh::Mesh& mesh,
+    vk::PrimitiveTopology topology = vk::PrimitiveTopology::eTriangleList);
+
+  //! Uploads mesh with its simplified levels of detail and a point impostor.
+  //! @param mesh Most detailed level.
+  //! @returns Handle of the uploaded chain.
+  uint32_t uploadLodChain(const mesh::Mesh& mesh);
+
+  //! Setup pipeline, reading uniforms from set 0 and bindless descriptors from set 1.
   void pipeline();
 
+  //! Setup compute pipeline culling instances against the view frustum.
+  void culling();
+
   //! Setup render pass.
   void renderPass();
 
   //! Setup shaders.
   void shaders();
 
+  //! Pipelines replaced by a reload, destroyed once no frame in flight uses them.
+  struct RetiredPipelines
+  {
+    std::vector<vkr::Pipeline> pipelines;
+  };
+
+  //! Reloads shader binaries and recreates the pipelines using them.
+  //! Keeps the previous shaders and pipelines if any binary or pipeline fails.
+  //! @returns Replaced pipelines.
+  //! @throws std::runtime_error If a binary can't be read.
+  //! @throws vk::SystemError If a pipeline can't be created.
+  [[nodiscard]] RetiredPipelines reloadShaders();
+
+  //! Loads SPIR-V shader module.
+  //! @param path Path of the shader binary.
+  //! @returns Shader module.
+  //! @throws std::runtime_error If the binary can't be read.
+  [[nodiscard]] vkr::ShaderModule shaderModule(const std::filesystem::path& path) const;
+
   //! Setup command pool and command buffers.
   void commands();
 
   //! Setup
   void setup();
 
+  //! Creates a device local buffer, filled through the uploader.
+  //! @param buffer Created buffer.
+  //! @param allocation Memory bound to the buffer.
+  //! @param size Buffer size [bytes].
+  //! @param usage Buffer usage, transfer destination is added.
+  void deviceLocalBuffer(
+    vkr::Buffer& buffer,
+    Allocation& allocation,
+    vk::DeviceSize size,
+    vk::BufferUsageFlags usage) const;
+
+  //! @returns Queue family used for graphics.
+  [[nodiscard]] uint32_t graphicsFamily() const
+  {
+    return _queueFamilyHints.graphicsFamily.value();
+  }
+
+  //! @returns Queue family used for transfers.
+  [[nodiscard]] uint32_t transferFamily() const
+  {
+    return _queueFamilyHints.transferFamily.value();
+  }
+
+  //! @returns Distinct queue families accessing uploaded buffers.
+  [[nodiscard]] std::vector<uint32_t> sharingFamilies() const;
+
+  //! @returns Whether rendering goes to offscreen images rather than to a surface.
+  [[nodiscard]] bool offscreen() const noexcept
+  {
+    return !*_surface;
+  }
+
 public:
   const vkr::Context _ctx {};
   vkr::Instance _instance { nullptr };
   vkr::PhysicalDevice _physicalDevice { nullptr };
   vkr::Device _device { nullptr };
+  std::unique_ptr<Allocator> _allocator;
+  std::unique_ptr<PipelineCache> _pipelineCache;
+  std::unique_ptr<BindlessDescriptors> _bindless;
 
   vkr::Queue _graphicsQueue { nullptr };
   vkr::Queue _presentQueue { nullptr };
+  vkr::Queue _transferQueue { nullptr };
+
+  std::unique_ptr<Uploader> _uploader;
 
   vkr::CommandPool _commandPool { nullptr };
   vkr::CommandBuffers _commandBuffers { nullptr };
@@ -84,37 +228,127 @@ public:
   vkr::Image _depthImage { nullptr };
   vk::Format _depthImageFormat {};
   vkr::ImageView _depthImageView { nullptr };
-  vkr::DeviceMemory _depthMemory { nullptr };
+  Allocation _depthAllocation;
 
-  vkr::DeviceMemory _uniformBufferMemory { nullptr };
+  Allocation _uniformAllocation;
   vkr::Buffer _uniformBuffer { nullptr };
+  //! Distance between the uniform ranges of frames in flight, selected by a dynamic offset.
+  vk::DeviceSize _uniformStride = 0;
 
   vkr::DescriptorSetLayout _uniformDescriptorLayout { nullptr };
   vkr::DescriptorPool _uniformDescriptorPool { nullptr };
   vkr::DescriptorSets _uniformDescriptorSets { nullptr };
 
-  vkr::DeviceMemory _vertexBufferMemory { nullptr };
-  vkr::Buffer _vertexBuffer { nullptr };
+  //! Mesh uploaded to the device.
+  struct GpuMesh
+  {
+    Allocation vertexAllocation;
+    vkr::Buffer vertexBuffer { nullptr };
+    Allocation indexAllocation;
+    vkr::Buffer indexBuffer { nullptr };
+    uint32_t indexCount = 0;
+    vk::IndexType indexType = vk::IndexType::eUint16;
+    //! Sphere enclosing the mesh, tested by culling.
+    mesh::Sphere bounds {};
+    //! Points are drawn by the point pipeline, triangles by the main one.
+    vk::PrimitiveTopology topology = vk::PrimitiveTopology::eTriangleList;
+    //! Bindless indices of the vertex and index buffers.
+    uint32_t vertexDescriptor = 0;
+    uint32_t indexDescriptor = 0;
+  };
+
+  std::vector<GpuMesh> _meshes;
+
+  //! Meshes of decreasing detail standing in for one mesh, selected by its size on screen.
+  struct LodChain
+  {
+    //! Mesh of every level, most detailed first.
+    std::vector<uint32_t> levels;
+    //! Smallest projected diameter every level is drawn at [pixels].
+    std::vector<float> minimumSizes;
+    //! Point drawn when smaller than the last level.
+    uint32_t impostor = 0;
+    //! Diameter of the most detailed level.
+    float diameter = 0.0f;
+
+    //! @param size Projected diameter [pixels].
+    //! @returns Mesh drawn at the size.
+    [[nodiscard]] uint32_t select(float size) const noexcept
+    {
+      for (size_t level = 0; level < levels.size(); ++level)
+      {
+        if (size >= minimumSizes[level])
+          return levels[level];
+      }
+      return impostor;
+    }
+  };
+
+  //! Grid resolution of the most detailed simplified level, halved by every next one.
+  static constexpr uint32_t LodFinestResolution = 32;
+  static constexpr uint32_t LodCoarsestResolution = 4;
+  //! Projected diameter below which bodies are drawn as points [pixels].
+  static constexpr float ImpostorSize = 4.0f;
+
+  std::vector<LodChain> _lodChains;
+  uint32_t _cubeLods = 0;
 
+  PresentationOptions _presentation {};
+
+  GLFWwindow* _window = nullptr;
   vkr::SurfaceKHR _surface { nullptr };
   vk::SurfaceCapabilitiesKHR _surfaceCapabilities {};
   vkr::SwapchainKHR _swapChain { nullptr };
-  std::vector<vkr::ImageView> _swapChainImageViews;
-  vk::Format _surfaceImageFormat {};
+  //! Present mode in use, after fallbacks.
+  vk::PresentModeKHR _presentMode = vk::PresentModeKHR::eFifo;
+
+  //! Color image rendered to when there is no swap chain.
+  struct OffscreenImage
+  {
+    Allocation allocation;
+    vkr::Image image { nullptr };
+  };
+
+  std::vector<OffscreenImage> _offscreenImages;
+
+  //! Color images rendered to, owned either by the swap chain or offscreen.
+  std::vector<vk::Image> _colorImages;
+  std::vector<vkr::ImageView> _colorImageViews;
+  vk::Format _colorImageFormat {};
+  //! Size of the color images.
+  vk::Extent2D _extent {};
   std::vector<vkr::Framebuffer> _framebuffers;
 
   vkr::RenderPass _renderPass { nullptr };
   vkr::Pipeline _pipeline { nullptr };
+  //! Draws point impostors, sharing the layout of the main pipeline.
+  vkr::Pipeline _pointPipeline { nullptr };
   vkr::PipelineLayout _pipelineLayout { nullptr };
 
   vkr::ShaderModule _fragmentShader { nullptr };
   vkr::ShaderModule _vertexShader { nullptr };
+  vkr::ShaderModule _pointVertexShader { nullptr };
+
+  vkr::DescriptorSetLayout _cullDescriptorLayout { nullptr };
+  vkr::PipelineLayout _cullPipelineLayout { nullptr };
+  vkr::Pipeline _cullPipeline { nullptr };
+  vkr::ShaderModule _cullShader { nullptr };
 
 private:
+  //! Creates views of the color images.
+  void colorImageViews();
+
+  //! Creates the mesh and point impostor pipelines from the current shaders.
+  [[nodiscard]] std::vector<vkr::Pipeline> graphicsPipelines() const;
+
+  //! Creates the culling pipeline from the current shader.
+  [[nodiscard]] vkr::Pipeline cullPipeline() const;
+
   struct QueueFamilyHints
   {
     std::optional<uint32_t> graphicsFamily;
     std::optional<uint32_t> presentFamily;
+    std::optional<uint32_t> transferFamily;
   } _queueFamilyHints;
 
 public:
@@ -136,11 +370,18 @@ public:
       throw std::runtime_error("Couldn't initialize GLFW.");
 
     glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-    glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+    glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
 
     _window = glfwCreateWindow(
       width, height, "Title", nullptr, nullptr);
 
+    // Swap chain is recreated on the next frame.
+    glfwSetWindowUserPointer(_window, this);
+    glfwSetFramebufferSizeCallback(
+      _window, [](GLFWwindow* window, int, int) {
+        static_cast<Display*>(glfwGetWindowUserPointer(window))->_resized = true;
+      });
+
     // Copy GLFW extensions
     uint32_t glfwExtensionCount = 0;
     auto glfwExtensions = glfwGetRequiredInstanceExtensions(
@@ -151,117 +392,418 @@ public:
     }
   }
 
+  //! @returns Whether the window has no area to render to, such as when minimized.
+  [[nodiscard]] bool minimized() const
+  {
+    int framebufferWidth = 0;
+    int framebufferHeight = 0;
+    glfwGetFramebufferSize(_window, &framebufferWidth, &framebufferHeight);
+    return framebufferWidth == 0 || framebufferHeight == 0;
+  }
+
 public:
   GLFWwindow* _window;
   int width = 800;
   int height = 600;
+  //! Whether the framebuffer was resized since the flag was cleared.
+  bool _resized = false;
+};
+
+
+//! Per-instance data read by the vertex shader.
+struct InstanceData
+{
+  glm::mat4x4 transform;
+};
+
+//! Per-frame data read by the shaders, written into the uniform range of the frame in flight.
+struct FrameUniforms
+{
+  //! Transformation of scene positions into Vulkan clip space.
+  glm::mat4x4 clipFromScene;
+};
+
+//! Per-draw data pushed as constants.
+struct DrawConstants
+{
+  //! Transformation of instance positions into the scene.
+  glm::mat4x4 model;
+};
+
+//! View frustum culled against.
+struct Frustum
+{
+  //! Normalized planes, pointing inside the frustum.
+  std::array<glm::vec4, 6> planes;
+
+  //! Extracts the frustum planes of a transformation.
+  //! @param clipFromWorld Transformation of instance positions into Vulkan clip space.
+  //! @returns Frustum.
+  static Frustum fromClip(const glm::mat4x4& clipFromWorld);
 };
 
+//! Contiguous range of instances drawn with one mesh.
+struct DrawBatch
+{
+  //! Largest number of instances of a batch. Instances of a mesh are split into several
+  //! batches, so that scenes of a few meshes have enough draws to record on several threads.
+  static constexpr uint32_t MaxInstances = 4096;
+
+  uint32_t mesh;
+  uint32_t firstInstance;
+  uint32_t instanceCount;
+};
+
+//! Frame read back from an offscreen image.
+struct Frame
+{
+  //! Serial of the frame, counting from 1.
+  uint64_t serial;
+  vk::Extent2D extent;
+  //! Tightly packed RGBA8 pixels, top row first.
+  std::span<const std::byte> pixels;
+};
 
-static constexpr int32_t MaxFramesInFlight = 2;
+//! Receives read back frames in order, on the render thread.
+using FrameSink = std::function<void(const Frame&)>;
 
 class InFlightRendering
 {
 public:
-  explicit InFlightRendering(const Renderer& renderer);
+  explicit InFlightRendering(Renderer& renderer);
+  ~InFlightRendering();
   /**
    * Draws frame.
+   * @param instances Instances to draw, grouped by mesh.
+   * @param batches Instance ranges drawn with one mesh each.
+   * @param uniforms Uniforms of the frame, written once the previous frame of the slot completes.
+   * @param constants Constants pushed for the draws.
+   * @param frustum View frustum, instances outside of it are culled on the device.
+   * @param inputTime Time the input affecting the frame was sampled.
+   */
+  void draw(
+    std::span<const InstanceData> instances,
+    std::span<const DrawBatch> batches,
+    const FrameUniforms& uniforms,
+    const DrawConstants& constants,
+    const Frustum& frustum,
+    std::chrono::steady_clock::time_point inputTime = std::chrono::steady_clock::now());
+
+  //! Input to photon latency of recent frames.
+  //! Measured until the device completes the frame, so the wait for the display isn't included.
+  struct LatencyStatistics
+  {
+    std::chrono::duration<double, std::milli> average {};
+    std::chrono::duration<double, std::milli> maximum {};
+    uint64_t frames = 0;
+  };
+
+  /**
+   * @returns Latency statistics since the last reset.
    */
-  void draw();
+  [[nodiscard]] LatencyStatistics latency() const noexcept;
+
+  /**
+   * Resets latency statistics.
+   */
+  void resetLatency() noexcept;
+
+  /**
+   * Sets receiver of offscreen frames.
+   * Frames are read back asynchronously and handed over once their frame slot is reused,
+   * so the sink lags one frame per frame in flight behind.
+   */
+  void setFrameSink(FrameSink sink);
+
+  /**
+   * Sets simulation of bodies resident on the device.
+   * Its ticks are recorded into every frame, and its transforms are drawn instead of the instances.
+   * @param simulation Simulation, null to draw the instances passed to draw().
+   */
+  void setBodySimulation(BodySimulation* simulation) noexcept;
+
+  /**
+   * Reloads shaders of the renderer and of the body simulation between frames.
+   * Replaced pipelines are destroyed once the frames in flight using them complete.
+   * @throws std::runtime_error If a binary can't be read, keeping the previous pipelines.
+   * @throws vk::SystemError If a pipeline can't be created, keeping the previous pipelines.
+   */
+  void reloadShaders();
+
+  /**
+   * Marks the swap chain as out of date, so that it is recreated before the next frame.
+   */
+  void invalidateSwapChain() noexcept;
+
+  /**
+   * Starts capturing rendered frames.
+   * @param options Capture options.
+   */
+  void startCapture(const CaptureOptions& options);
+
+  /**
+   * Stops capturing, once the captured frames are written.
+   */
+  void stopCapture();
+
+  /**
+   * Waits for frames in flight, hands their images to the frame sink,
+   * and their captures to the encoder.
+   */
+  void flush();
 
 private:
   /**
    * Renders image in swapchain.
+   * @param instances Instances to draw, grouped by mesh.
+   * @param batches Instance ranges drawn with one mesh each.
+   * @param uniforms Uniforms of the frame.
+   * @param frustum View frustum.
+   * @returns Whether the frame was submitted, not if there was no image to render to.
    */
-  void render();
+  bool render(
+    std::span<const InstanceData> instances,
+    std::span<const DrawBatch> batches,
+    const FrameUniforms& uniforms,
+    const Frustum& frustum);
 
   /**
    * Presents rendered image to surface.
    */
   void present();
 
-private:
-private:
-  const Renderer& _renderer;
+  /**
+   * Acquires next swap chain image, recreating the swap chain for as long as it is out of date.
+   * @returns Whether an image was acquired, not while the surface has no area.
+   */
+  bool acquire(vk::Semaphore imageAvailableSemaphore);
 
-  std::array<vkr::Semaphore, MaxFramesInFlight> _imageAvailableSemaphores
-    {
-      vkr::Semaphore { nullptr }, vkr::Semaphore { nullptr }
-    };
+  /**
+   * Recreates the swap chain, retiring the old one until the frames using it complete.
+   */
+  void recreateSwapChain();
 
-  std::array<vkr::Semaphore, MaxFramesInFlight> _imageRenderedSemaphores
-    {
-      vkr::Semaphore { nullptr }, vkr::Semaphore { nullptr }
-    };
+  /**
+   * Records culling of the instances, which compacts the visible instances of every batch
+   * and counts them in its indirect draw command.
+   * @param commandBuffer Command buffer of the frame, outside of a render pass.
+   * @param instances Buffer of the instances to draw, grouped by mesh.
+   * @param batches Instance ranges drawn with one mesh each.
+   * @param frustum View frustum.
+   * @param frame Serial of the frame.
+   */
+  void cull(
+    const vkr::CommandBuffer& commandBuffer,
+    vk::Buffer instances,
+    std::span<const DrawBatch> batches,
+    const Frustum& frustum,
+    uint64_t frame);
 
-  std::array<vkr::Fence, MaxFramesInFlight> _inFlightFences
-    {
-      vkr::Fence { nullptr }, vkr::Fence { nullptr }
-    };
+  /**
+   * Records indirect draws of the batches, with all the state they need.
+   * Called concurrently when recording in parallel.
+   * @param commandBuffer Command buffer inside the render pass.
+   * @param batches Instance ranges drawn with one mesh each.
+   * @param firstBatch Index of the first batch in the frame, selecting its draw command.
+   */
+  void recordDraws(
+    const vkr::CommandBuffer& commandBuffer,
+    std::span<const DrawBatch> batches,
+    size_t firstBatch) const;
 
-  std::array<vk::ClearValue, MaxFramesInFlight> _clearValues {};
+  /**
+   * Writes timestamp at the start of a device pass, if profiling.
+   * @returns Scope to end.
+   */
+  uint32_t beginDeviceScope(const vkr::CommandBuffer& commandBuffer, const char* name);
+
+  /**
+   * Writes timestamp at the end of a device pass, if profiling.
+   */
+  void endDeviceScope(const vkr::CommandBuffer& commandBuffer, uint32_t scope);
 
 private:
-  uint32_t _inFlightFrameIndex = 0;
-  uint32_t _currentImageIndex = 0;
-};
+  Renderer& _renderer;
 
+  //! Whether the swap chain must be recreated before the next frame.
+  bool _swapChainOutdated = false;
+  //! Replaced swap chains, with the serial of the last frame that may use them.
+  std::deque<std::pair<uint64_t, Renderer::RetiredSwapChain>> _retiredSwapChains;
+  //! Pipelines replaced by shader reloads, with the serial of the last frame that may use them.
+  std::deque<std::pair<uint64_t, Renderer::RetiredPipelines>> _retiredPipelines;
 
+  //! Number of frames in flight, the size of the per-frame arrays.
+  uint32_t _framesInFlight = 0;
 
+  std::vector<vkr::Semaphore> _imageAvailableSemaphores;
+  std::vector<vkr::Semaphore> _imageRenderedSemaphores;
+  std::vector<vkr::Fence> _inFlightFences;
 
-class Engine
-{
+  std::array<vk::ClearValue, 2> _clearValues {};
+  //! Constants pushed for the draws of the current frame.
+  DrawConstants _drawConstants {};
 
-public:
-  void run(sdk::State& state)
+  //! Device local buffer of instance data, one per frame in flight.
+  //! Streamed through the staging ring every frame.
+  struct InstanceBuffer
+  {
+    Allocation allocation;
+    vkr::Buffer buffer { nullptr };
+    //! Instances that passed culling, compacted from the first instance of their batch.
+    Allocation visibleAllocation;
+    vkr::Buffer visibleBuffer { nullptr };
+    //! Bindless index of the visible buffer, read by the vertex shaders.
+    std::optional<uint32_t> visibleDescriptor;
+    size_t capacity = 0;
+  };
+
+  std::vector<InstanceBuffer> _instanceBuffers;
+
+  //! Device local buffer of indirect draw commands, one per frame in flight.
+  //! Instance counts are filled in by culling.
+  struct IndirectBuffer
   {
-    auto& camera = state.getActiveCamera();
-    auto model = glm::mat4x4( 1.0f );
+    Allocation allocation;
+    vkr::Buffer buffer { nullptr };
+    size_t capacity = 0;
+  };
 
-    const auto view = glm::lookAt(
-      camera._position,
-      glm::vec3(0.0f, 0.0f, 0.0f),
-      glm::vec3(0.0f, -1.0f, 0.0f));
+  std::vector<IndirectBuffer> _indirectBuffers;
+  //! Draw commands of the current frame, before culling.
+  std::vector<vk::DrawIndexedIndirectCommand> _drawCommands;
 
-    const auto clip = glm::mat4x4(
-      1.0f,  0.0f, 0.0f, 0.0f,
-      0.0f, -1.0f, 0.0f, 0.0f,
-      0.0f,  0.0f, 0.5f, 0.0f,
-      0.0f,  0.0f, 0.5f, 1.0f);  // vulkan clip space has inverted y and half z !
+  vkr::DescriptorPool _cullDescriptorPool { nullptr };
+  //! Descriptor sets of culling, one per frame in flight.
+  vkr::DescriptorSets _cullDescriptorSets { nullptr };
 
-    _display.setup(_renderer);
-    _renderer.setup();
-    _renderer.surface(_display._window);
-    _renderer.physicalDevice();
-    _renderer.logicalDevice();
+  //! Host visible copy of an offscreen image, one per frame in flight.
+  struct Readback
+  {
+    Allocation allocation;
+    vkr::Buffer buffer { nullptr };
+    //! Serial of the frame copied into the buffer, 0 if none.
+    uint64_t frame = 0;
+  };
+
+  std::vector<Readback> _readbacks;
+  FrameSink _frameSink;
+
+  std::unique_ptr<FrameCapture> _capture;
+  BodySimulation* _bodySimulation = nullptr;
+
+  //! Smallest number of batches worth recording on another thread.
+  static constexpr size_t MinimumBatchesPerThread = 8;
+  //! Batches per recording thread, at least, 0 when all threads record every frame.
+  size_t _minimumBatchesPerThread = MinimumBatchesPerThread;
+  //! Records draws into secondary command buffers when the scene is large enough.
+  std::unique_ptr<ParallelRecorder> _recorder;
+  //! Timestamps of device passes, only when profiling.
+  std::unique_ptr<DeviceProfiler> _deviceProfiler;
 
-    _renderer.shaders();
+  /**
+   * Hands the read back image of a completed frame slot to the frame sink.
+   */
+  void deliver(uint32_t frameIndex);
 
-    _renderer.swapChain();
+  /**
+   * Polls fences of frames in flight, without waiting, measures latency of the completed ones,
+   * and hands completed captures to the encoder.
+   */
+  void pollCompletedFrames();
 
-    _renderer.depthBuffer();
-    _renderer.uniformBuffer();
-    _renderer.vertexBuffer();
+  /**
+   * Grows the instance buffer of the current frame to hold at least count instances.
+   * Must only be called once the frame fence is signaled.
+   */
+  void reserveInstances(size_t count);
 
-    _renderer.renderPass();
+  /**
+   * Grows the indirect buffer of the current frame to hold at least count draw commands.
+   * Must only be called once the frame fence is signaled.
+   */
+  void reserveDrawCommands(size_t count);
 
-    _renderer.framebuffers();
+private:
+  uint32_t _inFlightFrameIndex = 0;
+  uint32_t _currentImageIndex = 0;
 
-    _renderer.pipeline();
+  //! Serial of the last submitted frame.
+  uint64_t _frameSerial = 0;
+  //! Serial of the frame last submitted in each slot.
+  std::vector<uint64_t> _frameSerials;
+  //! Serial of the last frame known to be completed.
+  uint64_t _completedFrameSerial = 0;
+
+  //! Input sampling time of the frame last submitted in each slot.
+  std::vector<std::chrono::steady_clock::time_point> _inputTimes;
+  //! Whether latency of the frame last submitted in each slot is yet to be measured.
+  std::vector<bool> _latencyPending;
+
+  std::chrono::steady_clock::duration _latencySum {};
+  std::chrono::steady_clock::duration _latencyMax {};
+  uint64_t _latencyFrames = 0;
+};
 
-    _renderer.commands();
 
 
+
+//! Options of offscreen rendering.
+struct OffscreenOptions
+{
+  //! Size of the rendered frames.
+  vk::Extent2D extent { .width = 800, .height = 600 };
+  //! Number of frames to render.
+  uint64_t frameCount = 1;
+  //! Receives the rendered frames.
+  FrameSink sink;
+};
+
+class Engine
+{
+
+public:
+  //! Runs the render loop until the window is closed.
+  //! @param state Engine state.
+  //! @param snapshots Optional snapshot exchange of a concurrently running simulation.
+  void run(sdk::State& state, sim::SnapshotExchange* snapshots = nullptr)
+  {
+    _startTime = std::chrono::steady_clock::now();
+    setupRenderer(nullptr);
+
     InFlightRendering rendering(_renderer);
+    if (_captureOptions)
+      rendering.startCapture(*_captureOptions);
+    if (_deviceEnvironment)
+    {
+      _bodySimulation = std::make_unique<BodySimulation>(_renderer, *_deviceEnvironment);
+      rendering.setBodySimulation(_bodySimulation.get());
+    }
 
     float rotationY = 0;
     float rotationX = 0;
-    auto uniform = reinterpret_cast<glm::mat4x4*>(
-      _renderer._uniformBufferMemory.mapMemory(0, sizeof(glm::mat4x4)));
+
+    auto reportTime = std::chrono::steady_clock::now();
+    uint64_t reportFrames = 0;
 
     while(!glfwWindowShouldClose(_display._window))
     {
+      ProfileScope pollScope("poll");
       glfwPollEvents();
+      pollScope.end();
+      const auto inputTime = std::chrono::steady_clock::now();
+
+      if (_display._resized)
+      {
+        _display._resized = false;
+        rendering.invalidateSwapChain();
+      }
+
+      // Nothing to render to, sleep until the window is restored.
+      if (_display.minimized())
+      {
+        glfwWaitEvents();
+        continue;
+      }
 
       rotationY = 0;
       rotationX = 0;
@@ -285,13 +827,40 @@ public:
       }
 
       if (rotationY)
-        model = glm::rotate(model, rotationY, {0,1,0});
+        _scene.rotate(_sceneRoot, rotationY, {0,1,0});
       if (rotationX)
-        model = glm::rotate(model, rotationX, {1,0,0});
+        _scene.rotate(_sceneRoot, rotationX, {1,0,0});
 
-      *uniform = clip * camera._viewport._projection * view * model;
+      ProfileScope transformScope("transforms");
+      _scene.update();
+      transformScope.end();
 
-      rendering.draw();
+      if (_shaderWatcher && _shaderWatcher->rebuilt())
+        reloadShaders(rendering);
+
+      frame(rendering, state.getActiveCamera(), _scene.world(_sceneRoot), snapshots, inputTime);
+      if (_tracePath)
+        Profiler::instance().collect();
+
+      // Frame rate and latency in the window title, refreshed every second.
+      reportFrames++;
+      if (inputTime - reportTime >= std::chrono::seconds(1))
+      {
+        const auto latency = rendering.latency();
+        const auto elapsed = std::chrono::duration<double>(inputTime - reportTime);
+        auto title = std::format(
+          "sim - {:.0f} fps, input to photon {:.1f} ms (max {:.1f} ms)",
+          reportFrames / elapsed.count(),
+          latency.average.count(),
+          latency.maximum.count());
+        if (_tracePath)
+          title += " - " + Profiler::instance().summary();
+        glfwSetWindowTitle(_display._window, title.c_str());
+
+        rendering.resetLatency();
+        reportTime = inputTime;
+        reportFrames = 0;
+      }
 
       if(glfwGetKey(_display._window, GLFW_KEY_ESCAPE))
       {
@@ -299,11 +868,447 @@ public:
       }
 
     }
+
+    // Frames in flight and uploads must complete before their resources are destroyed.
+    rendering.flush();
+    rendering.stopCapture();
+    _renderer._device.waitIdle();
+    _bodySimulation.reset();
+    writeTrace();
+  }
+
+  //! Renders frames into device images, without a window or a surface.
+  //! Works with software drivers on machines without a display.
+  //! @param state Engine state.
+  //! @param options Offscreen rendering options.
+  //! @param snapshots Optional snapshot exchange of a concurrently running simulation.
+  void runOffscreen(
+    sdk::State& state,
+    const OffscreenOptions& options,
+    sim::SnapshotExchange* snapshots = nullptr)
+  {
+    _startTime = std::chrono::steady_clock::now();
+    setupRenderer(&options);
+
+    InFlightRendering rendering(_renderer);
+    rendering.setFrameSink(options.sink);
+    if (_captureOptions)
+      rendering.startCapture(*_captureOptions);
+    if (_deviceEnvironment)
+    {
+      _bodySimulation = std::make_unique<BodySimulation>(_renderer, *_deviceEnvironment);
+      rendering.setBodySimulation(_bodySimulation.get());
+    }
+
+    for (uint64_t frameIndex = 0; frameIndex < options.frameCount; ++frameIndex)
+    {
+      _scene.update();
+      frame(rendering, state.getActiveCamera(), _scene.world(_sceneRoot), snapshots, std::chrono::steady_clock::now());
+      if (_tracePath)
+        Profiler::instance().collect();
+    }
+
+    rendering.flush();
+    rendering.stopCapture();
+    _renderer._device.waitIdle();
+    _bodySimulation.reset();
+    writeTrace();
+  }
+
+  //! Sets frame pacing of the next run.
+  //! @param options Presentation options.
+  void presentation(PresentationOptions options)
+  {
+    options.framesInFlight = std::max(options.framesInFlight, 1u);
+    _renderer._presentation = options;
+  }
+
+  //! Simulates the bodies of the environment on the device during the next run,
+  //! instead of drawing snapshots of a host simulation.
+  //! @param environment Environment to simulate, must outlive the run.
+  void simulateOnDevice(const sim::Environment& environment)
+  {
+    _deviceEnvironment = &environment;
+  }
+
+  //! Ticks the bodies of the world on the render thread during the next run, and draws
+  //! its entities straight from their chunks, instead of snapshots of a concurrent simulation.
+  //! @param world World of the entities, must outlive the run.
+  //! @param environment Conditions of the bodies, must outlive the run. Its own bodies aren't simulated.
+  void simulateWorld(sdk::World& world, sim::Environment& environment)
+  {
+    _world = &world;
+    _worldDynamics.emplace(environment);
+    _worldKinematics.emplace(environment);
+    _worldTime = {};
+  }
+
+  //! Compares the device simulation with the host simulators, without a window.
+  //! @param environment Environment to simulate, left untouched.
+  //! @param ticks Number of ticks.
+  //! @returns Largest differences.
+  ParityReport checkSimulationParity(const sim::Environment& environment, uint32_t ticks)
+  {
+    const OffscreenOptions options {};
+    setupRenderer(&options);
+    const auto report = checkParity(_renderer, environment, ticks);
+    _renderer._device.waitIdle();
+    return report;
+  }
+
+  //! Recompiles shaders edited during the next run, and reloads them between frames.
+  //! @param sources Directory of the GLSL sources, the one of the source tree by default.
+  void watchShaders(std::filesystem::path sources = ShaderWatcher::defaultSources())
+  {
+    _shaderWatcher = std::make_unique<ShaderWatcher>(std::move(sources));
+  }
+
+  //! Profiles the next run, summarising it in the window title,
+  //! and writes its trace once it ends.
+  //! @param tracePath Path of the Chrome trace JSON file.
+  void profile(std::filesystem::path tracePath)
+  {
+    _tracePath = std::move(tracePath);
+    Profiler::instance().enable(true);
+  }
+
+  //! Captures rendered frames of the next run.
+  //! @param options Capture options.
+  void capture(CaptureOptions options)
+  {
+    _captureOptions = std::move(options);
+  }
+
+  //! @returns Time from the start of run() until the first frame was submitted for presentation.
+  [[nodiscard]] std::chrono::steady_clock::duration timeToFirstFrame() const noexcept
+  {
+    return _timeToFirstFrame;
+  }
+
+  //! @returns Transforms of the scene, updated once per frame.
+  [[nodiscard]] sdk::SceneGraph& scene() noexcept
+  {
+    return _scene;
+  }
+
+  //! @returns Root node of the scene, actors are placed under.
+  [[nodiscard]] sdk::TransformNode sceneRoot() const noexcept
+  {
+    return _sceneRoot;
+  }
+
+private:
+  //! Writes the trace of the run, if profiling, and prints its summary.
+  void writeTrace()
+  {
+    if (!_tracePath)
+      return;
+
+    auto& profiler = Profiler::instance();
+    profiler.collect();
+    printf("Profile: %s\n", profiler.summary().c_str());
+    profiler.writeTrace(*_tracePath);
+    printf("Trace written to '%s'.\n", _tracePath->string().c_str());
+  }
+
+  //! Reloads rebuilt shaders, keeping the previous ones if they don't load.
+  //! @param rendering Rendering of frames in flight.
+  void reloadShaders(InFlightRendering& rendering)
+  {
+    try
+    {
+      const auto start = std::chrono::steady_clock::now();
+      rendering.reloadShaders();
+      printf("Reloaded shaders in %.1f ms\n",
+             std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+    catch (const std::exception& exception)
+    {
+      printf("Couldn't reload shaders: %s\n", exception.what());
+    }
+  }
+
+  //! Sets up the renderer.
+  //! @param offscreen Offscreen options, null to render to a window.
+  void setupRenderer(const OffscreenOptions* offscreen)
+  {
+    if (!offscreen)
+      _display.setup(_renderer);
+    _renderer.setup();
+    if (!offscreen)
+      _renderer.surface(_display._window);
+    _renderer.physicalDevice();
+    _renderer.logicalDevice();
+    _renderer.allocator();
+    _renderer.uploads();
+    _renderer.pipelineCache();
+    _renderer.bindless();
+
+    _renderer.shaders();
+
+    if (offscreen)
+      _renderer.offscreenTargets(offscreen->extent);
+    else
+      _renderer.swapChain();
+
+    _renderer.depthBuffer();
+    _renderer.uniformBuffer();
+    _renderer.vertexBuffer();
+
+    _renderer.renderPass();
+
+    _renderer.framebuffers();
+
+    _renderer.culling();
+
+    _renderer.pipeline();
+
+    _renderer.commands();
+
+    printf("%s", _renderer._allocator->report().c_str());
+  }
+
+  //! Ticks the world by fixed steps up to the time, reporting its created and destroyed entities.
+  //! @param now Time of the frame.
+  void tickWorld(std::chrono::steady_clock::time_point now)
+  {
+    using Tick = std::chrono::duration<double, std::ratio<1, WorldTicksPerSecond>>;
+    const auto tickDuration = std::chrono::duration_cast<std::chrono::steady_clock::duration>(Tick(1));
+    if (_worldTime == std::chrono::steady_clock::time_point {})
+      _worldTime = now;
+
+    uint32_t ticks = 0;
+    while (_worldTime + tickDuration <= now)
+    {
+      // A stalled frame doesn't spiral into ever more ticks, the world falls behind instead.
+      if (ticks++ == MaxWorldTicksPerFrame)
+      {
+        _worldTime = now;
+        break;
+      }
+
+      _world->flush();
+      _world->eachChunk<sim::Body>([this](std::span<sim::Body> bodies) {
+        _worldDynamics->Tick(bodies, 1.0f / WorldTicksPerSecond);
+        _worldKinematics->Tick(bodies, 1.0f / WorldTicksPerSecond);
+      });
+      _worldTime += tickDuration;
+    }
+  }
+
+  //! Builds and draws a frame.
+  //! @param rendering Rendering of frames in flight.
+  //! @param camera Camera to render from.
+  //! @param model Model matrix of the scene.
+  //! @param snapshots Optional snapshot exchange of a concurrently running simulation.
+  //! @param inputTime Time the input was sampled.
+  void frame(
+    InFlightRendering& rendering,
+    const sdk::Camera& camera,
+    const glm::mat4x4& model,
+    sim::SnapshotExchange* snapshots,
+    std::chrono::steady_clock::time_point inputTime)
+  {
+    const auto view = glm::lookAt(
+      camera._position,
+      glm::vec3(0.0f, 0.0f, 0.0f),
+      glm::vec3(0.0f, -1.0f, 0.0f));
+
+    const auto clip = glm::mat4x4(
+      1.0f,  0.0f, 0.0f, 0.0f,
+      0.0f, -1.0f, 0.0f, 0.0f,
+      0.0f,  0.0f, 0.5f, 0.0f,
+      0.0f,  0.0f, 0.5f, 1.0f);  // vulkan clip space has inverted y and half z !
+
+    // Bodies of snapshots are cubes, entities of a world are drawn with the chain of their
+    // render component, both at the level of detail of their size on screen.
+    const auto& lods = _renderer._lodChains[_renderer._cubeLods];
+    const auto pixelsPerUnit = camera._viewport._projection[1][1] * 0.5f
+                               * static_cast<float>(_renderer._extent.height);
+
+    // Bodies simulated on the device are all drawn at the most detailed level,
+    // as their sizes on screen aren't known to the host.
+    if (_bodySimulation)
+    {
+      _instances.clear();
+      _batches.clear();
+      addBatches(lods.levels.front(), 0, _bodySimulation->bodyCount());
+    }
+    else
+    {
+      if (_world)
+      {
+        ProfileScope scope("world tick");
+        tickWorld(inputTime);
+      }
+      ProfileScope scope("instances");
+      buildInstances(lods, view * model, pixelsPerUnit, snapshots);
+    }
+
+    // Model is pushed per draw, the rest of the transformation is shared by the frame.
+    const FrameUniforms uniforms {
+      .clipFromScene = clip * camera._viewport._projection * view};
+    const DrawConstants constants {
+      .model = model};
+    const auto frustum = Frustum::fromClip(uniforms.clipFromScene * model);
+
+    rendering.draw(_instances, _batches, uniforms, constants, frustum, inputTime);
+
+    if (_timeToFirstFrame == std::chrono::steady_clock::duration::zero())
+    {
+      _timeToFirstFrame = std::chrono::steady_clock::now() - _startTime;
+      printf("Time to first frame: %.1f ms\n",
+             std::chrono::duration<double, std::milli>(_timeToFirstFrame).count());
+    }
+  }
+
+  //! Builds instances of the bodies, or of the entities of the world, grouped into batches
+  //! per selected level of detail.
+  //! @param lods Level of detail chain of the bodies of snapshots, and of entities
+  //!             whose render component has no valid chain.
+  //! @param viewModel View and model matrix of the scene.
+  //! @param pixelsPerUnit Projected size of a unit at unit distance [pixels].
+  //! @param snapshots Optional snapshot exchange of a concurrently running simulation.
+  void buildInstances(
+    const Renderer::LodChain& lods,
+    const glm::mat4x4& viewModel,
+    float pixelsPerUnit,
+    sim::SnapshotExchange* snapshots)
+  {
+    // Instances are bucketed by the selected mesh, so that every mesh is drawn by contiguous batches.
+    _lodInstances.resize(_renderer._meshes.size());
+    for (auto& bucket : _lodInstances)
+    {
+      bucket.clear();
+    }
+
+    const auto addChainInstance = [&](const Renderer::LodChain& chain, const glm::mat4x4& transform) {
+      const auto distance = glm::length(glm::vec3(viewModel * transform[3]));
+      const auto size = chain.diameter * pixelsPerUnit / std::max(distance, 1e-3f);
+      _lodInstances[chain.select(size)].push_back(InstanceData {
+        .transform = transform});
+    };
+    const auto addInstance = [&](const glm::mat4x4& transform) {
+      addChainInstance(lods, transform);
+    };
+    const auto chainOf = [&](const sdk::Render& render) -> const Renderer::LodChain& {
+      return render.lods < _renderer._lodChains.size() ? _renderer._lodChains[render.lods] : lods;
+    };
+
+    // Entities of the world are read straight from its chunks, which the render thread ticks.
+    if (_world)
+    {
+      _world->eachChunk<sim::Body, sdk::Render>(
+        [&](std::span<sim::Body> bodies, std::span<sdk::Render> renders) {
+          for (size_t row = 0; row < bodies.size(); ++row)
+          {
+            const auto& position = bodies[row]._position;
+            addChainInstance(chainOf(renders[row]), glm::translate(glm::mat4x4( 1.0f ), glm::vec3(
+              position._right, position._up, position._forward)));
+          }
+        });
+      _world->eachChunk<sdk::Transform, sdk::Render>(
+        [&](std::span<sdk::Transform> transforms, std::span<sdk::Render> renders) {
+          for (size_t row = 0; row < transforms.size(); ++row)
+          {
+            const auto& transform = transforms[row];
+            addChainInstance(
+              chainOf(renders[row]),
+              glm::translate(glm::mat4x4( 1.0f ), transform.position)
+                * glm::mat4_cast(glm::quat(transform.rotation))
+                * glm::scale(glm::mat4x4( 1.0f ), transform.scale));
+          }
+        });
+    }
+    // Pick up the latest simulation state, never waiting for the simulation,
+    // and build one instance per body.
+    else if (snapshots)
+    {
+      snapshots->Acquire();
+      snapshots->Interpolate(sim::Snapshot::Clock::now(), _bodyPositions);
+
+      for (const auto& position : _bodyPositions)
+      {
+        addInstance(glm::translate(glm::mat4x4( 1.0f ), glm::vec3(
+          position._right, position._up, position._forward)));
+      }
+    }
+    else
+    {
+      addInstance(glm::mat4x4( 1.0f ));
+    }
+
+    _instances.clear();
+    _batches.clear();
+    for (uint32_t mesh = 0; mesh < _lodInstances.size(); ++mesh)
+    {
+      const auto& bucket = _lodInstances[mesh];
+      if (bucket.empty())
+        continue;
+
+      addBatches(
+        mesh,
+        static_cast<uint32_t>(_instances.size()),
+        static_cast<uint32_t>(bucket.size()));
+      _instances.insert(_instances.end(), bucket.begin(), bucket.end());
+    }
+  }
+
+  //! Adds batches drawing a range of instances with a mesh, of DrawBatch::MaxInstances at most.
+  //! @param mesh Mesh of the instances.
+  //! @param firstInstance First instance of the range.
+  //! @param instanceCount Number of instances of the range.
+  void addBatches(uint32_t mesh, uint32_t firstInstance, uint32_t instanceCount)
+  {
+    for (uint32_t offset = 0; offset < instanceCount; offset += DrawBatch::MaxInstances)
+    {
+      _batches.push_back(DrawBatch {
+        .mesh = mesh,
+        .firstInstance = firstInstance + offset,
+        .instanceCount = std::min(instanceCount - offset, DrawBatch::MaxInstances)});
+    }
   }
 
 private:
   Renderer _renderer;
   Display _display;
+
+  std::optional<CaptureOptions> _captureOptions;
+  //! Trace written by a profiled run.
+  std::optional<std::filesystem::path> _tracePath;
+
+  //! Transforms of the scene, rotated as a whole by the arrow keys.
+  sdk::SceneGraph _scene;
+  const sdk::TransformNode _sceneRoot = _scene.create();
+
+  std::chrono::steady_clock::time_point _startTime {};
+  std::chrono::steady_clock::duration _timeToFirstFrame {};
+
+  //! Interpolated body positions of the current frame.
+  std::vector<math::vec3d> _bodyPositions;
+  //! Instances of the current frame, grouped by mesh.
+  std::vector<InstanceData> _instances;
+  //! Batches of the current frame.
+  std::vector<DrawBatch> _batches;
+  //! Instances of the current frame, by the mesh their level of detail selects.
+  std::vector<std::vector<InstanceData>> _lodInstances;
+
+  //! Ticks of the world per second.
+  static constexpr int WorldTicksPerSecond = 128;
+  //! Most ticks of the world per frame.
+  static constexpr uint32_t MaxWorldTicksPerFrame = 8;
+  //! World ticked and drawn by the run, if any.
+  sdk::World* _world = nullptr;
+  std::optional<sim::BodyDynamicsSimulator> _worldDynamics;
+  std::optional<sim::BodyKinematicsSimulator> _worldKinematics;
+  //! Time the world was ticked up to.
+  std::chrono::steady_clock::time_point _worldTime {};
+
+  //! Environment simulated on the device, if any.
+  const sim::Environment* _deviceEnvironment = nullptr;
+  std::unique_ptr<BodySimulation> _bodySimulation;
+  //! Recompiles edited shaders, if watching.
+  std::unique_ptr<ShaderWatcher> _shaderWatcher;
 };
 
 } // namespace vulkan
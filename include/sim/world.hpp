@@ -0,0 +1,376 @@
+//
+// Created by maros on 15.12.2023.
+//
+
+#ifndef SIM_WORLD_HPP
+#define SIM_WORLD_HPP
+
+#include "sim/engine.hpp"
+#include "sim/sim.hpp"
+
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <bitset>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+namespace sdk
+{
+
+//! Handle of an entity, stale once the entity is destroyed.
+struct Entity
+{
+  uint32_t index = 0;
+  uint32_t generation = 0;
+
+  bool operator==(const Entity&) const = default;
+};
+
+//! Transform component of entities placed in the scene without a body.
+//! Bodies are placed by their simulated position.
+struct Transform
+{
+  glm::vec3 position { 0.0f };
+  //! Euler angles [rad].
+  glm::vec3 rotation { 0.0f };
+  glm::vec3 scale { 1.0f };
+};
+
+//! Render component, of the entities drawn by the renderer.
+struct Render
+{
+  //! Level of detail chain the entity is drawn with, the cube's is the first.
+  uint32_t lods = 0;
+};
+
+//! Entity component store grouping entities by their set of components, their archetype.
+//!
+//! Components of an archetype are stored column by column in chunks of contiguous arrays,
+//! so that systems iterate them without indirection, a chunk at a time. Bodies are
+//! the physics components, ticked in place by the simulators.
+//!
+//! Creation and destruction are reported to handlers in batches by flush(),
+//! instead of a virtual call per actor. Destroyed entities stay accessible until then.
+class World
+{
+public:
+  //! Receives a batch of created or destroyed entities.
+  using EventHandler = std::function<void(World& world, std::span<const Entity> entities)>;
+
+  //! Number of entities in a chunk.
+  static constexpr size_t ChunkCapacity = 1024;
+  //! Number of distinct component types.
+  static constexpr size_t MaxComponents = 64;
+
+  World();
+  ~World();
+
+  World(const World&) = delete;
+  World& operator=(const World&) = delete;
+
+  //! Creates entity.
+  //! @param components Components of the entity, of distinct types.
+  //! @returns Entity, reported to the create handlers by the next flush.
+  template<typename... Components>
+  Entity create(Components&&... components);
+
+  //! Creates entity of an actor simulated as a body.
+  //! @param actor Actor placing the body.
+  //! @param body Body, moved to the actor position.
+  //! @param render Render component.
+  //! @returns Entity.
+  Entity spawn(const Actor& actor, sim::Body body, Render render = {});
+
+  //! Creates entity of an actor placed in the scene without a body.
+  //! @param actor Actor whose position and rotation the entity takes.
+  //! @param render Render component.
+  //! @returns Entity.
+  Entity spawn(const Actor& actor, Render render = {});
+
+  //! Destroys entity at the next flush, after reporting it to the destroy handlers.
+  //! @param entity Entity, ignored if already destroyed.
+  void destroy(Entity entity);
+
+  //! @returns Whether the entity exists.
+  [[nodiscard]] bool alive(Entity entity) const noexcept;
+
+  //! @returns Component of the entity, or null if it has none.
+  template<typename Component>
+  [[nodiscard]] Component* get(Entity entity);
+
+  //! Calls function with spans of the components of every chunk having all of them.
+  //! @param function Function taking a std::span per component.
+  template<typename... Components, typename Function>
+  void eachChunk(Function&& function);
+
+  //! Calls function with the components of every entity having all of them.
+  //! @param function Function taking a reference per component.
+  template<typename... Components, typename Function>
+  void each(Function&& function);
+
+  //! Adds handler of created entities.
+  void onCreate(EventHandler handler);
+
+  //! Adds handler of destroyed entities.
+  void onDestroy(EventHandler handler);
+
+  //! Reports created and destroyed entities to the handlers, and removes the destroyed ones.
+  //! Entities created or destroyed by the handlers are reported by the next flush.
+  void flush();
+
+  //! @returns Number of entities.
+  [[nodiscard]] size_t size() const noexcept
+  {
+    return _records.size() - _freeIndices.size();
+  }
+
+private:
+  using Signature = std::bitset<MaxComponents>;
+
+  //! Row of an entity.
+  struct Location
+  {
+    uint32_t chunk = 0;
+    uint32_t row = 0;
+  };
+
+  //! Storage of the entities of one archetype.
+  class Archetype
+  {
+  public:
+    explicit Archetype(Signature signature) noexcept
+      : signature(signature)
+    {}
+
+    virtual ~Archetype() = default;
+
+    //! Appends entity with default constructed components.
+    virtual Location allocate(Entity entity) = 0;
+
+    //! Removes entity, moving the last entity of the archetype into its row.
+    //! @returns Moved entity, if any.
+    virtual std::optional<Entity> remove(Location location) = 0;
+
+    //! @returns Component array of a chunk, or null if the archetype doesn't have the component.
+    virtual void* column(uint32_t component, size_t chunk) noexcept = 0;
+
+    [[nodiscard]] virtual size_t chunkCount() const noexcept = 0;
+    [[nodiscard]] virtual size_t chunkSize(size_t chunk) const noexcept = 0;
+
+  public:
+    const Signature signature;
+  };
+
+  //! Archetype of a set of component types.
+  template<typename... Components>
+  class Table;
+
+  //! Location and archetype of an entity index.
+  struct Record
+  {
+    uint32_t generation = 0;
+    //! Archetype of the entity, null if the index is free.
+    Archetype* archetype = nullptr;
+    Location location;
+    //! Whether the entity is destroyed by the next flush.
+    bool destroying = false;
+  };
+
+  //! @returns Identifier of a component type.
+  //! @throws std::runtime_error If there are more than MaxComponents types.
+  template<typename Component>
+  static uint32_t componentId()
+  {
+    static const uint32_t id = nextComponentId();
+    return id;
+  }
+
+  //! @returns Identifier of a new component type.
+  //! @throws std::runtime_error If there are more than MaxComponents types.
+  static uint32_t nextComponentId();
+
+  //! @returns Archetype of the signature, or null.
+  Archetype* find(Signature signature) const noexcept;
+
+  //! @returns New entity handle.
+  Entity allocateEntity();
+
+  //! Removes entity from its archetype and frees its index.
+  void erase(Entity entity);
+
+private:
+  static inline std::atomic<uint32_t> _nextComponentId = 0;
+
+  std::vector<Record> _records;
+  std::vector<uint32_t> _freeIndices;
+  std::vector<std::unique_ptr<Archetype>> _archetypes;
+
+  std::vector<Entity> _created;
+  std::vector<Entity> _destroyed;
+  std::vector<EventHandler> _createHandlers;
+  std::vector<EventHandler> _destroyHandlers;
+};
+
+template<typename... Components>
+class World::Table final
+  : public World::Archetype
+{
+public:
+  using Archetype::Archetype;
+
+  Location allocate(Entity entity) override
+  {
+    if (_chunks.empty() || _chunks.back().entities.size() == ChunkCapacity)
+    {
+      // Columns never grow past the capacity, so spans of a chunk stay valid while iterating.
+      auto& chunk = _chunks.emplace_back();
+      chunk.entities.reserve(ChunkCapacity);
+      std::apply([](auto&... columns) { (columns.reserve(ChunkCapacity), ...); }, chunk.columns);
+    }
+
+    auto& chunk = _chunks.back();
+    chunk.entities.push_back(entity);
+    std::apply([](auto&... columns) { (columns.emplace_back(), ...); }, chunk.columns);
+    return Location {
+      .chunk = static_cast<uint32_t>(_chunks.size() - 1),
+      .row = static_cast<uint32_t>(chunk.entities.size() - 1)};
+  }
+
+  std::optional<Entity> remove(Location location) override
+  {
+    auto& last = _chunks.back();
+    auto& chunk = _chunks[location.chunk];
+    const auto lastRow = last.entities.size() - 1;
+
+    // Chunks stay dense, the hole is filled with the last entity.
+    std::optional<Entity> moved;
+    if (&chunk != &last || location.row != lastRow)
+    {
+      moved = last.entities[lastRow];
+      chunk.entities[location.row] = last.entities[lastRow];
+      ((std::get<std::vector<Components>>(chunk.columns)[location.row]
+          = std::move(std::get<std::vector<Components>>(last.columns)[lastRow])), ...);
+    }
+
+    last.entities.pop_back();
+    std::apply([](auto&... columns) { (columns.pop_back(), ...); }, last.columns);
+    if (last.entities.empty())
+      _chunks.pop_back();
+    return moved;
+  }
+
+  void* column(uint32_t component, size_t chunk) noexcept override
+  {
+    void* data = nullptr;
+    ((component == componentId<Components>()
+        ? data = std::get<std::vector<Components>>(_chunks[chunk].columns).data()
+        : nullptr), ...);
+    return data;
+  }
+
+  [[nodiscard]] size_t chunkCount() const noexcept override
+  {
+    return _chunks.size();
+  }
+
+  [[nodiscard]] size_t chunkSize(size_t chunk) const noexcept override
+  {
+    return _chunks[chunk].entities.size();
+  }
+
+private:
+  struct Chunk
+  {
+    std::vector<Entity> entities;
+    std::tuple<std::vector<Components>...> columns;
+  };
+
+  std::vector<Chunk> _chunks;
+};
+
+template<typename... Components>
+Entity World::create(Components&&... components)
+{
+  static_assert(sizeof...(Components) > 0, "Entity needs a component");
+
+  Signature signature;
+  (signature.set(componentId<std::decay_t<Components>>()), ...);
+
+  auto* archetype = find(signature);
+  if (!archetype)
+  {
+    archetype = _archetypes.emplace_back(
+      std::make_unique<Table<std::decay_t<Components>...>>(signature)).get();
+  }
+
+  const auto entity = allocateEntity();
+  const auto location = archetype->allocate(entity);
+  ((static_cast<std::decay_t<Components>*>(
+      archetype->column(componentId<std::decay_t<Components>>(), location.chunk))[location.row]
+      = std::forward<Components>(components)), ...);
+
+  _records[entity.index] = Record {
+    .generation = entity.generation,
+    .archetype = archetype,
+    .location = location};
+  _created.push_back(entity);
+  return entity;
+}
+
+template<typename Component>
+Component* World::get(Entity entity)
+{
+  if (!alive(entity))
+    return nullptr;
+
+  const auto& record = _records[entity.index];
+  auto* column = static_cast<Component*>(
+    record.archetype->column(componentId<Component>(), record.location.chunk));
+  return column ? column + record.location.row : nullptr;
+}
+
+template<typename... Components, typename Function>
+void World::eachChunk(Function&& function)
+{
+  Signature query;
+  (query.set(componentId<Components>()), ...);
+
+  for (const auto& archetype : _archetypes)
+  {
+    if ((archetype->signature & query) != query)
+      continue;
+
+    for (size_t chunk = 0; chunk < archetype->chunkCount(); ++chunk)
+    {
+      const auto size = archetype->chunkSize(chunk);
+      function(std::span<Components>(
+        static_cast<Components*>(archetype->column(componentId<Components>(), chunk)),
+        size)...);
+    }
+  }
+}
+
+template<typename... Components, typename Function>
+void World::each(Function&& function)
+{
+  static_assert(sizeof...(Components) > 0, "Query needs a component");
+
+  eachChunk<Components...>([&](std::span<Components>... columns) {
+    const auto size = std::get<0>(std::forward_as_tuple(columns...)).size();
+    for (size_t row = 0; row < size; ++row)
+    {
+      function(columns[row]...);
+    }
+  });
+}
+
+}// namespace sdk
+
+#endif//SIM_WORLD_HPP
@@ -1,17 +1,33 @@
-#version 400
+#version 450
 
 #extension GL_ARB_separate_shader_objects : enable
 #extension GL_ARB_shading_language_420pack : enable
+#extension GL_EXT_nonuniform_qualifier : require
 
-layout (std140, set = 0, binding = 0) uniform buf {
-    mat4 mvp;
-} ubuf;
+// Uniforms of the frame, at the dynamic offset of its frame in flight.
+layout (std140, set = 0, binding = 0) uniform Frame {
+    mat4 clipFromScene;
+} frame;
+
+// Bindless storage buffers, the draw selects the one holding its instances.
+layout (std430, set = 1, binding = 0) readonly buffer Instances {
+    mat4 transforms[];
+} instances[];
+
+layout (push_constant) uniform Draw {
+    mat4 model;
+    // Bindless index of the visible instances, and the first one of the batch.
+    uint instanceBuffer;
+    uint firstInstance;
+} draw;
 
 layout (location = 0) in vec3 pos;
 //layout (location = 1) in vec3 inColor;
 //layout (location = 0) out vec3 outColor;
 
 void main() {
+    const mat4 instanceTransform
+        = instances[draw.instanceBuffer].transforms[draw.firstInstance + gl_InstanceIndex];
 //    outColor = inColor;
-    gl_Position = ubuf.mvp * vec4(pos, 1.0);
-}
\ No newline at end of file
+    gl_Position = frame.clipFromScene * draw.model * instanceTransform * vec4(pos, 1.0);
+}
@@ -0,0 +1,35 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+#extension GL_EXT_nonuniform_qualifier : require
+
+// Impostor of bodies only a few pixels large, drawn as a single point each.
+
+layout (constant_id = 0) const float pointSize = 1.0;
+
+// Uniforms of the frame, at the dynamic offset of its frame in flight.
+layout (std140, set = 0, binding = 0) uniform Frame {
+    mat4 clipFromScene;
+} frame;
+
+// Bindless storage buffers, the draw selects the one holding its instances.
+layout (std430, set = 1, binding = 0) readonly buffer Instances {
+    mat4 transforms[];
+} instances[];
+
+layout (push_constant) uniform Draw {
+    mat4 model;
+    // Bindless index of the visible instances, and the first one of the batch.
+    uint instanceBuffer;
+    uint firstInstance;
+} draw;
+
+layout (location = 0) in vec3 pos;
+
+void main() {
+    const mat4 instanceTransform
+        = instances[draw.instanceBuffer].transforms[draw.firstInstance + gl_InstanceIndex];
+    gl_Position = frame.clipFromScene * draw.model * instanceTransform * vec4(pos, 1.0);
+    gl_PointSize = pointSize;
+}
@@ -0,0 +1,237 @@
+//
+// Created by maros on 14.12.2023.
+//
+
+#include "sim/bindless.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <format>
+#include <stdexcept>
+
+namespace vulkan
+{
+
+bool BindlessDescriptors::supported(const vkr::PhysicalDevice& physicalDevice)
+{
+  const auto extensions = physicalDevice.enumerateDeviceExtensionProperties();
+  const bool extension = std::ranges::any_of(extensions, [](const auto& properties) {
+    return std::string_view(properties.extensionName.data()) == VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME; });
+  if (!extension)
+    return false;
+
+  const auto features = physicalDevice.getFeatures2<
+    vk::PhysicalDeviceFeatures2,
+    vk::PhysicalDeviceDescriptorIndexingFeaturesEXT>().get<vk::PhysicalDeviceDescriptorIndexingFeaturesEXT>();
+  return features.runtimeDescriptorArray
+         && features.descriptorBindingPartiallyBound
+         && features.descriptorBindingUpdateUnusedWhilePending
+         && features.descriptorBindingStorageBufferUpdateAfterBind
+         && features.descriptorBindingSampledImageUpdateAfterBind;
+}
+
+vk::PhysicalDeviceDescriptorIndexingFeaturesEXT BindlessDescriptors::requiredFeatures() noexcept
+{
+  return vk::PhysicalDeviceDescriptorIndexingFeaturesEXT {
+    .descriptorBindingSampledImageUpdateAfterBind = true,
+    .descriptorBindingStorageBufferUpdateAfterBind = true,
+    .descriptorBindingUpdateUnusedWhilePending = true,
+    .descriptorBindingPartiallyBound = true,
+    .runtimeDescriptorArray = true};
+}
+
+BindlessDescriptors::BindlessDescriptors(
+  const vkr::PhysicalDevice& physicalDevice,
+  const vkr::Device& device)
+  : _device(device)
+{
+  // Arrays are sized by the device limits, images get the resources buffers leave.
+  const auto limits = physicalDevice.getProperties2<
+    vk::PhysicalDeviceProperties2,
+    vk::PhysicalDeviceDescriptorIndexingPropertiesEXT>().get<vk::PhysicalDeviceDescriptorIndexingPropertiesEXT>();
+  _buffers.capacity = std::min({
+    MaxBuffers,
+    limits.maxPerStageDescriptorUpdateAfterBindStorageBuffers,
+    limits.maxDescriptorSetUpdateAfterBindStorageBuffers,
+    limits.maxPerStageUpdateAfterBindResources / 2});
+  _images.capacity = std::min({
+    MaxImages,
+    limits.maxPerStageDescriptorUpdateAfterBindSampledImages,
+    limits.maxPerStageDescriptorUpdateAfterBindSamplers,
+    limits.maxDescriptorSetUpdateAfterBindSampledImages,
+    limits.maxDescriptorSetUpdateAfterBindSamplers,
+    limits.maxPerStageUpdateAfterBindResources - _buffers.capacity});
+
+  const auto stages = vk::ShaderStageFlagBits::eVertex
+                      | vk::ShaderStageFlagBits::eFragment
+                      | vk::ShaderStageFlagBits::eCompute;
+  const std::array bindings {
+    vk::DescriptorSetLayoutBinding {
+      .binding = BufferBinding,
+      .descriptorType = vk::DescriptorType::eStorageBuffer,
+      .descriptorCount = _buffers.capacity,
+      .stageFlags = stages},
+    vk::DescriptorSetLayoutBinding {
+      .binding = ImageBinding,
+      .descriptorType = vk::DescriptorType::eCombinedImageSampler,
+      .descriptorCount = _images.capacity,
+      .stageFlags = stages}};
+
+  // Unregistered indices are never accessed, so the arrays may have holes.
+  const auto bindingFlag = vk::DescriptorBindingFlagBitsEXT::eUpdateAfterBind
+                           | vk::DescriptorBindingFlagBitsEXT::eUpdateUnusedWhilePending
+                           | vk::DescriptorBindingFlagBitsEXT::ePartiallyBound;
+  const std::array<vk::DescriptorBindingFlagsEXT, 2> bindingFlags {bindingFlag, bindingFlag};
+  const vk::DescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsCreateInfo {
+    .bindingCount = static_cast<uint32_t>(bindingFlags.size()),
+    .pBindingFlags = bindingFlags.data()};
+
+  _layout = vkr::DescriptorSetLayout(
+    _device,
+    vk::DescriptorSetLayoutCreateInfo {
+      .pNext = &bindingFlagsCreateInfo,
+      .flags = vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPoolEXT,
+      .bindingCount = static_cast<uint32_t>(bindings.size()),
+      .pBindings = bindings.data()});
+
+  const std::array poolSizes {
+    vk::DescriptorPoolSize {
+      .type = vk::DescriptorType::eStorageBuffer,
+      .descriptorCount = _buffers.capacity},
+    vk::DescriptorPoolSize {
+      .type = vk::DescriptorType::eCombinedImageSampler,
+      .descriptorCount = _images.capacity}};
+
+  _pool = vkr::DescriptorPool(
+    _device,
+    vk::DescriptorPoolCreateInfo {
+      .flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet
+               | vk::DescriptorPoolCreateFlagBits::eUpdateAfterBindEXT,
+      .maxSets = 1,
+      .poolSizeCount = static_cast<uint32_t>(poolSizes.size()),
+      .pPoolSizes = poolSizes.data()});
+
+  _sets = vkr::DescriptorSets(
+    _device,
+    vk::DescriptorSetAllocateInfo {
+      .descriptorPool = *_pool,
+      .descriptorSetCount = 1,
+      .pSetLayouts = &(*_layout)});
+
+  printf("Bindless descriptors: %u buffers, %u images\n", _buffers.capacity, _images.capacity);
+}
+
+uint32_t BindlessDescriptors::Slots::acquire(std::string_view kind)
+{
+  if (!released.empty())
+  {
+    const auto index = released.back();
+    released.pop_back();
+    return index;
+  }
+
+  if (used == capacity)
+    throw std::runtime_error(std::format("Bindless {} array is full ({})", kind, capacity));
+  return used++;
+}
+
+uint32_t BindlessDescriptors::addBuffer(
+  vk::Buffer buffer,
+  vk::DeviceSize offset,
+  vk::DeviceSize range)
+{
+  std::scoped_lock lock(_mutex);
+  const auto index = _buffers.acquire("buffer");
+  writeBuffer(index, buffer, offset, range);
+  return index;
+}
+
+void BindlessDescriptors::updateBuffer(
+  uint32_t index,
+  vk::Buffer buffer,
+  vk::DeviceSize offset,
+  vk::DeviceSize range)
+{
+  std::scoped_lock lock(_mutex);
+  writeBuffer(index, buffer, offset, range);
+}
+
+void BindlessDescriptors::releaseBuffer(uint32_t index)
+{
+  std::scoped_lock lock(_mutex);
+  _buffers.released.push_back(index);
+}
+
+uint32_t BindlessDescriptors::addImage(
+  vk::ImageView imageView,
+  vk::Sampler sampler,
+  vk::ImageLayout layout)
+{
+  std::scoped_lock lock(_mutex);
+  const auto index = _images.acquire("image");
+  writeImage(index, imageView, sampler, layout);
+  return index;
+}
+
+void BindlessDescriptors::updateImage(
+  uint32_t index,
+  vk::ImageView imageView,
+  vk::Sampler sampler,
+  vk::ImageLayout layout)
+{
+  std::scoped_lock lock(_mutex);
+  writeImage(index, imageView, sampler, layout);
+}
+
+void BindlessDescriptors::releaseImage(uint32_t index)
+{
+  std::scoped_lock lock(_mutex);
+  _images.released.push_back(index);
+}
+
+void BindlessDescriptors::writeBuffer(
+  uint32_t index,
+  vk::Buffer buffer,
+  vk::DeviceSize offset,
+  vk::DeviceSize range)
+{
+  const vk::DescriptorBufferInfo bufferInfo {
+    .buffer = buffer,
+    .offset = offset,
+    .range = range};
+
+  _device.updateDescriptorSets(
+    vk::WriteDescriptorSet {
+      .dstSet = set(),
+      .dstBinding = BufferBinding,
+      .dstArrayElement = index,
+      .descriptorCount = 1,
+      .descriptorType = vk::DescriptorType::eStorageBuffer,
+      .pBufferInfo = &bufferInfo},
+    nullptr);
+}
+
+void BindlessDescriptors::writeImage(
+  uint32_t index,
+  vk::ImageView imageView,
+  vk::Sampler sampler,
+  vk::ImageLayout layout)
+{
+  const vk::DescriptorImageInfo imageInfo {
+    .sampler = sampler,
+    .imageView = imageView,
+    .imageLayout = layout};
+
+  _device.updateDescriptorSets(
+    vk::WriteDescriptorSet {
+      .dstSet = set(),
+      .dstBinding = ImageBinding,
+      .dstArrayElement = index,
+      .descriptorCount = 1,
+      .descriptorType = vk::DescriptorType::eCombinedImageSampler,
+      .pImageInfo = &imageInfo},
+    nullptr);
+}
+
+}// namespace vulkan
@@ -0,0 +1,471 @@
+//
+// Created by maros on 12.12.2023.
+//
+
+#include "sim/bodies.hpp"
+#include "sim/vulkan.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <format>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace
+{
+
+//! Workgroup size of the body shader.
+constexpr uint32_t BodyWorkgroupSize = 64;
+
+//! Largest upload handed to the staging ring at once [bytes].
+constexpr size_t UploadChunkSize = 8 * 1024 * 1024;
+
+//! Body state as laid out in the storage buffer.
+struct GpuBody
+{
+  //! Position and weight.
+  glm::vec4 position;
+  //! Velocity and whether the body is on ground.
+  glm::vec4 velocity;
+  glm::vec4 acceleration;
+  //! Impulse forces and their remaining time, unused ones have no time left.
+  std::array<glm::vec4, vulkan::BodySimulation::MaxImpulses> impulses;
+};
+
+//! Push constants of the body shader.
+struct TickConstants
+{
+  glm::vec4 gravity;
+  glm::vec4 wind;
+  float step;
+  uint32_t bodyCount;
+};
+
+glm::vec4 toVec4(const math::vec3d& vector, float w = 0.0f)
+{
+  return {
+    static_cast<float>(vector._right),
+    static_cast<float>(vector._up),
+    static_cast<float>(vector._forward),
+    w};
+}
+
+math::vec3d toVec3d(const glm::vec4& vector)
+{
+  return {vector.x, vector.y, vector.z};
+}
+
+//! @returns Difference of the vectors, relative to the magnitude of the expected one when above one.
+double difference(const math::vec3d& actual, const math::vec3d& expected)
+{
+  const auto delta = actual - expected;
+  const auto magnitude = std::sqrt(
+    expected._right * expected._right
+    + expected._up * expected._up
+    + expected._forward * expected._forward);
+  return std::sqrt(
+           delta._right * delta._right
+           + delta._up * delta._up
+           + delta._forward * delta._forward)
+         / std::max(magnitude, 1.0);
+}
+
+}// namespace
+
+namespace vulkan
+{
+
+BodySimulation::BodySimulation(
+  const Renderer& renderer,
+  const sim::Environment& environment,
+  uint32_t ticksPerSecond)
+    : _renderer(renderer)
+    , _bodyCount(static_cast<uint32_t>(environment._bodies.size()))
+    , _step(1.0f / static_cast<float>(ticksPerSecond))
+    , _tickDuration(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(1.0 / ticksPerSecond)))
+    , _gravity(toVec4(environment._gravity))
+    , _wind(toVec4(environment._wind))
+{
+  const auto& device = _renderer._device;
+
+  std::vector<GpuBody> bodies;
+  std::vector<InstanceData> transforms;
+  bodies.reserve(_bodyCount);
+  transforms.reserve(_bodyCount);
+  for (const auto& body : environment._bodies)
+  {
+    if (body._impulseForces.size() > MaxImpulses)
+      throw std::runtime_error(std::format(
+        "Body has {} impulse forces, device simulation supports at most {}",
+        body._impulseForces.size(), MaxImpulses));
+
+    auto& gpuBody = bodies.emplace_back(GpuBody {
+      .position = toVec4(body._position, body._weight),
+      .velocity = toVec4(body._velocity, body._onGround ? 1.0f : 0.0f),
+      .acceleration = toVec4(body._acceleration),
+      .impulses = {}});
+
+    size_t impulse = 0;
+    for (const auto& [force, time] : body._impulseForces)
+    {
+      gpuBody.impulses[impulse++] = toVec4(force, time);
+    }
+
+    transforms.push_back(InstanceData {
+      .transform = glm::translate(glm::mat4x4( 1.0f ), glm::vec3(gpuBody.position))});
+  }
+
+  // Buffers can't be empty, an environment without bodies still gets one slot.
+  const auto bodyBufferSize = std::max<size_t>(bodies.size(), 1) * sizeof(GpuBody);
+  const auto transformBufferSize = std::max<size_t>(transforms.size(), 1) * sizeof(InstanceData);
+  _renderer.deviceLocalBuffer(
+    _bodyBuffer,
+    _bodyAllocation,
+    bodyBufferSize,
+    vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferSrc);
+  _renderer.deviceLocalBuffer(
+    _transformBuffer,
+    _transformAllocation,
+    transformBufferSize,
+    vk::BufferUsageFlagBits::eStorageBuffer);
+
+  // Uploaded in chunks, as the whole environment may not fit the staging ring.
+  const auto upload = [&](vk::Buffer buffer, std::span<const std::byte> data) {
+    for (size_t offset = 0; offset < data.size(); offset += UploadChunkSize)
+    {
+      _renderer._uploader->upload(
+        buffer,
+        offset,
+        data.subspan(offset, std::min(UploadChunkSize, data.size() - offset)));
+    }
+  };
+  upload(*_bodyBuffer, std::as_bytes(std::span(bodies)));
+  upload(*_transformBuffer, std::as_bytes(std::span(transforms)));
+  _renderer._uploader->submit();
+
+  // Bodies and transforms.
+  std::array<vk::DescriptorSetLayoutBinding, 2> bindings {};
+  for (uint32_t binding = 0; binding < bindings.size(); ++binding)
+  {
+    bindings[binding] = vk::DescriptorSetLayoutBinding {
+      .binding = binding,
+      .descriptorType = vk::DescriptorType::eStorageBuffer,
+      .descriptorCount = 1,
+      .stageFlags = vk::ShaderStageFlagBits::eCompute};
+  }
+
+  _descriptorLayout = vkr::DescriptorSetLayout(
+    device,
+    vk::DescriptorSetLayoutCreateInfo {
+      .bindingCount = static_cast<uint32_t>(bindings.size()),
+      .pBindings = bindings.data()});
+
+  const vk::DescriptorPoolSize descriptorPoolSize {
+    .type = vk::DescriptorType::eStorageBuffer,
+    .descriptorCount = static_cast<uint32_t>(bindings.size())};
+
+  _descriptorPool = vkr::DescriptorPool(
+    device,
+    vk::DescriptorPoolCreateInfo {
+      .flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet,
+      .maxSets = 1,
+      .poolSizeCount = 1,
+      .pPoolSizes = &descriptorPoolSize});
+
+  _descriptorSets = vkr::DescriptorSets(
+    device,
+    vk::DescriptorSetAllocateInfo {
+      .descriptorPool = *_descriptorPool,
+      .descriptorSetCount = 1,
+      .pSetLayouts = &(*_descriptorLayout)});
+
+  const std::array bufferInfos {
+    vk::DescriptorBufferInfo {
+      .buffer = *_bodyBuffer,
+      .offset = 0,
+      .range = VK_WHOLE_SIZE},
+    vk::DescriptorBufferInfo {
+      .buffer = *_transformBuffer,
+      .offset = 0,
+      .range = VK_WHOLE_SIZE}};
+
+  std::array<vk::WriteDescriptorSet, 2> descriptorWrites {};
+  for (uint32_t binding = 0; binding < bufferInfos.size(); ++binding)
+  {
+    descriptorWrites[binding] = vk::WriteDescriptorSet {
+      .dstSet = *_descriptorSets.front(),
+      .dstBinding = binding,
+      .dstArrayElement = 0,
+      .descriptorCount = 1,
+      .descriptorType = vk::DescriptorType::eStorageBuffer,
+      .pBufferInfo = &bufferInfos[binding]};
+  }
+  device.updateDescriptorSets(descriptorWrites, nullptr);
+
+  const vk::PushConstantRange pushConstantRange {
+    .stageFlags = vk::ShaderStageFlagBits::eCompute,
+    .offset = 0,
+    .size = sizeof(TickConstants)};
+
+  _pipelineLayout = vkr::PipelineLayout(
+    device,
+    vk::PipelineLayoutCreateInfo {
+      .setLayoutCount = 1,
+      .pSetLayouts = &(*_descriptorLayout),
+      .pushConstantRangeCount = 1,
+      .pPushConstantRanges = &pushConstantRange});
+
+  _shader = _renderer.shaderModule("bodies-comp.spv");
+  _pipeline = _renderer._pipelineCache->createComputePipeline(
+    vk::ComputePipelineCreateInfo {
+      .stage = vk::PipelineShaderStageCreateInfo {
+        .stage = vk::ShaderStageFlagBits::eCompute,
+        .module = *_shader,
+        .pName = "main"},
+      .layout = *_pipelineLayout});
+
+  _commandPool = vkr::CommandPool(
+    device,
+    vk::CommandPoolCreateInfo {
+      .flags = vk::CommandPoolCreateFlagBits::eTransient,
+      .queueFamilyIndex = _renderer.graphicsFamily()});
+}
+
+template<typename Record>
+void BodySimulation::submitAndWait(Record&& record) const
+{
+  // Bodies must be uploaded before the first tick.
+  _renderer._uploader->finish();
+
+  const auto& device = _renderer._device;
+  auto commandBuffers = vkr::CommandBuffers(
+    device,
+    vk::CommandBufferAllocateInfo {
+      .commandPool = *_commandPool,
+      .level = vk::CommandBufferLevel::ePrimary,
+      .commandBufferCount = 1});
+  const auto& commandBuffer = commandBuffers.front();
+
+  commandBuffer.begin(vk::CommandBufferBeginInfo {
+    .flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+  record(commandBuffer);
+  commandBuffer.end();
+
+  const vkr::Fence fence(device, vk::FenceCreateInfo{});
+  _renderer._graphicsQueue.submit(
+    vk::SubmitInfo {
+      .commandBufferCount = 1,
+      .pCommandBuffers = &(*commandBuffer)},
+    *fence);
+
+  const auto result = device.waitForFences(*fence, true, UINT64_MAX);
+  assert(result == vk::Result::eSuccess);
+}
+
+uint32_t BodySimulation::record(
+  const vkr::CommandBuffer& commandBuffer,
+  std::chrono::steady_clock::time_point now)
+{
+  if (!_lastTick)
+  {
+    _lastTick = now;
+    return 0;
+  }
+
+  auto ticks = static_cast<uint32_t>((now - *_lastTick) / _tickDuration);
+  if (ticks > MaxTicksPerFrame)
+  {
+    // Device can't keep up, the simulation slows down rather than spiralling.
+    ticks = MaxTicksPerFrame;
+    _lastTick = now;
+  }
+  else
+  {
+    *_lastTick += ticks * _tickDuration;
+  }
+
+  recordTicks(commandBuffer, ticks);
+  return ticks;
+}
+
+vkr::Pipeline BodySimulation::reloadShader()
+{
+  auto shader = _renderer.shaderModule("bodies-comp.spv");
+  auto pipeline = _renderer._pipelineCache->createComputePipeline(
+    vk::ComputePipelineCreateInfo {
+      .stage = vk::PipelineShaderStageCreateInfo {
+        .stage = vk::ShaderStageFlagBits::eCompute,
+        .module = *shader,
+        .pName = "main"},
+      .layout = *_pipelineLayout});
+
+  _shader = std::move(shader);
+  return std::exchange(_pipeline, std::move(pipeline));
+}
+
+void BodySimulation::run(uint32_t ticks)
+{
+  submitAndWait([&](const vkr::CommandBuffer& commandBuffer) {
+    recordTicks(commandBuffer, ticks);
+  });
+}
+
+void BodySimulation::download(sim::Environment& environment) const
+{
+  const auto size = vk::DeviceSize(_bodyCount) * sizeof(GpuBody);
+  if (size == 0)
+    return;
+
+  Allocation readbackAllocation;
+  vkr::Buffer readbackBuffer(
+    _renderer._device,
+    vk::BufferCreateInfo {
+      .size = size,
+      .usage = vk::BufferUsageFlagBits::eTransferDst,
+      .sharingMode = vk::SharingMode::eExclusive});
+  readbackAllocation = _renderer._allocator->bind(
+    readbackBuffer,
+    vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+
+  submitAndWait([&](const vkr::CommandBuffer& commandBuffer) {
+    commandBuffer.pipelineBarrier(
+      vk::PipelineStageFlagBits::eComputeShader,
+      vk::PipelineStageFlagBits::eTransfer,
+      {},
+      vk::MemoryBarrier {
+        .srcAccessMask = vk::AccessFlagBits::eShaderWrite,
+        .dstAccessMask = vk::AccessFlagBits::eTransferRead},
+      nullptr,
+      nullptr);
+
+    commandBuffer.copyBuffer(
+      *_bodyBuffer,
+      *readbackBuffer,
+      vk::BufferCopy {
+        .srcOffset = 0,
+        .dstOffset = 0,
+        .size = size});
+
+    commandBuffer.pipelineBarrier(
+      vk::PipelineStageFlagBits::eTransfer,
+      vk::PipelineStageFlagBits::eHost,
+      {},
+      vk::MemoryBarrier {
+        .srcAccessMask = vk::AccessFlagBits::eTransferWrite,
+        .dstAccessMask = vk::AccessFlagBits::eHostRead},
+      nullptr,
+      nullptr);
+  });
+
+  std::vector<GpuBody> bodies(_bodyCount);
+  std::memcpy(bodies.data(), readbackAllocation.mapped(), size);
+
+  auto gpuBody = bodies.begin();
+  for (auto& body : environment._bodies)
+  {
+    if (gpuBody == bodies.end())
+      break;
+
+    body._position = toVec3d(gpuBody->position);
+    body._velocity = toVec3d(gpuBody->velocity);
+    body._acceleration = toVec3d(gpuBody->acceleration);
+
+    size_t impulse = 0;
+    for (auto& [force, time] : body._impulseForces)
+    {
+      time = gpuBody->impulses[impulse++].w;
+    }
+    ++gpuBody;
+  }
+}
+
+void BodySimulation::recordTicks(const vkr::CommandBuffer& commandBuffer, uint32_t ticks) const
+{
+  if (ticks == 0 || _bodyCount == 0)
+    return;
+
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, *_pipeline);
+  commandBuffer.bindDescriptorSets(
+    vk::PipelineBindPoint::eCompute,
+    *_pipelineLayout,
+    0,
+    *_descriptorSets.front(),
+    nullptr);
+
+  const TickConstants constants {
+    .gravity = _gravity,
+    .wind = _wind,
+    .step = _step,
+    .bodyCount = _bodyCount};
+  commandBuffer.pushConstants<TickConstants>(
+    *_pipelineLayout,
+    vk::ShaderStageFlagBits::eCompute,
+    0,
+    constants);
+
+  // Every tick reads the state of the previous one. The first one also waits for
+  // the earlier frames, whose culling may still read the transforms.
+  const vk::MemoryBarrier computeBarrier {
+    .srcAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite,
+    .dstAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite};
+
+  for (uint32_t tick = 0; tick < ticks; ++tick)
+  {
+    commandBuffer.pipelineBarrier(
+      vk::PipelineStageFlagBits::eComputeShader,
+      vk::PipelineStageFlagBits::eComputeShader,
+      {},
+      computeBarrier,
+      nullptr,
+      nullptr);
+    commandBuffer.dispatch(
+      (_bodyCount + BodyWorkgroupSize - 1) / BodyWorkgroupSize, 1, 1);
+  }
+
+  // Transforms of the last tick are read by culling.
+  commandBuffer.pipelineBarrier(
+    vk::PipelineStageFlagBits::eComputeShader,
+    vk::PipelineStageFlagBits::eComputeShader,
+    {},
+    computeBarrier,
+    nullptr,
+    nullptr);
+}
+
+ParityReport checkParity(
+  const Renderer& renderer,
+  const sim::Environment& environment,
+  uint32_t ticks)
+{
+  auto deviceEnvironment = environment;
+  BodySimulation simulation(renderer, deviceEnvironment);
+  simulation.run(ticks);
+  simulation.download(deviceEnvironment);
+
+  auto hostEnvironment = environment;
+  sim::BodyDynamicsSimulator dynamicsSimulator(hostEnvironment);
+  sim::BodyKinematicsSimulator kinematicsSimulator(hostEnvironment);
+  for (uint32_t tick = 0; tick < ticks; ++tick)
+  {
+    dynamicsSimulator.Tick(simulation.step());
+    kinematicsSimulator.Tick(simulation.step());
+  }
+
+  ParityReport report;
+  auto hostBody = hostEnvironment._bodies.begin();
+  for (const auto& deviceBody : deviceEnvironment._bodies)
+  {
+    report.position = std::max(report.position, difference(deviceBody._position, hostBody->_position));
+    report.velocity = std::max(report.velocity, difference(deviceBody._velocity, hostBody->_velocity));
+    ++report.bodies;
+    ++hostBody;
+  }
+  return report;
+}
+
+}// namespace vulkan
@@ -0,0 +1,427 @@
+//
+// Created by maros on 09.12.2023.
+//
+
+#include "sim/capture.hpp"
+#include "sim/vulkan.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <format>
+#include <span>
+#include <stdexcept>
+
+namespace
+{
+
+//! CRC-32 of PNG chunks.
+uint32_t crc32(uint32_t crc, std::span<const uint8_t> data)
+{
+  static const auto table = [] {
+    std::array<uint32_t, 256> table {};
+    for (uint32_t n = 0; n < table.size(); ++n)
+    {
+      uint32_t c = n;
+      for (int32_t k = 0; k < 8; ++k)
+        c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      table[n] = c;
+    }
+    return table;
+  }();
+
+  crc = ~crc;
+  for (const auto byte: data)
+  {
+    crc = table[(crc ^ byte) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+//! Appends big endian integer.
+void appendBigEndian(std::vector<uint8_t>& output, uint32_t value)
+{
+  output.insert(output.end(), {
+    static_cast<uint8_t>(value >> 24),
+    static_cast<uint8_t>(value >> 16),
+    static_cast<uint8_t>(value >> 8),
+    static_cast<uint8_t>(value)});
+}
+
+//! Writes PNG chunk.
+void writeChunk(std::ostream& output, const char (&type)[5], std::span<const uint8_t> data)
+{
+  std::vector<uint8_t> header;
+  appendBigEndian(header, static_cast<uint32_t>(data.size()));
+  header.insert(header.end(), type, type + 4);
+
+  const auto typeBytes = std::span<const uint8_t>(header).subspan(4);
+  const auto crc = crc32(crc32(0, typeBytes), data);
+
+  std::vector<uint8_t> footer;
+  appendBigEndian(footer, crc);
+
+  output.write(reinterpret_cast<const char*>(header.data()), static_cast<std::streamsize>(header.size()));
+  output.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+  output.write(reinterpret_cast<const char*>(footer.data()), static_cast<std::streamsize>(footer.size()));
+}
+
+//! Writes RGB scanlines, each prefixed by its filter type, as a PNG.
+//! Data is stored, not compressed, as the encoder must keep up with the frame rate.
+void writePng(std::ostream& output, uint32_t width, uint32_t height, std::span<const uint8_t> scanlines)
+{
+  constexpr uint8_t Signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+  output.write(reinterpret_cast<const char*>(Signature), sizeof(Signature));
+
+  std::vector<uint8_t> header;
+  appendBigEndian(header, width);
+  appendBigEndian(header, height);
+  // 8 bit depth, truecolor, deflate, adaptive filtering, no interlace.
+  header.insert(header.end(), {8, 2, 0, 0, 0});
+  writeChunk(output, "IHDR", header);
+
+  // Zlib stream of stored deflate blocks.
+  constexpr size_t MaxStoredBlock = 65535;
+  std::vector<uint8_t> compressed;
+  compressed.reserve(scanlines.size() + scanlines.size() / MaxStoredBlock * 5 + 16);
+  compressed.insert(compressed.end(), {0x78, 0x01});
+
+  uint32_t adlerA = 1;
+  uint32_t adlerB = 0;
+  for (size_t offset = 0; offset < scanlines.size(); offset += MaxStoredBlock)
+  {
+    const auto block = scanlines.subspan(offset, std::min(MaxStoredBlock, scanlines.size() - offset));
+    const auto length = static_cast<uint16_t>(block.size());
+    const bool final = offset + block.size() == scanlines.size();
+    compressed.insert(compressed.end(), {
+      static_cast<uint8_t>(final ? 1 : 0),
+      static_cast<uint8_t>(length),
+      static_cast<uint8_t>(length >> 8),
+      static_cast<uint8_t>(~length),
+      static_cast<uint8_t>(~length >> 8)});
+    compressed.insert(compressed.end(), block.begin(), block.end());
+
+    for (const auto byte: block)
+    {
+      adlerA = (adlerA + byte) % 65521;
+      adlerB = (adlerB + adlerA) % 65521;
+    }
+  }
+  appendBigEndian(compressed, (adlerB << 16) | adlerA);
+
+  writeChunk(output, "IDAT", compressed);
+  writeChunk(output, "IEND", {});
+}
+
+}// namespace
+
+namespace vulkan
+{
+
+FrameCapture::FrameCapture(const Renderer& renderer, CaptureOptions options)
+    : _renderer(renderer)
+    , _options(std::move(options))
+    , _extent(renderer._extent)
+{
+  if (!_renderer.offscreen()
+      && !(_renderer._surfaceCapabilities.supportedUsageFlags & vk::ImageUsageFlagBits::eTransferSrc))
+    throw std::runtime_error("Swap chain images can't be copied from, capture is not supported");
+
+  _bgra = _renderer._colorImageFormat == vk::Format::eB8G8R8A8Unorm
+          || _renderer._colorImageFormat == vk::Format::eB8G8R8A8Srgb;
+
+  // Frames in flight, one being handed over and one being encoded.
+  _slots.resize(_renderer._presentation.framesInFlight + 2);
+
+  const auto size = vk::DeviceSize(_extent.width) * _extent.height * 4;
+  for (auto& slot: _slots)
+  {
+    slot.buffer = vkr::Buffer(
+      _renderer._device,
+      vk::BufferCreateInfo {
+        .size = size,
+        .usage = vk::BufferUsageFlagBits::eTransferDst,
+        .sharingMode = vk::SharingMode::eExclusive});
+
+    // Cached memory is much faster to read from, when there is one.
+    const auto hostVisible = vk::MemoryPropertyFlagBits::eHostVisible
+                             | vk::MemoryPropertyFlagBits::eHostCoherent;
+    try
+    {
+      slot.allocation = _renderer._allocator->bind(
+        slot.buffer, hostVisible | vk::MemoryPropertyFlagBits::eHostCached);
+    }
+    catch (const std::runtime_error&)
+    {
+      slot.allocation = _renderer._allocator->bind(slot.buffer, hostVisible);
+    }
+  }
+
+  if (_options.format == CaptureFormat::Png)
+  {
+    std::filesystem::create_directories(_options.path);
+  }
+  else
+  {
+    _output.open(_options.path, std::ios::binary | std::ios::trunc);
+    if (!_output)
+      throw std::runtime_error(
+        std::format("Couldn't open capture at '{}'", _options.path.string()));
+
+    if (_options.format == CaptureFormat::Y4m)
+    {
+      _output << std::format(
+        "YUV4MPEG2 W{} H{} F{}:1 Ip A1:1 C444\n",
+        _extent.width, _extent.height, _options.frameRate);
+    }
+  }
+
+  _encoder = std::jthread([this](std::stop_token stop) {
+    encode(stop);
+  });
+}
+
+FrameCapture::~FrameCapture()
+{
+  // Encoder drains the queue before stopping.
+  _encoder.request_stop();
+  _encoder.join();
+
+  printf("Captured %llu frames to '%s', skipped %llu\n",
+         static_cast<unsigned long long>(_capturedFrames),
+         _options.path.string().c_str(),
+         static_cast<unsigned long long>(_skippedFrames));
+}
+
+bool FrameCapture::record(
+  const vkr::CommandBuffer& commandBuffer,
+  vk::Image image,
+  vk::ImageLayout layout,
+  uint64_t frame)
+{
+  // Captures keep the size they started with, frames of a resized swap chain are skipped.
+  if (_renderer._extent != _extent)
+  {
+    _skippedFrames++;
+    return false;
+  }
+
+  Slot* slot = nullptr;
+  {
+    std::scoped_lock lock(_mutex);
+    const auto free = std::ranges::find(_slots, Slot::State::Free, &Slot::state);
+    if (free != _slots.end())
+      slot = &*free;
+  }
+
+  // Encoder fell behind, the frame rate takes precedence.
+  if (!slot)
+  {
+    _skippedFrames++;
+    return false;
+  }
+
+  const vk::ImageSubresourceRange colorRange {
+    .aspectMask = vk::ImageAspectFlagBits::eColor,
+    .baseMipLevel = 0,
+    .levelCount = 1,
+    .baseArrayLayer = 0,
+    .layerCount = 1};
+
+  const bool transition = layout != vk::ImageLayout::eTransferSrcOptimal;
+  if (transition)
+  {
+    commandBuffer.pipelineBarrier(
+      vk::PipelineStageFlagBits::eColorAttachmentOutput,
+      vk::PipelineStageFlagBits::eTransfer,
+      {},
+      nullptr,
+      nullptr,
+      vk::ImageMemoryBarrier {
+        .srcAccessMask = vk::AccessFlagBits::eColorAttachmentWrite,
+        .dstAccessMask = vk::AccessFlagBits::eTransferRead,
+        .oldLayout = layout,
+        .newLayout = vk::ImageLayout::eTransferSrcOptimal,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = image,
+        .subresourceRange = colorRange});
+  }
+
+  commandBuffer.copyImageToBuffer(
+    image,
+    vk::ImageLayout::eTransferSrcOptimal,
+    *slot->buffer,
+    vk::BufferImageCopy {
+      .bufferOffset = 0,
+      .bufferRowLength = 0,
+      .bufferImageHeight = 0,
+      .imageSubresource = {
+        .aspectMask = vk::ImageAspectFlagBits::eColor,
+        .mipLevel = 0,
+        .baseArrayLayer = 0,
+        .layerCount = 1},
+      .imageOffset = {0, 0, 0},
+      .imageExtent = {_extent.width, _extent.height, 1}});
+
+  if (transition)
+  {
+    // Presentation is ordered by the semaphore signaled at submission.
+    commandBuffer.pipelineBarrier(
+      vk::PipelineStageFlagBits::eTransfer,
+      vk::PipelineStageFlagBits::eBottomOfPipe,
+      {},
+      nullptr,
+      nullptr,
+      vk::ImageMemoryBarrier {
+        .srcAccessMask = {},
+        .dstAccessMask = {},
+        .oldLayout = vk::ImageLayout::eTransferSrcOptimal,
+        .newLayout = layout,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = image,
+        .subresourceRange = colorRange});
+  }
+
+  commandBuffer.pipelineBarrier(
+    vk::PipelineStageFlagBits::eTransfer,
+    vk::PipelineStageFlagBits::eHost,
+    {},
+    vk::MemoryBarrier {
+      .srcAccessMask = vk::AccessFlagBits::eTransferWrite,
+      .dstAccessMask = vk::AccessFlagBits::eHostRead},
+    nullptr,
+    nullptr);
+
+  std::scoped_lock lock(_mutex);
+  slot->state = Slot::State::Recorded;
+  slot->frame = frame;
+  return true;
+}
+
+void FrameCapture::poll(uint64_t completedFrame)
+{
+  std::vector<Slot*> completed;
+  {
+    std::scoped_lock lock(_mutex);
+    for (auto& slot: _slots)
+    {
+      if (slot.state == Slot::State::Recorded && slot.frame <= completedFrame)
+        completed.push_back(&slot);
+    }
+
+    // Video formats need the frames in order.
+    std::ranges::sort(completed, {}, &Slot::frame);
+    for (auto* slot: completed)
+    {
+      slot->state = Slot::State::Encoding;
+      _queue.push_back(slot);
+    }
+  }
+
+  if (!completed.empty())
+  {
+    _capturedFrames += completed.size();
+    _queueCondition.notify_one();
+  }
+}
+
+void FrameCapture::encode(std::stop_token stop)
+{
+  while (true)
+  {
+    Slot* slot = nullptr;
+    {
+      std::unique_lock lock(_mutex);
+      // Returns false only once stopped with nothing left to encode.
+      if (!_queueCondition.wait(lock, stop, [this] { return !_queue.empty(); }))
+        return;
+
+      slot = _queue.front();
+      _queue.pop_front();
+    }
+
+    write(*slot);
+
+    std::scoped_lock lock(_mutex);
+    slot->state = Slot::State::Free;
+  }
+}
+
+void FrameCapture::write(const Slot& slot)
+{
+  const auto* pixels = reinterpret_cast<const uint8_t*>(slot.allocation.mapped());
+  const size_t pixelCount = size_t(_extent.width) * _extent.height;
+  const size_t red = _bgra ? 2 : 0;
+  const size_t blue = _bgra ? 0 : 2;
+
+  switch (_options.format)
+  {
+    case CaptureFormat::Png:
+    {
+      // RGB scanlines, alpha of the clear color is not meant to be seen.
+      const size_t rowSize = 1 + size_t(_extent.width) * 3;
+      _scratch.resize(rowSize * _extent.height);
+      for (uint32_t y = 0; y < _extent.height; ++y)
+      {
+        auto* row = _scratch.data() + y * rowSize;
+        const auto* source = pixels + size_t(y) * _extent.width * 4;
+        *row++ = 0;
+        for (uint32_t x = 0; x < _extent.width; ++x, source += 4)
+        {
+          *row++ = source[red];
+          *row++ = source[1];
+          *row++ = source[blue];
+        }
+      }
+
+      std::ofstream output(
+        _options.path / std::format("frame-{:06}.png", slot.frame), std::ios::binary);
+      writePng(output, _extent.width, _extent.height, _scratch);
+      break;
+    }
+    case CaptureFormat::Raw:
+    {
+      if (!_bgra)
+      {
+        _output.write(reinterpret_cast<const char*>(pixels), static_cast<std::streamsize>(pixelCount * 4));
+        break;
+      }
+
+      _scratch.resize(pixelCount * 4);
+      for (size_t pixel = 0; pixel < pixelCount; ++pixel)
+      {
+        _scratch[pixel * 4 + 0] = pixels[pixel * 4 + 2];
+        _scratch[pixel * 4 + 1] = pixels[pixel * 4 + 1];
+        _scratch[pixel * 4 + 2] = pixels[pixel * 4 + 0];
+        _scratch[pixel * 4 + 3] = pixels[pixel * 4 + 3];
+      }
+      _output.write(reinterpret_cast<const char*>(_scratch.data()), static_cast<std::streamsize>(_scratch.size()));
+      break;
+    }
+    case CaptureFormat::Y4m:
+    {
+      // BT.601 studio range planes, full chroma resolution.
+      _scratch.resize(pixelCount * 3);
+      auto* yPlane = _scratch.data();
+      auto* uPlane = yPlane + pixelCount;
+      auto* vPlane = uPlane + pixelCount;
+      for (size_t pixel = 0; pixel < pixelCount; ++pixel)
+      {
+        const int32_t r = pixels[pixel * 4 + red];
+        const int32_t g = pixels[pixel * 4 + 1];
+        const int32_t b = pixels[pixel * 4 + blue];
+        yPlane[pixel] = static_cast<uint8_t>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+        uPlane[pixel] = static_cast<uint8_t>(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+        vPlane[pixel] = static_cast<uint8_t>(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+      }
+
+      _output << "FRAME\n";
+      _output.write(reinterpret_cast<const char*>(_scratch.data()), static_cast<std::streamsize>(_scratch.size()));
+      break;
+    }
+  }
+}
+
+}// namespace vulkan
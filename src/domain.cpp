@@ -0,0 +1,375 @@
+//
+// Created by maros on 21.12.2023.
+//
+
+#include "sim/domain.hpp"
+#include "sim/metrics.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <format>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+
+namespace
+{
+
+//! Identifiers of the bodies added by a worker start at its rank shifted by this many bits.
+constexpr uint32_t IdentifierRankShift = 48;
+
+//! Metrics of the domain exchanges.
+struct DomainMetrics
+{
+  sim::Counter& _migrations;
+  sim::Counter& _ghosts;
+  sim::Histogram& _exchange;
+};
+
+//! @returns Metrics of the domain exchanges.
+const DomainMetrics& ExchangeMetrics()
+{
+  static const DomainMetrics metrics {
+    ._migrations = sim::Metrics::Instance().RegisterCounter(
+      "sim_domain_migrations_total", "Bodies migrated to the regions of other workers."),
+    ._ghosts = sim::Metrics::Instance().RegisterCounter(
+      "sim_domain_ghosts_total", "Ghosts sent to the regions of other workers."),
+    ._exchange = sim::Metrics::Instance().RegisterHistogram(
+      "sim_domain_exchange_seconds", "Duration of an exchange between the workers.", 1e-9)};
+  return metrics;
+}
+
+//! Appends value to a message.
+template<typename Type>
+void Write(sim::Message& message, const Type& value)
+{
+  static_assert(std::is_trivially_copyable_v<Type>);
+  const auto offset = message.size();
+  message.resize(offset + sizeof(Type));
+  std::memcpy(message.data() + offset, &value, sizeof(Type));
+}
+
+void Write(sim::Message& message, const math::vec3d& vector)
+{
+  Write(message, vector._right);
+  Write(message, vector._up);
+  Write(message, vector._forward);
+}
+
+//! Reads value of a message.
+//! @param offset Offset of the value, advanced past it.
+//! @throws std::runtime_error If the message ends before the value.
+template<typename Type>
+Type Read(const sim::Message& message, size_t& offset)
+{
+  static_assert(std::is_trivially_copyable_v<Type>);
+  if (message.size() - offset < sizeof(Type))
+    throw std::runtime_error("Malformed message of a worker");
+
+  Type value;
+  std::memcpy(&value, message.data() + offset, sizeof(Type));
+  offset += sizeof(Type);
+  return value;
+}
+
+math::vec3d ReadVector(const sim::Message& message, size_t& offset)
+{
+  const auto right = Read<double>(message, offset);
+  const auto up = Read<double>(message, offset);
+  const auto forward = Read<double>(message, offset);
+  return {right, up, forward};
+}
+
+void Write(sim::Message& message, const sim::Body& body)
+{
+  Write(message, body._weight);
+  Write(message, static_cast<uint8_t>(body._onGround));
+  Write(message, static_cast<uint8_t>(body._wasOnGround));
+  Write(message, body._position);
+  Write(message, static_cast<uint32_t>(body._forces.size()));
+  for (const auto& force : body._forces)
+  {
+    Write(message, force);
+  }
+  Write(message, static_cast<uint32_t>(body._impulseForces.size()));
+  for (const auto& [force, time] : body._impulseForces)
+  {
+    Write(message, force);
+    Write(message, time);
+  }
+  Write(message, body._velocity);
+  Write(message, body._acceleration);
+}
+
+sim::Body ReadBody(const sim::Message& message, size_t& offset)
+{
+  sim::Body body;
+  body._weight = Read<float>(message, offset);
+  body._onGround = Read<uint8_t>(message, offset) != 0;
+  body._wasOnGround = Read<uint8_t>(message, offset) != 0;
+  body._position = ReadVector(message, offset);
+  const auto forces = Read<uint32_t>(message, offset);
+  for (uint32_t force = 0; force < forces; ++force)
+  {
+    body._forces.push_back(ReadVector(message, offset));
+  }
+  const auto impulses = Read<uint32_t>(message, offset);
+  for (uint32_t impulse = 0; impulse < impulses; ++impulse)
+  {
+    const auto force = ReadVector(message, offset);
+    body._impulseForces.emplace_back(force, Read<float>(message, offset));
+  }
+  body._velocity = ReadVector(message, offset);
+  body._acceleration = ReadVector(message, offset);
+  return body;
+}
+
+//! @returns Distance of the position from the box, 0 inside of it.
+double DistanceTo(const sim::Box& box, const math::vec3d& position) noexcept
+{
+  const auto outside = [](double min, double max, double value) {
+    return std::max({min - value, 0.0, value - max});
+  };
+  const auto right = outside(box._min._right, box._max._right, position._right);
+  const auto up = outside(box._min._up, box._max._up, position._up);
+  const auto forward = outside(box._min._forward, box._max._forward, position._forward);
+  return std::sqrt(right * right + up * up + forward * forward);
+}
+
+}// namespace
+
+uint32_t sim::RegionGrid::RegionOf(const math::vec3d& position) const noexcept
+{
+  const auto cell = [](double min, double max, uint32_t divisions, double value) {
+    const double fraction = (value - min) / (max - min);
+    const double index = std::floor(fraction * divisions);
+    return static_cast<uint32_t>(std::clamp(index, 0.0, static_cast<double>(divisions - 1)));
+  };
+  const auto x = cell(_min._right, _max._right, _divisions[0], position._right);
+  const auto y = cell(_min._up, _max._up, _divisions[1], position._up);
+  const auto z = cell(_min._forward, _max._forward, _divisions[2], position._forward);
+  return (z * _divisions[1] + y) * _divisions[0] + x;
+}
+
+sim::Box sim::RegionGrid::BoundsOf(uint32_t region) const noexcept
+{
+  constexpr auto Infinity = std::numeric_limits<double>::infinity();
+
+  const std::array<uint32_t, 3> cell {
+    region % _divisions[0],
+    region / _divisions[0] % _divisions[1],
+    region / (_divisions[0] * _divisions[1])};
+  const std::array<double, 3> min {_min._right, _min._up, _min._forward};
+  const std::array<double, 3> max {_max._right, _max._up, _max._forward};
+
+  std::array<double, 3> lower {};
+  std::array<double, 3> upper {};
+  for (size_t axis = 0; axis < 3; ++axis)
+  {
+    const double size = (max[axis] - min[axis]) / _divisions[axis];
+    lower[axis] = cell[axis] == 0 ? -Infinity : min[axis] + size * cell[axis];
+    upper[axis] = cell[axis] + 1 == _divisions[axis] ? Infinity : min[axis] + size * (cell[axis] + 1);
+  }
+
+  return Box {
+    ._min = {lower[0], lower[1], lower[2]},
+    ._max = {upper[0], upper[1], upper[2]}};
+}
+
+std::vector<uint32_t> sim::RegionGrid::NeighborsOf(uint32_t region) const
+{
+  const std::array<int64_t, 3> cell {
+    region % _divisions[0],
+    region / _divisions[0] % _divisions[1],
+    region / (_divisions[0] * _divisions[1])};
+
+  std::vector<uint32_t> neighbors;
+  for (int64_t z = cell[2] - 1; z <= cell[2] + 1; ++z)
+  {
+    for (int64_t y = cell[1] - 1; y <= cell[1] + 1; ++y)
+    {
+      for (int64_t x = cell[0] - 1; x <= cell[0] + 1; ++x)
+      {
+        if (x < 0 || y < 0 || z < 0
+            || x >= _divisions[0] || y >= _divisions[1] || z >= _divisions[2])
+          continue;
+
+        const auto neighbor = static_cast<uint32_t>((z * _divisions[1] + y) * _divisions[0] + x);
+        if (neighbor != region)
+          neighbors.push_back(neighbor);
+      }
+    }
+  }
+  return neighbors;
+}
+
+sim::Domain::Domain(
+  Environment& environment,
+  RegionGrid grid,
+  Transport& transport,
+  double halo)
+    : _grid(grid)
+    , _transport(transport)
+    , _halo(halo)
+    , _region(transport.Rank())
+    , _dynamics(environment)
+    , _kinematics(environment)
+    , _nextIdentifier(uint64_t(transport.Rank()) << IdentifierRankShift)
+{
+  if (_grid.Count() != _transport.Ranks())
+    throw std::runtime_error(std::format(
+      "Grid of {} regions doesn't match {} workers", _grid.Count(), _transport.Ranks()));
+
+  _neighbors = _grid.NeighborsOf(_region);
+  for (const auto neighbor : _neighbors)
+  {
+    _neighborBounds.push_back(_grid.BoundsOf(neighbor));
+  }
+  _outgoing.resize(_transport.Ranks());
+}
+
+bool sim::Domain::Add(Body body)
+{
+  if (_grid.RegionOf(body._position) != _region)
+    return false;
+
+  _bodies.push_back(std::move(body));
+  _identifiers.push_back(_nextIdentifier++);
+  return true;
+}
+
+bool sim::Domain::Tick(float time, bool stop)
+{
+  _dynamics.Tick(_bodies, time);
+  _kinematics.Tick(_bodies, time);
+
+  _stop = stop;
+  Emigrate();
+
+  const auto start = std::chrono::steady_clock::now();
+  _transport.Exchange(_outgoing, _incoming);
+  ExchangeMetrics()._exchange.Record(std::chrono::steady_clock::now() - start);
+
+  return Immigrate();
+}
+
+void sim::Domain::Capture(Snapshot& snapshot, double time) const
+{
+  snapshot.Begin(time);
+  snapshot.Append(_bodies);
+  snapshot._bodies.insert(snapshot._bodies.end(), _ghosts.begin(), _ghosts.end());
+  snapshot.Index();
+}
+
+void sim::Domain::Emigrate()
+{
+  // Every message starts with the stop flag, followed by the migrants and the ghosts,
+  // each preceded by their count, patched once known.
+  constexpr size_t MigrantsOffset = sizeof(uint8_t);
+  for (auto& message : _outgoing)
+  {
+    message.clear();
+    Write(message, static_cast<uint8_t>(_stop));
+    Write(message, uint32_t(0));
+  }
+
+  std::vector<uint32_t> migrants(_outgoing.size(), 0);
+  _emigrated = 0;
+  for (size_t index = 0; index < _bodies.size();)
+  {
+    const auto region = _grid.RegionOf(_bodies[index]._position);
+    if (region == _region)
+    {
+      ++index;
+      continue;
+    }
+
+    Write(_outgoing[region], _identifiers[index]);
+    Write(_outgoing[region], _bodies[index]);
+    migrants[region]++;
+    _emigrated++;
+
+    // Order of the bodies isn't kept.
+    _bodies[index] = std::move(_bodies.back());
+    _bodies.pop_back();
+    _identifiers[index] = _identifiers.back();
+    _identifiers.pop_back();
+  }
+
+  std::vector<uint32_t> ghosts(_outgoing.size(), 0);
+  std::vector<size_t> ghostsOffsets(_outgoing.size(), 0);
+  for (size_t region = 0; region < _outgoing.size(); ++region)
+  {
+    auto& message = _outgoing[region];
+    std::memcpy(message.data() + MigrantsOffset, &migrants[region], sizeof(uint32_t));
+    ghostsOffsets[region] = message.size();
+    Write(message, uint32_t(0));
+  }
+
+  size_t ghostCount = 0;
+  for (size_t index = 0; index < _bodies.size(); ++index)
+  {
+    const auto& body = _bodies[index];
+    for (size_t neighbor = 0; neighbor < _neighbors.size(); ++neighbor)
+    {
+      if (DistanceTo(_neighborBounds[neighbor], body._position) > _halo)
+        continue;
+
+      auto& message = _outgoing[_neighbors[neighbor]];
+      Write(message, _identifiers[index]);
+      Write(message, body._position);
+      Write(message, body._velocity);
+      ghosts[_neighbors[neighbor]]++;
+      ghostCount++;
+    }
+  }
+
+  for (size_t region = 0; region < _outgoing.size(); ++region)
+  {
+    std::memcpy(_outgoing[region].data() + ghostsOffsets[region], &ghosts[region], sizeof(uint32_t));
+  }
+
+  ExchangeMetrics()._migrations.Add(_emigrated);
+  ExchangeMetrics()._ghosts.Add(ghostCount);
+}
+
+bool sim::Domain::Immigrate()
+{
+  bool running = !_stop;
+  _immigrated = 0;
+  _ghosts.clear();
+  _ghostIdentifiers.clear();
+
+  for (uint32_t region = 0; region < _incoming.size(); ++region)
+  {
+    if (region == _region)
+      continue;
+
+    const auto& message = _incoming[region];
+    size_t offset = 0;
+    running &= Read<uint8_t>(message, offset) == 0;
+
+    const auto migrants = Read<uint32_t>(message, offset);
+    for (uint32_t migrant = 0; migrant < migrants; ++migrant)
+    {
+      _identifiers.push_back(Read<uint64_t>(message, offset));
+      _bodies.push_back(ReadBody(message, offset));
+    }
+    _immigrated += migrants;
+
+    const auto ghosts = Read<uint32_t>(message, offset);
+    for (uint32_t ghost = 0; ghost < ghosts; ++ghost)
+    {
+      _ghostIdentifiers.push_back(Read<uint64_t>(message, offset));
+      const auto position = ReadVector(message, offset);
+      const auto velocity = ReadVector(message, offset);
+      _ghosts.push_back(BodyState {
+        ._position = position,
+        ._velocity = velocity});
+    }
+  }
+
+  return running;
+}
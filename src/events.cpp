@@ -0,0 +1,181 @@
+//
+// Created by maros on 22.12.2023.
+//
+
+#include "sim/events.hpp"
+#include "sim/metrics.hpp"
+#include "sim/sim.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <utility>
+
+namespace
+{
+
+//! @returns Whether the position is within the box.
+bool Contains(const sim::Box& box, const math::vec3d& position) noexcept
+{
+  return position._right >= box._min._right && position._right <= box._max._right
+         && position._up >= box._min._up && position._up <= box._max._up
+         && position._forward >= box._min._forward && position._forward <= box._max._forward;
+}
+
+double SquaredMagnitude(const math::vec3d& vector) noexcept
+{
+  return vector._right * vector._right
+         + vector._up * vector._up
+         + vector._forward * vector._forward;
+}
+
+//! @returns Counter of the merged events.
+sim::Counter& EventCounter()
+{
+  static auto& counter = sim::Metrics::Instance().RegisterCounter(
+    "sim_events_total", "Events produced by the simulation passes.");
+  return counter;
+}
+
+}// namespace
+
+const char* sim::ToString(EventType type) noexcept
+{
+  switch (type)
+  {
+    case EventType::RegionEnter:
+      return "region enter";
+    case EventType::RegionExit:
+      return "region exit";
+    case EventType::SpeedAbove:
+      return "speed above";
+    case EventType::SpeedBelow:
+      return "speed below";
+    case EventType::HeightAbove:
+      return "height above";
+    case EventType::HeightBelow:
+      return "height below";
+    case EventType::GroundContact:
+      return "ground contact";
+    case EventType::GroundRelease:
+      return "ground release";
+  }
+  return "unknown";
+}
+
+sim::EventStream::EventStream()
+{
+  static std::atomic<uint64_t> nextIdentifier = 1;
+  _identifier = nextIdentifier.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint32_t sim::EventStream::AddRegion(const Box& region)
+{
+  _regions.push_back(region);
+  return static_cast<uint32_t>(_regions.size() - 1);
+}
+
+uint32_t sim::EventStream::AddSpeedThreshold(double speed)
+{
+  _speeds.push_back(speed * speed);
+  return static_cast<uint32_t>(_speeds.size() - 1);
+}
+
+uint32_t sim::EventStream::AddHeightThreshold(double height)
+{
+  _heights.push_back(height);
+  return static_cast<uint32_t>(_heights.size() - 1);
+}
+
+void sim::EventStream::Moved(
+  uint64_t body,
+  const math::vec3d& position,
+  const math::vec3d& velocity,
+  const Body& moved)
+{
+  for (uint32_t region = 0; region < _regions.size(); ++region)
+  {
+    const bool was = Contains(_regions[region], position);
+    const bool is = Contains(_regions[region], moved._position);
+    if (was != is)
+      Emit(is ? EventType::RegionEnter : EventType::RegionExit, region, body, moved._position);
+  }
+
+  if (!_speeds.empty())
+  {
+    const auto was = SquaredMagnitude(velocity);
+    const auto is = SquaredMagnitude(moved._velocity);
+    for (uint32_t speed = 0; speed < _speeds.size(); ++speed)
+    {
+      const auto threshold = _speeds[speed];
+      if (was < threshold && is >= threshold)
+        Emit(EventType::SpeedAbove, speed, body, moved._position);
+      else if (was >= threshold && is < threshold)
+        Emit(EventType::SpeedBelow, speed, body, moved._position);
+    }
+  }
+
+  for (uint32_t height = 0; height < _heights.size(); ++height)
+  {
+    const auto threshold = _heights[height];
+    if (position._up < threshold && moved._position._up >= threshold)
+      Emit(EventType::HeightAbove, height, body, moved._position);
+    else if (position._up >= threshold && moved._position._up < threshold)
+      Emit(EventType::HeightBelow, height, body, moved._position);
+  }
+}
+
+void sim::EventStream::Grounded(uint64_t index, Body& body)
+{
+  if (body._onGround == body._wasOnGround)
+    return;
+
+  body._wasOnGround = body._onGround;
+  Emit(body._onGround ? EventType::GroundContact : EventType::GroundRelease, 0, index, body._position);
+}
+
+void sim::EventStream::Merge()
+{
+  _events.clear();
+  for (const auto& buffer : _buffers)
+  {
+    _events.insert(_events.end(), buffer->_events.begin(), buffer->_events.end());
+    buffer->_events.clear();
+  }
+
+  // Threads tick ranges of bodies in any order, events are ordered as a single thread would.
+  std::stable_sort(_events.begin(), _events.end(), [](const Event& lhs, const Event& rhs) {
+    return lhs._body < rhs._body;
+  });
+  EventCounter().Add(_events.size());
+}
+
+sim::EventStream::Buffer& sim::EventStream::Local()
+{
+  // Buffer of the stream the thread last emitted into. Identifiers are never reused,
+  // so the entry of a destroyed stream is never matched, and a thread keeps only one.
+  thread_local std::pair<uint64_t, Buffer*> cached {0, nullptr};
+  if (cached.first == _identifier)
+    return *cached.second;
+
+  // Looked up once per thread, unless it alternates between streams.
+  std::scoped_lock lock(_mutex);
+  const auto thread = std::this_thread::get_id();
+  const auto found = std::ranges::find_if(_buffers, [thread](const auto& buffer) {
+    return buffer->_thread == thread;
+  });
+  auto* buffer = found != _buffers.end()
+                   ? found->get()
+                   : _buffers.emplace_back(std::make_unique<Buffer>(Buffer {._thread = thread, ._events = {}})).get();
+  cached = {_identifier, buffer};
+  return *buffer;
+}
+
+void sim::EventStream::Emit(EventType type, uint32_t trigger, uint64_t body, const math::vec3d& position)
+{
+  Local()._events.push_back(Event {
+    ._type = type,
+    ._trigger = trigger,
+    ._body = body,
+    ._position = position});
+}
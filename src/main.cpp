@@ -1,95 +1,506 @@
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <csignal>
 #include <cstdio>
+#include <cstring>
+#include <format>
+#include <fstream>
 #include <iostream>
+#include <optional>
+#include <thread>
 
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <sim/domain.hpp>
 #include <sim/engine.hpp>
+#include <sim/events.hpp>
+#include <sim/metrics.hpp>
+#include <sim/shared.hpp>
+#include <sim/sim.hpp>
+#include <sim/snapshot.hpp>
 #include <sim/vulkan.hpp>
+#include <sim/world.hpp>
+
+
+//! Set by a termination signal of a headless simulation.
+volatile std::sig_atomic_t terminated = 0;
+
+//! Runs the simulation until stop is requested, publishing a snapshot every tick.
+//! @param env Environment of the bodies, its own bodies aren't simulated.
+//! @param world World of the simulated bodies.
+//! @param publisher Optional publisher of the snapshots to viewer processes.
+void simulate(
+  std::stop_token stop,
+  sim::Environment& env,
+  sdk::World& world,
+  sim::SnapshotExchange& snapshots,
+  sim::SharedSnapshotPublisher* publisher)
+{
+  sim::BodyDynamicsSimulator dynamicsSimulator(env);
+  sim::BodyKinematicsSimulator kinematicsSimulator(env);
+
+  // Bodies falling through the ground plane are reported, and counted by sim_events_total.
+  // Ground contact changes would be too, but nothing sets Body::_onGround in this loop.
+  sim::EventStream events;
+  events.AddHeightThreshold(0.0);
+  dynamicsSimulator.SetEvents(&events);
+  kinematicsSimulator.SetEvents(&events);
+
+  using Clock = std::chrono::steady_clock;
 
+  // Time [s].
+  double simulationTime = 0.0;
+  // Ticks per second.
+  const int32_t tps = 128;
+  // Time per tick.
+  const auto timePerTick = std::chrono::duration_cast<Clock::duration>(
+    std::chrono::duration<double>(1.0 / tps));
+  // Tick simulation time [s].
+  const auto tickSimulationTime = 1.0f / tps;
+
+  auto& metrics = sim::Metrics::Instance();
+  auto& bodyCount = metrics.RegisterGauge(
+    "sim_bodies", "Bodies in the simulated world.");
+  auto& tickDuration = metrics.RegisterHistogram(
+    "sim_tick_seconds", "Duration of a simulation tick, snapshot capture included.", 1e-9);
+
+  // Bodies are counted as the world reports them created and destroyed, once per flush.
+  const auto countBodies = [&bodyCount](int64_t sign) {
+    return [&bodyCount, sign](sdk::World& world, std::span<const sdk::Entity> entities) {
+      const auto bodies = std::ranges::count_if(entities, [&world](sdk::Entity entity) {
+        return world.get<sim::Body>(entity) != nullptr;
+      });
+      bodyCount.Add(sign * bodies);
+    };
+  };
+  world.onCreate(countBodies(1));
+  world.onDestroy(countBodies(-1));
+
+  auto nextTick = Clock::now();
+  while (!stop.stop_requested())
+  {
+    simulationTime += tickSimulationTime;
+
+    // Bodies are ticked and captured in place, chunk by chunk.
+    vulkan::ProfileScope tickScope("tick");
+    const auto tickStart = Clock::now();
+    world.flush();
+    auto& snapshot = snapshots.Back();
+    snapshot.Begin(simulationTime);
+    world.eachChunk<sim::Body>([&](std::span<sim::Body> bodies) {
+      // Events refer to bodies by their index in the snapshot.
+      const auto firstBody = snapshot._bodies.size();
+      dynamicsSimulator.Tick(bodies, tickSimulationTime, firstBody);
+      kinematicsSimulator.Tick(bodies, tickSimulationTime, firstBody);
+      snapshot.Append(bodies);
+    });
+    snapshot.Index();
+    events.Merge();
+    tickScope.end();
+    tickDuration.Record(Clock::now() - tickStart);
+
+    // Publishing never waits for the renderer, nor for the viewers.
+    // Both interpolate on the publication time, stamped before either publishes.
+    snapshots.Stamp();
+    if (publisher)
+      publisher->Publish(snapshot);
+    snapshots.Publish();
+
+    nextTick += timePerTick;
+    std::this_thread::sleep_until(nextTick);
+  }
+}
 
-//  sim::Environment env {
-//    ._wind = math::vec3d{0.0f}};
-//
-//  sim::BodyDynamicsSimulator dynamicsSimulator(env);
-//  sim::BodyKinematicsSimulator kinematicsSimulator(env);
-//
-//  auto body = sim::Body {
-//    ._weight = 0,
-//    ._position = {0, -25, 0}};
-//
-//
-//
-//  auto extractFloat = [](const char* data, float& value) {
-//    std::from_chars(data, data + std::strlen(data), value);
-//  };
-//
-//  if (argc >= 6) {
-//    extractFloat(argv[1], body._weight);
-//
-//    float duration = 0.0f;
-//    math::vec3f impulse(0.0f);
-//
-//    extractFloat(argv[2], impulse._right);
-//    extractFloat(argv[3], impulse._up);
-//    extractFloat(argv[4], impulse._forward);
-//    extractFloat(argv[5], duration);
-//
-//    body._impulseForces.emplace_back(
-//      math::vec3d{
-//        impulse._right,
-//        impulse._up,
-//        impulse._forward},
-//      duration);
-//  }
-//
-//  env.AddBody(body);
-//
-//  using Clock = std::chrono::high_resolution_clock;
-//
-//  // Time [s].
-//  float simulationTime = 0.0f;
-//  // Ticks per second.
-//  const int32_t tps = 128;
-//  // Time per tick [ms].
-//  const long timePerTick = 1000 / tps;
-//
-//  Clock::time_point lastTick;
-//  std::chrono::duration<float, std::chrono::milliseconds::period> lastTickDuration{};
-//
-//  bool simulation = true;
-//  while (simulation) {
-//    const auto tickNow = Clock::now();
-//    // Delta between ticks
-//    const auto tickDelta = std::chrono::duration_cast<std::chrono::milliseconds>(
-//      tickNow - lastTick);
-//
-//    if (tickDelta < std::chrono::milliseconds(timePerTick)) {
-//      std::this_thread::sleep_for(tickDelta);
-//      continue;
-//    }
-//
-//    // Tick simulation simulationTime [s].
-//    const auto tickSimulationTime = timePerTick / 1000.0f;
-//    simulationTime += tickSimulationTime;
-//
-//    dynamicsSimulator.Tick(tickSimulationTime);
-//    kinematicsSimulator.Tick(tickSimulationTime);
-//
-//    lastTick = tickNow;
-//    lastTickDuration = Clock::now() - tickNow;
-//  }
-//
-//  return 0;
+//! Hands snapshots published by a simulation process over to the renderer, until stop is requested.
+//! @param reader Reader of the shared memory of the simulation.
+void view(
+  std::stop_token stop,
+  sim::SharedSnapshotReader& reader,
+  sim::SnapshotExchange& snapshots)
+{
+  // Polled well within a tick, so that snapshots are interpolated close to their publication.
+  constexpr auto PollInterval = std::chrono::milliseconds(1);
+  // Attaching is retried less often, while there's no simulation.
+  constexpr auto AttachInterval = std::chrono::milliseconds(100);
+
+  while (!stop.stop_requested())
+  {
+    // Snapshots keep the stamps of the simulation process.
+    if (reader.Read(snapshots.Back()))
+      snapshots.Publish();
+    std::this_thread::sleep_for(reader.Attached() ? PollInterval : AttachInterval);
+  }
+}
+
+//! Simulates a region of a decomposed world, until any worker is interrupted.
+//! @param directory Directory of the sockets of the workers.
+//! @param rank Rank of this worker, the region it owns.
+//! @param workers Number of workers.
+//! @param grid Regions of the workers.
+//! @param env Environment of the bodies, its own bodies aren't simulated.
+//! @param body Body seeded into the region owning it.
+//! @param metricsPath Optional path of the metrics, suffixed by the rank.
+//! @returns Exit code.
+int work(
+  const std::filesystem::path& directory,
+  uint32_t rank,
+  uint32_t workers,
+  const sim::RegionGrid& grid,
+  sim::Environment& env,
+  const sim::Body& body,
+  const std::optional<std::filesystem::path>& metricsPath)
+{
+  using Clock = std::chrono::steady_clock;
+  // Ticks per second.
+  const int32_t tps = 128;
+  const auto timePerTick = std::chrono::duration_cast<Clock::duration>(
+    std::chrono::duration<double>(1.0 / tps));
+
+  try
+  {
+    std::optional<sim::MetricsDump> metricsDump;
+    if (metricsPath)
+      metricsDump.emplace(std::format("{}.{}", metricsPath->string(), rank));
+
+    sim::SocketTransport transport(directory, rank, workers);
+    sim::Domain domain(env, grid, transport);
+    domain.Add(body);
+
+    auto nextTick = Clock::now();
+    auto reportTime = nextTick;
+    // Workers stop together, after the tick any of them was interrupted in.
+    while (domain.Tick(1.0f / tps, terminated != 0))
+    {
+      if (nextTick - reportTime >= std::chrono::seconds(1))
+      {
+        printf("Worker %u: %zu bodies, %zu ghosts\n", rank, domain.Owned(), domain.Ghosts().size());
+        reportTime = nextTick;
+      }
+
+      nextTick += timePerTick;
+      std::this_thread::sleep_until(nextTick);
+    }
+  }
+  catch (const std::exception& exception)
+  {
+    printf("Worker %u failed: %s\n", rank, exception.what());
+    return 1;
+  }
+  return 0;
+}
+
+//! Simulates the world decomposed into regions of worker processes, until interrupted.
+//! @param workers Number of workers, regions split the world along its width.
+//! @returns Exit code.
+int decompose(
+  uint32_t workers,
+  sim::Environment& env,
+  const sim::Body& body,
+  const std::optional<std::filesystem::path>& metricsPath)
+{
+  const sim::RegionGrid grid {
+    ._min = {-64.0, 0.0, -64.0},
+    ._max = {64.0, 64.0, 64.0},
+    ._divisions = {workers, 1, 1}};
 
+  // Sockets of the workers, removed once they exit.
+  const auto directory = std::filesystem::temp_directory_path() / std::format("sim-{}", getpid());
+  std::filesystem::create_directories(directory);
+
+  // Interrupts reach the whole process group, the workers stop on their own.
+  std::signal(SIGINT, [](int) { terminated = 1; });
+  std::signal(SIGTERM, [](int) { terminated = 1; });
+
+  std::vector<pid_t> children;
+  for (uint32_t rank = 0; rank < workers; ++rank)
+  {
+    std::fflush(stdout);
+    const pid_t child = fork();
+    if (child == 0)
+    {
+      const int code = work(directory, rank, workers, grid, env, body, metricsPath);
+      std::fflush(stdout);
+      _exit(code);
+    }
+    if (child < 0)
+    {
+      printf("Couldn't start worker %u\n", rank);
+      break;
+    }
+    children.push_back(child);
+  }
+
+  int result = children.size() == workers ? 0 : 1;
+  for (const auto child : children)
+  {
+    int status = 0;
+    while (waitpid(child, &status, 0) < 0 && errno == EINTR)
+    {
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      result = 1;
+  }
+
+  std::error_code error;
+  std::filesystem::remove_all(directory, error);
+  return result;
+}
+
+//! Writes frame as a binary PPM image.
+void writeFrame(const vulkan::Frame& frame)
+{
+  std::ofstream output(
+    std::format("frame-{:05}.ppm", frame.serial), std::ios::binary);
+  output << std::format("P6\n{} {}\n255\n", frame.extent.width, frame.extent.height);
+
+  // PPM has no alpha.
+  for (size_t pixel = 0; pixel < frame.pixels.size(); pixel += 4)
+  {
+    output.write(reinterpret_cast<const char*>(frame.pixels.data() + pixel), 3);
+  }
+}
 
 int main(int argc, char** argv)
 {
+  // --offscreen <frames> renders the given number of frames into PPM images, without a window.
+  // --capture <path> captures rendered frames, into a Y4M video or raw RGBA file by extension,
+  // into a PNG sequence in a directory otherwise.
+  // --present-mode <fifo|mailbox|immediate> and --frames-in-flight <count> tune frame pacing.
+  // --record-threads <count> records the draws on the given number of threads every frame.
+  // --simulation <cpu|gpu|world> selects where bodies are simulated. World ticks them on the render
+  // thread, which draws them straight from the world, instead of snapshots of a simulation thread.
+  // --parity-check <ticks> compares the GPU simulation with the CPU one, and exits.
+  // --profile <path> profiles host scopes and device passes, and writes a Chrome trace JSON file.
+  // --metrics <path> writes metrics in the Prometheus text format to the file every second.
+  // --watch-shaders <directory> recompiles shaders edited in the directory and reloads them.
+  // --publish <name> simulates without a window, publishing snapshots to the shared memory object,
+  // such as /sim, until interrupted. --publish-capacity <bodies> bounds the published bodies.
+  // --view <name> renders snapshots published to the shared memory object by another process.
+  // --workers <count> simulates without a window in worker processes, each owning a region
+  // of the world, until interrupted.
+  uint64_t offscreenFrames = 0;
+  bool deviceSimulation = false;
+  bool worldSimulation = false;
+  uint32_t parityTicks = 0;
+  std::optional<vulkan::CaptureOptions> capture;
+  std::optional<std::filesystem::path> tracePath;
+  std::optional<std::filesystem::path> metricsPath;
+  std::optional<std::filesystem::path> shaderSources;
+  std::optional<std::string> publishName;
+  uint32_t publishCapacity = 65536;
+  std::optional<std::string> viewName;
+  uint32_t workers = 0;
+  vulkan::PresentationOptions presentation;
+  while (argc >= 3 && std::strncmp(argv[1], "--", 2) == 0)
+  {
+    if (std::strcmp(argv[1], "--offscreen") == 0)
+    {
+      std::from_chars(argv[2], argv[2] + std::strlen(argv[2]), offscreenFrames);
+    }
+    else if (std::strcmp(argv[1], "--capture") == 0)
+    {
+      const std::filesystem::path path = argv[2];
+      capture = vulkan::CaptureOptions {
+        .path = path,
+        .format = path.extension() == ".y4m"
+                    ? vulkan::CaptureFormat::Y4m
+                    : path.extension() == ".rgba"
+                        ? vulkan::CaptureFormat::Raw
+                        : vulkan::CaptureFormat::Png};
+    }
+    else if (std::strcmp(argv[1], "--present-mode") == 0)
+    {
+      if (std::strcmp(argv[2], "mailbox") == 0)
+        presentation.presentMode = vk::PresentModeKHR::eMailbox;
+      else if (std::strcmp(argv[2], "immediate") == 0)
+        presentation.presentMode = vk::PresentModeKHR::eImmediate;
+      else
+        presentation.presentMode = vk::PresentModeKHR::eFifo;
+    }
+    else if (std::strcmp(argv[1], "--frames-in-flight") == 0)
+    {
+      std::from_chars(argv[2], argv[2] + std::strlen(argv[2]), presentation.framesInFlight);
+    }
+    else if (std::strcmp(argv[1], "--record-threads") == 0)
+    {
+      std::from_chars(argv[2], argv[2] + std::strlen(argv[2]), presentation.recordThreads);
+    }
+    else if (std::strcmp(argv[1], "--simulation") == 0)
+    {
+      deviceSimulation = std::strcmp(argv[2], "gpu") == 0;
+      worldSimulation = std::strcmp(argv[2], "world") == 0;
+    }
+    else if (std::strcmp(argv[1], "--parity-check") == 0)
+    {
+      std::from_chars(argv[2], argv[2] + std::strlen(argv[2]), parityTicks);
+    }
+    else if (std::strcmp(argv[1], "--profile") == 0)
+    {
+      tracePath = argv[2];
+    }
+    else if (std::strcmp(argv[1], "--metrics") == 0)
+    {
+      metricsPath = argv[2];
+    }
+    else if (std::strcmp(argv[1], "--watch-shaders") == 0)
+    {
+      shaderSources = argv[2];
+    }
+    else if (std::strcmp(argv[1], "--publish") == 0)
+    {
+      publishName = argv[2];
+    }
+    else if (std::strcmp(argv[1], "--publish-capacity") == 0)
+    {
+      std::from_chars(argv[2], argv[2] + std::strlen(argv[2]), publishCapacity);
+    }
+    else if (std::strcmp(argv[1], "--view") == 0)
+    {
+      viewName = argv[2];
+    }
+    else if (std::strcmp(argv[1], "--workers") == 0)
+    {
+      std::from_chars(argv[2], argv[2] + std::strlen(argv[2]), workers);
+    }
+    else
+    {
+      std::cerr << "Unknown option " << argv[1] << std::endl;
+      return 1;
+    }
+
+    argc -= 2;
+    argv += 2;
+  }
+
+  sim::Environment env {
+    ._wind = math::vec3d{0.0f}};
+
+  auto body = sim::Body {
+    ._weight = 1,
+    ._position = {0, 0, 0}};
+
+  auto extractFloat = [](const char* data, float& value) {
+    std::from_chars(data, data + std::strlen(data), value);
+  };
+
+  if (argc >= 6) {
+    extractFloat(argv[1], body._weight);
+
+    float duration = 0.0f;
+    math::vec3f impulse(0.0f);
+
+    extractFloat(argv[2], impulse._right);
+    extractFloat(argv[3], impulse._up);
+    extractFloat(argv[4], impulse._forward);
+    extractFloat(argv[5], duration);
+
+    body._impulseForces.emplace_back(
+      math::vec3d{
+        impulse._right,
+        impulse._up,
+        impulse._forward},
+      duration);
+  }
+
+  // Forked before any thread starts.
+  if (workers > 0)
+    return decompose(workers, env, body, metricsPath);
+
+  vulkan::Engine engine;
+  if (tracePath)
+    engine.profile(*tracePath);
+  if (shaderSources)
+    engine.watchShaders(*shaderSources);
+
+  // Declared before the simulation, so that the last dump follows its final tick.
+  std::optional<sim::MetricsDump> metricsDump;
+  if (metricsPath)
+    metricsDump.emplace(*metricsPath);
+
+  if (parityTicks > 0)
+  {
+    env.AddBody(body);
+    // Relative difference tolerated between the single precision device and the host.
+    constexpr double Tolerance = 1e-3;
+    const auto report = engine.checkSimulationParity(env, parityTicks);
+    printf("Simulation parity after %u ticks of %zu bodies: position %.2e, velocity %.2e\n",
+           parityTicks, report.bodies, report.position, report.velocity);
+    return report.position <= Tolerance && report.velocity <= Tolerance ? 0 : 1;
+  }
+
+  // Bodies simulated on the device, or ticked in the world by the render thread, are drawn without snapshots.
+  sim::SnapshotExchange snapshots;
+  sdk::World world;
+  std::optional<sim::SharedSnapshotPublisher> publisher;
+  std::optional<sim::SharedSnapshotReader> reader;
+  std::jthread simulation;
+  if (publishName)
+  {
+    // Headless, the simulation runs undisturbed until interrupted.
+    publisher.emplace(*publishName, publishCapacity);
+    world.create(std::move(body));
+    std::signal(SIGINT, [](int) { terminated = 1; });
+    std::signal(SIGTERM, [](int) { terminated = 1; });
+    simulation = std::jthread(
+      simulate, std::ref(env), std::ref(world), std::ref(snapshots), &*publisher);
+    while (!terminated)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    simulation.request_stop();
+    simulation.join();
+    return 0;
+  }
+  else if (viewName)
+  {
+    // Bodies are simulated by another process.
+    reader.emplace(*viewName);
+    simulation = std::jthread(view, std::ref(*reader), std::ref(snapshots));
+  }
+  else if (deviceSimulation)
+  {
+    env.AddBody(body);
+    engine.simulateOnDevice(env);
+  }
+  else if (worldSimulation)
+  {
+    // Body is launched by an actor at the origin, which stays marked by an entity without a body.
+    const sdk::Actor launcher;
+    world.spawn(launcher, std::move(body));
+    world.spawn(launcher);
+    engine.simulateWorld(world, env);
+  }
+  else
+  {
+    world.create(std::move(body));
+    simulation = std::jthread(
+      simulate, std::ref(env), std::ref(world), std::ref(snapshots), nullptr);
+  }
+  auto* const exchange = deviceSimulation || worldSimulation ? nullptr : &snapshots;
+
   sdk::State state;
   state.getActiveCamera()
     .translate({-5.0f, -6.0f, -10.0f});
 
+  engine.presentation(presentation);
+  if (capture)
+    engine.capture(*capture);
 
-
-  vulkan::Engine engine;
-  engine.run(state);
+  if (offscreenFrames > 0)
+  {
+    engine.runOffscreen(
+      state,
+      vulkan::OffscreenOptions {
+        .frameCount = offscreenFrames,
+        .sink = writeFrame},
+      exchange);
+  }
+  else
+  {
+    engine.run(state, exchange);
+  }
 
   return 0;
 }
@@ -0,0 +1,372 @@
+//
+// Created by maros on 07.12.2023.
+//
+
+#include "sim/memory.hpp"
+#include "sim/metrics.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <format>
+#include <stdexcept>
+#include <utility>
+
+namespace
+{
+
+//! @returns Order of the smallest buddy node holding size.
+uint32_t nodeOrder(vk::DeviceSize size, vk::DeviceSize minNodeSize)
+{
+  const auto nodes = std::max<vk::DeviceSize>(1, (size + minNodeSize - 1) / minNodeSize);
+  return static_cast<uint32_t>(std::bit_width(std::bit_ceil(nodes)) - 1);
+}
+
+//! Metrics of the device memory.
+struct MemoryMetrics
+{
+  sim::Counter& allocations;
+  //! Bytes handed out to allocations.
+  sim::Gauge& used;
+  //! Bytes allocated from the device.
+  sim::Gauge& reserved;
+};
+
+//! @returns Metrics of the device memory, registered on first use.
+const MemoryMetrics& memoryMetrics()
+{
+  auto& metrics = sim::Metrics::Instance();
+  static const MemoryMetrics memoryMetrics {
+    .allocations = metrics.RegisterCounter(
+      "gpu_allocations_total", "Device memory allocations handed out."),
+    .used = metrics.RegisterGauge(
+      "gpu_memory_used_bytes", "Device memory handed out to allocations."),
+    .reserved = metrics.RegisterGauge(
+      "gpu_memory_reserved_bytes", "Device memory allocated from the device.")};
+  return memoryMetrics;
+}
+
+}// namespace
+
+namespace vulkan
+{
+
+Allocation::Allocation(Allocation&& rhs) noexcept
+    : _allocator(std::exchange(rhs._allocator, nullptr))
+    , _block(std::exchange(rhs._block, nullptr))
+    , _memoryType(rhs._memoryType)
+    , _kind(rhs._kind)
+    , _offset(rhs._offset)
+    , _order(rhs._order)
+{
+}
+
+Allocation& Allocation::operator=(Allocation&& rhs) noexcept
+{
+  if (this == &rhs)
+    return *this;
+
+  if (_allocator)
+    _allocator->free(*this);
+
+  _allocator = std::exchange(rhs._allocator, nullptr);
+  _block = std::exchange(rhs._block, nullptr);
+  _memoryType = rhs._memoryType;
+  _kind = rhs._kind;
+  _offset = rhs._offset;
+  _order = rhs._order;
+  return *this;
+}
+
+Allocation::~Allocation()
+{
+  if (_allocator)
+    _allocator->free(*this);
+}
+
+Allocator::Allocator(
+  const vkr::PhysicalDevice& physicalDevice,
+  const vkr::Device& device,
+  vk::DeviceSize blockSize)
+    : _device(device)
+    , _memoryProperties(physicalDevice.getMemoryProperties())
+    , _bufferImageGranularity(physicalDevice.getProperties().limits.bufferImageGranularity)
+{
+  // Small heaps, such as the host visible part of device memory, get smaller blocks.
+  for (uint32_t memoryType = 0; memoryType < _memoryProperties.memoryTypeCount; ++memoryType)
+  {
+    const auto heapSize = _memoryProperties.memoryHeaps[
+      _memoryProperties.memoryTypes[memoryType].heapIndex].size;
+    _blockSizes[memoryType] = std::max(
+      MinNodeSize,
+      std::min(std::bit_floor(blockSize), std::bit_floor(heapSize / 8)));
+  }
+}
+
+Allocation Allocator::allocate(
+  const vk::MemoryRequirements& requirements,
+  vk::MemoryPropertyFlags properties,
+  ResourceKind kind)
+{
+  const auto type = memoryType(requirements.memoryTypeBits, properties);
+  const auto blockSize = _blockSizes[type];
+
+  // Buddy nodes are aligned to their size.
+  const auto order = nodeOrder(
+    std::max(requirements.size, requirements.alignment), MinNodeSize);
+  const auto nodeSize = MinNodeSize << order;
+
+  std::scoped_lock lock(_mutex);
+
+  Allocation allocation;
+  allocation._memoryType = type;
+  allocation._kind = kind;
+
+  // Allocations bigger than half of a block get their own.
+  if (nodeSize > blockSize / 2)
+  {
+    auto& block = createBlock(type, kind, requirements.size, true);
+    block.used = requirements.size;
+    block.allocations = 1;
+    memoryMetrics().allocations.Add();
+    memoryMetrics().used.Add(static_cast<int64_t>(block.used));
+
+    allocation._allocator = this;
+    allocation._block = &block;
+    return allocation;
+  }
+
+  auto& blocks = pool(type, kind);
+  const auto maxOrder = nodeOrder(blockSize, MinNodeSize);
+
+  MemoryBlock* target = nullptr;
+  uint32_t freeOrder = 0;
+  for (const auto& block: blocks)
+  {
+    if (block->dedicated)
+      continue;
+
+    for (freeOrder = order; freeOrder <= maxOrder; ++freeOrder)
+    {
+      if (!block->freeNodes[freeOrder].empty())
+        break;
+    }
+
+    if (freeOrder <= maxOrder)
+    {
+      target = block.get();
+      break;
+    }
+  }
+
+  if (!target)
+  {
+    target = &createBlock(type, kind, blockSize, false);
+    freeOrder = maxOrder;
+  }
+
+  // Take the free node and split it down to the requested order.
+  auto& freeNodes = target->freeNodes;
+  const auto offset = *freeNodes[freeOrder].begin();
+  freeNodes[freeOrder].erase(freeNodes[freeOrder].begin());
+  while (freeOrder > order)
+  {
+    freeOrder--;
+    freeNodes[freeOrder].insert(offset + (MinNodeSize << freeOrder));
+  }
+
+  target->used += nodeSize;
+  target->allocations++;
+  memoryMetrics().allocations.Add();
+  memoryMetrics().used.Add(static_cast<int64_t>(nodeSize));
+
+  allocation._allocator = this;
+  allocation._block = target;
+  allocation._offset = offset;
+  allocation._order = order;
+  return allocation;
+}
+
+Allocation Allocator::bind(
+  const vkr::Buffer& buffer,
+  vk::MemoryPropertyFlags properties)
+{
+  auto allocation = allocate(
+    buffer.getMemoryRequirements(), properties, ResourceKind::Linear);
+  buffer.bindMemory(allocation.memory(), allocation.offset());
+  return allocation;
+}
+
+Allocation Allocator::bind(
+  const vkr::Image& image,
+  vk::MemoryPropertyFlags properties,
+  vk::ImageTiling tiling)
+{
+  auto allocation = allocate(
+    image.getMemoryRequirements(),
+    properties,
+    tiling == vk::ImageTiling::eOptimal ? ResourceKind::Optimal : ResourceKind::Linear);
+  image.bindMemory(allocation.memory(), allocation.offset());
+  return allocation;
+}
+
+uint32_t Allocator::memoryType(
+  uint32_t memoryTypeBits, vk::MemoryPropertyFlags properties) const
+{
+  for (uint32_t memoryTypeIndex = 0; memoryTypeIndex < _memoryProperties.memoryTypeCount; ++memoryTypeIndex)
+  {
+    const auto memoryTypeBit = 1u << memoryTypeIndex;
+    if ((memoryTypeBits & memoryTypeBit)
+        && (_memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & properties) == properties)
+    {
+      return memoryTypeIndex;
+    }
+  }
+
+  throw std::runtime_error("No memory type satisfying the requirements found.");
+}
+
+MemoryStatistics Allocator::statistics(uint32_t memoryType) const
+{
+  std::scoped_lock lock(_mutex);
+
+  MemoryStatistics statistics;
+  for (const auto& blocks: _pools[memoryType])
+  {
+    for (const auto& block: blocks)
+    {
+      statistics.blocks++;
+      statistics.dedicatedBlocks += block->dedicated ? 1 : 0;
+      statistics.allocations += block->allocations;
+      statistics.reserved += block->size;
+      statistics.used += block->used;
+    }
+  }
+  return statistics;
+}
+
+MemoryStatistics Allocator::statistics() const
+{
+  MemoryStatistics total;
+  for (uint32_t memoryType = 0; memoryType < _memoryProperties.memoryTypeCount; ++memoryType)
+  {
+    const auto statistics = this->statistics(memoryType);
+    total.blocks += statistics.blocks;
+    total.dedicatedBlocks += statistics.dedicatedBlocks;
+    total.allocations += statistics.allocations;
+    total.reserved += statistics.reserved;
+    total.used += statistics.used;
+  }
+  return total;
+}
+
+std::string Allocator::report() const
+{
+  std::string report;
+  for (uint32_t memoryType = 0; memoryType < _memoryProperties.memoryTypeCount; ++memoryType)
+  {
+    const auto statistics = this->statistics(memoryType);
+    if (statistics.blocks == 0)
+      continue;
+
+    report += std::format(
+      "Memory type {} (heap {}, {}): {} blocks ({} dedicated), {} allocations, {} KiB used of {} KiB\n",
+      memoryType,
+      _memoryProperties.memoryTypes[memoryType].heapIndex,
+      vk::to_string(_memoryProperties.memoryTypes[memoryType].propertyFlags),
+      statistics.blocks,
+      statistics.dedicatedBlocks,
+      statistics.allocations,
+      statistics.used / 1024,
+      statistics.reserved / 1024);
+  }
+  return report;
+}
+
+void Allocator::free(Allocation& allocation) noexcept
+{
+  std::scoped_lock lock(_mutex);
+
+  auto* block = allocation._block;
+  auto& blocks = pool(allocation._memoryType, allocation._kind);
+
+  allocation._allocator = nullptr;
+  allocation._block = nullptr;
+
+  block->allocations--;
+  if (block->dedicated)
+  {
+    memoryMetrics().used.Add(-static_cast<int64_t>(block->used));
+    memoryMetrics().reserved.Add(-static_cast<int64_t>(block->size));
+    std::erase_if(blocks, [block](const auto& candidate) { return candidate.get() == block; });
+    return;
+  }
+
+  // Merge the node with its free buddies.
+  auto offset = allocation._offset;
+  auto order = allocation._order;
+  const auto maxOrder = static_cast<uint32_t>(block->freeNodes.size() - 1);
+  block->used -= MinNodeSize << order;
+  memoryMetrics().used.Add(-static_cast<int64_t>(MinNodeSize << order));
+
+  while (order < maxOrder)
+  {
+    const auto buddy = offset ^ (MinNodeSize << order);
+    if (block->freeNodes[order].erase(buddy) == 0)
+      break;
+
+    offset = std::min(offset, buddy);
+    order++;
+  }
+  block->freeNodes[order].insert(offset);
+
+  // Release empty blocks, keeping one around to avoid churn.
+  if (block->allocations == 0)
+  {
+    const auto sharedBlocks = std::ranges::count_if(
+      blocks, [](const auto& candidate) { return !candidate->dedicated; });
+    if (sharedBlocks > 1)
+    {
+      memoryMetrics().reserved.Add(-static_cast<int64_t>(block->size));
+      std::erase_if(blocks, [block](const auto& candidate) { return candidate.get() == block; });
+    }
+  }
+}
+
+MemoryBlock& Allocator::createBlock(
+  uint32_t memoryType, ResourceKind kind, vk::DeviceSize size, bool dedicated)
+{
+  auto block = std::make_unique<MemoryBlock>(MemoryBlock {
+    .memory = vkr::DeviceMemory(
+      _device,
+      vk::MemoryAllocateInfo {
+        .allocationSize = size,
+        .memoryTypeIndex = memoryType}),
+    .size = size,
+    .dedicated = dedicated});
+
+  if (_memoryProperties.memoryTypes[memoryType].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible)
+  {
+    block->mapped = static_cast<std::byte*>(
+      block->memory.mapMemory(0, VK_WHOLE_SIZE));
+  }
+
+  if (!dedicated)
+  {
+    // Whole block starts as a single free node of the highest order.
+    block->freeNodes.resize(nodeOrder(size, MinNodeSize) + 1);
+    block->freeNodes.back().insert(0);
+  }
+
+  memoryMetrics().reserved.Add(static_cast<int64_t>(size));
+  return *pool(memoryType, kind).emplace_back(std::move(block));
+}
+
+std::vector<std::unique_ptr<MemoryBlock>>& Allocator::pool(uint32_t memoryType, ResourceKind kind)
+{
+  // Buddy nodes never share a granularity page when the granularity is within the smallest node,
+  // so linear and optimal resources may share blocks.
+  const bool separate = _bufferImageGranularity > MinNodeSize;
+  return _pools[memoryType][separate && kind == ResourceKind::Optimal ? 1 : 0];
+}
+
+}// namespace vulkan
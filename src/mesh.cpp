@@ -0,0 +1,436 @@
+//
+// Created by maros on 03.12.2023.
+//
+
+#include "sim/mesh.hpp"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+namespace
+{
+
+//! Simulated vertex cache size.
+constexpr int32_t CacheSize = 32;
+
+//! Vertex score used by the Forsyth optimisation.
+//! @param cachePosition Position of the vertex in the cache, -1 if not cached.
+//! @param remaining Number of triangles not yet emitted using the vertex.
+float vertexScore(int32_t cachePosition, uint32_t remaining)
+{
+  constexpr float CacheDecayPower = 1.5f;
+  constexpr float LastTriangleScore = 0.75f;
+  constexpr float ValenceBoostScale = 2.0f;
+  constexpr float ValenceBoostPower = 0.5f;
+
+  // Vertex is no longer used.
+  if (remaining == 0)
+    return -1.0f;
+
+  float score = 0.0f;
+  if (cachePosition >= 0)
+  {
+    // Vertices of the last triangle get a fixed score,
+    // so that the optimisation doesn't prefer strips.
+    if (cachePosition < 3)
+      score = LastTriangleScore;
+    else
+      score = std::pow(
+        1.0f - static_cast<float>(cachePosition - 3) / (CacheSize - 3),
+        CacheDecayPower);
+  }
+
+  // Boost vertices with few triangles left, so that they get finished off.
+  score += ValenceBoostScale * std::pow(static_cast<float>(remaining), -ValenceBoostPower);
+  return score;
+}
+
+}// namespace
+
+std::vector<std::byte> mesh::Mesh::packedIndices() const
+{
+  std::vector<std::byte> packed;
+  if (indexWidth() == IndexWidth::U32)
+  {
+    packed.resize(indices.size() * sizeof(uint32_t));
+    std::memcpy(packed.data(), indices.data(), packed.size());
+    return packed;
+  }
+
+  packed.resize(indices.size() * sizeof(uint16_t));
+  auto* narrow = reinterpret_cast<uint16_t*>(packed.data());
+  for (size_t i = 0; i < indices.size(); ++i)
+  {
+    narrow[i] = static_cast<uint16_t>(indices[i]);
+  }
+  return packed;
+}
+
+mesh::Sphere mesh::Mesh::boundingSphere() const
+{
+  if (vertices.empty())
+    return {};
+
+  auto minimum = vertices.front().pos;
+  auto maximum = vertices.front().pos;
+  for (const auto& vertex : vertices)
+  {
+    minimum = glm::min(minimum, vertex.pos);
+    maximum = glm::max(maximum, vertex.pos);
+  }
+
+  const auto center = (minimum + maximum) * 0.5f;
+  float radiusSquared = 0.0f;
+  for (const auto& vertex : vertices)
+  {
+    const auto offset = vertex.pos - center;
+    radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+  }
+  return {.center = center, .radius = std::sqrt(radiusSquared)};
+}
+
+void mesh::optimizeVertexCache(Mesh& mesh)
+{
+  const auto vertexCount = mesh.vertices.size();
+  const auto triangleCount = mesh.indices.size() / 3;
+  if (triangleCount == 0)
+    return;
+
+  // Triangles adjacent to each vertex, in compressed rows.
+  std::vector<uint32_t> remaining(vertexCount, 0);
+  for (const auto index: mesh.indices)
+  {
+    remaining[index]++;
+  }
+
+  std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+  for (size_t vertex = 0; vertex < vertexCount; ++vertex)
+  {
+    adjacencyOffsets[vertex + 1] = adjacencyOffsets[vertex] + remaining[vertex];
+  }
+
+  std::vector<uint32_t> adjacency(mesh.indices.size());
+  {
+    std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+    for (size_t triangle = 0; triangle < triangleCount; ++triangle)
+    {
+      for (size_t corner = 0; corner < 3; ++corner)
+      {
+        adjacency[fill[mesh.indices[triangle * 3 + corner]]++] = static_cast<uint32_t>(triangle);
+      }
+    }
+  }
+
+  std::vector<float> vertexScores(vertexCount);
+  for (size_t vertex = 0; vertex < vertexCount; ++vertex)
+  {
+    vertexScores[vertex] = vertexScore(-1, remaining[vertex]);
+  }
+
+  std::vector<bool> emitted(triangleCount, false);
+  std::vector<float> triangleScores(triangleCount);
+  for (size_t triangle = 0; triangle < triangleCount; ++triangle)
+  {
+    triangleScores[triangle] = vertexScores[mesh.indices[triangle * 3 + 0]]
+                               + vertexScores[mesh.indices[triangle * 3 + 1]]
+                               + vertexScores[mesh.indices[triangle * 3 + 2]];
+  }
+
+  // Cache holds three extra entries for the vertices of the emitted triangle.
+  std::vector<uint32_t> cache;
+  std::vector<uint32_t> nextCache;
+  cache.reserve(CacheSize + 3);
+  nextCache.reserve(CacheSize + 3);
+
+  std::vector<uint32_t> optimized;
+  optimized.reserve(mesh.indices.size());
+
+  // Scan cursor for when the cache yields no candidate triangle.
+  size_t scan = 0;
+  int64_t best = -1;
+
+  for (size_t emittedCount = 0; emittedCount < triangleCount; ++emittedCount)
+  {
+    if (best < 0)
+    {
+      // Pick the best triangle that isn't emitted yet.
+      float bestScore = -1.0f;
+      while (emitted[scan])
+        ++scan;
+      for (size_t triangle = scan; triangle < triangleCount; ++triangle)
+      {
+        if (!emitted[triangle] && triangleScores[triangle] > bestScore)
+        {
+          bestScore = triangleScores[triangle];
+          best = static_cast<int64_t>(triangle);
+        }
+      }
+    }
+
+    const auto triangle = static_cast<size_t>(best);
+    emitted[triangle] = true;
+
+    // Emit triangle and move its vertices to the front of the cache.
+    nextCache.clear();
+    for (size_t corner = 0; corner < 3; ++corner)
+    {
+      const auto vertex = mesh.indices[triangle * 3 + corner];
+      optimized.push_back(vertex);
+      nextCache.push_back(vertex);
+
+      // Remove triangle from the vertex adjacency.
+      const auto begin = adjacency.begin() + adjacencyOffsets[vertex];
+      const auto end = begin + remaining[vertex];
+      std::iter_swap(std::find(begin, end, triangle), end - 1);
+      remaining[vertex]--;
+    }
+
+    for (const auto vertex: cache)
+    {
+      if (std::find(nextCache.begin(), nextCache.end(), vertex) == nextCache.end())
+        nextCache.push_back(vertex);
+    }
+
+    // Vertices pushed out of the cache.
+    for (size_t position = CacheSize; position < nextCache.size(); ++position)
+    {
+      vertexScores[nextCache[position]] = vertexScore(-1, remaining[nextCache[position]]);
+    }
+    if (nextCache.size() > CacheSize)
+      nextCache.resize(CacheSize);
+
+    for (size_t position = 0; position < nextCache.size(); ++position)
+    {
+      const auto vertex = nextCache[position];
+      vertexScores[vertex] = vertexScore(static_cast<int32_t>(position), remaining[vertex]);
+    }
+
+    // Rescore triangles touching the cache and pick the best one among them.
+    best = -1;
+    float bestScore = -1.0f;
+    for (const auto vertex: nextCache)
+    {
+      const auto begin = adjacencyOffsets[vertex];
+      for (auto i = begin; i < begin + remaining[vertex]; ++i)
+      {
+        const auto candidate = adjacency[i];
+        const float score = vertexScores[mesh.indices[candidate * 3 + 0]]
+                            + vertexScores[mesh.indices[candidate * 3 + 1]]
+                            + vertexScores[mesh.indices[candidate * 3 + 2]];
+        triangleScores[candidate] = score;
+
+        if (score > bestScore)
+        {
+          bestScore = score;
+          best = candidate;
+        }
+      }
+    }
+
+    std::swap(cache, nextCache);
+  }
+
+  mesh.indices = std::move(optimized);
+}
+
+void mesh::optimizeVertexFetch(Mesh& mesh)
+{
+  constexpr auto Unassigned = std::numeric_limits<uint32_t>::max();
+
+  std::vector<uint32_t> remap(mesh.vertices.size(), Unassigned);
+  std::vector<Vertex> vertices;
+  vertices.reserve(mesh.vertices.size());
+
+  for (auto& index: mesh.indices)
+  {
+    if (remap[index] == Unassigned)
+    {
+      remap[index] = static_cast<uint32_t>(vertices.size());
+      vertices.push_back(mesh.vertices[index]);
+    }
+    index = remap[index];
+  }
+
+  // Unreferenced vertices are dropped.
+  mesh.vertices = std::move(vertices);
+}
+
+void mesh::optimize(Mesh& mesh)
+{
+  optimizeVertexCache(mesh);
+  optimizeVertexFetch(mesh);
+}
+
+mesh::Mesh mesh::simplify(const Mesh& mesh, uint32_t resolution)
+{
+  if (mesh.vertices.empty() || resolution == 0)
+    return mesh;
+
+  auto minimum = mesh.vertices.front().pos;
+  auto maximum = mesh.vertices.front().pos;
+  for (const auto& vertex : mesh.vertices)
+  {
+    minimum = glm::min(minimum, vertex.pos);
+    maximum = glm::max(maximum, vertex.pos);
+  }
+
+  const auto extent = maximum - minimum;
+  const auto cellSize = std::max({extent.x, extent.y, extent.z}) / static_cast<float>(resolution);
+  if (cellSize <= 0.0f)
+    return mesh;
+
+  // Cells are keyed by their coordinates packed into 21 bits each.
+  const auto cellKey = [&](const glm::vec3& position) {
+    const auto cell = glm::min(
+      glm::uvec3((position - minimum) / cellSize),
+      glm::uvec3(resolution - 1));
+    return uint64_t(cell.x) | uint64_t(cell.y) << 21 | uint64_t(cell.z) << 42;
+  };
+
+  Mesh simplified;
+  std::unordered_map<uint64_t, uint32_t> cells;
+  std::vector<uint32_t> remap(mesh.vertices.size());
+  std::vector<uint32_t> counts;
+  for (size_t index = 0; index < mesh.vertices.size(); ++index)
+  {
+    const auto& position = mesh.vertices[index].pos;
+    const auto [cell, inserted] = cells.try_emplace(
+      cellKey(position), static_cast<uint32_t>(simplified.vertices.size()));
+    if (inserted)
+    {
+      simplified.vertices.push_back({{0.0f, 0.0f, 0.0f}});
+      counts.push_back(0);
+    }
+
+    remap[index] = cell->second;
+    simplified.vertices[cell->second].pos += position;
+    counts[cell->second]++;
+  }
+
+  for (size_t index = 0; index < simplified.vertices.size(); ++index)
+  {
+    simplified.vertices[index].pos /= static_cast<float>(counts[index]);
+  }
+
+  for (size_t triangle = 0; triangle + 2 < mesh.indices.size(); triangle += 3)
+  {
+    const auto a = remap[mesh.indices[triangle]];
+    const auto b = remap[mesh.indices[triangle + 1]];
+    const auto c = remap[mesh.indices[triangle + 2]];
+    if (a == b || b == c || a == c)
+      continue;
+
+    simplified.indices.insert(simplified.indices.end(), {a, b, c});
+  }
+
+  optimize(simplified);
+  return simplified;
+}
+
+mesh::Mesh mesh::cube()
+{
+  Mesh cube {
+    .vertices = {
+      {{-1.0f, -1.0f, +1.0f}},
+      {{+1.0f, -1.0f, +1.0f}},
+      {{-1.0f, +1.0f, +1.0f}},
+      {{+1.0f, +1.0f, +1.0f}},
+      {{+1.0f, -1.0f, -1.0f}},
+      {{-1.0f, -1.0f, -1.0f}},
+      {{+1.0f, +1.0f, -1.0f}},
+      {{-1.0f, +1.0f, -1.0f}},
+    },
+    .indices = {
+      // front
+      0, 1, 2, 2, 1, 3,
+      // back
+      4, 5, 6, 6, 5, 7,
+      // right
+      1, 4, 3, 3, 4, 6,
+      // left
+      5, 0, 7, 7, 0, 2,
+      // top
+      2, 3, 7, 7, 3, 6,
+      // bottom
+      5, 4, 0, 0, 4, 1,
+    }};
+
+  optimize(cube);
+  return cube;
+}
+
+mesh::Mesh mesh::load(const std::filesystem::path& path)
+{
+  std::ifstream input(path);
+  if (!input)
+    throw std::runtime_error(
+      std::format("Couldn't open mesh at '{}'", path.string()));
+
+  Mesh mesh;
+  std::string line;
+  std::vector<uint32_t> polygon;
+  size_t lineNumber = 0;
+
+  while (std::getline(input, line))
+  {
+    lineNumber++;
+    std::istringstream tokens(line);
+    std::string keyword;
+    tokens >> keyword;
+
+    if (keyword == "v")
+    {
+      Vertex vertex{};
+      if (!(tokens >> vertex.pos.x >> vertex.pos.y >> vertex.pos.z))
+        throw std::runtime_error(
+          std::format("Malformed vertex in '{}' on line {}", path.string(), lineNumber));
+      mesh.vertices.push_back(vertex);
+    }
+    else if (keyword == "f")
+    {
+      polygon.clear();
+      std::string corner;
+      while (tokens >> corner)
+      {
+        // Only the position index is used, texture and normal indices are skipped.
+        int64_t index = 0;
+        const auto [end, error] = std::from_chars(
+          corner.data(), corner.data() + corner.size(), index);
+        if (error != std::errc{} || index == 0)
+          throw std::runtime_error(
+            std::format("Malformed face in '{}' on line {}", path.string(), lineNumber));
+
+        // Negative indices are relative to the end of the vertex list.
+        const auto resolved = index < 0
+                                ? static_cast<int64_t>(mesh.vertices.size()) + index
+                                : index - 1;
+        if (resolved < 0 || resolved >= static_cast<int64_t>(mesh.vertices.size()))
+          throw std::runtime_error(
+            std::format("Vertex index out of range in '{}' on line {}", path.string(), lineNumber));
+        polygon.push_back(static_cast<uint32_t>(resolved));
+      }
+
+      if (polygon.size() < 3)
+        throw std::runtime_error(
+          std::format("Degenerate face in '{}' on line {}", path.string(), lineNumber));
+
+      for (size_t i = 1; i + 1 < polygon.size(); ++i)
+      {
+        mesh.indices.insert(mesh.indices.end(), {polygon[0], polygon[i], polygon[i + 1]});
+      }
+    }
+  }
+
+  optimize(mesh);
+  return mesh;
+}
@@ -0,0 +1,226 @@
+//
+// Created by maros on 18.12.2023.
+//
+
+#include "sim/metrics.hpp"
+
+#include <bit>
+#include <cmath>
+#include <cstdio>
+#include <exception>
+#include <format>
+#include <fstream>
+#include <stdexcept>
+
+namespace sim
+{
+
+uint64_t Counter::Value() const noexcept
+{
+  uint64_t value = 0;
+  for (const auto& shard : _shards)
+  {
+    value += shard.value.load(std::memory_order_relaxed);
+  }
+  return value;
+}
+
+size_t Counter::ShardIndex() noexcept
+{
+  // Threads take shards round robin, in the order they first count.
+  static std::atomic<size_t> nextShard = 0;
+  thread_local const size_t shard = nextShard.fetch_add(1, std::memory_order_relaxed) % Shards;
+  return shard;
+}
+
+uint32_t Histogram::BucketOf(uint64_t value) noexcept
+{
+  // Values below the sub buckets are exact, the rest keep their leading bits.
+  if (value < SubBuckets)
+    return static_cast<uint32_t>(value);
+
+  const auto shift = static_cast<uint32_t>(std::bit_width(value)) - SubBucketBits - 1;
+  const auto subBucket = static_cast<uint32_t>(value >> shift) - SubBuckets;
+  return (shift + 1) * SubBuckets + subBucket;
+}
+
+uint64_t Histogram::UpperBound(uint32_t bucket) noexcept
+{
+  if (bucket < SubBuckets)
+    return bucket;
+
+  const auto shift = bucket / SubBuckets - 1;
+  const auto leading = uint64_t(SubBuckets + bucket % SubBuckets);
+  // Wraps to the largest value for the last bucket.
+  return ((leading + 1) << shift) - 1;
+}
+
+uint64_t Histogram::Quantile(double fraction) const noexcept
+{
+  const auto count = Count();
+  if (count == 0)
+    return 0;
+
+  const auto rank = std::max<uint64_t>(
+    1, static_cast<uint64_t>(std::ceil(fraction * static_cast<double>(count))));
+  uint64_t cumulative = 0;
+  for (uint32_t bucket = 0; bucket < Buckets; ++bucket)
+  {
+    cumulative += _buckets[bucket].load(std::memory_order_relaxed);
+    if (cumulative >= rank)
+      return std::min(UpperBound(bucket), _maximum.load(std::memory_order_relaxed));
+  }
+  return _maximum.load(std::memory_order_relaxed);
+}
+
+Metrics& Metrics::Instance()
+{
+  static Metrics metrics;
+  return metrics;
+}
+
+Metrics::Entry& Metrics::Find(std::string_view name, std::string_view help)
+{
+  for (const auto& entry : _entries)
+  {
+    if (entry->name == name)
+      return *entry;
+  }
+
+  return *_entries.emplace_back(std::make_unique<Entry>(Entry {
+    .name = std::string(name),
+    .help = std::string(help)}));
+}
+
+Counter& Metrics::RegisterCounter(std::string_view name, std::string_view help)
+{
+  std::scoped_lock lock(_mutex);
+  auto& entry = Find(name, help);
+  if (entry.gauge || entry.histogram)
+    throw std::runtime_error(std::format("Metric '{}' isn't a counter.", name));
+  if (!entry.counter)
+    entry.counter = std::make_unique<Counter>();
+  return *entry.counter;
+}
+
+Gauge& Metrics::RegisterGauge(std::string_view name, std::string_view help)
+{
+  std::scoped_lock lock(_mutex);
+  auto& entry = Find(name, help);
+  if (entry.counter || entry.histogram)
+    throw std::runtime_error(std::format("Metric '{}' isn't a gauge.", name));
+  if (!entry.gauge)
+    entry.gauge = std::make_unique<Gauge>();
+  return *entry.gauge;
+}
+
+Histogram& Metrics::RegisterHistogram(std::string_view name, std::string_view help, double unit)
+{
+  std::scoped_lock lock(_mutex);
+  auto& entry = Find(name, help);
+  if (entry.counter || entry.gauge)
+    throw std::runtime_error(std::format("Metric '{}' isn't a histogram.", name));
+  if (!entry.histogram)
+    entry.histogram = std::make_unique<Histogram>(unit);
+  return *entry.histogram;
+}
+
+std::string Metrics::Exposition() const
+{
+  std::scoped_lock lock(_mutex);
+
+  std::string exposition;
+  for (const auto& entry : _entries)
+  {
+    exposition += std::format("# HELP {} {}\n", entry->name, entry->help);
+    if (entry->counter)
+    {
+      exposition += std::format(
+        "# TYPE {0} counter\n{0} {1}\n", entry->name, entry->counter->Value());
+    }
+    else if (entry->gauge)
+    {
+      exposition += std::format(
+        "# TYPE {0} gauge\n{0} {1}\n", entry->name, entry->gauge->Value());
+    }
+    else if (entry->histogram)
+    {
+      // Quantiles are exported as a summary, the buckets are too many for Prometheus.
+      const auto& histogram = *entry->histogram;
+      exposition += std::format("# TYPE {} summary\n", entry->name);
+      for (const auto quantile : {0.5, 0.9, 0.99, 0.999, 1.0})
+      {
+        exposition += std::format(
+          "{}{{quantile=\"{}\"}} {}\n",
+          entry->name,
+          quantile,
+          static_cast<double>(histogram.Quantile(quantile)) * histogram.Unit());
+      }
+      exposition += std::format(
+        "{0}_sum {1}\n{0}_count {2}\n",
+        entry->name,
+        static_cast<double>(histogram.Sum()) * histogram.Unit(),
+        histogram.Count());
+    }
+  }
+  return exposition;
+}
+
+void Metrics::Write(const std::filesystem::path& path) const
+{
+  auto temporary = path;
+  temporary += ".tmp";
+  {
+    std::ofstream file(temporary, std::ios::trunc);
+    file << Exposition();
+    if (!file)
+      throw std::runtime_error(std::format("Couldn't write metrics '{}'.", temporary.string()));
+  }
+  std::filesystem::rename(temporary, path);
+}
+
+MetricsDump::MetricsDump(
+  std::filesystem::path path,
+  std::chrono::steady_clock::duration interval)
+  : _path(std::move(path))
+  , _interval(interval)
+{
+  _writer = std::jthread([this](std::stop_token stop) {
+    while (true)
+    {
+      {
+        // Woken up early only by a stop request.
+        std::unique_lock lock(_mutex);
+        _wakeup.wait_for(lock, stop, _interval, []() { return false; });
+        if (stop.stop_requested())
+          break;
+      }
+
+      try
+      {
+        Metrics::Instance().Write(_path);
+      }
+      catch (const std::exception& exception)
+      {
+        printf("%s\n", exception.what());
+      }
+    }
+  });
+}
+
+MetricsDump::~MetricsDump()
+{
+  _writer.request_stop();
+  _writer.join();
+
+  try
+  {
+    Metrics::Instance().Write(_path);
+  }
+  catch (const std::exception& exception)
+  {
+    printf("%s\n", exception.what());
+  }
+}
+
+}// namespace sim
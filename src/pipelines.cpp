@@ -0,0 +1,178 @@
+//
+// Created by maros on 08.12.2023.
+//
+
+#include "sim/pipelines.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <format>
+#include <fstream>
+#include <thread>
+
+namespace
+{
+
+//! Size of VkPipelineCacheHeaderVersionOne.
+constexpr size_t CacheHeaderSize = 16 + VK_UUID_SIZE;
+
+}// namespace
+
+namespace vulkan
+{
+
+PipelineCache::PipelineCache(
+  const vkr::PhysicalDevice& physicalDevice,
+  const vkr::Device& device,
+  std::filesystem::path directory)
+    : _device(device)
+    , _properties(physicalDevice.getProperties())
+{
+  if (directory.empty())
+    directory = defaultDirectory();
+
+  const auto identifiers = physicalDevice.getProperties2<
+    vk::PhysicalDeviceProperties2,
+    vk::PhysicalDeviceIDProperties>().get<vk::PhysicalDeviceIDProperties>();
+
+  std::string deviceUuid;
+  for (const auto byte: identifiers.deviceUUID)
+  {
+    deviceUuid += std::format("{:02x}", byte);
+  }
+  _path = directory / std::format(
+    "pipelines-{}-{:08x}.bin", deviceUuid, _properties.driverVersion);
+
+  // Missing or foreign cache is not an error, the pipelines are just compiled from scratch.
+  std::vector<std::byte> data;
+  std::error_code error;
+  if (const auto size = std::filesystem::file_size(_path, error); !error)
+  {
+    std::ifstream input(_path, std::ios::binary);
+    data.resize(size);
+    if (!input.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(size)))
+      data.clear();
+  }
+
+  if (!compatible(data))
+    data.clear();
+  _warm = !data.empty();
+
+  _cache = vkr::PipelineCache(
+    _device,
+    vk::PipelineCacheCreateInfo {
+      .initialDataSize = data.size(),
+      .pInitialData = data.data()});
+}
+
+void PipelineCache::save() const
+{
+  const auto data = _cache.getData();
+
+  // Written next to the cache and renamed over it,
+  // so that a crash or a concurrent launch never leaves a truncated cache behind.
+  std::error_code error;
+  std::filesystem::create_directories(_path.parent_path(), error);
+
+  auto temporaryPath = _path;
+  temporaryPath += ".tmp";
+  {
+    std::ofstream output(temporaryPath, std::ios::binary | std::ios::trunc);
+    output.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+    if (!output)
+    {
+      printf("Couldn't write pipeline cache to '%s'\n", temporaryPath.string().c_str());
+      return;
+    }
+  }
+
+  std::filesystem::rename(temporaryPath, _path, error);
+  if (error)
+    printf("Couldn't write pipeline cache to '%s': %s\n", _path.string().c_str(), error.message().c_str());
+}
+
+std::vector<vkr::Pipeline> PipelineCache::createGraphicsPipelines(
+  std::span<const vk::GraphicsPipelineCreateInfo> createInfos) const
+{
+  std::vector<vkr::Pipeline> pipelines;
+  pipelines.reserve(createInfos.size());
+  for (size_t i = 0; i < createInfos.size(); ++i)
+  {
+    pipelines.emplace_back(nullptr);
+  }
+  std::vector<std::exception_ptr> errors(createInfos.size());
+
+  // Pipeline cache is internally synchronized, workers pick pipelines until none are left.
+  std::atomic<size_t> next = 0;
+  const auto worker = [&]() {
+    for (auto index = next++; index < createInfos.size(); index = next++)
+    {
+      try
+      {
+        pipelines[index] = vkr::Pipeline(_device, _cache, createInfos[index]);
+      }
+      catch (...)
+      {
+        errors[index] = std::current_exception();
+      }
+    }
+  };
+
+  const auto workerCount = std::min<size_t>(
+    createInfos.size(), std::max(1u, std::thread::hardware_concurrency()));
+  {
+    std::vector<std::jthread> workers;
+    for (size_t i = 1; i < workerCount; ++i)
+    {
+      workers.emplace_back(worker);
+    }
+    worker();
+  }
+
+  for (const auto& error: errors)
+  {
+    if (error)
+      std::rethrow_exception(error);
+  }
+  return pipelines;
+}
+
+vkr::Pipeline PipelineCache::createComputePipeline(
+  const vk::ComputePipelineCreateInfo& createInfo) const
+{
+  return vkr::Pipeline(_device, _cache, createInfo);
+}
+
+std::filesystem::path PipelineCache::defaultDirectory()
+{
+  if (const auto* cacheHome = std::getenv("XDG_CACHE_HOME"); cacheHome && *cacheHome)
+    return std::filesystem::path(cacheHome) / "sim";
+  if (const auto* localAppData = std::getenv("LOCALAPPDATA"); localAppData && *localAppData)
+    return std::filesystem::path(localAppData) / "sim";
+  if (const auto* home = std::getenv("HOME"); home && *home)
+    return std::filesystem::path(home) / ".cache" / "sim";
+  return std::filesystem::current_path();
+}
+
+bool PipelineCache::compatible(std::span<const std::byte> data) const
+{
+  if (data.size() < CacheHeaderSize)
+    return false;
+
+  // Drivers are required to reject foreign data, but not all of them do so gracefully.
+  uint32_t header[4];
+  std::memcpy(header, data.data(), sizeof(header));
+  const auto [headerSize, headerVersion, vendorId, deviceId] = header;
+
+  return headerSize >= CacheHeaderSize
+         && headerVersion == static_cast<uint32_t>(vk::PipelineCacheHeaderVersion::eOne)
+         && vendorId == _properties.vendorID
+         && deviceId == _properties.deviceID
+         && std::memcmp(data.data() + 16, _properties.pipelineCacheUUID.data(), VK_UUID_SIZE) == 0;
+}
+
+}// namespace vulkan
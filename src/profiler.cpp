@@ -0,0 +1,275 @@
+//
+// Created by maros on 13.12.2023.
+//
+
+#include "sim/profiler.hpp"
+#include "sim/vulkan.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <format>
+#include <fstream>
+
+namespace vulkan
+{
+
+Profiler& Profiler::instance()
+{
+  static Profiler profiler;
+  return profiler;
+}
+
+Profiler::Ring& Profiler::threadRing()
+{
+  // Rings are never destroyed before the profiler, so the pointer stays valid.
+  thread_local Ring* ring = nullptr;
+  if (ring)
+    return *ring;
+
+  std::scoped_lock lock(_ringsMutex);
+  auto& registered = _rings.emplace_back(std::make_unique<Ring>());
+  registered->thread = static_cast<uint32_t>(_rings.size());
+  ring = registered.get();
+  return *ring;
+}
+
+void Profiler::record(const char* name, Clock::time_point start, Clock::time_point end)
+{
+  auto& ring = threadRing();
+  const auto head = ring.head.load(std::memory_order_relaxed);
+  if (head - ring.tail.load(std::memory_order_acquire) >= RingCapacity)
+  {
+    ring.dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  ring.events[head % RingCapacity] = ProfileEvent {
+    .name = name,
+    .start = since(start),
+    .duration = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count(),
+    .thread = ring.thread};
+  ring.head.store(head + 1, std::memory_order_release);
+}
+
+void Profiler::recordDevice(const char* name, int64_t start, int64_t duration) noexcept
+{
+  auto& ring = *_deviceRing;
+  const auto head = ring.head.load(std::memory_order_relaxed);
+  if (head - ring.tail.load(std::memory_order_acquire) >= RingCapacity)
+  {
+    ring.dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  ring.events[head % RingCapacity] = ProfileEvent {
+    .name = name,
+    .start = start,
+    .duration = duration,
+    .thread = DeviceThread};
+  ring.head.store(head + 1, std::memory_order_release);
+}
+
+void Profiler::collect()
+{
+  std::vector<Ring*> rings;
+  {
+    std::scoped_lock lock(_ringsMutex);
+    rings.reserve(_rings.size() + 1);
+    for (const auto& ring : _rings)
+    {
+      rings.push_back(ring.get());
+    }
+  }
+  rings.push_back(_deviceRing.get());
+
+  std::scoped_lock lock(_traceMutex);
+  for (auto* ring : rings)
+  {
+    const auto tail = ring->tail.load(std::memory_order_relaxed);
+    const auto head = ring->head.load(std::memory_order_acquire);
+    for (auto index = tail; index != head; ++index)
+    {
+      append(ring->events[index % RingCapacity]);
+    }
+    ring->tail.store(head, std::memory_order_release);
+    _dropped += ring->dropped.exchange(0, std::memory_order_relaxed);
+  }
+}
+
+void Profiler::append(const ProfileEvent& event)
+{
+  if (_trace.size() == TraceCapacity)
+    _trace.pop_front();
+  _trace.push_back(event);
+
+  auto& statistics = _window[event.name];
+  statistics.total += event.duration;
+  statistics.maximum = std::max(statistics.maximum, event.duration);
+  statistics.count++;
+}
+
+std::string Profiler::summary()
+{
+  std::scoped_lock lock(_traceMutex);
+
+  std::string summary;
+  for (const auto& [name, statistics] : _window)
+  {
+    if (!summary.empty())
+      summary += ", ";
+    summary += std::format(
+      "{} {:.2f} ms (max {:.2f} ms)",
+      name,
+      static_cast<double>(statistics.total) / static_cast<double>(statistics.count) * 1e-6,
+      static_cast<double>(statistics.maximum) * 1e-6);
+  }
+  if (_dropped > 0)
+    summary += std::format(", {} dropped", _dropped);
+
+  _window.clear();
+  _dropped = 0;
+  return summary;
+}
+
+void Profiler::writeTrace(const std::filesystem::path& path)
+{
+  std::ofstream file(path, std::ios::trunc);
+  if (!file)
+    throw std::runtime_error(std::format("Couldn't write trace '{}'.", path.string()));
+
+  size_t threadCount = 0;
+  {
+    std::scoped_lock lock(_ringsMutex);
+    threadCount = _rings.size();
+  }
+
+  std::scoped_lock lock(_traceMutex);
+
+  // Trace event format, timestamps and durations in microseconds.
+  file << R"({"displayTimeUnit":"ms","traceEvents":[)" << '\n';
+  file << std::format(
+    R"({{"name":"thread_name","ph":"M","pid":1,"tid":{},"args":{{"name":"device"}}}})",
+    DeviceThread);
+  for (size_t thread = 1; thread <= threadCount; ++thread)
+  {
+    file << std::format(
+      ",\n"
+      R"({{"name":"thread_name","ph":"M","pid":1,"tid":{},"args":{{"name":"host {}"}}}})",
+      thread,
+      thread);
+  }
+
+  for (const auto& event : _trace)
+  {
+    file << std::format(
+      ",\n"
+      R"({{"name":"{}","ph":"X","pid":1,"tid":{},"ts":{:.3f},"dur":{:.3f}}})",
+      event.name,
+      event.thread,
+      static_cast<double>(event.start) * 1e-3,
+      static_cast<double>(event.duration) * 1e-3);
+  }
+  file << "\n]}\n";
+
+  if (!file)
+    throw std::runtime_error(std::format("Couldn't write trace '{}'.", path.string()));
+}
+
+DeviceProfiler::DeviceProfiler(const Renderer& renderer, uint32_t framesInFlight)
+  : _frames(framesInFlight)
+{
+  const auto& physicalDevice = renderer._physicalDevice;
+  const auto validBits = physicalDevice.getQueueFamilyProperties()[
+    renderer.graphicsFamily()].timestampValidBits;
+  if (validBits == 0)
+  {
+    printf("Graphics queue doesn't support timestamps, device time isn't profiled.\n");
+    return;
+  }
+
+  _mask = validBits >= 64 ? ~uint64_t(0) : (uint64_t(1) << validBits) - 1;
+  _period = physicalDevice.getProperties().limits.timestampPeriod;
+  _queryPool = vkr::QueryPool(
+    renderer._device,
+    vk::QueryPoolCreateInfo {
+      .queryType = vk::QueryType::eTimestamp,
+      .queryCount = QueriesPerFrame * framesInFlight});
+}
+
+void DeviceProfiler::collect(uint32_t frameIndex)
+{
+  auto& frame = _frames[frameIndex];
+  if (frame.submitted == 0 || frame.names.empty())
+    return;
+
+  const auto queryCount = static_cast<uint32_t>(frame.names.size() * 2);
+  const auto [result, timestamps] = _queryPool.getResults<uint64_t>(
+    frameIndex * QueriesPerFrame,
+    queryCount,
+    queryCount * sizeof(uint64_t),
+    sizeof(uint64_t),
+    vk::QueryResultFlagBits::e64);
+
+  // Scopes begin in order, the first timestamp is the earliest.
+  if (result == vk::Result::eSuccess)
+  {
+    const auto origin = timestamps.front();
+    for (size_t scope = 0; scope < frame.names.size(); ++scope)
+    {
+      const auto begin = (timestamps[scope * 2] - origin) & _mask;
+      const auto end = (timestamps[scope * 2 + 1] - origin) & _mask;
+      Profiler::instance().recordDevice(
+        frame.names[scope],
+        frame.submitted + static_cast<int64_t>(static_cast<double>(begin) * _period),
+        static_cast<int64_t>(static_cast<double>(end - begin) * _period));
+    }
+  }
+
+  frame.names.clear();
+  frame.submitted = 0;
+}
+
+void DeviceProfiler::beginFrame(const vkr::CommandBuffer& commandBuffer, uint32_t frameIndex)
+{
+  collect(frameIndex);
+  _frameIndex = frameIndex;
+  _frames[frameIndex].names.clear();
+
+  if (supported())
+    commandBuffer.resetQueryPool(*_queryPool, frameIndex * QueriesPerFrame, QueriesPerFrame);
+}
+
+uint32_t DeviceProfiler::begin(const vkr::CommandBuffer& commandBuffer, const char* name)
+{
+  auto& frame = _frames[_frameIndex];
+  if (!supported() || frame.names.size() == MaxScopesPerFrame)
+    return NoScope;
+
+  const auto scope = static_cast<uint32_t>(frame.names.size());
+  frame.names.push_back(name);
+  commandBuffer.writeTimestamp(
+    vk::PipelineStageFlagBits::eTopOfPipe,
+    *_queryPool,
+    _frameIndex * QueriesPerFrame + scope * 2);
+  return scope;
+}
+
+void DeviceProfiler::end(const vkr::CommandBuffer& commandBuffer, uint32_t scope)
+{
+  if (scope == NoScope)
+    return;
+
+  commandBuffer.writeTimestamp(
+    vk::PipelineStageFlagBits::eBottomOfPipe,
+    *_queryPool,
+    _frameIndex * QueriesPerFrame + scope * 2 + 1);
+}
+
+void DeviceProfiler::submitted(Profiler::Clock::time_point time)
+{
+  auto& frame = _frames[_frameIndex];
+  if (!frame.names.empty())
+    frame.submitted = std::max<int64_t>(Profiler::instance().since(time), 1);
+}
+
+}// namespace vulkan
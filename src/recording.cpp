@@ -0,0 +1,162 @@
+//
+// Created by maros on 11.12.2023.
+//
+
+#include "sim/recording.hpp"
+#include "sim/vulkan.hpp"
+
+#include <algorithm>
+
+namespace vulkan
+{
+
+ParallelRecorder::ParallelRecorder(
+  const Renderer& renderer,
+  uint32_t framesInFlight,
+  uint32_t threadCount)
+{
+  if (threadCount == 0)
+    threadCount = std::max(1u, std::thread::hardware_concurrency());
+  _threadCount = threadCount;
+  _errors.resize(_threadCount);
+
+  const auto& device = renderer._device;
+  _pools.resize(framesInFlight);
+  for (auto& framePools : _pools)
+  {
+    framePools.resize(_threadCount);
+    for (auto& threadPool : framePools)
+    {
+      // Pools are reset as a whole every frame, the buffers are never reset individually.
+      threadPool.pool = vkr::CommandPool(
+        device,
+        vk::CommandPoolCreateInfo {
+          .flags = vk::CommandPoolCreateFlagBits::eTransient,
+          .queueFamilyIndex = renderer.graphicsFamily()});
+
+      threadPool.commandBuffer = std::move(vkr::CommandBuffers(
+        device,
+        vk::CommandBufferAllocateInfo {
+          .commandPool = *threadPool.pool,
+          .level = vk::CommandBufferLevel::eSecondary,
+          .commandBufferCount = 1}).front());
+    }
+  }
+
+  for (uint32_t thread = 1; thread < _threadCount; ++thread)
+  {
+    _workers.emplace_back([this, thread](std::stop_token stop) {
+      work(stop, thread);
+    });
+  }
+}
+
+ParallelRecorder::~ParallelRecorder() = default;
+
+uint32_t ParallelRecorder::threadsFor(size_t count, size_t minimumPerThread) const noexcept
+{
+  if (minimumPerThread == 0)
+    return _threadCount;
+  const auto worthwhile = count / minimumPerThread;
+  return static_cast<uint32_t>(std::clamp<size_t>(worthwhile, 1, _threadCount));
+}
+
+std::vector<vk::CommandBuffer> ParallelRecorder::record(
+  uint32_t frameIndex,
+  const vk::CommandBufferInheritanceInfo& inheritance,
+  size_t count,
+  size_t minimumPerThread,
+  const RecordFunction& function)
+{
+  const auto activeThreads = threadsFor(count, minimumPerThread);
+  {
+    std::scoped_lock lock(_mutex);
+    _frameIndex = frameIndex;
+    _count = count;
+    _inheritance = &inheritance;
+    _function = &function;
+    _activeThreads = activeThreads;
+    _pendingThreads = activeThreads - 1;
+    std::ranges::fill(_errors, nullptr);
+    ++_dispatch;
+  }
+  if (activeThreads > 1)
+    _dispatchCondition.notify_all();
+
+  recordRange(0);
+
+  {
+    std::unique_lock lock(_mutex);
+    _doneCondition.wait(lock, [this]() {
+      return _pendingThreads == 0;
+    });
+    _function = nullptr;
+    _inheritance = nullptr;
+  }
+
+  for (const auto& error: _errors)
+  {
+    if (error)
+      std::rethrow_exception(error);
+  }
+
+  std::vector<vk::CommandBuffer> commandBuffers;
+  for (uint32_t thread = 0; thread < activeThreads; ++thread)
+  {
+    commandBuffers.emplace_back(*_pools[frameIndex][thread].commandBuffer);
+  }
+  return commandBuffers;
+}
+
+void ParallelRecorder::work(std::stop_token stop, uint32_t thread)
+{
+  uint64_t dispatch = 0;
+  while (true)
+  {
+    {
+      std::unique_lock lock(_mutex);
+      if (!_dispatchCondition.wait(lock, stop, [&]() {
+            return _dispatch != dispatch;
+          }))
+        return;
+
+      dispatch = _dispatch;
+      if (thread >= _activeThreads)
+        continue;
+    }
+
+    recordRange(thread);
+
+    {
+      std::scoped_lock lock(_mutex);
+      --_pendingThreads;
+    }
+    _doneCondition.notify_one();
+  }
+}
+
+void ParallelRecorder::recordRange(uint32_t thread) noexcept
+{
+  try
+  {
+    const auto begin = _count * thread / _activeThreads;
+    const auto end = _count * (thread + 1) / _activeThreads;
+
+    auto& threadPool = _pools[_frameIndex][thread];
+    threadPool.pool.reset();
+
+    const auto& commandBuffer = threadPool.commandBuffer;
+    commandBuffer.begin(vk::CommandBufferBeginInfo {
+      .flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit
+               | vk::CommandBufferUsageFlagBits::eRenderPassContinue,
+      .pInheritanceInfo = _inheritance});
+    (*_function)(commandBuffer, begin, end);
+    commandBuffer.end();
+  }
+  catch (...)
+  {
+    _errors[thread] = std::current_exception();
+  }
+}
+
+}// namespace vulkan
@@ -0,0 +1,338 @@
+//
+// Created by maros on 16.12.2023.
+//
+
+#include "sim/scene.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <format>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+
+namespace sdk
+{
+
+SceneGraph::SceneGraph(uint32_t threadCount)
+{
+  if (threadCount == 0)
+    threadCount = std::max(1u, std::thread::hardware_concurrency());
+  _threadCount = threadCount;
+}
+
+TransformNode SceneGraph::create(std::optional<TransformNode> parent)
+{
+  const auto parentSlot = parent ? slotOf(*parent) : NoParent;
+
+  uint32_t index = 0;
+  if (!_freeHandles.empty())
+  {
+    index = _freeHandles.back();
+    _freeHandles.pop_back();
+  }
+  else
+  {
+    index = static_cast<uint32_t>(_handles.size());
+    _handles.emplace_back();
+  }
+
+  // Appended out of order, placed in its level by the next update.
+  const auto slot = static_cast<uint32_t>(_nodes.size());
+  _handles[index].slot = slot;
+  _nodes.push_back(index);
+  _parents.push_back(parentSlot);
+  _positions.emplace_back(0.0f);
+  _rotations.emplace_back(1.0f, 0.0f, 0.0f, 0.0f);
+  _scales.emplace_back(1.0f);
+  _worlds.emplace_back(1.0f);
+  _dirty.push_back(0);
+  _changed.push_back(0);
+  _destroyed.push_back(0);
+
+  _reorder = true;
+  markDirty(slot);
+  return TransformNode {
+    .index = index,
+    .generation = _handles[index].generation};
+}
+
+TransformNode SceneGraph::create(const Actor& actor, std::optional<TransformNode> parent)
+{
+  const auto node = create(parent);
+  const auto slot = _handles[node.index].slot;
+  _positions[slot] = actor._position;
+  _rotations[slot] = glm::quat(actor._rotation);
+  return node;
+}
+
+void SceneGraph::destroy(TransformNode node)
+{
+  if (!alive(node))
+    return;
+
+  _destroyed[_handles[node.index].slot] = 1;
+  _reorder = true;
+}
+
+void SceneGraph::setParent(TransformNode node, std::optional<TransformNode> parent)
+{
+  const auto slot = slotOf(node);
+  const auto parentSlot = parent ? slotOf(*parent) : NoParent;
+  for (auto ancestor = parentSlot; ancestor != NoParent; ancestor = _parents[ancestor])
+  {
+    if (ancestor == slot)
+      throw std::runtime_error(std::format(
+        "Transform node {} can't be parented to its descendant {}", node.index, parent->index));
+  }
+
+  _parents[slot] = parentSlot;
+  _reorder = true;
+  markDirty(slot);
+}
+
+bool SceneGraph::alive(TransformNode node) const noexcept
+{
+  if (node.index >= _handles.size())
+    return false;
+
+  const auto& handle = _handles[node.index];
+  return handle.generation == node.generation
+         && handle.slot != NoParent
+         && !_destroyed[handle.slot];
+}
+
+void SceneGraph::setPosition(TransformNode node, const glm::vec3& position)
+{
+  const auto slot = slotOf(node);
+  _positions[slot] = position;
+  markDirty(slot);
+}
+
+void SceneGraph::setRotation(TransformNode node, const glm::quat& rotation)
+{
+  const auto slot = slotOf(node);
+  _rotations[slot] = rotation;
+  markDirty(slot);
+}
+
+void SceneGraph::setScale(TransformNode node, const glm::vec3& scale)
+{
+  const auto slot = slotOf(node);
+  _scales[slot] = scale;
+  markDirty(slot);
+}
+
+void SceneGraph::translate(TransformNode node, const glm::vec3& translationVector)
+{
+  const auto slot = slotOf(node);
+  _positions[slot] += translationVector;
+  markDirty(slot);
+}
+
+void SceneGraph::rotate(TransformNode node, float angle, const glm::vec3& axis)
+{
+  const auto slot = slotOf(node);
+  _rotations[slot] = _rotations[slot] * glm::angleAxis(angle, axis);
+  markDirty(slot);
+}
+
+const glm::mat4x4& SceneGraph::world(TransformNode node) const
+{
+  return _worlds[slotOf(node)];
+}
+
+size_t SceneGraph::update()
+{
+  if (_reorder)
+    reorder();
+  if (_dirtyCount == 0)
+    return 0;
+
+  size_t updated = 0;
+  const auto levelCount = static_cast<uint32_t>(_levels.size() - 1);
+  for (auto level = _firstDirtyLevel; level < levelCount; ++level)
+  {
+    const size_t begin = _levels[level];
+    const size_t end = _levels[level + 1];
+    const bool first = level == _firstDirtyLevel;
+
+    const auto count = end - begin;
+    const auto threads = std::clamp<size_t>(count / ParallelThreshold, 1, _threadCount);
+    if (threads == 1)
+    {
+      updated += updateRange(begin, end, first);
+      continue;
+    }
+
+    // Ranges of a level only read the previous levels, so they're independent.
+    std::atomic<size_t> levelUpdated = 0;
+    const auto step = (count + threads - 1) / threads;
+    {
+      std::vector<std::jthread> workers;
+      for (size_t thread = 1; thread < threads; ++thread)
+      {
+        workers.emplace_back([&, thread]() {
+          const auto rangeBegin = std::min(begin + thread * step, end);
+          levelUpdated += updateRange(rangeBegin, std::min(rangeBegin + step, end), first);
+        });
+      }
+      levelUpdated += updateRange(begin, std::min(begin + step, end), first);
+    }
+    updated += levelUpdated;
+  }
+
+  _dirtyCount = 0;
+  _firstDirtyLevel = levelCount;
+  return updated;
+}
+
+uint32_t SceneGraph::slotOf(TransformNode node) const
+{
+  if (!alive(node))
+    throw std::runtime_error(std::format("Transform node {} doesn't exist", node.index));
+  return _handles[node.index].slot;
+}
+
+uint32_t SceneGraph::levelOf(uint32_t slot) const noexcept
+{
+  const auto level = std::ranges::upper_bound(_levels, slot);
+  return static_cast<uint32_t>(level - _levels.begin() - 1);
+}
+
+void SceneGraph::markDirty(uint32_t slot)
+{
+  if (_dirty[slot])
+    return;
+
+  _dirty[slot] = 1;
+  _dirtyCount++;
+  // Levels are known again once reordered.
+  if (!_reorder)
+    _firstDirtyLevel = std::min(_firstDirtyLevel, levelOf(slot));
+}
+
+void SceneGraph::reorder()
+{
+  const auto count = static_cast<uint32_t>(_nodes.size());
+
+  // Children of every slot, grouped by parent.
+  std::vector<uint32_t> roots;
+  std::vector<uint32_t> childOffsets(count + 1, 0);
+  for (uint32_t slot = 0; slot < count; ++slot)
+  {
+    if (_destroyed[slot])
+      continue;
+    if (_parents[slot] == NoParent)
+      roots.push_back(slot);
+    else
+      childOffsets[_parents[slot] + 1]++;
+  }
+  std::partial_sum(childOffsets.begin(), childOffsets.end(), childOffsets.begin());
+
+  std::vector<uint32_t> children(childOffsets.back());
+  std::vector<uint32_t> cursors(childOffsets.begin(), childOffsets.end() - 1);
+  for (uint32_t slot = 0; slot < count; ++slot)
+  {
+    if (!_destroyed[slot] && _parents[slot] != NoParent)
+      children[cursors[_parents[slot]]++] = slot;
+  }
+
+  // Breadth first from the roots, destroyed nodes and their descendants are never reached.
+  auto order = std::move(roots);
+  order.reserve(count);
+  _levels.clear();
+  for (size_t begin = 0; begin < order.size();)
+  {
+    _levels.push_back(static_cast<uint32_t>(begin));
+    const auto end = order.size();
+    for (auto index = begin; index < end; ++index)
+    {
+      const auto parent = order[index];
+      order.insert(
+        order.end(),
+        children.begin() + childOffsets[parent],
+        children.begin() + childOffsets[parent + 1]);
+    }
+    begin = end;
+  }
+  _levels.push_back(static_cast<uint32_t>(order.size()));
+
+  std::vector<uint32_t> orderedSlots(count, NoParent);
+  for (uint32_t slot = 0; slot < order.size(); ++slot)
+  {
+    orderedSlots[order[slot]] = slot;
+  }
+  for (uint32_t slot = 0; slot < count; ++slot)
+  {
+    if (orderedSlots[slot] != NoParent)
+      continue;
+
+    auto& handle = _handles[_nodes[slot]];
+    handle.generation++;
+    handle.slot = NoParent;
+    _freeHandles.push_back(_nodes[slot]);
+  }
+
+  const auto permute = [&order](auto& values) {
+    std::remove_cvref_t<decltype(values)> ordered;
+    ordered.reserve(order.size());
+    for (const auto slot : order)
+    {
+      ordered.push_back(values[slot]);
+    }
+    values = std::move(ordered);
+  };
+  permute(_nodes);
+  permute(_parents);
+  permute(_positions);
+  permute(_rotations);
+  permute(_scales);
+  permute(_worlds);
+  permute(_dirty);
+  permute(_changed);
+  permute(_destroyed);
+
+  _dirtyCount = 0;
+  _firstDirtyLevel = static_cast<uint32_t>(_levels.size() - 1);
+  for (uint32_t slot = 0; slot < order.size(); ++slot)
+  {
+    _handles[_nodes[slot]].slot = slot;
+    if (_parents[slot] != NoParent)
+      _parents[slot] = orderedSlots[_parents[slot]];
+    if (_dirty[slot])
+    {
+      _dirtyCount++;
+      _firstDirtyLevel = std::min(_firstDirtyLevel, levelOf(slot));
+    }
+  }
+  _reorder = false;
+}
+
+size_t SceneGraph::updateRange(size_t begin, size_t end, bool first) noexcept
+{
+  size_t updated = 0;
+  for (auto slot = begin; slot < end; ++slot)
+  {
+    // Parents of the shallowest level aren't updated, their flags are stale.
+    const auto parent = _parents[slot];
+    const bool changed = _dirty[slot]
+                         || (!first && parent != NoParent && _changed[parent]);
+    _dirty[slot] = 0;
+    _changed[slot] = changed;
+    if (!changed)
+      continue;
+
+    auto local = glm::translate(glm::mat4x4(1.0f), _positions[slot])
+                 * glm::mat4_cast(_rotations[slot]);
+    local = glm::scale(local, _scales[slot]);
+    _worlds[slot] = parent == NoParent ? local : _worlds[parent] * local;
+    updated++;
+  }
+  return updated;
+}
+
+}// namespace sdk
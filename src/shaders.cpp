@@ -0,0 +1,155 @@
+//
+// Created by maros on 19.12.2023.
+//
+
+#include "sim/shaders.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <format>
+#include <system_error>
+
+#ifndef SIM_GLSLC
+#define SIM_GLSLC "glslc"
+#endif
+
+#ifndef SIM_SHADER_DIRECTORY
+#define SIM_SHADER_DIRECTORY "resources/shaders"
+#endif
+
+namespace vulkan
+{
+
+namespace
+{
+
+//! @returns Whether the file is a GLSL source.
+bool isSource(const std::filesystem::path& path)
+{
+  const auto extension = path.extension();
+  return extension == ".vert" || extension == ".frag" || extension == ".comp";
+}
+
+}// namespace
+
+ShaderWatcher::ShaderWatcher(
+  std::filesystem::path sources,
+  std::filesystem::path compiler)
+  : _sources(std::move(sources))
+  , _compiler(std::move(compiler))
+{
+  // Sources as they are now are already compiled by the build.
+  std::error_code error;
+  for (const auto& entry : std::filesystem::directory_iterator(_sources, error))
+  {
+    if (isSource(entry.path()))
+      _modified[entry.path()] = entry.last_write_time(error);
+  }
+  if (error)
+  {
+    printf("Couldn't list shaders in '%s': %s\n", _sources.string().c_str(), error.message().c_str());
+  }
+
+  _watcher = std::jthread([this](std::stop_token stop) {
+    while (true)
+    {
+      {
+        // Woken up early only by a stop request.
+        std::unique_lock lock(_mutex);
+        _wakeup.wait_for(lock, stop, PollInterval, []() { return false; });
+        if (stop.stop_requested())
+          break;
+      }
+
+      if (poll())
+        _rebuilt.store(true, std::memory_order_release);
+    }
+  });
+
+  printf("Watching shaders in '%s'\n", _sources.string().c_str());
+}
+
+ShaderWatcher::~ShaderWatcher()
+{
+  _watcher.request_stop();
+  _watcher.join();
+}
+
+std::filesystem::path ShaderWatcher::defaultCompiler()
+{
+  return SIM_GLSLC;
+}
+
+std::filesystem::path ShaderWatcher::defaultSources()
+{
+  return SIM_SHADER_DIRECTORY;
+}
+
+std::filesystem::path ShaderWatcher::binaryOf(const std::filesystem::path& source)
+{
+  // cube.vert is loaded as cube-vert.spv.
+  return std::format(
+    "{}-{}.spv",
+    source.stem().string(),
+    source.extension().string().substr(1));
+}
+
+bool ShaderWatcher::poll()
+{
+  bool compiled = false;
+
+  std::error_code error;
+  for (const auto& entry : std::filesystem::directory_iterator(_sources, error))
+  {
+    if (!isSource(entry.path()))
+      continue;
+
+    const auto modified = entry.last_write_time(error);
+    if (error)
+      continue;
+
+    auto [known, inserted] = _modified.try_emplace(entry.path(), modified);
+    if (!inserted && known->second == modified)
+      continue;
+    known->second = modified;
+
+    compiled |= compile(entry.path());
+  }
+
+  return compiled;
+}
+
+bool ShaderWatcher::compile(const std::filesystem::path& source) const
+{
+  const auto binary = binaryOf(source);
+  auto temporary = binary;
+  temporary += ".tmp";
+
+  const auto command = std::format(
+    R"("{}" "{}" -o "{}")",
+    _compiler.string(),
+    source.string(),
+    temporary.string());
+  if (std::system(command.c_str()) != 0)
+  {
+    // The compiler reports the errors, the previous binary stays in place.
+    printf("Couldn't compile shader '%s'\n", source.string().c_str());
+    std::error_code error;
+    std::filesystem::remove(temporary, error);
+    return false;
+  }
+
+  // Replaced atomically, so that the renderer never loads a partial binary.
+  std::error_code error;
+  std::filesystem::rename(temporary, binary, error);
+  if (error)
+  {
+    printf("Couldn't replace shader '%s': %s\n", binary.string().c_str(), error.message().c_str());
+    return false;
+  }
+
+  printf("Compiled shader '%s'\n", binary.string().c_str());
+  return true;
+}
+
+}// namespace vulkan
@@ -0,0 +1,276 @@
+//
+// Created by maros on 20.12.2023.
+//
+
+#include "sim/shared.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <format>
+#include <new>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+
+//! Attempts of a reader to copy a slot the producer keeps overwriting.
+constexpr uint32_t MaxReadAttempts = 4;
+
+sim::SharedSnapshotRing::Slot& SlotAt(std::byte* memory, const sim::SharedSnapshotRing::Header& header, uint64_t sequence)
+{
+  return *reinterpret_cast<sim::SharedSnapshotRing::Slot*>(
+    memory + sim::SharedSnapshotRing::SlotOffset + (sequence % header._slotCount) * header._slotSize);
+}
+
+const sim::SharedSnapshotRing::Slot& SlotAt(const std::byte* memory, const sim::SharedSnapshotRing::Header& header, uint64_t sequence)
+{
+  return *reinterpret_cast<const sim::SharedSnapshotRing::Slot*>(
+    memory + sim::SharedSnapshotRing::SlotOffset + (sequence % header._slotCount) * header._slotSize);
+}
+
+sim::SharedSnapshotRing::Body* BodiesOf(sim::SharedSnapshotRing::Slot& slot)
+{
+  return reinterpret_cast<sim::SharedSnapshotRing::Body*>(
+    reinterpret_cast<std::byte*>(&slot) + sizeof(sim::SharedSnapshotRing::Slot));
+}
+
+const sim::SharedSnapshotRing::Body* BodiesOf(const sim::SharedSnapshotRing::Slot& slot)
+{
+  return reinterpret_cast<const sim::SharedSnapshotRing::Body*>(
+    reinterpret_cast<const std::byte*>(&slot) + sizeof(sim::SharedSnapshotRing::Slot));
+}
+
+}// namespace
+
+sim::SharedSnapshotPublisher::SharedSnapshotPublisher(
+  std::string name,
+  uint32_t capacity,
+  uint32_t slotCount)
+    : _name(std::move(name))
+    , _size(SharedSnapshotRing::Size(std::max(slotCount, 2u), capacity))
+{
+  // A previous producer that didn't exit cleanly may have left its object behind,
+  // viewers still mapping it are told to attach to this one.
+  if (const int previous = shm_open(_name.c_str(), O_RDWR, 0); previous >= 0)
+  {
+    struct stat status {};
+    if (fstat(previous, &status) == 0
+        && static_cast<size_t>(status.st_size) >= sizeof(SharedSnapshotRing::Header))
+    {
+      void* memory = mmap(nullptr, sizeof(SharedSnapshotRing::Header), PROT_READ | PROT_WRITE, MAP_SHARED, previous, 0);
+      if (memory != MAP_FAILED)
+      {
+        static_cast<SharedSnapshotRing::Header*>(memory)->_closed.store(1, std::memory_order_release);
+        munmap(memory, sizeof(SharedSnapshotRing::Header));
+      }
+    }
+    close(previous);
+    shm_unlink(_name.c_str());
+  }
+
+  const int descriptor = shm_open(_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+  if (descriptor < 0)
+    throw std::runtime_error(std::format(
+      "Couldn't create shared memory '{}': {}", _name, std::strerror(errno)));
+
+  if (ftruncate(descriptor, static_cast<off_t>(_size)) != 0)
+  {
+    const int error = errno;
+    close(descriptor);
+    shm_unlink(_name.c_str());
+    throw std::runtime_error(std::format(
+      "Couldn't size shared memory '{}' to {} bytes: {}", _name, _size, std::strerror(error)));
+  }
+
+  void* memory = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+  close(descriptor);
+  if (memory == MAP_FAILED)
+  {
+    shm_unlink(_name.c_str());
+    throw std::runtime_error(std::format(
+      "Couldn't map shared memory '{}': {}", _name, std::strerror(errno)));
+  }
+  _memory = static_cast<std::byte*>(memory);
+
+  // Slots are zero filled by the truncation, which is a valid even version.
+  auto* header = new (_memory) SharedSnapshotRing::Header {};
+  header->_slotCount = std::max(slotCount, 2u);
+  header->_capacity = capacity;
+  header->_slotSize = SharedSnapshotRing::SlotSize(capacity);
+  header->_bodySize = sizeof(SharedSnapshotRing::Body);
+  for (uint32_t slot = 0; slot < header->_slotCount; ++slot)
+  {
+    new (_memory + SharedSnapshotRing::SlotOffset + slot * header->_slotSize) SharedSnapshotRing::Slot {};
+  }
+  header->_magic.store(SharedSnapshotRing::Magic, std::memory_order_release);
+
+  printf("Publishing snapshots of up to %u bodies to shared memory '%s' (%zu bytes)\n",
+         capacity, _name.c_str(), _size);
+}
+
+sim::SharedSnapshotPublisher::~SharedSnapshotPublisher()
+{
+  // Viewers still mapping the object keep it alive, and attach to the next producer.
+  auto* header = reinterpret_cast<SharedSnapshotRing::Header*>(_memory);
+  header->_closed.store(1, std::memory_order_release);
+  munmap(_memory, _size);
+  shm_unlink(_name.c_str());
+}
+
+void sim::SharedSnapshotPublisher::Publish(const Snapshot& snapshot) noexcept
+{
+  auto& header = *reinterpret_cast<SharedSnapshotRing::Header*>(_memory);
+  const auto sequence = ++_sequence;
+  auto& slot = SlotAt(_memory, header, sequence);
+
+  const auto bodyCount = static_cast<uint32_t>(std::min<size_t>(snapshot._bodies.size(), header._capacity));
+  if (bodyCount < snapshot._bodies.size() && !_truncated)
+  {
+    _truncated = true;
+    printf("Snapshot of %zu bodies exceeds the shared memory capacity of %u bodies\n",
+           snapshot._bodies.size(), header._capacity);
+  }
+
+  // Odd version while written, readers of the slot retry.
+  const auto version = slot._version.load(std::memory_order_relaxed);
+  slot._version.store(version + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  slot._sequence = sequence;
+  slot._time = snapshot._time;
+  slot._published = snapshot._published.time_since_epoch().count();
+  slot._bodyCount = bodyCount;
+  auto* const bodies = BodiesOf(slot);
+  for (uint32_t index = 0; index < bodyCount; ++index)
+  {
+    const auto& body = snapshot._bodies[index];
+    bodies[index] = SharedSnapshotRing::Body {
+      ._position = {body._position._right, body._position._up, body._position._forward},
+      ._velocity = {body._velocity._right, body._velocity._up, body._velocity._forward}};
+  }
+
+  slot._version.store(version + 2, std::memory_order_release);
+  header._latest.store(sequence, std::memory_order_release);
+}
+
+sim::SharedSnapshotReader::SharedSnapshotReader(std::string name)
+    : _name(std::move(name))
+{
+}
+
+sim::SharedSnapshotReader::~SharedSnapshotReader()
+{
+  Detach();
+}
+
+bool sim::SharedSnapshotReader::Read(Snapshot& snapshot)
+{
+  if (_memory)
+  {
+    const auto& header = *reinterpret_cast<const SharedSnapshotRing::Header*>(_memory);
+    if (header._closed.load(std::memory_order_acquire))
+      Detach();
+  }
+  if (!_memory)
+    Attach();
+  if (!_memory)
+    return false;
+
+  const auto& header = *reinterpret_cast<const SharedSnapshotRing::Header*>(_memory);
+  for (uint32_t attempt = 0; attempt < MaxReadAttempts; ++attempt)
+  {
+    const auto latest = header._latest.load(std::memory_order_acquire);
+    if (latest == 0 || latest == _sequence)
+      return false;
+
+    const auto& slot = SlotAt(_memory, header, latest);
+    const auto version = slot._version.load(std::memory_order_acquire);
+    if (version % 2 != 0)
+      continue;
+
+    // Copied optimistically, the count is bounded in case it's torn.
+    const auto sequence = slot._sequence;
+    const auto time = slot._time;
+    const auto published = slot._published;
+    const auto bodyCount = std::min(slot._bodyCount, header._capacity);
+    const auto* const bodies = BodiesOf(slot);
+    snapshot._bodies.clear();
+    snapshot._bodies.reserve(bodyCount);
+    for (uint32_t index = 0; index < bodyCount; ++index)
+    {
+      const auto& body = bodies[index];
+      snapshot._bodies.push_back(BodyState {
+        ._position = {body._position[0], body._position[1], body._position[2]},
+        ._velocity = {body._velocity[0], body._velocity[1], body._velocity[2]}});
+    }
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot._version.load(std::memory_order_relaxed) != version)
+      continue;
+
+    _sequence = sequence;
+    snapshot._sequence = sequence;
+    snapshot._time = time;
+    snapshot._published = Snapshot::Clock::time_point(Snapshot::Clock::duration(published));
+    return true;
+  }
+
+  // The producer laps the reader, the next read catches up.
+  return false;
+}
+
+void sim::SharedSnapshotReader::Attach()
+{
+  const int descriptor = shm_open(_name.c_str(), O_RDONLY, 0);
+  if (descriptor < 0)
+    return;
+
+  struct stat status {};
+  if (fstat(descriptor, &status) != 0
+      || static_cast<size_t>(status.st_size) < SharedSnapshotRing::SlotOffset)
+  {
+    close(descriptor);
+    return;
+  }
+
+  const auto size = static_cast<size_t>(status.st_size);
+  void* memory = mmap(nullptr, size, PROT_READ, MAP_SHARED, descriptor, 0);
+  close(descriptor);
+  if (memory == MAP_FAILED)
+    return;
+
+  // The producer may still be writing the header, or be of another build.
+  const auto& header = *static_cast<const SharedSnapshotRing::Header*>(memory);
+  if (header._magic.load(std::memory_order_acquire) != SharedSnapshotRing::Magic
+      || header._bodySize != sizeof(SharedSnapshotRing::Body)
+      || header._slotCount == 0
+      || header._slotSize < SharedSnapshotRing::SlotSize(header._capacity)
+      || SharedSnapshotRing::SlotOffset + header._slotCount * header._slotSize > size
+      || header._closed.load(std::memory_order_acquire))
+  {
+    munmap(memory, size);
+    return;
+  }
+
+  _memory = static_cast<const std::byte*>(memory);
+  _size = size;
+  _sequence = 0;
+  printf("Attached to shared memory '%s'\n", _name.c_str());
+}
+
+void sim::SharedSnapshotReader::Detach() noexcept
+{
+  if (!_memory)
+    return;
+
+  munmap(const_cast<std::byte*>(_memory), _size);
+  _memory = nullptr;
+  _size = 0;
+}
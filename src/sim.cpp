@@ -3,6 +3,53 @@
 //
 
 #include "sim/sim.hpp"
+#include "sim/events.hpp"
+#include "sim/metrics.hpp"
+
+#include <chrono>
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+//! Metrics of the ticks of a simulator.
+struct TickMetrics
+{
+  sim::Counter& _bodies;
+  sim::Histogram& _duration;
+
+  //! Records tick of bodies started at start.
+  void Record(size_t bodies, Clock::time_point start) const noexcept
+  {
+    _bodies.Add(bodies);
+    _duration.Record(Clock::now() - start);
+  }
+};
+
+//! @returns Metrics of the dynamics simulator.
+const TickMetrics& DynamicsMetrics()
+{
+  static const TickMetrics metrics {
+    ._bodies = sim::Metrics::Instance().RegisterCounter(
+      "sim_dynamics_bodies_total", "Bodies stepped by the dynamics simulator."),
+    ._duration = sim::Metrics::Instance().RegisterHistogram(
+      "sim_dynamics_tick_seconds", "Duration of a dynamics simulator tick.", 1e-9)};
+  return metrics;
+}
+
+//! @returns Metrics of the kinematics simulator.
+const TickMetrics& KinematicsMetrics()
+{
+  static const TickMetrics metrics {
+    ._bodies = sim::Metrics::Instance().RegisterCounter(
+      "sim_kinematics_bodies_total", "Bodies stepped by the kinematics simulator."),
+    ._duration = sim::Metrics::Instance().RegisterHistogram(
+      "sim_kinematics_tick_seconds", "Duration of a kinematics simulator tick.", 1e-9)};
+  return metrics;
+}
+
+}// namespace
 
 void sim::Environment::AddBody(sim::Body body)
 {
@@ -19,52 +66,74 @@ sim::BodyDynamicsSimulator::BodyDynamicsSimulator(sim::Environment& env)
 
 void sim::BodyDynamicsSimulator::Tick(float time) noexcept
 {
+  const auto start = Clock::now();
+  size_t index = 0;
   for (auto& body: _environment._bodies)
   {
-    const math::vec3d kineticFrictionForce =
-      math::vec3d{_environment._gravity._up * (0.50 / 0.20)} * math::SidewaysVector;
-
-    const math::vec3d staticFrictionForce =
-      math::vec3d{_environment._gravity._up * (0.50 / 0.35)} * math::SidewaysVector;
-
-    std::array<math::vec3d, 3> forces{
-      // Add gravity force to the body.
-      _environment._gravity * body._weight,// F = m*g
-
-      // Add wind force to the body.
-      _environment._wind * body._weight,
-
-      // Add kinetic friction force to the body.
-      body._onGround && (math::SidewaysVector * body._velocity).magnitudeSquared() > 0.1
-        ? kineticFrictionForce
-        : math::ZeroVector,
-    };
-
-    auto force = std::accumulate(
-      forces.begin(),
-      forces.end(),
-      math::vec3d(0));
-
-    // Apply impulse forces.
-    for (auto& [impulseForce, impulseTime]: body._impulseForces)
-    {
-      if (impulseTime > 0.0f)
-        force += impulseForce;
-      impulseTime -= time;
-    }
-
-    // If body is on ground and has no velocity,
-    // force must be greater than static friction force to get the body moving.
-    {
-      if (body._onGround && body._velocity._right == 0.0 && force._right + staticFrictionForce._right < 0.0)
-        force._right = 0;
-
-      if (body._onGround && body._velocity._forward == 0.0 && force._forward + staticFrictionForce._forward < 0.0)
-        force._forward = 0;
-    }
-
-    body._acceleration = force / body._weight;
+    Step(body, time);
+    if (_events)
+      _events->Grounded(index++, body);
+  }
+  DynamicsMetrics().Record(_environment._bodies.size(), start);
+}
+
+void sim::BodyDynamicsSimulator::Tick(std::span<Body> bodies, float time, size_t firstBody) const noexcept
+{
+  const auto start = Clock::now();
+  for (size_t index = 0; index < bodies.size(); ++index)
+  {
+    Step(bodies[index], time);
+    if (_events)
+      _events->Grounded(firstBody + index, bodies[index]);
+  }
+  DynamicsMetrics().Record(bodies.size(), start);
+}
+
+void sim::BodyDynamicsSimulator::Step(Body& body, float time) const noexcept
+{
+  const math::vec3d kineticFrictionForce =
+    math::vec3d{_environment._gravity._up * (0.50 / 0.20)} * math::SidewaysVector;
+
+  const math::vec3d staticFrictionForce =
+    math::vec3d{_environment._gravity._up * (0.50 / 0.35)} * math::SidewaysVector;
+
+  std::array<math::vec3d, 3> forces{
+    // Add gravity force to the body.
+    _environment._gravity * body._weight,// F = m*g
+
+    // Add wind force to the body.
+    _environment._wind * body._weight,
+
+    // Add kinetic friction force to the body.
+    body._onGround && (math::SidewaysVector * body._velocity).magnitudeSquared() > 0.1
+      ? kineticFrictionForce
+      : math::ZeroVector,
+  };
+
+  auto force = std::accumulate(
+    forces.begin(),
+    forces.end(),
+    math::vec3d(0));
+
+  // Apply impulse forces.
+  for (auto& [impulseForce, impulseTime]: body._impulseForces)
+  {
+    if (impulseTime > 0.0f)
+      force += impulseForce;
+    impulseTime -= time;
+  }
+
+  // If body is on ground and has no velocity,
+  // force must be greater than static friction force to get the body moving.
+  {
+    if (body._onGround && body._velocity._right == 0.0 && force._right + staticFrictionForce._right < 0.0)
+      force._right = 0;
+
+    if (body._onGround && body._velocity._forward == 0.0 && force._forward + staticFrictionForce._forward < 0.0)
+      force._forward = 0;
   }
+
+  body._acceleration = force / body._weight;
 }
 
 sim::BodyKinematicsSimulator::BodyKinematicsSimulator(sim::Environment& env)
@@ -72,15 +141,49 @@ sim::BodyKinematicsSimulator::BodyKinematicsSimulator(sim::Environment& env)
 
 void sim::BodyKinematicsSimulator::Tick(float time) noexcept
 {
+  const auto start = Clock::now();
+  size_t index = 0;
   for (auto& body: _environment._bodies)
   {
-    body._velocity += body._acceleration * time;
+    Step(body, time, index++);
+  }
+  KinematicsMetrics().Record(_environment._bodies.size(), start);
+}
 
-    if ((body._velocity * math::SidewaysVector).magnitudeSquared() < 0.1 && (body._acceleration * math::SidewaysVector).magnitudeSquared() < 0.1)
-    {
-      body._velocity *= math::UpwardVector;
-    }
+void sim::BodyKinematicsSimulator::Tick(std::span<Body> bodies, float time, size_t firstBody) const noexcept
+{
+  const auto start = Clock::now();
+  for (size_t index = 0; index < bodies.size(); ++index)
+  {
+    Step(bodies[index], time, firstBody + index);
+  }
+  KinematicsMetrics().Record(bodies.size(), start);
+}
 
-    body._position += body._velocity * time;
+void sim::BodyKinematicsSimulator::Step(Body& body, float time, size_t index) const noexcept
+{
+  // Only bodies of a stream with triggers pay for keeping their previous state.
+  if (_events)
+  {
+    const auto position = body._position;
+    const auto velocity = body._velocity;
+    Move(body, time);
+    _events->Moved(index, position, velocity, body);
   }
+  else
+  {
+    Move(body, time);
+  }
+}
+
+void sim::BodyKinematicsSimulator::Move(Body& body, float time) noexcept
+{
+  body._velocity += body._acceleration * time;
+
+  if ((body._velocity * math::SidewaysVector).magnitudeSquared() < 0.1 && (body._acceleration * math::SidewaysVector).magnitudeSquared() < 0.1)
+  {
+    body._velocity *= math::UpwardVector;
+  }
+
+  body._position += body._velocity * time;
 }
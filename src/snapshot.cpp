@@ -0,0 +1,113 @@
+//
+// Created by maros on 02.12.2023.
+//
+
+#include "sim/snapshot.hpp"
+
+#include <algorithm>
+
+void sim::Snapshot::Capture(const sim::Environment& environment, double time)
+{
+  Begin(time);
+  _bodies.reserve(environment._bodies.size());
+  for (const auto& body: environment._bodies)
+  {
+    _bodies.push_back(BodyState{
+      ._position = body._position,
+      ._velocity = body._velocity});
+  }
+  Index();
+}
+
+void sim::Snapshot::Begin(double time)
+{
+  _time = time;
+  _bodies.clear();
+}
+
+void sim::Snapshot::Append(std::span<const Body> bodies)
+{
+  _bodies.reserve(_bodies.size() + bodies.size());
+  for (const auto& body: bodies)
+  {
+    _bodies.push_back(BodyState{
+      ._position = body._position,
+      ._velocity = body._velocity});
+  }
+}
+
+void sim::Snapshot::Index()
+{
+  _index.Update(_bodies);
+}
+
+sim::SnapshotExchange::SnapshotExchange() noexcept
+    : _back(&_slots[0])
+    , _shared(reinterpret_cast<std::uintptr_t>(&_slots[1]))
+    , _latest(&_slots[2])
+    , _previous(&_slots[3])
+{
+}
+
+void sim::SnapshotExchange::Stamp() noexcept
+{
+  _back->_sequence = ++_sequence;
+  _back->_published = Snapshot::Clock::now();
+}
+
+void sim::SnapshotExchange::Publish() noexcept
+{
+  // Hand the back slot over and take whichever slot was in between.
+  // If the consumer didn't pick up the previous one, it's simply overwritten.
+  const auto shared = _shared.exchange(
+    reinterpret_cast<std::uintptr_t>(_back) | FreshBit,
+    std::memory_order_acq_rel);
+  _back = reinterpret_cast<Snapshot*>(shared & ~FreshBit);
+}
+
+bool sim::SnapshotExchange::Acquire() noexcept
+{
+  if ((_shared.load(std::memory_order_relaxed) & FreshBit) == 0)
+    return false;
+
+  // Give back the oldest consumer slot, the newest one becomes previous.
+  const auto shared = _shared.exchange(
+    reinterpret_cast<std::uintptr_t>(_previous),
+    std::memory_order_acq_rel);
+  _previous = _latest;
+  _latest = reinterpret_cast<Snapshot*>(shared & ~FreshBit);
+  return true;
+}
+
+void sim::SnapshotExchange::Interpolate(
+  Snapshot::Clock::time_point now,
+  std::vector<math::vec3d>& positions) const
+{
+  const auto& latest = *_latest;
+  const auto& previous = *_previous;
+
+  // Time between the two snapshots [s].
+  const double tick = latest._time - previous._time;
+  // Time since the latest snapshot was published [s].
+  const double elapsed = std::chrono::duration<double>(
+    now - latest._published).count();
+  const double alpha = tick > 0.0
+                         ? std::clamp(elapsed / tick, 0.0, 1.0)
+                         : 1.0;
+
+  positions.clear();
+  positions.reserve(latest._bodies.size());
+  for (size_t index = 0; index < latest._bodies.size(); ++index)
+  {
+    const auto& to = latest._bodies[index]._position;
+    // Bodies added since the previous snapshot are not interpolated.
+    if (index >= previous._bodies.size())
+    {
+      positions.push_back(to);
+      continue;
+    }
+
+    const auto& from = previous._bodies[index]._position;
+    positions.push_back(from + (to - from) * alpha);
+  }
+}
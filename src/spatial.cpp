@@ -0,0 +1,473 @@
+//
+// Created by maros on 17.12.2023.
+//
+
+#include "sim/spatial.hpp"
+#include "sim/snapshot.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <queue>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+
+namespace sim
+{
+
+namespace
+{
+
+//! @returns Dot product of two vectors.
+double Dot(const math::vec3d& lhs, const math::vec3d& rhs) noexcept
+{
+  return lhs._right * rhs._right + lhs._up * rhs._up + lhs._forward * rhs._forward;
+}
+
+//! @returns Squared distance between two points.
+double DistanceSquared(const math::vec3d& lhs, const math::vec3d& rhs) noexcept
+{
+  const auto difference = lhs - rhs;
+  return Dot(difference, difference);
+}
+
+//! @returns Number of threads a batch of queries is split across.
+size_t ThreadsFor(size_t queryCount) noexcept
+{
+  const auto worthwhile = queryCount / SpatialIndex::MinQueriesPerThread;
+  return std::clamp<size_t>(worthwhile, 1, std::max(1u, std::thread::hardware_concurrency()));
+}
+
+//! Calls function with contiguous ranges of the queries, one per thread.
+template<typename Function>
+void ForEachRange(size_t queryCount, size_t threads, Function&& function)
+{
+  const auto step = (queryCount + threads - 1) / threads;
+  std::vector<std::jthread> workers;
+  for (size_t thread = 1; thread < threads; ++thread)
+  {
+    workers.emplace_back([&, thread]() {
+      const auto begin = std::min(thread * step, queryCount);
+      function(thread, begin, std::min(begin + step, queryCount));
+    });
+  }
+  function(0, 0, std::min(step, queryCount));
+}
+
+}// namespace
+
+SpatialIndex::SpatialIndex(double cellSize)
+  : _cellSize(cellSize)
+{
+}
+
+void SpatialIndex::Update(std::span<const BodyState> bodies)
+{
+  const auto previous = static_cast<uint32_t>(_keys.size());
+  const auto count = static_cast<uint32_t>(bodies.size());
+
+  // Bodies past the new count are gone.
+  for (auto body = previous; body > count; --body)
+  {
+    Remove(body - 1);
+  }
+  _keys.resize(count);
+  _rows.resize(count);
+
+  _relinked = 0;
+  _positions.clear();
+  _positions.reserve(count);
+  _min = Cell {
+    ._x = CellBias,
+    ._y = CellBias,
+    ._z = CellBias};
+  _max = Cell {
+    ._x = -CellBias,
+    ._y = -CellBias,
+    ._z = -CellBias};
+  for (uint32_t body = 0; body < count; ++body)
+  {
+    const auto& position = bodies[body]._position;
+    _positions.push_back(position);
+
+    const auto cell = CellOf(position);
+    _min = Cell {
+      ._x = std::min(_min._x, cell._x),
+      ._y = std::min(_min._y, cell._y),
+      ._z = std::min(_min._z, cell._z)};
+    _max = Cell {
+      ._x = std::max(_max._x, cell._x),
+      ._y = std::max(_max._y, cell._y),
+      ._z = std::max(_max._z, cell._z)};
+
+    // Most bodies stay within their cell between updates.
+    const auto key = KeyOf(cell);
+    if (body < previous)
+    {
+      if (_keys[body] == key)
+        continue;
+      Remove(body);
+    }
+    Insert(body, key);
+    _relinked++;
+  }
+}
+
+void SpatialIndex::Query(const Sphere& sphere, std::vector<uint32_t>& results) const
+{
+  const auto extent = math::vec3d(sphere._radius);
+  const auto radiusSquared = sphere._radius * sphere._radius;
+  ForEachCell(
+    CellOf(sphere._center - extent),
+    CellOf(sphere._center + extent),
+    [&](const std::vector<uint32_t>& bodies) {
+      for (const auto body : bodies)
+      {
+        if (DistanceSquared(_positions[body], sphere._center) <= radiusSquared)
+          results.push_back(body);
+      }
+    });
+}
+
+void SpatialIndex::Query(const Box& box, std::vector<uint32_t>& results) const
+{
+  ForEachCell(
+    CellOf(box._min),
+    CellOf(box._max),
+    [&](const std::vector<uint32_t>& bodies) {
+      for (const auto body : bodies)
+      {
+        const auto& position = _positions[body];
+        if (position._right >= box._min._right && position._right <= box._max._right
+            && position._up >= box._min._up && position._up <= box._max._up
+            && position._forward >= box._min._forward && position._forward <= box._max._forward)
+          results.push_back(body);
+      }
+    });
+}
+
+void SpatialIndex::Query(const Nearest& nearest, std::vector<uint32_t>& results) const
+{
+  const auto count = std::min<size_t>(nearest._count, _positions.size());
+  if (count == 0)
+    return;
+
+  // Farthest of the nearest bodies found so far on top.
+  std::priority_queue<std::pair<double, uint32_t>> found;
+  const auto consider = [&](uint32_t body) {
+    const auto distance = DistanceSquared(_positions[body], nearest._point);
+    if (found.size() < count)
+      found.emplace(distance, body);
+    else if (distance < found.top().first)
+    {
+      found.pop();
+      found.emplace(distance, body);
+    }
+  };
+
+  // Rings of cells around the point, until no unvisited cell can be nearer than
+  // the farthest body found. Bodies in ring r+1 and beyond are at least r cells away.
+  const auto center = CellOf(nearest._point);
+  size_t visited = 0;
+  for (int64_t ring = 0; visited < _positions.size(); ++ring)
+  {
+    const auto side = static_cast<double>(2 * ring + 1);
+    if (side * side * side > static_cast<double>(_cells.size()))
+    {
+      // Sparse grid, scanning the bodies is cheaper than the ring.
+      found = {};
+      for (uint32_t body = 0; body < _positions.size(); ++body)
+      {
+        consider(body);
+      }
+      break;
+    }
+
+    for (auto x = center._x - ring; x <= center._x + ring; ++x)
+    {
+      for (auto y = center._y - ring; y <= center._y + ring; ++y)
+      {
+        // Only the faces of the ring, its inside was visited already.
+        const bool face = std::abs(x - center._x) == ring || std::abs(y - center._y) == ring;
+        const auto zStep = face || ring == 0 ? 1 : 2 * ring;
+        for (auto z = center._z - ring; z <= center._z + ring; z += zStep)
+        {
+          const auto cell = _cells.find(KeyOf(Cell {._x = x, ._y = y, ._z = z}));
+          if (cell == _cells.end())
+            continue;
+          for (const auto body : cell->second)
+          {
+            consider(body);
+          }
+          visited += cell->second.size();
+        }
+      }
+    }
+
+    const auto reach = static_cast<double>(ring) * _cellSize;
+    if (found.size() == count && found.top().first <= reach * reach)
+      break;
+  }
+
+  const auto first = results.size();
+  results.resize(first + found.size());
+  for (auto index = results.size(); !found.empty(); found.pop())
+  {
+    results[--index] = found.top().second;
+  }
+}
+
+std::optional<RayHit> SpatialIndex::Query(const Ray& ray) const
+{
+  if (_positions.empty())
+    return std::nullopt;
+
+  // Bodies hit within the radius may lie in neighbouring cells of the traversed ones.
+  const auto margin = static_cast<int64_t>(std::ceil(ray._radius / _cellSize));
+  const auto radiusSquared = ray._radius * ray._radius;
+
+  std::optional<RayHit> hit;
+  const auto test = [&](const std::vector<uint32_t>& bodies) {
+    for (const auto body : bodies)
+    {
+      const auto offset = _positions[body] - ray._origin;
+      const auto along = Dot(offset, ray._direction);
+      const auto missSquared = Dot(offset, offset) - along * along;
+      if (missSquared > radiusSquared)
+        continue;
+
+      const auto halfChord = std::sqrt(radiusSquared - missSquared);
+      auto distance = along - halfChord;
+      if (distance < 0.0)
+        distance = along + halfChord;
+      if (distance < 0.0 || distance > ray._length)
+        continue;
+      if (!hit || distance < hit->_distance)
+        hit = RayHit {._body = body, ._distance = distance};
+    }
+  };
+
+  // Cells along the ray, stepped by the nearest boundary.
+  const double origin[3] {ray._origin._right, ray._origin._up, ray._origin._forward};
+  const double direction[3] {ray._direction._right, ray._direction._up, ray._direction._forward};
+  const auto start = CellOf(ray._origin);
+  int64_t cell[3] {start._x, start._y, start._z};
+  const int64_t min[3] {_min._x - margin, _min._y - margin, _min._z - margin};
+  const int64_t max[3] {_max._x + margin, _max._y + margin, _max._z + margin};
+
+  int64_t step[3] {};
+  double next[3] {};
+  double delta[3] {};
+  for (int axis = 0; axis < 3; ++axis)
+  {
+    constexpr auto Infinity = std::numeric_limits<double>::infinity();
+    if (direction[axis] == 0.0)
+    {
+      next[axis] = Infinity;
+      delta[axis] = Infinity;
+      continue;
+    }
+
+    step[axis] = direction[axis] > 0.0 ? 1 : -1;
+    const auto boundary = static_cast<double>(cell[axis] + (step[axis] > 0 ? 1 : 0)) * _cellSize;
+    next[axis] = (boundary - origin[axis]) / direction[axis];
+    delta[axis] = _cellSize / std::abs(direction[axis]);
+  }
+
+  // Cells near the traversed ones are tested once, however many traversed cells they neighbour.
+  std::unordered_set<const std::vector<uint32_t>*> tested;
+  const auto slack = static_cast<double>(margin + 1) * _cellSize * std::sqrt(3.0);
+  for (double distance = 0.0; distance <= ray._length;)
+  {
+    // Later cells can't hold a nearer hit.
+    if (hit && distance > hit->_distance + slack)
+      break;
+
+    // Past the occupied cells in the direction of the ray.
+    bool leaving = false;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+      leaving |= (step[axis] > 0 && cell[axis] > max[axis]) || (step[axis] < 0 && cell[axis] < min[axis])
+                 || (step[axis] == 0 && (cell[axis] > max[axis] || cell[axis] < min[axis]));
+    }
+    if (leaving)
+      break;
+
+    const Cell traversed {._x = cell[0], ._y = cell[1], ._z = cell[2]};
+    if (margin == 0)
+    {
+      if (const auto found = _cells.find(KeyOf(traversed)); found != _cells.end())
+        test(found->second);
+    }
+    else
+    {
+      ForEachCell(
+        Cell {._x = traversed._x - margin, ._y = traversed._y - margin, ._z = traversed._z - margin},
+        Cell {._x = traversed._x + margin, ._y = traversed._y + margin, ._z = traversed._z + margin},
+        [&](const std::vector<uint32_t>& bodies) {
+          if (tested.insert(&bodies).second)
+            test(bodies);
+        });
+    }
+
+    const auto axis = next[0] < next[1]
+                        ? (next[0] < next[2] ? 0 : 2)
+                        : (next[1] < next[2] ? 1 : 2);
+    distance = next[axis];
+    cell[axis] += step[axis];
+    next[axis] += delta[axis];
+  }
+
+  return hit;
+}
+
+void SpatialIndex::Query(std::span<const Sphere> queries, SpatialResults& results) const
+{
+  Batch(queries, results);
+}
+
+void SpatialIndex::Query(std::span<const Box> queries, SpatialResults& results) const
+{
+  Batch(queries, results);
+}
+
+void SpatialIndex::Query(std::span<const Nearest> queries, SpatialResults& results) const
+{
+  Batch(queries, results);
+}
+
+void SpatialIndex::Query(
+  std::span<const Ray> queries,
+  std::vector<std::optional<RayHit>>& results) const
+{
+  results.resize(queries.size());
+  ForEachRange(queries.size(), ThreadsFor(queries.size()), [&](size_t, size_t begin, size_t end) {
+    for (auto query = begin; query < end; ++query)
+    {
+      results[query] = Query(queries[query]);
+    }
+  });
+}
+
+template<typename QueryType>
+void SpatialIndex::Batch(std::span<const QueryType> queries, SpatialResults& results) const
+{
+  // Every thread collects into its own results, concatenated in query order.
+  const auto threads = ThreadsFor(queries.size());
+  std::vector<SpatialResults> partial(threads);
+  ForEachRange(queries.size(), threads, [&](size_t thread, size_t begin, size_t end) {
+    auto& own = partial[thread];
+    own._offsets.reserve(end - begin);
+    for (auto query = begin; query < end; ++query)
+    {
+      own._offsets.push_back(static_cast<uint32_t>(own._bodies.size()));
+      Query(queries[query], own._bodies);
+    }
+  });
+
+  results._offsets.clear();
+  results._bodies.clear();
+  results._offsets.reserve(queries.size() + 1);
+  for (const auto& own : partial)
+  {
+    const auto base = static_cast<uint32_t>(results._bodies.size());
+    for (const auto offset : own._offsets)
+    {
+      results._offsets.push_back(base + offset);
+    }
+    results._bodies.insert(results._bodies.end(), own._bodies.begin(), own._bodies.end());
+  }
+  results._offsets.push_back(static_cast<uint32_t>(results._bodies.size()));
+}
+
+SpatialIndex::Cell SpatialIndex::CellOf(const math::vec3d& position) const noexcept
+{
+  const auto coordinate = [this](double value) {
+    const auto cell = std::floor(value / _cellSize);
+    return static_cast<int64_t>(std::clamp(
+      cell,
+      static_cast<double>(-CellBias),
+      static_cast<double>(CellBias - 1)));
+  };
+  return Cell {
+    ._x = coordinate(position._right),
+    ._y = coordinate(position._up),
+    ._z = coordinate(position._forward)};
+}
+
+uint64_t SpatialIndex::KeyOf(const Cell& cell) noexcept
+{
+  // 21 bits per coordinate.
+  return static_cast<uint64_t>(cell._x + CellBias) << 42
+         | static_cast<uint64_t>(cell._y + CellBias) << 21
+         | static_cast<uint64_t>(cell._z + CellBias);
+}
+
+SpatialIndex::Cell SpatialIndex::CellOf(uint64_t key) noexcept
+{
+  constexpr uint64_t Mask = (uint64_t(1) << 21) - 1;
+  return Cell {
+    ._x = static_cast<int64_t>(key >> 42 & Mask) - CellBias,
+    ._y = static_cast<int64_t>(key >> 21 & Mask) - CellBias,
+    ._z = static_cast<int64_t>(key & Mask) - CellBias};
+}
+
+void SpatialIndex::Insert(uint32_t body, uint64_t key)
+{
+  auto& cell = _cells[key];
+  _keys[body] = key;
+  _rows[body] = static_cast<uint32_t>(cell.size());
+  cell.push_back(body);
+}
+
+void SpatialIndex::Remove(uint32_t body)
+{
+  const auto found = _cells.find(_keys[body]);
+  auto& cell = found->second;
+
+  // Cells stay dense, the hole is filled with the last body of the cell.
+  const auto last = cell.back();
+  cell[_rows[body]] = last;
+  _rows[last] = _rows[body];
+  cell.pop_back();
+  if (cell.empty())
+    _cells.erase(found);
+}
+
+template<typename Function>
+void SpatialIndex::ForEachCell(const Cell& min, const Cell& max, Function&& function) const
+{
+  const auto volume = static_cast<double>(max._x - min._x + 1)
+                      * static_cast<double>(max._y - min._y + 1)
+                      * static_cast<double>(max._z - min._z + 1);
+
+  // Large ranges over few cells are cheaper to filter than to look up.
+  if (volume > static_cast<double>(_cells.size()))
+  {
+    for (const auto& [key, bodies] : _cells)
+    {
+      const auto cell = CellOf(key);
+      if (cell._x >= min._x && cell._x <= max._x
+          && cell._y >= min._y && cell._y <= max._y
+          && cell._z >= min._z && cell._z <= max._z)
+        function(bodies);
+    }
+    return;
+  }
+
+  for (auto x = min._x; x <= max._x; ++x)
+  {
+    for (auto y = min._y; y <= max._y; ++y)
+    {
+      for (auto z = min._z; z <= max._z; ++z)
+      {
+        const auto found = _cells.find(KeyOf(Cell {._x = x, ._y = y, ._z = z}));
+        if (found != _cells.end())
+          function(found->second);
+      }
+    }
+  }
+}
+
+}// namespace sim
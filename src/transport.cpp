@@ -0,0 +1,329 @@
+//
+// Created by maros on 21.12.2023.
+//
+
+#include "sim/transport.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <format>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace
+{
+
+//! @returns Address of a socket path.
+//! @throws std::runtime_error If the path is too long for a socket.
+sockaddr_un AddressOf(const std::filesystem::path& path)
+{
+  sockaddr_un address {};
+  address.sun_family = AF_UNIX;
+  const auto string = path.string();
+  if (string.size() >= sizeof(address.sun_path))
+    throw std::runtime_error(std::format("Socket path '{}' is too long", string));
+  std::memcpy(address.sun_path, string.c_str(), string.size() + 1);
+  return address;
+}
+
+//! Writes all of the data to a blocking socket.
+void WriteAll(int socket, const void* data, size_t size)
+{
+  const auto* bytes = static_cast<const std::byte*>(data);
+  while (size > 0)
+  {
+    const auto written = write(socket, bytes, size);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written <= 0)
+      throw std::runtime_error(std::format("Couldn't write to worker: {}", std::strerror(errno)));
+    bytes += written;
+    size -= static_cast<size_t>(written);
+  }
+}
+
+//! Reads all of the data from a blocking socket.
+void ReadAll(int socket, void* data, size_t size)
+{
+  auto* bytes = static_cast<std::byte*>(data);
+  while (size > 0)
+  {
+    const auto read = ::read(socket, bytes, size);
+    if (read < 0 && errno == EINTR)
+      continue;
+    if (read <= 0)
+      throw std::runtime_error("Couldn't read from worker, it's gone");
+    bytes += read;
+    size -= static_cast<size_t>(read);
+  }
+}
+
+}// namespace
+
+std::vector<std::unique_ptr<sim::LocalTransport>> sim::LocalTransport::Create(uint32_t ranks)
+{
+  auto hub = std::make_shared<Hub>();
+  hub->_mailboxes.resize(ranks, std::vector<std::deque<Message>>(ranks));
+
+  std::vector<std::unique_ptr<LocalTransport>> transports;
+  for (uint32_t rank = 0; rank < ranks; ++rank)
+  {
+    transports.emplace_back(new LocalTransport(hub, rank));
+  }
+  return transports;
+}
+
+sim::LocalTransport::LocalTransport(std::shared_ptr<Hub> hub, uint32_t rank) noexcept
+    : _hub(std::move(hub))
+    , _rank(rank)
+{
+}
+
+void sim::LocalTransport::Exchange(std::span<const Message> outgoing, std::vector<Message>& incoming)
+{
+  const auto ranks = Ranks();
+  incoming.resize(ranks);
+
+  std::unique_lock lock(_hub->_mutex);
+  for (uint32_t peer = 0; peer < ranks; ++peer)
+  {
+    if (peer != _rank)
+      _hub->_mailboxes[_rank][peer].push_back(outgoing[peer]);
+  }
+  _hub->_delivered.notify_all();
+
+  for (uint32_t peer = 0; peer < ranks; ++peer)
+  {
+    incoming[peer].clear();
+    if (peer == _rank)
+      continue;
+
+    auto& mailbox = _hub->_mailboxes[peer][_rank];
+    _hub->_delivered.wait(lock, [&mailbox]() { return !mailbox.empty(); });
+    incoming[peer] = std::move(mailbox.front());
+    mailbox.pop_front();
+  }
+}
+
+sim::SocketTransport::SocketTransport(std::filesystem::path directory, uint32_t rank, uint32_t ranks)
+    : _path(SocketPath(directory, rank))
+    , _rank(rank)
+    , _sockets(ranks, -1)
+{
+  const auto address = AddressOf(_path);
+  _listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(_path.c_str());
+  if (_listener < 0
+      || bind(_listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0
+      || listen(_listener, static_cast<int>(ranks)) != 0)
+  {
+    const int error = errno;
+    if (_listener >= 0)
+      close(_listener);
+    throw std::runtime_error(std::format(
+      "Couldn't listen on '{}': {}", _path.string(), std::strerror(error)));
+  }
+
+  try
+  {
+    // Lower ranks are connected to, they may not have started yet.
+    const auto deadline = std::chrono::steady_clock::now() + ConnectTimeout;
+    for (uint32_t peer = 0; peer < rank; ++peer)
+    {
+      const auto peerAddress = AddressOf(SocketPath(directory, peer));
+      while (true)
+      {
+        const int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (connection >= 0
+            && connect(connection, reinterpret_cast<const sockaddr*>(&peerAddress), sizeof(peerAddress)) == 0)
+        {
+          _sockets[peer] = connection;
+          break;
+        }
+        if (connection >= 0)
+          close(connection);
+        if (std::chrono::steady_clock::now() > deadline)
+          throw std::runtime_error(std::format("Worker {} didn't start in time", peer));
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+      WriteAll(_sockets[peer], &_rank, sizeof(_rank));
+    }
+
+    // Higher ranks connect, introducing themselves.
+    for (uint32_t accepted = rank + 1; accepted < ranks; ++accepted)
+    {
+      pollfd listener {.fd = _listener, .events = POLLIN, .revents = 0};
+      const auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+      if (poll(&listener, 1, static_cast<int>(std::max<int64_t>(timeout.count(), 0))) <= 0)
+        throw std::runtime_error("Workers didn't start in time");
+
+      const int connection = accept(_listener, nullptr, nullptr);
+      if (connection < 0)
+        throw std::runtime_error(std::format("Couldn't accept worker: {}", std::strerror(errno)));
+
+      uint32_t peer = 0;
+      ReadAll(connection, &peer, sizeof(peer));
+      if (peer <= rank || peer >= ranks || _sockets[peer] >= 0)
+      {
+        close(connection);
+        throw std::runtime_error(std::format("Unexpected worker {}", peer));
+      }
+      _sockets[peer] = connection;
+    }
+  }
+  catch (...)
+  {
+    for (const int socket : _sockets)
+    {
+      if (socket >= 0)
+        close(socket);
+    }
+    close(_listener);
+    unlink(_path.c_str());
+    throw;
+  }
+
+  // Exchanges interleave sends and receives across the sockets.
+  for (const int socket : _sockets)
+  {
+    if (socket >= 0)
+      fcntl(socket, F_SETFL, fcntl(socket, F_GETFL) | O_NONBLOCK);
+  }
+}
+
+sim::SocketTransport::~SocketTransport()
+{
+  for (const int socket : _sockets)
+  {
+    if (socket >= 0)
+      close(socket);
+  }
+  close(_listener);
+  unlink(_path.c_str());
+}
+
+std::filesystem::path sim::SocketTransport::SocketPath(
+  const std::filesystem::path& directory,
+  uint32_t rank)
+{
+  return directory / std::format("worker-{}.sock", rank);
+}
+
+void sim::SocketTransport::Exchange(std::span<const Message> outgoing, std::vector<Message>& incoming)
+{
+  const auto ranks = Ranks();
+  incoming.resize(ranks);
+
+  // Messages are framed by their size.
+  struct Peer
+  {
+    uint64_t sendSize = 0;
+    size_t sent = 0;
+    uint64_t receiveSize = 0;
+    size_t received = 0;
+  };
+  std::vector<Peer> peers(ranks);
+  size_t pending = 0;
+  for (uint32_t peer = 0; peer < ranks; ++peer)
+  {
+    incoming[peer].clear();
+    if (peer == _rank)
+      continue;
+    peers[peer].sendSize = outgoing[peer].size();
+    pending += 2;
+  }
+
+  std::vector<pollfd> descriptors;
+  std::vector<uint32_t> descriptorPeers;
+  while (pending > 0)
+  {
+    descriptors.clear();
+    descriptorPeers.clear();
+    for (uint32_t peer = 0; peer < ranks; ++peer)
+    {
+      if (peer == _rank)
+        continue;
+
+      const auto& state = peers[peer];
+      const bool sending = state.sent < sizeof(uint64_t) + state.sendSize;
+      const bool receiving = state.received < sizeof(uint64_t)
+                             || state.received < sizeof(uint64_t) + state.receiveSize;
+      if (!sending && !receiving)
+        continue;
+
+      descriptors.push_back(pollfd {
+        .fd = _sockets[peer],
+        .events = static_cast<short>((sending ? POLLOUT : 0) | (receiving ? POLLIN : 0)),
+        .revents = 0});
+      descriptorPeers.push_back(peer);
+    }
+
+    if (poll(descriptors.data(), descriptors.size(), -1) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      throw std::runtime_error(std::format("Couldn't poll workers: {}", std::strerror(errno)));
+    }
+
+    for (size_t index = 0; index < descriptors.size(); ++index)
+    {
+      const auto& descriptor = descriptors[index];
+      const auto peer = descriptorPeers[index];
+      auto& state = peers[peer];
+
+      if (descriptor.revents & POLLOUT)
+      {
+        // Size first, then the message.
+        const auto* header = reinterpret_cast<const std::byte*>(&state.sendSize);
+        const auto* data = state.sent < sizeof(uint64_t)
+                             ? header + state.sent
+                             : outgoing[peer].data() + (state.sent - sizeof(uint64_t));
+        const auto size = state.sent < sizeof(uint64_t)
+                            ? sizeof(uint64_t) - state.sent
+                            : sizeof(uint64_t) + state.sendSize - state.sent;
+        const auto written = send(descriptor.fd, data, size, MSG_NOSIGNAL);
+        if (written < 0 && errno != EAGAIN && errno != EINTR)
+          throw std::runtime_error(std::format("Worker {} is gone: {}", peer, std::strerror(errno)));
+        if (written > 0)
+        {
+          state.sent += static_cast<size_t>(written);
+          if (state.sent == sizeof(uint64_t) + state.sendSize)
+            pending--;
+        }
+      }
+
+      if (descriptor.revents & (POLLIN | POLLHUP | POLLERR))
+      {
+        auto& message = incoming[peer];
+        auto* header = reinterpret_cast<std::byte*>(&state.receiveSize);
+        auto* data = state.received < sizeof(uint64_t)
+                       ? header + state.received
+                       : message.data() + (state.received - sizeof(uint64_t));
+        const auto size = state.received < sizeof(uint64_t)
+                            ? sizeof(uint64_t) - state.received
+                            : sizeof(uint64_t) + state.receiveSize - state.received;
+        const auto read = recv(descriptor.fd, data, size, 0);
+        if (read == 0)
+          throw std::runtime_error(std::format("Worker {} is gone", peer));
+        if (read < 0 && errno != EAGAIN && errno != EINTR)
+          throw std::runtime_error(std::format("Couldn't receive from worker {}: {}", peer, std::strerror(errno)));
+        if (read > 0)
+        {
+          state.received += static_cast<size_t>(read);
+          if (state.received == sizeof(uint64_t))
+            message.resize(state.receiveSize);
+          if (state.received == sizeof(uint64_t) + state.receiveSize)
+            pending--;
+        }
+      }
+    }
+  }
+}
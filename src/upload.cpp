@@ -0,0 +1,323 @@
+//
+// Created by maros on 05.12.2023.
+//
+
+#include "sim/upload.hpp"
+#include "sim/vulkan.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <optional>
+
+namespace
+{
+
+vk::DeviceSize alignUp(vk::DeviceSize value, vk::DeviceSize alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+}// namespace
+
+namespace vulkan
+{
+
+Uploader::Uploader(const Renderer& renderer, vk::DeviceSize capacity)
+    : _renderer(renderer)
+{
+  ring(capacity);
+
+  _alignment = std::max<vk::DeviceSize>(
+    _alignment,
+    _renderer._physicalDevice.getProperties().limits.optimalBufferCopyOffsetAlignment);
+
+  _commandPool = vkr::CommandPool(
+    _renderer._device,
+    vk::CommandPoolCreateInfo {
+      .flags = vk::CommandPoolCreateFlagBits::eTransient,
+      .queueFamilyIndex = _renderer.transferFamily()});
+}
+
+void Uploader::ring(vk::DeviceSize capacity)
+{
+  const auto& device = _renderer._device;
+
+  // Staging buffer is read by both the transfer and the graphics queue.
+  const auto families = _renderer.sharingFamilies();
+  _stagingBuffer = vkr::Buffer(
+    device,
+    vk::BufferCreateInfo {
+      .size = capacity,
+      .usage = vk::BufferUsageFlagBits::eTransferSrc,
+      .sharingMode = families.size() > 1
+                       ? vk::SharingMode::eConcurrent
+                       : vk::SharingMode::eExclusive,
+      .queueFamilyIndexCount = static_cast<uint32_t>(families.size()),
+      .pQueueFamilyIndices = families.data()});
+
+  // Persistently mapped by the allocator.
+  _stagingAllocation = _renderer._allocator->bind(
+    _stagingBuffer,
+    vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+  _staging = _stagingAllocation.mapped();
+  _capacity = capacity;
+  _head = 0;
+  _tail = 0;
+}
+
+void Uploader::upload(
+  vk::Buffer destination,
+  vk::DeviceSize offset,
+  std::span<const std::byte> data)
+{
+  if (data.empty())
+    return;
+
+  const auto stagingOffset = allocate(data.size());
+  std::memcpy(_staging + stagingOffset, data.data(), data.size());
+
+  _queuedCopies.emplace_back(
+    destination,
+    vk::BufferCopy {
+      .srcOffset = stagingOffset,
+      .dstOffset = offset,
+      .size = data.size()});
+}
+
+void Uploader::stream(
+  const vkr::CommandBuffer& commandBuffer,
+  vk::Buffer destination,
+  vk::DeviceSize offset,
+  std::span<const std::byte> data,
+  uint64_t frame)
+{
+  if (data.empty())
+    return;
+
+  const auto stagingOffset = allocate(data.size());
+  std::memcpy(_staging + stagingOffset, data.data(), data.size());
+  _openFrame = std::max(_openFrame, frame);
+
+  commandBuffer.copyBuffer(
+    *_stagingBuffer,
+    destination,
+    vk::BufferCopy {
+      .srcOffset = stagingOffset,
+      .dstOffset = offset,
+      .size = data.size()});
+}
+
+void Uploader::submit()
+{
+  if (_queuedCopies.empty())
+    return;
+
+  const auto& device = _renderer._device;
+  auto& batch = close();
+
+  vkr::CommandBuffers commandBuffers(
+    device,
+    vk::CommandBufferAllocateInfo {
+      .commandPool = *_commandPool,
+      .level = vk::CommandBufferLevel::ePrimary,
+      .commandBufferCount = 1});
+  batch.commandBuffer = std::move(commandBuffers.front());
+
+  batch.commandBuffer.begin(vk::CommandBufferBeginInfo {
+    .flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+  for (const auto& [destination, region]: _queuedCopies)
+  {
+    batch.commandBuffer.copyBuffer(*_stagingBuffer, destination, region);
+  }
+  batch.commandBuffer.end();
+  _queuedCopies.clear();
+
+  batch.fence = vkr::Fence(device, vk::FenceCreateInfo{});
+  batch.semaphore = vkr::Semaphore(device, vk::SemaphoreCreateInfo{});
+
+  _renderer._transferQueue.submit(
+    vk::SubmitInfo {
+      .commandBufferCount = 1,
+      .pCommandBuffers = &(*batch.commandBuffer),
+      .signalSemaphoreCount = 1,
+      .pSignalSemaphores = &(*batch.semaphore)},
+    *batch.fence);
+}
+
+std::vector<vk::Semaphore> Uploader::acquireWaitSemaphores(uint64_t frame)
+{
+  std::vector<vk::Semaphore> semaphores;
+  const auto acquire = [&semaphores, frame](std::deque<Batch>& batches) {
+    for (auto& batch: batches)
+    {
+      if (!*batch.semaphore || batch.semaphoreAcquired)
+        continue;
+
+      // The semaphore may only be destroyed once the waiting frame completes.
+      batch.semaphoreAcquired = true;
+      batch.frame = std::max(batch.frame, frame);
+      semaphores.push_back(*batch.semaphore);
+    }
+  };
+
+  // Transfers submitted before the ring grew are waited for as well.
+  for (auto& retired: _retiredRings)
+  {
+    acquire(retired.batches);
+  }
+  acquire(_batches);
+  return semaphores;
+}
+
+void Uploader::endFrame(uint64_t frame)
+{
+  // Queued copies must not end up in a batch without a transfer.
+  submit();
+
+  _openFrame = std::max(_openFrame, frame);
+  if (_openAllocations > 0)
+    close();
+}
+
+void Uploader::retire(uint64_t frame)
+{
+  _completedFrame = std::max(_completedFrame, frame);
+  reclaim();
+}
+
+void Uploader::finish()
+{
+  submit();
+
+  const auto wait = [this](const std::deque<Batch>& batches) {
+    for (const auto& batch: batches)
+    {
+      if (!*batch.fence)
+        continue;
+
+      const auto result = _renderer._device.waitForFences(
+        *batch.fence, true, UINT64_MAX);
+      assert(result == vk::Result::eSuccess);
+    }
+  };
+  for (const auto& retired: _retiredRings)
+  {
+    wait(retired.batches);
+  }
+  wait(_batches);
+  reclaim();
+}
+
+vk::DeviceSize Uploader::allocate(vk::DeviceSize size)
+{
+  reclaim();
+  if (size > _capacity)
+    grow(size);
+
+  while (true)
+  {
+    const bool empty = _batches.empty() && _openAllocations == 0;
+    if (empty)
+    {
+      _head = 0;
+      _tail = 0;
+    }
+
+    std::optional<vk::DeviceSize> offset;
+    const auto aligned = alignUp(_head, _alignment);
+    if (empty || _head > _tail)
+    {
+      // Free space is at the end of the ring, and at its start, up to the tail.
+      if (aligned + size <= _capacity)
+        offset = aligned;
+      else if (size <= _tail)
+        offset = 0;
+    }
+    else if (_head < _tail && aligned + size <= _tail)
+    {
+      offset = aligned;
+    }
+
+    if (offset)
+    {
+      _head = *offset + size;
+      _openAllocations++;
+      return *offset;
+    }
+
+    // Out of space. The oldest transfer is the only work the uploader can wait for on its own,
+    // frames are retired by their owner and must not stall, the ring grows instead.
+    if (_batches.empty()
+        || !*_batches.front().fence
+        || _batches.front().frame > _completedFrame)
+    {
+      grow(size);
+      continue;
+    }
+
+    const auto result = _renderer._device.waitForFences(
+      *_batches.front().fence, true, UINT64_MAX);
+    assert(result == vk::Result::eSuccess);
+    reclaim();
+  }
+}
+
+void Uploader::grow(vk::DeviceSize size)
+{
+  // Copies queued from the current ring are submitted, and its allocations closed,
+  // so that all of its batches retire with it.
+  submit();
+  if (_openAllocations > 0)
+    close();
+
+  _retiredRings.push_back(RetiredRing {
+    .allocation = std::move(_stagingAllocation),
+    .buffer = std::move(_stagingBuffer),
+    .batches = std::move(_batches)});
+  _batches.clear();
+
+  ring(std::max(_capacity * 2, alignUp(size, _alignment) * 2));
+}
+
+bool Uploader::completed(const Batch& batch) const
+{
+  if (batch.frame > _completedFrame)
+    return false;
+  return !*batch.fence || batch.fence.getStatus() == vk::Result::eSuccess;
+}
+
+void Uploader::reclaim()
+{
+  // Rings replaced by bigger ones are released once all of their batches completed.
+  while (!_retiredRings.empty())
+  {
+    auto& retired = _retiredRings.front();
+    while (!retired.batches.empty() && completed(retired.batches.front()))
+    {
+      retired.batches.pop_front();
+    }
+    if (!retired.batches.empty())
+      break;
+    _retiredRings.pop_front();
+  }
+
+  while (!_batches.empty() && completed(_batches.front()))
+  {
+    _tail = _batches.front().end;
+    _batches.pop_front();
+  }
+}
+
+Uploader::Batch& Uploader::close()
+{
+  auto& batch = _batches.emplace_back();
+  batch.end = _head;
+  batch.frame = _openFrame;
+
+  _openAllocations = 0;
+  _openFrame = 0;
+  return batch;
+}
+
+}// namespace vulkan
@@ -4,15 +4,72 @@
 
 #include "sim/vulkan.hpp"
 
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
 namespace vulkan
 {
 
+namespace
+{
+
+//! Workgroup size of the culling shader.
+constexpr uint32_t CullWorkgroupSize = 64;
+
+//! Push constants of the culling shader.
+struct CullConstants
+{
+  std::array<glm::vec4, 6> planes;
+  //! Bounding sphere of the mesh, center and radius.
+  glm::vec4 sphere;
+  uint32_t batch;
+  uint32_t firstInstance;
+  uint32_t instanceCount;
+};
+
+//! Metrics of the rendering.
+struct RenderMetrics
+{
+  sim::Counter& frames;
+  sim::Counter& instances;
+  sim::Histogram& drawDuration;
+  sim::Histogram& latency;
+};
+
+//! @returns Metrics of the rendering, registered on first use.
+const RenderMetrics& renderMetrics()
+{
+  auto& metrics = sim::Metrics::Instance();
+  static const RenderMetrics renderMetrics {
+    .frames = metrics.RegisterCounter(
+      "render_frames_total", "Frames drawn."),
+    .instances = metrics.RegisterCounter(
+      "render_instances_total", "Instances submitted for culling and drawing."),
+    .drawDuration = metrics.RegisterHistogram(
+      "render_draw_seconds", "Host time of drawing a frame, from waiting for its slot to presenting it.", 1e-9),
+    .latency = metrics.RegisterHistogram(
+      "render_input_latency_seconds", "Time from sampling the input of a frame until its completion.", 1e-9)};
+  return renderMetrics;
+}
+
+//! Push constants of a draw, following the draw constants of the frame.
+struct BatchConstants
+{
+  //! Bindless index of the buffer of visible instances.
+  uint32_t instanceBuffer;
+  uint32_t firstInstance;
+};
+
+}// namespace
+
 void Renderer::surface(GLFWwindow* window)
 {
   // Create surface.
   VkSurfaceKHR directSurface;
   glfwCreateWindowSurface(*_instance, window, nullptr, &directSurface);
   _surface = vkr::SurfaceKHR(_instance, directSurface);
+  _window = window;
 
   // Swap chain extension for device.
   _devExtensions.emplace_back(
@@ -37,27 +94,46 @@ void Renderer::logicalDevice()
   const auto queueFamilyProperties
     = _physicalDevice.getQueueFamilyProperties();
 
-  int32_t index = 0;
-  // Find queue families for graphics & present
-  for (const auto& queueFamily: queueFamilyProperties)
+  // Find queue families for graphics, present & transfer
+  for (uint32_t index = 0; index < queueFamilyProperties.size(); ++index)
   {
+    const auto& queueFamily = queueFamilyProperties[index];
     if (queueFamily.queueFlags & vk::QueueFlagBits::eGraphics)
     {
       _queueFamilyHints.graphicsFamily = index;
 
+      // Offscreen rendering presents nothing.
+      if (offscreen())
+        continue;
+
       const auto glfwSupport = glfwGetPhysicalDevicePresentationSupport(
         *_instance, *_physicalDevice, index);
       if (_physicalDevice.getSurfaceSupportKHR(index, *_surface) && glfwSupport == GLFW_TRUE)
       {
         _queueFamilyHints.presentFamily = index;
       }
-      index++;
+    }
+    // Transfer-only family is usually backed by dedicated copy engines.
+    else if (queueFamily.queueFlags & vk::QueueFlagBits::eTransfer
+             && !(queueFamily.queueFlags & vk::QueueFlagBits::eCompute))
+    {
+      _queueFamilyHints.transferFamily = index;
     }
   }
 
-    if (!_queueFamilyHints.graphicsFamily || !_queueFamilyHints.presentFamily)
+    if (!_queueFamilyHints.graphicsFamily)
+      throw std::runtime_error("No queue family supporting graphics found");
+    if (!offscreen() && !_queueFamilyHints.presentFamily)
       throw std::runtime_error("No queue family supporting graphics and presentation found");
 
+    // Without a surface, the present queue is never used.
+    if (!_queueFamilyHints.presentFamily)
+      _queueFamilyHints.presentFamily = _queueFamilyHints.graphicsFamily;
+
+    // Without a dedicated transfer family, transfers go through the graphics family.
+    if (!_queueFamilyHints.transferFamily)
+      _queueFamilyHints.transferFamily = _queueFamilyHints.graphicsFamily;
+
     // Device extensions in contiguous array.
     std::vector<const char*> extensions;
     extensions.reserve(_devExtensions.size());
@@ -66,23 +142,77 @@ void Renderer::logicalDevice()
       extensions.emplace_back(ext.data());
     }
 
-    const vk::DeviceQueueCreateInfo deviceQueueCreateInfo{
-      .queueFamilyIndex = _queueFamilyHints.graphicsFamily.value(),
-      .queueCount = 1,
-      .pQueuePriorities = queuePriorities,
-    };
+    std::vector<vk::DeviceQueueCreateInfo> deviceQueueCreateInfos;
+    for (const auto family: {
+           _queueFamilyHints.graphicsFamily.value(),
+           _queueFamilyHints.presentFamily.value(),
+           _queueFamilyHints.transferFamily.value()})
+    {
+      if (std::ranges::any_of(deviceQueueCreateInfos, [family](const auto& info) {
+            return info.queueFamilyIndex == family; }))
+        continue;
+
+      deviceQueueCreateInfos.push_back(vk::DeviceQueueCreateInfo{
+        .queueFamilyIndex = family,
+        .queueCount = 1,
+        .pQueuePriorities = queuePriorities,
+      });
+    }
+
+    // Impostors are drawn as points a few pixels large, where supported.
+    const vk::PhysicalDeviceFeatures features {
+      .largePoints = _physicalDevice.getFeatures().largePoints};
+
+    // Shaders index resources from bindless descriptor arrays.
+    if (!BindlessDescriptors::supported(_physicalDevice))
+      throw std::runtime_error("Device doesn't support descriptor indexing");
+    extensions.emplace_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+    const auto descriptorIndexingFeatures = BindlessDescriptors::requiredFeatures();
 
     // Create the device.
     _device = vkr::Device(
       _physicalDevice,
       vk::DeviceCreateInfo{
-        .queueCreateInfoCount = 1,
-        .pQueueCreateInfos = &deviceQueueCreateInfo,
+        .pNext = &descriptorIndexingFeatures,
+        .queueCreateInfoCount = static_cast<uint32_t>(deviceQueueCreateInfos.size()),
+        .pQueueCreateInfos = deviceQueueCreateInfos.data(),
         .enabledExtensionCount = static_cast<uint32_t>(extensions.size()),
-        .ppEnabledExtensionNames = extensions.data()});
+        .ppEnabledExtensionNames = extensions.data(),
+        .pEnabledFeatures = &features});
+
+  _graphicsQueue = vkr::Queue(
+    _device, _queueFamilyHints.graphicsFamily.value(), 0);
+
+  _presentQueue = vkr::Queue(
+    _device, _queueFamilyHints.presentFamily.value(), 0);
+
+  _transferQueue = vkr::Queue(
+    _device, _queueFamilyHints.transferFamily.value(), 0);
+}
+
+void Renderer::bindless()
+{
+  _bindless = std::make_unique<BindlessDescriptors>(_physicalDevice, _device);
+}
+
+void Renderer::allocator()
+{
+  _allocator = std::make_unique<Allocator>(_physicalDevice, _device);
+}
+
+void Renderer::uploads()
+{
+  // Big enough for the static geometry and a couple of frames of instance data,
+  // grown by the uploader once the instance data of the frames in flight doesn't fit.
+  _uploader = std::make_unique<Uploader>(*this, 64 * 1024 * 1024);
 }
 
-void Renderer::swapChain()
+void Renderer::pipelineCache()
+{
+  _pipelineCache = std::make_unique<PipelineCache>(_physicalDevice, _device);
+}
+
+void Renderer::swapChain(vk::SwapchainKHR oldSwapChain)
 {
   // Query the surface formats supported by the physical device.
   const auto surfaceFormats
@@ -90,17 +220,57 @@ void Renderer::swapChain()
   if (surfaceFormats.empty())
     throw std::runtime_error("No surface formats supported.");
 
-  _surfaceImageFormat = surfaceFormats.front().format == vk::Format::eUndefined
-                              ? vk::Format::eB8G8R8A8Unorm
-                              : surfaceFormats.front().format;
+  _colorImageFormat = surfaceFormats.front().format == vk::Format::eUndefined
+                            ? vk::Format::eB8G8R8A8Unorm
+                            : surfaceFormats.front().format;
 
   _surfaceCapabilities = _physicalDevice.getSurfaceCapabilitiesKHR(*_surface);
 
-  const vk::Extent2D swapChainExtent =
-    _surfaceCapabilities.currentExtent;
+  // Surface may leave the extent up to the swap chain, which then matches the window.
+  _extent = _surfaceCapabilities.currentExtent;
+  if (_extent.width == std::numeric_limits<uint32_t>::max())
+  {
+    int framebufferWidth = 0;
+    int framebufferHeight = 0;
+    glfwGetFramebufferSize(_window, &framebufferWidth, &framebufferHeight);
+    _extent = vk::Extent2D {
+      .width = std::clamp(
+        static_cast<uint32_t>(framebufferWidth),
+        _surfaceCapabilities.minImageExtent.width,
+        _surfaceCapabilities.maxImageExtent.width),
+      .height = std::clamp(
+        static_cast<uint32_t>(framebufferHeight),
+        _surfaceCapabilities.minImageExtent.height,
+        _surfaceCapabilities.maxImageExtent.height)};
+  }
 
-  const auto swapChainPresentMode
-    = vk::PresentModeKHR::eFifo;
+  // Preferred present mode, falling back to the low latency modes, and to FIFO,
+  // the only one guaranteed to be supported.
+  const auto presentModes = _physicalDevice.getSurfacePresentModesKHR(*_surface);
+  const std::array presentModeChain {
+    _presentation.presentMode,
+    vk::PresentModeKHR::eMailbox,
+    vk::PresentModeKHR::eImmediate};
+  _presentMode = vk::PresentModeKHR::eFifo;
+  // Falling back from FIFO to a mode that doesn't wait for the display makes no sense.
+  if (_presentation.presentMode != vk::PresentModeKHR::eFifo)
+  {
+    const auto supported = std::ranges::find_first_of(presentModeChain, presentModes);
+    if (supported != presentModeChain.end())
+      _presentMode = *supported;
+  }
+
+  // Mailbox needs an image to render to while one is queued and another one displayed.
+  auto minImageCount = _surfaceCapabilities.minImageCount;
+  if (_presentMode == vk::PresentModeKHR::eMailbox)
+    minImageCount++;
+  if (_surfaceCapabilities.maxImageCount > 0)
+    minImageCount = std::min(minImageCount, _surfaceCapabilities.maxImageCount);
+
+  printf("Present mode: %s (%s requested), %u frames in flight\n",
+         vk::to_string(_presentMode).c_str(),
+         vk::to_string(_presentation.presentMode).c_str(),
+         _presentation.framesInFlight);
 
   const vk::SurfaceTransformFlagBitsKHR preTransform =
     _surfaceCapabilities.supportedTransforms & vk::SurfaceTransformFlagBitsKHR::eIdentity
@@ -114,17 +284,18 @@ void Renderer::swapChain()
 
   vk::SwapchainCreateInfoKHR swapChainCreateInfo {
       .surface = *_surface,
-      .minImageCount = _surfaceCapabilities.minImageCount, // buffering strategy
-      .imageFormat = _surfaceImageFormat,
+      .minImageCount = minImageCount, // buffering strategy
+      .imageFormat = _colorImageFormat,
       .imageColorSpace = vk::ColorSpaceKHR::eSrgbNonlinear,
-      .imageExtent = swapChainExtent,
+      .imageExtent = _extent,
       .imageArrayLayers = 1,
       .imageUsage = vk::ImageUsageFlagBits::eColorAttachment,
       .imageSharingMode = vk::SharingMode::eExclusive,
       .preTransform = preTransform,
       .compositeAlpha = compositeAlpha,
-      .presentMode = swapChainPresentMode,
-      .clipped = true};
+      .presentMode = _presentMode,
+      .clipped = true,
+      .oldSwapchain = oldSwapChain};
 
   const std::array queueFamilyIndices = {
     _queueFamilyHints.graphicsFamily.value(),
@@ -140,20 +311,100 @@ void Renderer::swapChain()
     swapChainCreateInfo.pQueueFamilyIndices = queueFamilyIndices.data();
   }
 
+  // Images are copied from when frames are captured.
+  if (_surfaceCapabilities.supportedUsageFlags & vk::ImageUsageFlagBits::eTransferSrc)
+    swapChainCreateInfo.imageUsage |= vk::ImageUsageFlagBits::eTransferSrc;
+
   _swapChain = vkr::SwapchainKHR(
     _device, swapChainCreateInfo);
 
-  const auto swapChainImages = _swapChain.getImages();
-  _swapChainImageViews.reserve(swapChainImages.size());
+  _colorImages = _swapChain.getImages();
+  colorImageViews();
+}
 
-  for (const auto& image : swapChainImages)
+Renderer::RetiredSwapChain Renderer::recreateSwapChain()
+{
+  RetiredSwapChain retired {
+    .swapChain = std::move(_swapChain),
+    .colorImageViews = std::move(_colorImageViews),
+    .depthAllocation = std::move(_depthAllocation),
+    .depthImage = std::move(_depthImage),
+    .depthImageView = std::move(_depthImageView),
+    .framebuffers = std::move(_framebuffers)};
+
+  _colorImages.clear();
+  _colorImageViews.clear();
+  _framebuffers.clear();
+
+  // Render pass and pipeline don't depend on the extent, which is set dynamically.
+  swapChain(*retired.swapChain);
+  depthBuffer();
+  framebuffers();
+
+  return retired;
+}
+
+bool Renderer::surfaceEmpty() const
+{
+  const auto capabilities = _physicalDevice.getSurfaceCapabilitiesKHR(*_surface);
+  if (capabilities.currentExtent.width != std::numeric_limits<uint32_t>::max())
+    return capabilities.currentExtent.width == 0 || capabilities.currentExtent.height == 0;
+
+  // Extent is up to the swap chain, which matches the window.
+  int framebufferWidth = 0;
+  int framebufferHeight = 0;
+  glfwGetFramebufferSize(_window, &framebufferWidth, &framebufferHeight);
+  return framebufferWidth == 0 || framebufferHeight == 0;
+}
+
+void Renderer::offscreenTargets(vk::Extent2D extent)
+{
+  // Supported as a color attachment and a copy source by every implementation.
+  _colorImageFormat = vk::Format::eR8G8B8A8Unorm;
+  _extent = extent;
+
+  // One image per frame in flight, like a swap chain with nothing to wait for.
+  for (uint32_t i = 0; i < _presentation.framesInFlight; ++i)
+  {
+    auto& offscreenImage = _offscreenImages.emplace_back();
+    offscreenImage.image = vkr::Image(
+      _device,
+      vk::ImageCreateInfo {
+        .imageType = vk::ImageType::e2D,
+        .format = _colorImageFormat,
+        .extent = vk::Extent3D {
+          .width = _extent.width,
+          .height = _extent.height,
+          .depth = 1
+        },
+        .mipLevels = 1,
+        .arrayLayers = 1,
+        .samples = vk::SampleCountFlagBits::e1,
+        .tiling = vk::ImageTiling::eOptimal,
+        .usage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc,
+        .sharingMode = vk::SharingMode::eExclusive,
+      });
+
+    offscreenImage.allocation = _allocator->bind(
+      offscreenImage.image, vk::MemoryPropertyFlagBits::eDeviceLocal, vk::ImageTiling::eOptimal);
+    _colorImages.push_back(*offscreenImage.image);
+  }
+
+  colorImageViews();
+}
+
+void Renderer::colorImageViews()
+{
+  _colorImageViews.reserve(_colorImages.size());
+
+  for (const auto& image : _colorImages)
   {
-    _swapChainImageViews.emplace_back(
+    _colorImageViews.emplace_back(
       _device,
       vk::ImageViewCreateInfo {
         .image = image,
         .viewType = vk::ImageViewType::e2D,
-        .format = _surfaceImageFormat,
+        .format = _colorImageFormat,
         .subresourceRange = {
           .aspectMask = vk::ImageAspectFlagBits::eColor,
           .baseMipLevel = 0,
@@ -167,12 +418,12 @@ void Renderer::swapChain()
 
 void Renderer::framebuffers()
 {
-  _framebuffers.reserve(_swapChainImageViews.size());
+  _framebuffers.reserve(_colorImageViews.size());
 
-  for (const auto& swapChainImageView : _swapChainImageViews)
+  for (const auto& colorImageView : _colorImageViews)
   {
     std::array framebufferAttachements = {
-      *swapChainImageView,
+      *colorImageView,
       *_depthImageView,
     };
 
@@ -182,8 +433,8 @@ void Renderer::framebuffers()
         .renderPass = *_renderPass,
         .attachmentCount = framebufferAttachements.size(),
         .pAttachments = framebufferAttachements.data(),
-        .width = _surfaceCapabilities.currentExtent.width,
-        .height = _surfaceCapabilities.currentExtent.height,
+        .width = _extent.width,
+        .height = _extent.height,
         .layers = 1
       });
   }
@@ -210,8 +461,8 @@ void Renderer::depthBuffer()
       .imageType = vk::ImageType::e2D,
       .format = _depthImageFormat,
       .extent = vk::Extent3D {
-        .width = _surfaceCapabilities.currentExtent.width,
-        .height = _surfaceCapabilities.currentExtent.height,
+        .width = _extent.width,
+        .height = _extent.height,
         .depth = 1
       },
       .mipLevels = 1,
@@ -222,34 +473,8 @@ void Renderer::depthBuffer()
       .sharingMode = vk::SharingMode::eExclusive,
     });
 
-  const vk::PhysicalDeviceMemoryProperties memoryProperties
-    = _physicalDevice.getMemoryProperties();
-  const vk::MemoryRequirements memoryRequirements
-    = _depthImage.getMemoryRequirements();
-
-  uint32_t memoryTypeBits = memoryRequirements.memoryTypeBits;
-  uint32_t memoryTypeIndex = ~0;
-  for ( uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++ )
-  {
-    const auto& memoryType = memoryProperties.memoryTypes[i];
-    if ((memoryTypeBits & 1)
-        && (memoryType.propertyFlags & vk::MemoryPropertyFlagBits::eDeviceLocal) == vk::MemoryPropertyFlagBits::eDeviceLocal)
-    {
-      memoryTypeIndex = i;
-      break;
-    }
-    memoryTypeBits >>= 1;
-  }
-  assert(memoryTypeIndex != ~0);
-
-  _depthMemory = vkr::DeviceMemory (
-    _device,
-    vk::MemoryAllocateInfo {
-      .allocationSize = memoryRequirements.size,
-      .memoryTypeIndex = memoryTypeIndex,
-    });
-
-  _depthImage.bindMemory(*_depthMemory, 0);
+  _depthAllocation = _allocator->bind(
+    _depthImage, vk::MemoryPropertyFlagBits::eDeviceLocal, imageTiling);
 
   _depthImageView = vkr::ImageView(
     _device,
@@ -269,142 +494,156 @@ void Renderer::depthBuffer()
 
 void Renderer::uniformBuffer()
 {
+  // Every frame in flight writes its own range, so the host never overwrites uniforms
+  // a frame still in flight reads.
+  const auto alignment = _physicalDevice.getProperties().limits.minUniformBufferOffsetAlignment;
+  _uniformStride = (sizeof(FrameUniforms) + alignment - 1) / alignment * alignment;
+
   _uniformBuffer =  vkr::Buffer(
     _device,
     vk::BufferCreateInfo {
-      .size = sizeof(glm::mat4x4),
+      .size = _uniformStride * _presentation.framesInFlight,
       .usage = vk::BufferUsageFlagBits::eUniformBuffer,
       .sharingMode = vk::SharingMode::eExclusive
     });
 
-  const auto memoryProperties = _physicalDevice.getMemoryProperties();
-  const auto memoryRequirements = _uniformBuffer.getMemoryRequirements();
-  uint32_t memoryTypeIndex = 0;
-
-  // Find the right memory for the uniform buffer.
-  for (; memoryTypeIndex < memoryProperties.memoryTypeCount; ++memoryTypeIndex)
-  {
-    const auto memoryTypeBit = 1 << memoryTypeIndex;
-    if (memoryRequirements.memoryTypeBits & memoryTypeBit)
-    {
-      const auto memoryType = memoryProperties.memoryTypes[memoryTypeIndex];
-      if (memoryType.propertyFlags & (vk::MemoryPropertyFlagBits::eHostVisible
-                                      | vk::MemoryPropertyFlagBits::eHostCoherent))
-      {
-        // we found the right memory, yippie!!
-        break;
-      }
-    }
-  }
+  // Persistently mapped by the allocator.
+  _uniformAllocation = _allocator->bind(
+    _uniformBuffer,
+    vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+}
 
-  _uniformBufferMemory = vkr::DeviceMemory(
-    _device,
-    vk::MemoryAllocateInfo {
-      .allocationSize = memoryRequirements.size,
-      .memoryTypeIndex = memoryTypeIndex,
-    });
+void Renderer::vertexBuffer()
+{
+  _cubeLods = uploadLodChain(mesh::cube());
+}
 
-  _uniformBuffer.bindMemory(*_uniformBufferMemory, 0);
+uint32_t Renderer::uploadMesh(
+  const mesh::Mesh& mesh,
+  vk::PrimitiveTopology topology)
+{
+  auto& gpuMesh = _meshes.emplace_back();
+  gpuMesh.topology = topology;
+
+  const auto vertices = std::as_bytes(std::span(mesh.vertices));
+  deviceLocalBuffer(
+    gpuMesh.vertexBuffer,
+    gpuMesh.vertexAllocation,
+    vertices.size(),
+    vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eStorageBuffer);
+  _uploader->upload(*gpuMesh.vertexBuffer, 0, vertices);
+
+  // Indices are packed to 16 bits whenever the vertex count allows it.
+  const auto indices = mesh.packedIndices();
+  deviceLocalBuffer(
+    gpuMesh.indexBuffer,
+    gpuMesh.indexAllocation,
+    indices.size(),
+    vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eStorageBuffer);
+  _uploader->upload(*gpuMesh.indexBuffer, 0, indices);
+
+  // Mesh data is reachable from any shader through the bindless arrays.
+  gpuMesh.vertexDescriptor = _bindless->addBuffer(*gpuMesh.vertexBuffer);
+  gpuMesh.indexDescriptor = _bindless->addBuffer(*gpuMesh.indexBuffer);
+
+  gpuMesh.indexCount = static_cast<uint32_t>(mesh.indices.size());
+  gpuMesh.indexType = mesh.indexWidth() == mesh::IndexWidth::U16
+                        ? vk::IndexType::eUint16
+                        : vk::IndexType::eUint32;
+  gpuMesh.bounds = mesh.boundingSphere();
+
+  return static_cast<uint32_t>(_meshes.size() - 1);
 }
 
-struct Mesh
+uint32_t Renderer::uploadLodChain(const mesh::Mesh& mesh)
 {
-  struct Vertex
+  auto& chain = _lodChains.emplace_back();
+  chain.levels.push_back(uploadMesh(mesh));
+
+  // Every level halves the clustering grid of the previous one.
+  // Levels that don't save a quarter of the triangles aren't worth a draw of their own.
+  std::vector<uint32_t> resolutions {0};
+  auto triangles = mesh.indices.size() / 3;
+  for (auto resolution = LodFinestResolution; resolution >= LodCoarsestResolution; resolution /= 2)
   {
-    glm::vec3 pos;
-  };
+    const auto level = mesh::simplify(mesh, resolution);
+    const auto levelTriangles = level.indices.size() / 3;
+    if (levelTriangles == 0 || levelTriangles * 4 > triangles * 3)
+      continue;
+
+    chain.levels.push_back(uploadMesh(level));
+    resolutions.push_back(resolution);
+    triangles = levelTriangles;
+  }
 
-  const std::array<Vertex, 24> verticies = {
-      // front
-      Vertex{{-1.0f, -1.0f, +1.0f}},
-      {{+1.0f, -1.0f, +1.0f}},
-      {{-1.0f, +1.0f, +1.0f}},
-      {{+1.0f, +1.0f, +1.0f}},
-      // back
-      {{+1.0f, -1.0f, -1.0f}},
-      {{-1.0f, -1.0f, -1.0f}},
-      {{+1.0f, +1.0f, -1.0f}},
-      {{-1.0f, +1.0f, -1.0f}},
-      // right
-      {{+1.0f, -1.0f, +1.0f}},
-      {{+1.0f, -1.0f, -1.0f}},
-      {{+1.0f, +1.0f, +1.0f}},
-      {{+1.0f, +1.0f, -1.0f}},
-      // left
-      {{-1.0f, -1.0f, -1.0f}},
-      {{-1.0f, -1.0f, +1.0f}},
-      {{-1.0f, +1.0f, -1.0f}},
-      {{-1.0f, +1.0f, +1.0f}},
-      // top
-      {{-1.0f, +1.0f, +1.0f}},
-      {{+1.0f, +1.0f, +1.0f}},
-      {{-1.0f, +1.0f, -1.0f}},
-      {{+1.0f, +1.0f, -1.0f}},
-      // bottom
-      {{-1.0f, -1.0f, -1.0f}},
-      {{+1.0f, -1.0f, -1.0f}},
-      {{-1.0f, -1.0f, +1.0f}},
-      {{+1.0f, -1.0f, +1.0f}}
-  };
+  // Level is drawn until the cells of the next one shrink to about two pixels,
+  // the last one until the body is small enough for its impostor.
+  for (size_t level = 0; level < chain.levels.size(); ++level)
+  {
+    chain.minimumSizes.push_back(
+      level + 1 < chain.levels.size()
+        ? 2.0f * static_cast<float>(resolutions[level + 1])
+        : ImpostorSize);
+  }
 
-} cube;
+  // Impostor is culled with the bounds of the full mesh, not of its single point.
+  const auto bounds = mesh.boundingSphere();
+  chain.diameter = 2.0f * bounds.radius;
+  chain.impostor = uploadMesh(
+    mesh::Mesh {
+      .vertices = {{bounds.center}},
+      .indices = {0}},
+    vk::PrimitiveTopology::ePointList);
+  _meshes[chain.impostor].bounds = bounds;
+
+  return static_cast<uint32_t>(_lodChains.size() - 1);
+}
 
-void Renderer::vertexBuffer()
+void Renderer::deviceLocalBuffer(
+  vkr::Buffer& buffer,
+  Allocation& allocation,
+  vk::DeviceSize size,
+  vk::BufferUsageFlags usage) const
 {
-  _vertexBuffer = vkr::Buffer(
+  // Shared with the transfer family, so that no ownership transfer is needed.
+  const auto families = sharingFamilies();
+  buffer = vkr::Buffer(
     _device,
     vk::BufferCreateInfo {
-      .size = cube.verticies.size() * sizeof(Mesh::Vertex),
-      .usage = vk::BufferUsageFlagBits::eVertexBuffer,
-      .sharingMode = vk::SharingMode::eExclusive,});
-
-  const auto memoryProperties = _physicalDevice.getMemoryProperties();
-  const auto memoryRequirements = _vertexBuffer.getMemoryRequirements();
-  uint32_t memoryTypeIndex = 0;
-
-  // Find the right memory for the uniform buffer.
-  for (; memoryTypeIndex < memoryProperties.memoryTypeCount; ++memoryTypeIndex)
-  {
-    const auto memoryTypeBit = 1 << memoryTypeIndex;
-    if (memoryRequirements.memoryTypeBits & memoryTypeBit)
-    {
-      const auto memoryType = memoryProperties.memoryTypes[memoryTypeIndex];
-      if (memoryType.propertyFlags & (vk::MemoryPropertyFlagBits::eHostVisible
-                                      | vk::MemoryPropertyFlagBits::eHostCoherent))
-      {
-        // we found the right memory, yippie!!
-        break;
-      }
-    }
-  }
-
-  _vertexBufferMemory = vkr::DeviceMemory(
-    _device,
-    vk::MemoryAllocateInfo {
-      .allocationSize = memoryRequirements.size,
-      .memoryTypeIndex = memoryTypeIndex
-    });
+      .size = size,
+      .usage = usage | vk::BufferUsageFlagBits::eTransferDst,
+      .sharingMode = families.size() > 1
+                       ? vk::SharingMode::eConcurrent
+                       : vk::SharingMode::eExclusive,
+      .queueFamilyIndexCount = static_cast<uint32_t>(families.size()),
+      .pQueueFamilyIndices = families.data()});
+
+  allocation = _allocator->bind(
+    buffer, vk::MemoryPropertyFlagBits::eDeviceLocal);
+}
 
-  auto memory = static_cast<uint8_t*>(
-    _vertexBufferMemory.mapMemory(0, memoryRequirements.size));
-  std::memcpy(memory, cube.verticies.data(), cube.verticies.size() * sizeof(Mesh::Vertex));
-  _vertexBufferMemory.unmapMemory();
-  _vertexBuffer.bindMemory(*_vertexBufferMemory, 0);
+std::vector<uint32_t> Renderer::sharingFamilies() const
+{
+  if (graphicsFamily() == transferFamily())
+    return {graphicsFamily()};
+  return {graphicsFamily(), transferFamily()};
 }
 
 void Renderer::renderPass()
 {
   const std::array attachmentDescriptions = {
-    // Surface attachment
+    // Color attachment
     vk::AttachmentDescription {
-      .format = _surfaceImageFormat,
+      .format = _colorImageFormat,
       .samples = vk::SampleCountFlagBits::e1,
       .loadOp = vk::AttachmentLoadOp::eClear,
       .storeOp = vk::AttachmentStoreOp::eStore,
       .stencilLoadOp = vk::AttachmentLoadOp::eDontCare,
       .stencilStoreOp = vk::AttachmentStoreOp::eDontCare,
       .initialLayout = vk::ImageLayout::eUndefined,
-      .finalLayout = vk::ImageLayout::ePresentSrcKHR},
+      .finalLayout = offscreen()
+                       ? vk::ImageLayout::eTransferSrcOptimal
+                       : vk::ImageLayout::ePresentSrcKHR},
     // Depth attachment
     vk::AttachmentDescription {
       .format = _depthImageFormat,
@@ -431,55 +670,148 @@ void Renderer::renderPass()
     .pColorAttachments = &surfaceAttachmentReference,
     .pDepthStencilAttachment = &depthAttachmentReference};
 
+  // Offscreen images are copied out right after the render pass.
+  const vk::SubpassDependency readbackDependency {
+    .srcSubpass = 0,
+    .dstSubpass = VK_SUBPASS_EXTERNAL,
+    .srcStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput,
+    .dstStageMask = vk::PipelineStageFlagBits::eTransfer,
+    .srcAccessMask = vk::AccessFlagBits::eColorAttachmentWrite,
+    .dstAccessMask = vk::AccessFlagBits::eTransferRead};
+
   _renderPass = vkr::RenderPass(
     _device,
     vk::RenderPassCreateInfo {
       .attachmentCount = 2,
       .pAttachments = attachmentDescriptions.data(),
       .subpassCount = 1,
-      .pSubpasses = &subpassDescription});
+      .pSubpasses = &subpassDescription,
+      .dependencyCount = offscreen() ? 1u : 0u,
+      .pDependencies = &readbackDependency});
 }
 
 
 void Renderer::shaders()
 {
-  const auto readSpvBinary = [](const std::filesystem::path& shaderBinaryPath) {
-    const auto size = std::filesystem::file_size(shaderBinaryPath);
-    std::ifstream input(shaderBinaryPath, std::ios::binary);
-    if (input.bad())
-      throw std::runtime_error(
-        std::format("Couldn't find shader at '{}'", shaderBinaryPath.c_str()));
-
-    std::vector<uint8_t> buffer(size);
-    input.read(reinterpret_cast<char*>(buffer.data()), size);
-    return std::pair{buffer, size};
-  };
+  _vertexShader = shaderModule("cube-vert.spv");
+  _fragmentShader = shaderModule("cube-frag.spv");
+  _cullShader = shaderModule("cull-comp.spv");
+  _pointVertexShader = shaderModule("point-vert.spv");
+}
 
-  const auto [vertexData, vertexLength] = readSpvBinary("cube-vert.spv");
-  const auto [fragmentData, fragmentLength] = readSpvBinary("cube-frag.spv");
+Renderer::RetiredPipelines Renderer::reloadShaders()
+{
+  // All binaries are read before anything is replaced, so that a missing one changes nothing.
+  auto vertexShader = shaderModule("cube-vert.spv");
+  auto fragmentShader = shaderModule("cube-frag.spv");
+  auto cullShader = shaderModule("cull-comp.spv");
+  auto pointVertexShader = shaderModule("point-vert.spv");
+
+  std::swap(_vertexShader, vertexShader);
+  std::swap(_fragmentShader, fragmentShader);
+  std::swap(_cullShader, cullShader);
+  std::swap(_pointVertexShader, pointVertexShader);
+
+  std::vector<vkr::Pipeline> pipelines;
+  vkr::Pipeline culling { nullptr };
+  try
+  {
+    pipelines = graphicsPipelines();
+    culling = cullPipeline();
+  }
+  catch (...)
+  {
+    // Previous modules stay, so that the next reload builds on what still renders.
+    std::swap(_vertexShader, vertexShader);
+    std::swap(_fragmentShader, fragmentShader);
+    std::swap(_cullShader, cullShader);
+    std::swap(_pointVertexShader, pointVertexShader);
+    throw;
+  }
 
-  assert(vertexData.capacity() % sizeof(uint32_t) == 0);
-  assert(fragmentData.capacity() % sizeof(uint32_t) == 0);
+  // Previous modules aren't needed once their pipelines exist, only the pipelines are
+  // still referenced by the frames in flight.
+  RetiredPipelines retired;
+  retired.pipelines.emplace_back(std::exchange(_pipeline, std::move(pipelines[0])));
+  retired.pipelines.emplace_back(std::exchange(_pointPipeline, std::move(pipelines[1])));
+  retired.pipelines.emplace_back(std::exchange(_cullPipeline, std::move(culling)));
+  return retired;
+}
 
-  _vertexShader = vkr::ShaderModule(
+vkr::ShaderModule Renderer::shaderModule(const std::filesystem::path& path) const
+{
+  std::error_code error;
+  const auto size = std::filesystem::file_size(path, error);
+  std::ifstream input(path, std::ios::binary);
+  if (error || !input)
+    throw std::runtime_error(
+      std::format("Couldn't find shader at '{}'", path.string()));
+
+  // SPIR-V is a stream of 32-bit words.
+  assert(size % sizeof(uint32_t) == 0);
+  std::vector<uint32_t> code(size / sizeof(uint32_t));
+  input.read(reinterpret_cast<char*>(code.data()), static_cast<std::streamsize>(size));
+
+  return vkr::ShaderModule(
     _device,
     vk::ShaderModuleCreateInfo{
-      .codeSize = vertexLength,
-      .pCode = reinterpret_cast<const uint32_t*>(vertexData.data())
+      .codeSize = size,
+      .pCode = code.data()
     });
+}
+
+void Renderer::culling()
+{
+  // Source instances, visible instances and draw commands.
+  std::array<vk::DescriptorSetLayoutBinding, 3> bindings {};
+  for (uint32_t binding = 0; binding < bindings.size(); ++binding)
+  {
+    bindings[binding] = vk::DescriptorSetLayoutBinding {
+      .binding = binding,
+      .descriptorType = vk::DescriptorType::eStorageBuffer,
+      .descriptorCount = 1,
+      .stageFlags = vk::ShaderStageFlagBits::eCompute};
+  }
 
-  _fragmentShader = vkr::ShaderModule(
+  _cullDescriptorLayout = vkr::DescriptorSetLayout(
     _device,
-    vk::ShaderModuleCreateInfo{
-      .codeSize = fragmentLength,
-      .pCode = reinterpret_cast<const uint32_t*>(fragmentData.data())
-    });
+    vk::DescriptorSetLayoutCreateInfo {
+      .bindingCount = static_cast<uint32_t>(bindings.size()),
+      .pBindings = bindings.data()});
+
+  const vk::PushConstantRange pushConstantRange {
+    .stageFlags = vk::ShaderStageFlagBits::eCompute,
+    .offset = 0,
+    .size = sizeof(CullConstants)};
+
+  _cullPipelineLayout = vkr::PipelineLayout(
+    _device,
+    vk::PipelineLayoutCreateInfo {
+      .setLayoutCount = 1,
+      .pSetLayouts = &(*_cullDescriptorLayout),
+      .pushConstantRangeCount = 1,
+      .pPushConstantRanges = &pushConstantRange});
+
+  _cullPipeline = cullPipeline();
+}
+
+vkr::Pipeline Renderer::cullPipeline() const
+{
+  return _pipelineCache->createComputePipeline(
+    vk::ComputePipelineCreateInfo {
+      .stage = vk::PipelineShaderStageCreateInfo {
+        .stage = vk::ShaderStageFlagBits::eCompute,
+        .module = *_cullShader,
+        .pName = "main"},
+      .layout = *_cullPipelineLayout});
 }
 
 void Renderer::pipeline()
 {
+  // Uniform range of the frame in flight is selected by a dynamic offset, so a single set
+  // serves all frames.
   const vk::DescriptorSetLayoutBinding uniformDescriptorSetLayoutBinding {
-    .descriptorType = vk::DescriptorType::eUniformBuffer,
+    .descriptorType = vk::DescriptorType::eUniformBufferDynamic,
     .descriptorCount = 1,
     .stageFlags = vk::ShaderStageFlagBits::eVertex};
 
@@ -489,15 +821,27 @@ void Renderer::pipeline()
       .bindingCount = 1,
       .pBindings = &uniformDescriptorSetLayoutBinding});
 
+  // Constants of the frame are followed by constants of every draw.
+  const vk::PushConstantRange pushConstantRange {
+    .stageFlags = vk::ShaderStageFlagBits::eVertex,
+    .offset = 0,
+    .size = sizeof(DrawConstants) + sizeof(BatchConstants)};
+
+  const std::array descriptorSetLayouts {
+    *_uniformDescriptorLayout,
+    _bindless->layout()};
+
   _pipelineLayout = vkr::PipelineLayout(
     _device,
     vk::PipelineLayoutCreateInfo {
-      .setLayoutCount = 1,
-      .pSetLayouts = &(*_uniformDescriptorLayout),});
+      .setLayoutCount = static_cast<uint32_t>(descriptorSetLayouts.size()),
+      .pSetLayouts = descriptorSetLayouts.data(),
+      .pushConstantRangeCount = 1,
+      .pPushConstantRanges = &pushConstantRange});
 
   // Uniform buffer
   const vk::DescriptorPoolSize uniformDescriptorPoolSize {
-    .type = vk::DescriptorType::eUniformBuffer,
+    .type = vk::DescriptorType::eUniformBufferDynamic,
     .descriptorCount = 1};
 
   _uniformDescriptorPool = vkr::DescriptorPool(
@@ -518,16 +862,23 @@ void Renderer::pipeline()
   const vk::DescriptorBufferInfo uniformDescriptorBufferInfo{
     .buffer = *_uniformBuffer,
     .offset = 0,
-    .range = sizeof( glm::mat4x4 )};
+    .range = sizeof(FrameUniforms)};
 
   const vk::WriteDescriptorSet writeUniformDescriptorSet {
     .dstSet = *_uniformDescriptorSets.front(),
     .descriptorCount = 1,
-    .descriptorType = vk::DescriptorType::eUniformBuffer,
+    .descriptorType = vk::DescriptorType::eUniformBufferDynamic,
     .pBufferInfo = &uniformDescriptorBufferInfo};
 
   _device.updateDescriptorSets(writeUniformDescriptorSet, nullptr);
 
+  auto pipelines = graphicsPipelines();
+  _pipeline = std::move(pipelines[0]);
+  _pointPipeline = std::move(pipelines[1]);
+}
+
+std::vector<vkr::Pipeline> Renderer::graphicsPipelines() const
+{
   std::array pipelineShaderStageCreateInfos {
     vk::PipelineShaderStageCreateInfo {
       .stage = vk::ShaderStageFlagBits::eVertex,
@@ -541,11 +892,11 @@ void Renderer::pipeline()
     },
   };
 
-  // Vertex buffer
+  // Vertex buffer, instances are read from the bindless buffers.
   std::array vertexBindingDescriptions {
     vk::VertexInputBindingDescription {
       .binding = 0,
-      .stride = sizeof(Mesh::Vertex),
+      .stride = sizeof(mesh::Vertex),
       .inputRate = vk::VertexInputRate::eVertex,
     }};
 
@@ -554,12 +905,7 @@ void Renderer::pipeline()
       .location = 0,
       .binding = 0,
       .format = vk::Format::eR32G32B32Sfloat,
-    },
-    /*vk::VertexInputAttributeDescription {
-      .location = 1,
-      .binding = 0,
-      .format = vk::Format::eR32G32B32Sfloat,
-    }*/};
+    }};
 
   vk::PipelineVertexInputStateCreateInfo vertexInputStateCreateInfo {
     .vertexBindingDescriptionCount = vertexBindingDescriptions.size(),
@@ -568,7 +914,43 @@ void Renderer::pipeline()
     .pVertexAttributeDescriptions = vertexAttributeDescriptions.data()};
 
   vk::PipelineInputAssemblyStateCreateInfo inputAssemblyStateCreateInfo {
-    .topology = vk::PrimitiveTopology::eTriangleStrip
+    .topology = vk::PrimitiveTopology::eTriangleList
+  };
+
+  // Point impostors, sized by a specialization constant.
+  // Points larger than a pixel need the large points feature.
+  const auto pointSizeRange = _physicalDevice.getProperties().limits.pointSizeRange;
+  const float pointSize = _physicalDevice.getFeatures().largePoints
+                            ? std::clamp(ImpostorSize, pointSizeRange[0], pointSizeRange[1])
+                            : 1.0f;
+
+  const vk::SpecializationMapEntry pointSizeEntry {
+    .constantID = 0,
+    .offset = 0,
+    .size = sizeof(float)};
+
+  const vk::SpecializationInfo pointSpecializationInfo {
+    .mapEntryCount = 1,
+    .pMapEntries = &pointSizeEntry,
+    .dataSize = sizeof(float),
+    .pData = &pointSize};
+
+  std::array pointShaderStageCreateInfos {
+    vk::PipelineShaderStageCreateInfo {
+      .stage = vk::ShaderStageFlagBits::eVertex,
+      .module = *_pointVertexShader,
+      .pName = "main",
+      .pSpecializationInfo = &pointSpecializationInfo,
+    },
+    vk::PipelineShaderStageCreateInfo {
+      .stage = vk::ShaderStageFlagBits::eFragment,
+      .module = *_fragmentShader,
+      .pName = "main",
+    },
+  };
+
+  vk::PipelineInputAssemblyStateCreateInfo pointInputAssemblyStateCreateInfo {
+    .topology = vk::PrimitiveTopology::ePointList
   };
 
   vk::PipelineViewportStateCreateInfo viewportStateCreateInfo {
@@ -639,9 +1021,7 @@ void Renderer::pipeline()
     .pDynamicStates = dynamicStates.data()
   };
 
-  _pipeline = vkr::Pipeline(
-    _device,
-    nullptr,
+  const std::array pipelineCreateInfos {
     vk::GraphicsPipelineCreateInfo {
       .stageCount = pipelineShaderStageCreateInfos.size(),
       .pStages = pipelineShaderStageCreateInfos.data(),
@@ -655,8 +1035,31 @@ void Renderer::pipeline()
       .pColorBlendState = &colorBlendStateCreateInfo,
       .pDynamicState = &pipelineDynamicStateCreateInfo,
       .layout = *_pipelineLayout,
-      .renderPass = *_renderPass});
+      .renderPass = *_renderPass},
+    vk::GraphicsPipelineCreateInfo {
+      .stageCount = pointShaderStageCreateInfos.size(),
+      .pStages = pointShaderStageCreateInfos.data(),
+      .pVertexInputState = &vertexInputStateCreateInfo,
+      .pInputAssemblyState = &pointInputAssemblyStateCreateInfo,
+      .pTessellationState = nullptr,
+      .pViewportState = &viewportStateCreateInfo,
+      .pRasterizationState = &rasterizationStateCreateInfo,
+      .pMultisampleState = &multisampleStateCreateInfo,
+      .pDepthStencilState = &depthStencilStateCreateInfo,
+      .pColorBlendState = &colorBlendStateCreateInfo,
+      .pDynamicState = &pipelineDynamicStateCreateInfo,
+      .layout = *_pipelineLayout,
+      .renderPass = *_renderPass}};
 
+  const auto start = std::chrono::steady_clock::now();
+  auto pipelines = _pipelineCache->createGraphicsPipelines(pipelineCreateInfos);
+  printf("Created %zu pipelines in %.1f ms (%s pipeline cache)\n",
+         pipelines.size(),
+         std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(),
+         _pipelineCache->warm() ? "warm" : "cold");
+
+  _pipelineCache->save();
+  return pipelines;
 }
 
 void Renderer::commands()
@@ -673,20 +1076,21 @@ void Renderer::commands()
     vk::CommandBufferAllocateInfo {
       .commandPool = *_commandPool,
       .level = vk::CommandBufferLevel::ePrimary,
-      .commandBufferCount = 2,
+      .commandBufferCount = _presentation.framesInFlight,
     });
 
-  _graphicsQueue = vkr::Queue(
-    _device, _queueFamilyHints.graphicsFamily.value(), 0);
-
-  _presentQueue = vkr::Queue(
-    _device, _queueFamilyHints.presentFamily.value(), 0);
 }
 
 void Renderer::setup()
 {
-  _extensions.emplace_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
-  _extensions.emplace_back(VK_KHR_SURFACE_EXTENSION_NAME);
+  // Surface extensions come from the display, if there is one.
+  // Debug utils are optional, software drivers on headless machines may not have them.
+  const auto availableExtensions = _ctx.enumerateInstanceExtensionProperties();
+  const bool debugUtils = std::ranges::any_of(
+    availableExtensions, [](const auto& extension) {
+      return std::string_view(extension.extensionName.data()) == VK_EXT_DEBUG_UTILS_EXTENSION_NAME; });
+  if (debugUtils)
+    _extensions.emplace_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
   //_layers.emplace_back("VK_LAYER_KHRONOS_validation");
   //_layers.emplace_back("VK_LAYER_RENDERDOC_Capture");
 
@@ -734,7 +1138,7 @@ void Renderer::setup()
     }};
 
   const vk::InstanceCreateInfo instanceCreateInfo {
-    .pNext = &debugMessengerInfo,
+    .pNext = debugUtils ? &debugMessengerInfo : nullptr,
     .pApplicationInfo = &applicationInfo,
     .enabledLayerCount = static_cast<uint32_t>(layers.size()),
     .ppEnabledLayerNames = layers.data(),
@@ -750,33 +1154,87 @@ void Renderer::setup()
     _instance, debugMessengerInfo);*/
 }
 
-InFlightRendering::InFlightRendering(const Renderer& renderer)
-  : _renderer(renderer)
+Frustum Frustum::fromClip(const glm::mat4x4& clipFromWorld)
 {
-  const auto& device = _renderer._device;
-  // Image available semaphores
-  _imageAvailableSemaphores = {
-    vkr::Semaphore(device, vk::SemaphoreCreateInfo{}),
-    vkr::Semaphore(device, vk::SemaphoreCreateInfo{}),
+  const auto row = [&](int index) {
+    return glm::vec4(
+      clipFromWorld[0][index],
+      clipFromWorld[1][index],
+      clipFromWorld[2][index],
+      clipFromWorld[3][index]);
   };
 
-  // Image rendered semaphores
-  _imageRenderedSemaphores = {
-    vkr::Semaphore(device, vk::SemaphoreCreateInfo{}),
-    vkr::Semaphore(device, vk::SemaphoreCreateInfo{}),
-  };
+  // Vulkan clip space has depth from 0 to w.
+  Frustum frustum {
+    .planes = {
+      row(3) + row(0),
+      row(3) - row(0),
+      row(3) + row(1),
+      row(3) - row(1),
+      row(2),
+      row(3) - row(2)}};
+
+  for (auto& plane : frustum.planes)
+  {
+    plane /= glm::length(glm::vec3(plane));
+  }
+  return frustum;
+}
 
-  // In flight fences
-  _inFlightFences = {
-    vkr::Fence(
-      device,
-      vk::FenceCreateInfo {
-        .flags = vk::FenceCreateFlagBits::eSignaled }),
-    vkr::Fence(
+InFlightRendering::InFlightRendering(Renderer& renderer)
+  : _renderer(renderer)
+  , _framesInFlight(renderer._presentation.framesInFlight)
+{
+  const auto& device = _renderer._device;
+
+  for (uint32_t frameIndex = 0; frameIndex < _framesInFlight; ++frameIndex)
+  {
+    // Image available semaphores
+    _imageAvailableSemaphores.emplace_back(device, vk::SemaphoreCreateInfo{});
+    // Image rendered semaphores
+    _imageRenderedSemaphores.emplace_back(device, vk::SemaphoreCreateInfo{});
+    // In flight fences
+    _inFlightFences.emplace_back(
       device,
       vk::FenceCreateInfo {
-        .flags = vk::FenceCreateFlagBits::eSignaled }),
-  };
+        .flags = vk::FenceCreateFlagBits::eSignaled });
+  }
+
+  _instanceBuffers.resize(_framesInFlight);
+  _indirectBuffers.resize(_framesInFlight);
+  _readbacks.resize(_framesInFlight);
+  _frameSerials.resize(_framesInFlight, 0);
+  _inputTimes.resize(_framesInFlight);
+  _latencyPending.resize(_framesInFlight, false);
+
+  const auto recordThreads = _renderer._presentation.recordThreads;
+  _recorder = std::make_unique<ParallelRecorder>(_renderer, _framesInFlight, recordThreads);
+  if (recordThreads > 0)
+    _minimumBatchesPerThread = 0;
+  if (Profiler::instance().enabled())
+    _deviceProfiler = std::make_unique<DeviceProfiler>(_renderer, _framesInFlight);
+
+  // Culling descriptor sets, updated every frame as the buffers may grow.
+  const vk::DescriptorPoolSize cullDescriptorPoolSize {
+    .type = vk::DescriptorType::eStorageBuffer,
+    .descriptorCount = 3 * _framesInFlight};
+
+  _cullDescriptorPool = vkr::DescriptorPool(
+    device,
+    vk::DescriptorPoolCreateInfo {
+      .flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet,
+      .maxSets = _framesInFlight,
+      .poolSizeCount = 1,
+      .pPoolSizes = &cullDescriptorPoolSize});
+
+  const std::vector cullDescriptorLayouts(
+    _framesInFlight, *_renderer._cullDescriptorLayout);
+  _cullDescriptorSets = vkr::DescriptorSets(
+    device,
+    vk::DescriptorSetAllocateInfo {
+      .descriptorPool = *_cullDescriptorPool,
+      .descriptorSetCount = _framesInFlight,
+      .pSetLayouts = cullDescriptorLayouts.data()});
 
   // Clear values.
   _clearValues = {
@@ -792,116 +1250,745 @@ InFlightRendering::InFlightRendering(const Renderer& renderer)
       }
     }
   };
+
+  if (!_renderer.offscreen())
+    return;
+
+  // Readback buffers, preferably cached, as they are only read by the host.
+  const auto readbackSize = vk::DeviceSize(_renderer._extent.width) * _renderer._extent.height * 4;
+  for (auto& readback : _readbacks)
+  {
+    readback.buffer = vkr::Buffer(
+      device,
+      vk::BufferCreateInfo {
+        .size = readbackSize,
+        .usage = vk::BufferUsageFlagBits::eTransferDst,
+        .sharingMode = vk::SharingMode::eExclusive});
+
+    const auto hostVisible = vk::MemoryPropertyFlagBits::eHostVisible
+                             | vk::MemoryPropertyFlagBits::eHostCoherent;
+    try
+    {
+      readback.allocation = _renderer._allocator->bind(
+        readback.buffer, hostVisible | vk::MemoryPropertyFlagBits::eHostCached);
+    }
+    catch (const std::runtime_error&)
+    {
+      readback.allocation = _renderer._allocator->bind(
+        readback.buffer, hostVisible);
+    }
+  }
+}
+
+InFlightRendering::~InFlightRendering()
+{
+  for (const auto& instanceBuffer : _instanceBuffers)
+  {
+    if (instanceBuffer.visibleDescriptor)
+      _renderer._bindless->releaseBuffer(*instanceBuffer.visibleDescriptor);
+  }
+}
+
+void InFlightRendering::setBodySimulation(BodySimulation* simulation) noexcept
+{
+  _bodySimulation = simulation;
+}
+
+void InFlightRendering::setFrameSink(FrameSink sink)
+{
+  _frameSink = std::move(sink);
+}
+
+void InFlightRendering::invalidateSwapChain() noexcept
+{
+  _swapChainOutdated = true;
+}
+
+void InFlightRendering::startCapture(const CaptureOptions& options)
+{
+  _capture = std::make_unique<FrameCapture>(_renderer, options);
+}
+
+void InFlightRendering::stopCapture()
+{
+  if (!_capture)
+    return;
+
+  // Captures recorded by frames still in flight are not lost.
+  flush();
+  _capture.reset();
+}
+
+void InFlightRendering::flush()
+{
+  const auto& device = _renderer._device;
+
+  // Oldest frame is in the slot rendered next.
+  for (uint32_t i = 0; i < _framesInFlight; ++i)
+  {
+    const auto frameIndex = (_inFlightFrameIndex + i) % _framesInFlight;
+    const auto fenceWaitResult = device.waitForFences(
+      *_inFlightFences[frameIndex], true, UINT64_MAX);
+    assert(fenceWaitResult == vk::Result::eSuccess);
+    deliver(frameIndex);
+    if (_deviceProfiler)
+      _deviceProfiler->collect(frameIndex);
+
+    // Latency of waited for frames would include the wait.
+    _latencyPending[frameIndex] = false;
+  }
+
+  _completedFrameSerial = _frameSerial;
+  _retiredSwapChains.clear();
+  _retiredPipelines.clear();
+  if (_capture)
+    _capture->poll(_completedFrameSerial);
+}
+
+void InFlightRendering::pollCompletedFrames()
+{
+  const auto now = std::chrono::steady_clock::now();
+
+  // Fences signal in submission order, the latest signaled one covers all frames before it.
+  for (uint32_t frameIndex = 0; frameIndex < _framesInFlight; ++frameIndex)
+  {
+    const bool pending = _frameSerials[frameIndex] > _completedFrameSerial
+                         || _latencyPending[frameIndex];
+    if (!pending || _inFlightFences[frameIndex].getStatus() != vk::Result::eSuccess)
+      continue;
+
+    _completedFrameSerial = std::max(_completedFrameSerial, _frameSerials[frameIndex]);
+    if (_latencyPending[frameIndex])
+    {
+      const auto latency = now - _inputTimes[frameIndex];
+      _latencySum += latency;
+      _latencyMax = std::max(_latencyMax, latency);
+      _latencyFrames++;
+      renderMetrics().latency.Record(latency);
+      _latencyPending[frameIndex] = false;
+    }
+  }
+
+  // Swap chains no longer used by any frame in flight.
+  while (!_retiredSwapChains.empty()
+         && _retiredSwapChains.front().first <= _completedFrameSerial)
+  {
+    _retiredSwapChains.pop_front();
+  }
+  while (!_retiredPipelines.empty()
+         && _retiredPipelines.front().first <= _completedFrameSerial)
+  {
+    _retiredPipelines.pop_front();
+  }
+
+  if (_capture)
+    _capture->poll(_completedFrameSerial);
+}
+
+void InFlightRendering::deliver(uint32_t frameIndex)
+{
+  auto& readback = _readbacks[frameIndex];
+  if (readback.frame == 0)
+    return;
+
+  if (_frameSink)
+  {
+    const auto extent = _renderer._extent;
+    _frameSink(Frame {
+      .serial = readback.frame,
+      .extent = extent,
+      .pixels = std::span<const std::byte>(
+        readback.allocation.mapped(), size_t(extent.width) * extent.height * 4)});
+  }
+  readback.frame = 0;
+}
+
+InFlightRendering::LatencyStatistics InFlightRendering::latency() const noexcept
+{
+  if (_latencyFrames == 0)
+    return {};
+
+  return LatencyStatistics {
+    .average = _latencySum / _latencyFrames,
+    .maximum = _latencyMax,
+    .frames = _latencyFrames};
 }
 
-void InFlightRendering::draw()
+void InFlightRendering::resetLatency() noexcept
 {
-  render();
-  present();
-  _inFlightFrameIndex = (_inFlightFrameIndex + 1) % MaxFramesInFlight;
+  _latencySum = {};
+  _latencyMax = {};
+  _latencyFrames = 0;
 }
 
-void InFlightRendering::render()
+void InFlightRendering::draw(
+  std::span<const InstanceData> instances,
+  std::span<const DrawBatch> batches,
+  const FrameUniforms& uniforms,
+  const DrawConstants& constants,
+  const Frustum& frustum,
+  std::chrono::steady_clock::time_point inputTime)
+{
+  const auto start = std::chrono::steady_clock::now();
+  _drawConstants = constants;
+  // Skipped frames leave the slot's fence signaled, and the slot free for the next frame.
+  if (!render(instances, batches, uniforms, frustum))
+    return;
+  if (!_renderer.offscreen())
+    present();
+
+  const auto& metrics = renderMetrics();
+  metrics.frames.Add();
+  metrics.instances.Add(instances.size());
+  metrics.drawDuration.Record(std::chrono::steady_clock::now() - start);
+
+  _inputTimes[_inFlightFrameIndex] = inputTime;
+  _latencyPending[_inFlightFrameIndex] = true;
+  _inFlightFrameIndex = (_inFlightFrameIndex + 1) % _framesInFlight;
+}
+
+bool InFlightRendering::render(
+  std::span<const InstanceData> instances,
+  std::span<const DrawBatch> batches,
+  const FrameUniforms& uniforms,
+  const Frustum& frustum)
 {
   const auto& device = _renderer._device;
   const auto& frameFence
     = *_inFlightFences[_inFlightFrameIndex];
 
+  ProfileScope waitScope("fence wait");
   const auto fenceWaitResult = device.waitForFences(
     frameFence, true, UINT64_MAX);
   assert(fenceWaitResult == vk::Result::eSuccess);
-  device.resetFences(frameFence);
+  pollCompletedFrames();
+  waitScope.end();
+
+  // Image read back by the previous frame of the slot is complete.
+  deliver(_inFlightFrameIndex);
 
   const auto& imageAvailableSemaphore
     = *_imageAvailableSemaphores[_inFlightFrameIndex];
   const auto& imageRenderedSemaphore
     = *_imageRenderedSemaphores[_inFlightFrameIndex];
 
-  const auto& swapchain = _renderer._swapChain;
-  auto [result, imageIndex] = swapchain.acquireNextImage(
-    UINT64_MAX, imageAvailableSemaphore);
-  _currentImageIndex = imageIndex;
+  // Offscreen images are owned by frame slots, there is nothing to acquire.
+  if (_renderer.offscreen())
+  {
+    _currentImageIndex = _inFlightFrameIndex;
+  }
+  else if (!acquire(imageAvailableSemaphore))
+  {
+    return false;
+  }
+  const auto imageIndex = _currentImageIndex;
+  assert(imageIndex < _renderer._colorImageViews.size());
 
-  assert(result == vk::Result::eSuccess);
-  assert(imageIndex < _renderer._swapChainImageViews.size());
+  // Uniform range of the slot is no longer read by the device.
+  {
+    ProfileScope scope("uniform update");
+    std::memcpy(
+      _renderer._uniformAllocation.mapped() + _inFlightFrameIndex * _renderer._uniformStride,
+      &uniforms,
+      sizeof(FrameUniforms));
+  }
+
+  // The frame is no longer in flight, its staged data and instance buffer can be reused.
+  auto& uploader = *_renderer._uploader;
+  uploader.retire(_frameSerials[_inFlightFrameIndex]);
+  const auto frameSerial = ++_frameSerial;
+  _frameSerials[_inFlightFrameIndex] = frameSerial;
+
+  // Bodies simulated on the device are drawn from their resident transforms.
+  const auto instanceCount = _bodySimulation
+                               ? size_t(_bodySimulation->bodyCount())
+                               : instances.size();
+  reserveInstances(instanceCount);
+  reserveDrawCommands(batches.size());
 
+  ProfileScope recordScope("record");
   const auto& commandBuffer = _renderer._commandBuffers[_inFlightFrameIndex];
   commandBuffer.reset();
   commandBuffer.begin(vk::CommandBufferBeginInfo{});
+  if (_deviceProfiler)
+    _deviceProfiler->beginFrame(commandBuffer, _inFlightFrameIndex);
+
+  // Instances are either streamed or written in place by the device simulation.
+  const auto& instanceBuffer = _instanceBuffers[_inFlightFrameIndex];
+  auto instanceSource = *instanceBuffer.buffer;
+  if (_bodySimulation)
+  {
+    const auto scope = beginDeviceScope(commandBuffer, "device simulation");
+    _bodySimulation->record(commandBuffer, std::chrono::steady_clock::now());
+    endDeviceScope(commandBuffer, scope);
+    instanceSource = _bodySimulation->transforms();
+  }
+  else if (!instances.empty())
+  {
+    uploader.stream(
+      commandBuffer,
+      *instanceBuffer.buffer,
+      0,
+      std::as_bytes(instances),
+      frameSerial);
+  }
+
+  // Only instances inside the frustum reach the vertex input.
+  if (instanceCount > 0)
+  {
+    const auto scope = beginDeviceScope(commandBuffer, "device cull");
+    cull(commandBuffer, instanceSource, batches, frustum, frameSerial);
+    endDeviceScope(commandBuffer, scope);
+  }
 
   const vk::RenderPassBeginInfo renderPassBeginInfo {
     .renderPass = *_renderer._renderPass,
     .framebuffer = *_renderer._framebuffers[imageIndex],
     .renderArea = vk::Rect2D {
       .offset = {0, 0},
-      .extent = _renderer._surfaceCapabilities.currentExtent
+      .extent = _renderer._extent
     },
     .clearValueCount = static_cast<uint32_t>(_clearValues.size()),
     .pClearValues = _clearValues.data()
   };
 
-  commandBuffer.beginRenderPass(
-    renderPassBeginInfo, vk::SubpassContents::eInline);
+  const auto renderPassScope = beginDeviceScope(commandBuffer, "device render pass");
+
+  // Large scenes are recorded on worker threads into secondary command buffers.
+  if (_recorder->threadsFor(batches.size(), _minimumBatchesPerThread) > 1)
+  {
+    commandBuffer.beginRenderPass(
+      renderPassBeginInfo, vk::SubpassContents::eSecondaryCommandBuffers);
+
+    const vk::CommandBufferInheritanceInfo inheritanceInfo {
+      .renderPass = *_renderer._renderPass,
+      .subpass = 0,
+      .framebuffer = *_renderer._framebuffers[imageIndex]};
+
+    const auto secondaryCommandBuffers = _recorder->record(
+      _inFlightFrameIndex,
+      inheritanceInfo,
+      batches.size(),
+      _minimumBatchesPerThread,
+      [&](const vkr::CommandBuffer& secondaryCommandBuffer, size_t begin, size_t end) {
+        recordDraws(
+          secondaryCommandBuffer,
+          batches.subspan(begin, end - begin),
+          begin);
+      });
+    commandBuffer.executeCommands(secondaryCommandBuffers);
+  }
+  else
+  {
+    commandBuffer.beginRenderPass(
+      renderPassBeginInfo, vk::SubpassContents::eInline);
+    recordDraws(commandBuffer, batches, 0);
+  }
+
+  commandBuffer.endRenderPass();
+  endDeviceScope(commandBuffer, renderPassScope);
+
+  // Copy offscreen image out, render pass leaves it in transfer source layout.
+  if (_renderer.offscreen())
+  {
+    const auto scope = beginDeviceScope(commandBuffer, "device readback");
+    auto& readback = _readbacks[_inFlightFrameIndex];
+    commandBuffer.copyImageToBuffer(
+      _renderer._colorImages[imageIndex],
+      vk::ImageLayout::eTransferSrcOptimal,
+      *readback.buffer,
+      vk::BufferImageCopy {
+        .bufferOffset = 0,
+        .bufferRowLength = 0,
+        .bufferImageHeight = 0,
+        .imageSubresource = {
+          .aspectMask = vk::ImageAspectFlagBits::eColor,
+          .mipLevel = 0,
+          .baseArrayLayer = 0,
+          .layerCount = 1},
+        .imageOffset = {0, 0, 0},
+        .imageExtent = {_renderer._extent.width, _renderer._extent.height, 1}});
+
+    commandBuffer.pipelineBarrier(
+      vk::PipelineStageFlagBits::eTransfer,
+      vk::PipelineStageFlagBits::eHost,
+      {},
+      vk::MemoryBarrier {
+        .srcAccessMask = vk::AccessFlagBits::eTransferWrite,
+        .dstAccessMask = vk::AccessFlagBits::eHostRead},
+      nullptr,
+      nullptr);
+    endDeviceScope(commandBuffer, scope);
+    readback.frame = frameSerial;
+  }
+
+  if (_capture)
+  {
+    _capture->record(
+      commandBuffer,
+      _renderer._colorImages[imageIndex],
+      _renderer.offscreen()
+        ? vk::ImageLayout::eTransferSrcOptimal
+        : vk::ImageLayout::ePresentSrcKHR,
+      frameSerial);
+  }
+
+  commandBuffer.end();
+  recordScope.end();
+
+  // Wait for the swapchain image, and for uploads submitted to the transfer queue.
+  ProfileScope submitScope("submit");
+  uploader.submit();
+  std::vector<vk::Semaphore> waitSemaphores;
+  std::vector<vk::PipelineStageFlags> waitDestinationStageMasks;
+  if (!_renderer.offscreen())
+  {
+    waitSemaphores.push_back(imageAvailableSemaphore);
+    waitDestinationStageMasks.push_back(vk::PipelineStageFlagBits::eColorAttachmentOutput);
+  }
+  for (const auto& semaphore : uploader.acquireWaitSemaphores(frameSerial))
+  {
+    waitSemaphores.push_back(semaphore);
+    waitDestinationStageMasks.push_back(vk::PipelineStageFlagBits::eAllCommands);
+  }
+
+  const vk::SubmitInfo submitInfo {
+    .waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size()),
+    .pWaitSemaphores = waitSemaphores.data(),
+    .pWaitDstStageMask = waitDestinationStageMasks.data(),
+    .commandBufferCount = 1,
+    .pCommandBuffers = &(*commandBuffer),
+    .signalSemaphoreCount = _renderer.offscreen() ? 0u : 1u,
+    .pSignalSemaphores = &imageRenderedSemaphore};
+
+  // Reset only once nothing can fail before the submit, which signals the fence again.
+  // A fence left unsignaled would hang the next wait for the slot.
+  device.resetFences(frameFence);
+  const auto& graphicsQueue
+    = _renderer._graphicsQueue;
+  graphicsQueue.submit(submitInfo, frameFence);
+  if (_deviceProfiler)
+    _deviceProfiler->submitted(Profiler::Clock::now());
+  uploader.endFrame(frameSerial);
+  return true;
+}
+
+uint32_t InFlightRendering::beginDeviceScope(
+  const vkr::CommandBuffer& commandBuffer,
+  const char* name)
+{
+  if (!_deviceProfiler)
+    return 0;
+  return _deviceProfiler->begin(commandBuffer, name);
+}
+
+void InFlightRendering::endDeviceScope(
+  const vkr::CommandBuffer& commandBuffer,
+  uint32_t scope)
+{
+  if (_deviceProfiler)
+    _deviceProfiler->end(commandBuffer, scope);
+}
+
+void InFlightRendering::reserveInstances(size_t count)
+{
+  auto& instanceBuffer = _instanceBuffers[_inFlightFrameIndex];
+  if (instanceBuffer.capacity >= count && *instanceBuffer.buffer)
+    return;
+
+  // Grow geometrically, so that a growing environment doesn't reallocate every frame.
+  const auto capacity = std::max<size_t>(
+    {count, instanceBuffer.capacity * 2, 1024});
+
+  _renderer.deviceLocalBuffer(
+    instanceBuffer.buffer,
+    instanceBuffer.allocation,
+    capacity * sizeof(InstanceData),
+    vk::BufferUsageFlagBits::eStorageBuffer);
+  _renderer.deviceLocalBuffer(
+    instanceBuffer.visibleBuffer,
+    instanceBuffer.visibleAllocation,
+    capacity * sizeof(InstanceData),
+    vk::BufferUsageFlagBits::eStorageBuffer);
+  instanceBuffer.capacity = capacity;
+
+  // Frame is no longer in flight, so nothing reads the descriptor being replaced.
+  auto& bindless = *_renderer._bindless;
+  if (instanceBuffer.visibleDescriptor)
+    bindless.updateBuffer(*instanceBuffer.visibleDescriptor, *instanceBuffer.visibleBuffer);
+  else
+    instanceBuffer.visibleDescriptor = bindless.addBuffer(*instanceBuffer.visibleBuffer);
+}
+
+void InFlightRendering::reserveDrawCommands(size_t count)
+{
+  auto& indirectBuffer = _indirectBuffers[_inFlightFrameIndex];
+  if (indirectBuffer.capacity >= count && *indirectBuffer.buffer)
+    return;
+
+  const auto capacity = std::max<size_t>(
+    {count, indirectBuffer.capacity * 2, 16});
+
+  _renderer.deviceLocalBuffer(
+    indirectBuffer.buffer,
+    indirectBuffer.allocation,
+    capacity * sizeof(vk::DrawIndexedIndirectCommand),
+    vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer);
+  indirectBuffer.capacity = capacity;
+}
+
+bool InFlightRendering::acquire(vk::Semaphore imageAvailableSemaphore)
+{
+  // Swap chain may go out of date repeatedly, while the window is resized or moved across monitors.
+  while (true)
+  {
+    if (_swapChainOutdated)
+    {
+      // No swap chain can be created without an area, the frame is skipped.
+      if (_renderer.surfaceEmpty())
+        return false;
+      recreateSwapChain();
+    }
+
+    try
+    {
+      auto [result, imageIndex] = _renderer._swapChain.acquireNextImage(
+        UINT64_MAX, imageAvailableSemaphore);
+      _currentImageIndex = imageIndex;
+
+      // Still presentable, recreated once this frame is presented.
+      if (result == vk::Result::eSuboptimalKHR)
+        _swapChainOutdated = true;
+      return true;
+    }
+    catch (const vk::OutOfDateKHRError&)
+    {
+      // Semaphore isn't signaled by a failed acquire, so it may be used again right away.
+      _swapChainOutdated = true;
+    }
+  }
+}
+
+void InFlightRendering::recreateSwapChain()
+{
+  // Frames submitted so far may still use the old swap chain, depth buffer and framebuffers.
+  _retiredSwapChains.emplace_back(_frameSerial, _renderer.recreateSwapChain());
+  _swapChainOutdated = false;
+}
+
+void InFlightRendering::reloadShaders()
+{
+  // Frames up to the current serial may still be recorded with the previous pipelines.
+  // Retired before the body simulation reloads, which may throw.
+  _retiredPipelines.emplace_back(_frameSerial, _renderer.reloadShaders());
+  if (_bodySimulation)
+    _retiredPipelines.back().second.pipelines.emplace_back(_bodySimulation->reloadShader());
+}
+
+void InFlightRendering::cull(
+  const vkr::CommandBuffer& commandBuffer,
+  vk::Buffer instances,
+  std::span<const DrawBatch> batches,
+  const Frustum& frustum,
+  uint64_t frame)
+{
+  const auto& instanceBuffer = _instanceBuffers[_inFlightFrameIndex];
+  const auto& indirectBuffer = _indirectBuffers[_inFlightFrameIndex];
+  const auto& descriptorSet = _cullDescriptorSets[_inFlightFrameIndex];
+  const auto& pipelineLayout = *_renderer._cullPipelineLayout;
+
+  // Instance counts start at zero, culling counts the visible instances.
+  _drawCommands.clear();
+  for (const auto& batch : batches)
+  {
+    _drawCommands.push_back(vk::DrawIndexedIndirectCommand {
+      .indexCount = _renderer._meshes[batch.mesh].indexCount,
+      .instanceCount = 0,
+      .firstIndex = 0,
+      .vertexOffset = 0,
+      .firstInstance = 0});
+  }
+
+  auto& uploader = *_renderer._uploader;
+  uploader.stream(
+    commandBuffer,
+    *indirectBuffer.buffer,
+    0,
+    std::as_bytes(std::span(_drawCommands)),
+    frame);
+
+  commandBuffer.pipelineBarrier(
+    vk::PipelineStageFlagBits::eTransfer,
+    vk::PipelineStageFlagBits::eComputeShader,
+    {},
+    vk::MemoryBarrier {
+      .srcAccessMask = vk::AccessFlagBits::eTransferWrite,
+      .dstAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite},
+    nullptr,
+    nullptr);
+
+  // Buffers may have been reallocated since the slot was last used.
+  const std::array bufferInfos {
+    vk::DescriptorBufferInfo {
+      .buffer = instances,
+      .offset = 0,
+      .range = VK_WHOLE_SIZE},
+    vk::DescriptorBufferInfo {
+      .buffer = *instanceBuffer.visibleBuffer,
+      .offset = 0,
+      .range = VK_WHOLE_SIZE},
+    vk::DescriptorBufferInfo {
+      .buffer = *indirectBuffer.buffer,
+      .offset = 0,
+      .range = VK_WHOLE_SIZE}};
+
+  std::array<vk::WriteDescriptorSet, 3> descriptorWrites {};
+  for (uint32_t binding = 0; binding < bufferInfos.size(); ++binding)
+  {
+    descriptorWrites[binding] = vk::WriteDescriptorSet {
+      .dstSet = *descriptorSet,
+      .dstBinding = binding,
+      .dstArrayElement = 0,
+      .descriptorCount = 1,
+      .descriptorType = vk::DescriptorType::eStorageBuffer,
+      .pBufferInfo = &bufferInfos[binding]};
+  }
+  _renderer._device.updateDescriptorSets(descriptorWrites, nullptr);
 
   commandBuffer.bindPipeline(
-    vk::PipelineBindPoint::eGraphics,
-    *_renderer._pipeline);
+    vk::PipelineBindPoint::eCompute,
+    *_renderer._cullPipeline);
+  commandBuffer.bindDescriptorSets(
+    vk::PipelineBindPoint::eCompute,
+    pipelineLayout,
+    0,
+    *descriptorSet,
+    nullptr);
+
+  // One dispatch per batch, as every batch has its own mesh bounds and draw command.
+  CullConstants constants {
+    .planes = frustum.planes};
+  for (uint32_t batchIndex = 0; batchIndex < batches.size(); ++batchIndex)
+  {
+    const auto& batch = batches[batchIndex];
+    if (batch.instanceCount == 0)
+      continue;
+
+    const auto& bounds = _renderer._meshes[batch.mesh].bounds;
+    constants.sphere = glm::vec4(bounds.center, bounds.radius);
+    constants.batch = batchIndex;
+    constants.firstInstance = batch.firstInstance;
+    constants.instanceCount = batch.instanceCount;
+
+    commandBuffer.pushConstants<CullConstants>(
+      pipelineLayout,
+      vk::ShaderStageFlagBits::eCompute,
+      0,
+      constants);
+    commandBuffer.dispatch(
+      (batch.instanceCount + CullWorkgroupSize - 1) / CullWorkgroupSize, 1, 1);
+  }
+
+  // Draw commands are read by the indirect draws, visible instances by the vertex shaders.
+  commandBuffer.pipelineBarrier(
+    vk::PipelineStageFlagBits::eComputeShader,
+    vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eVertexShader,
+    {},
+    vk::MemoryBarrier {
+      .srcAccessMask = vk::AccessFlagBits::eShaderWrite,
+      .dstAccessMask = vk::AccessFlagBits::eIndirectCommandRead
+                       | vk::AccessFlagBits::eShaderRead},
+    nullptr,
+    nullptr);
+}
+
+void InFlightRendering::recordDraws(
+  const vkr::CommandBuffer& commandBuffer,
+  std::span<const DrawBatch> batches,
+  size_t firstBatch) const
+{
+  const auto& instanceBuffer = _instanceBuffers[_inFlightFrameIndex];
+  const auto& indirectBuffer = _indirectBuffers[_inFlightFrameIndex];
 
-  // Bind descriptor sets
+  // Bind descriptor sets and push constants, shared by all pipelines and all draws
   const auto& pipelineLayout = *_renderer._pipelineLayout;
-  const auto& descriptorSet = *_renderer._uniformDescriptorSets.front();
+  const std::array descriptorSets {
+    *_renderer._uniformDescriptorSets.front(),
+    _renderer._bindless->set()};
+  const auto uniformOffset = static_cast<uint32_t>(
+    _inFlightFrameIndex * _renderer._uniformStride);
   commandBuffer.bindDescriptorSets(
     vk::PipelineBindPoint::eGraphics,
     pipelineLayout,
     0,
-    descriptorSet,
-    nullptr);
-
-  // Bind VBOs
-  const auto& vertexBuffer = *_renderer._vertexBuffer;
-  commandBuffer.bindVertexBuffers(
-    0, {vertexBuffer}, {0});
+    descriptorSets,
+    uniformOffset);
+  commandBuffer.pushConstants<DrawConstants>(
+    pipelineLayout,
+    vk::ShaderStageFlagBits::eVertex,
+    0,
+    _drawConstants);
 
   // Scissor
   commandBuffer.setScissor(
-    0, vk::Rect2D(vk::Offset2D( 0, 0 ), _renderer._surfaceCapabilities.currentExtent));
+    0, vk::Rect2D(vk::Offset2D( 0, 0 ), _renderer._extent));
 
   // Viewport
   commandBuffer.setViewport(
     0, vk::Viewport(
       0.0f,
       0.0f,
-      static_cast<float>(_renderer._surfaceCapabilities.currentExtent.width),
-      static_cast<float>(_renderer._surfaceCapabilities.currentExtent.height),
+      static_cast<float>(_renderer._extent.width),
+      static_cast<float>(_renderer._extent.height),
       0.0f,
       1.0f)
   );
 
-  commandBuffer.draw(
-    24, 1, 0, 0);
-
-  commandBuffer.endRenderPass();
-  commandBuffer.end();
-
-  const vk::PipelineStageFlags waitDestinationStageMask(
-    vk::PipelineStageFlagBits::eColorAttachmentOutput);
-
-  const vk::SubmitInfo submitInfo {
-    .waitSemaphoreCount = 1,
-    .pWaitSemaphores = &imageAvailableSemaphore,
-    .pWaitDstStageMask = &waitDestinationStageMask,
-    .commandBufferCount = 1,
-    .pCommandBuffers = &(*commandBuffer),
-    .signalSemaphoreCount = 1,
-    .pSignalSemaphores = &imageRenderedSemaphore};
+  // One indirect draw per batch, covering its visible instances.
+  vk::Pipeline boundPipeline {};
+  for (size_t index = 0; index < batches.size(); ++index)
+  {
+    const auto& batch = batches[index];
+    if (batch.instanceCount == 0)
+      continue;
+
+    // Impostors are drawn by the point pipeline.
+    const auto& mesh = _renderer._meshes[batch.mesh];
+    const auto pipeline = mesh.topology == vk::PrimitiveTopology::ePointList
+                            ? *_renderer._pointPipeline
+                            : *_renderer._pipeline;
+    if (pipeline != boundPipeline)
+    {
+      commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+      boundPipeline = pipeline;
+    }
 
-  const auto& graphicsQueue
-    = _renderer._graphicsQueue;
-  graphicsQueue.submit(submitInfo, frameFence);
+    // Visible instances are compacted from the first instance of the batch. The offset is pushed
+    // rather than set by the draw, which would need the indirect first instance feature.
+    const BatchConstants batchConstants {
+      .instanceBuffer = *instanceBuffer.visibleDescriptor,
+      .firstInstance = batch.firstInstance};
+    commandBuffer.pushConstants<BatchConstants>(
+      pipelineLayout,
+      vk::ShaderStageFlagBits::eVertex,
+      sizeof(DrawConstants),
+      batchConstants);
+
+    commandBuffer.bindVertexBuffers(0, *mesh.vertexBuffer, {0});
+    commandBuffer.bindIndexBuffer(
+      *mesh.indexBuffer, 0, mesh.indexType);
+
+    commandBuffer.drawIndexedIndirect(
+      *indirectBuffer.buffer,
+      (firstBatch + index) * sizeof(vk::DrawIndexedIndirectCommand),
+      1,
+      sizeof(vk::DrawIndexedIndirectCommand));
+  }
 }
 
 void InFlightRendering::present()
 {
+  ProfileScope scope("present");
   const auto& swapchain = _renderer._swapChain;
   const auto& frameRenderedSemaphore
     = *_imageRenderedSemaphores[_inFlightFrameIndex];
@@ -914,7 +2001,15 @@ void InFlightRendering::present()
     .pImageIndices = &_currentImageIndex};
 
   const auto& presentQueue = _renderer._presentQueue;
-  assert(presentQueue.presentKHR(presentInfoKHR) == vk::Result::eSuccess);
+  try
+  {
+    if (presentQueue.presentKHR(presentInfoKHR) == vk::Result::eSuboptimalKHR)
+      _swapChainOutdated = true;
+  }
+  catch (const vk::OutOfDateKHRError&)
+  {
+    _swapChainOutdated = true;
+  }
 }
 
 } // namespace vulkan
\ No newline at end of file
@@ -0,0 +1,144 @@
+//
+// Created by maros on 15.12.2023.
+//
+
+#include "sim/world.hpp"
+
+#include <format>
+#include <stdexcept>
+#include <utility>
+
+namespace sdk
+{
+
+World::World() = default;
+
+World::~World() = default;
+
+Entity World::spawn(const Actor& actor, sim::Body body, Render render)
+{
+  body._position = math::vec3d {
+    actor._position.x,
+    actor._position.y,
+    actor._position.z};
+  return create(std::move(body), render);
+}
+
+Entity World::spawn(const Actor& actor, Render render)
+{
+  // Scale of actors isn't used by the scene either.
+  return create(
+    Transform {
+      .position = actor._position,
+      .rotation = actor._rotation,
+      .scale = glm::vec3 {1.0f}},
+    render);
+}
+
+void World::destroy(Entity entity)
+{
+  if (!alive(entity))
+    return;
+
+  auto& record = _records[entity.index];
+  if (record.destroying)
+    return;
+  record.destroying = true;
+  _destroyed.push_back(entity);
+}
+
+bool World::alive(Entity entity) const noexcept
+{
+  return entity.index < _records.size()
+         && _records[entity.index].generation == entity.generation
+         && _records[entity.index].archetype != nullptr;
+}
+
+void World::onCreate(EventHandler handler)
+{
+  _createHandlers.push_back(std::move(handler));
+}
+
+void World::onDestroy(EventHandler handler)
+{
+  _destroyHandlers.push_back(std::move(handler));
+}
+
+void World::flush()
+{
+  // Batches are taken first, so that handlers can create and destroy entities.
+  const auto created = std::exchange(_created, {});
+  if (!created.empty())
+  {
+    for (const auto& handler : _createHandlers)
+    {
+      handler(*this, created);
+    }
+  }
+
+  const auto destroyed = std::exchange(_destroyed, {});
+  if (destroyed.empty())
+    return;
+
+  for (const auto& handler : _destroyHandlers)
+  {
+    handler(*this, destroyed);
+  }
+  for (const auto& entity : destroyed)
+  {
+    erase(entity);
+  }
+}
+
+uint32_t World::nextComponentId()
+{
+  // Signatures have a bit per component type.
+  const auto id = _nextComponentId++;
+  if (id >= MaxComponents)
+    throw std::runtime_error(std::format(
+      "World supports at most {} component types", MaxComponents));
+  return id;
+}
+
+World::Archetype* World::find(Signature signature) const noexcept
+{
+  for (const auto& archetype : _archetypes)
+  {
+    if (archetype->signature == signature)
+      return archetype.get();
+  }
+  return nullptr;
+}
+
+Entity World::allocateEntity()
+{
+  if (!_freeIndices.empty())
+  {
+    const auto index = _freeIndices.back();
+    _freeIndices.pop_back();
+    return Entity {
+      .index = index,
+      .generation = _records[index].generation};
+  }
+
+  _records.emplace_back();
+  return Entity {
+    .index = static_cast<uint32_t>(_records.size() - 1),
+    .generation = 0};
+}
+
+void World::erase(Entity entity)
+{
+  auto& record = _records[entity.index];
+  const auto moved = record.archetype->remove(record.location);
+  if (moved)
+    _records[moved->index].location = record.location;
+
+  // Generation invalidates handles of the entity.
+  record.archetype = nullptr;
+  record.destroying = false;
+  record.generation++;
+  _freeIndices.push_back(entity.index);
+}
+
+}// namespace sdk